@@ -0,0 +1,69 @@
+//***************************************************************************************
+// AlignedAllocator.h by llyr-who (C) 2011 All Rights Reserved.
+//
+// Standard allocator that hands out storage aligned to a fixed byte boundary, so
+// containers of floats can be read with aligned SIMD loads.
+//***************************************************************************************
+
+#ifndef ALIGNEDALLOCATOR_H
+#define ALIGNEDALLOCATOR_H
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+#if defined(_MSC_VER)
+#include <malloc.h>
+#endif
+
+template<typename T, std::size_t Alignment>
+class AlignedAllocator
+{
+public:
+	using value_type = T;
+
+	template<typename U>
+	struct rebind
+	{
+		using other = AlignedAllocator<U, Alignment>;
+	};
+
+	AlignedAllocator() = default;
+
+	template<typename U>
+	AlignedAllocator(const AlignedAllocator<U, Alignment>&) {}
+
+	T* allocate(std::size_t count)
+	{
+		// Round up to a whole number of alignment units.
+		std::size_t bytes = (count * sizeof(T) + Alignment - 1) / Alignment * Alignment;
+#if defined(_MSC_VER)
+		void* p = _aligned_malloc(bytes, Alignment);
+#else
+		// posix_memalign, since C++17's aligned_alloc is newer than the C++14 the tree builds as.
+		void* p = nullptr;
+		if (posix_memalign(&p, Alignment, bytes) != 0)
+			p = nullptr;
+#endif
+		if (p == nullptr)
+			throw std::bad_alloc();
+		return static_cast<T*>(p);
+	}
+
+	void deallocate(T* p, std::size_t)
+	{
+#if defined(_MSC_VER)
+		_aligned_free(p);
+#else
+		std::free(p);
+#endif
+	}
+};
+
+template<typename T, typename U, std::size_t Alignment>
+bool operator==(const AlignedAllocator<T, Alignment>&, const AlignedAllocator<U, Alignment>&) { return true; }
+
+template<typename T, typename U, std::size_t Alignment>
+bool operator!=(const AlignedAllocator<T, Alignment>&, const AlignedAllocator<U, Alignment>&) { return false; }
+
+#endif // ALIGNEDALLOCATOR_H
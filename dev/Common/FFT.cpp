@@ -0,0 +1,151 @@
+//***************************************************************************************
+// FFT.cpp by llyr-who (C) 2011 All Rights Reserved.
+//***************************************************************************************
+
+#include "FFT.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <utility>
+
+namespace
+{
+	typedef std::complex<float> Complex;
+
+	// Plain multiply; std::complex's operator* also handles infinities and
+	// NaNs, which costs a library call per product on some compilers.
+	inline Complex Mul(const Complex& a, const Complex& b)
+	{
+		return Complex(a.real()*b.real() - a.imag()*b.imag(), a.real()*b.imag() + a.imag()*b.real());
+	}
+
+	// Multiply by +i.
+	inline Complex MulI(const Complex& a)
+	{
+		return Complex(-a.imag(), a.real());
+	}
+
+	thread_local std::vector<Complex> tColumns;
+}
+
+FFT::FFT(std::size_t n)
+	: mSize(n), mLog2Size(0)
+{
+	assert(n != 0 && (n & (n - 1)) == 0);
+
+	while((std::size_t(1) << mLog2Size) < n)
+		++mLog2Size;
+
+	mBitReverse.resize(n);
+	for(std::size_t i = 0; i < n; ++i)
+	{
+		std::size_t r = 0;
+		for(std::size_t b = 0; b < mLog2Size; ++b)
+			r |= ((i >> b) & 1) << (mLog2Size - 1 - b);
+		mBitReverse[i] = r;
+	}
+
+	const double twoPi = 6.283185307179586;
+	mTwiddles.resize(n / 2);
+	for(std::size_t k = 0; k < n / 2; ++k)
+	{
+		double a = twoPi * double(k) / double(n);
+		mTwiddles[k] = Complex(float(std::cos(a)), float(std::sin(a)));
+	}
+}
+
+void FFT::Inverse(Complex* data)const
+{
+	std::size_t n = mSize;
+
+	for(std::size_t i = 0; i < n; ++i)
+	{
+		std::size_t r = mBitReverse[i];
+		if(i < r)
+			std::swap(data[i], data[r]);
+	}
+
+	// h is the half-size of the current radix-2 stage.
+	std::size_t h = 1;
+	if(mLog2Size % 2 == 1)
+	{
+		for(std::size_t i = 0; i < n; i += 2)
+		{
+			Complex a = data[i];
+			Complex b = data[i + 1];
+			data[i] = a + b;
+			data[i + 1] = a - b;
+		}
+		h = 2;
+	}
+
+	// Two radix-2 stages, of half-size h and 2h, per pass.
+	for(; h < n; h *= 4)
+	{
+		std::size_t stride1 = n / (2 * h); // twiddle step of the first stage
+		std::size_t stride2 = n / (4 * h); // and of the second
+		for(std::size_t block = 0; block < n; block += 4 * h)
+		{
+			Complex* x = data + block;
+			for(std::size_t j = 0; j < h; ++j)
+			{
+				Complex w1 = mTwiddles[j * stride1];
+				Complex w2 = mTwiddles[j * stride2];
+				// W_{4h}^{j+h} = W_{4h}^j * W_4^1 = w2 * i
+				Complex w3 = MulI(w2);
+
+				Complex a = x[j];
+				Complex b = Mul(x[j + h], w1);
+				Complex c = x[j + 2 * h];
+				Complex d = Mul(x[j + 3 * h], w1);
+
+				Complex s0 = a + b;
+				Complex s1 = a - b;
+				Complex t0 = Mul(c + d, w2);
+				Complex t1 = Mul(c - d, w3);
+
+				x[j] = s0 + t0;
+				x[j + 2 * h] = s0 - t0;
+				x[j + h] = s1 + t1;
+				x[j + 3 * h] = s1 - t1;
+			}
+		}
+	}
+}
+
+void FFT::Inverse2D(Complex* grid, ThreadPool& pool)const
+{
+	std::size_t n = mSize;
+
+	pool.ParallelFor(0, n, 4, [this, grid, n](std::size_t row)
+		{
+			Inverse(grid + row * n);
+		});
+
+	std::size_t blockCount = (n + ColumnBlock - 1) / ColumnBlock;
+	pool.ParallelFor(0, blockCount, 1, [this, grid, n](std::size_t block)
+		{
+			std::size_t first = block * ColumnBlock;
+			std::size_t width = std::min(ColumnBlock, n - first);
+
+			std::vector<Complex>& columns = tColumns;
+			columns.resize(ColumnBlock * n);
+
+			for(std::size_t r = 0; r < n; ++r)
+			{
+				for(std::size_t c = 0; c < width; ++c)
+					columns[c * n + r] = grid[r * n + first + c];
+			}
+
+			for(std::size_t c = 0; c < width; ++c)
+				Inverse(&columns[c * n]);
+
+			for(std::size_t r = 0; r < n; ++r)
+			{
+				for(std::size_t c = 0; c < width; ++c)
+					grid[r * n + first + c] = columns[c * n + r];
+			}
+		});
+}
@@ -0,0 +1,49 @@
+//***************************************************************************************
+// FFT.h by llyr-who (C) 2011 All Rights Reserved.
+//
+// Power-of-two complex FFT for the spectral ocean.  Transforms run in place after a
+// bit-reversal permutation.  Each pass fuses two radix-2 stages into one radix-4
+// (radix-2^2) butterfly, so a transform of 2^k points sweeps its data about k/2 times;
+// odd k gets one plain radix-2 pass first.
+//
+// The 2D transform does the rows in parallel, then the columns in parallel in blocks
+// of ColumnBlock adjacent columns.  Each block is gathered into a contiguous scratch
+// buffer first, so every access to the grid reads or writes whole cache lines.
+//***************************************************************************************
+
+#ifndef FFT_H
+#define FFT_H
+
+#include <complex>
+#include <cstddef>
+#include <vector>
+
+class ThreadPool;
+
+class FFT
+{
+public:
+	// n must be a power of two.
+	explicit FFT(std::size_t n);
+
+	std::size_t Size()const { return mSize; }
+
+	// Unnormalised inverse transform, x[j] = sum_k X[k] exp(+2 pi i jk / n), of n
+	// contiguous values.
+	void Inverse(std::complex<float>* data)const;
+
+	// The same for every row and then every column of a row-major n x n grid.
+	void Inverse2D(std::complex<float>* grid, ThreadPool& pool)const;
+
+private:
+	// Columns gathered per block; 8 complex floats fill a 64-byte cache line.
+	static const std::size_t ColumnBlock = 8;
+
+	std::size_t mSize;
+	std::size_t mLog2Size;
+	std::vector<std::size_t> mBitReverse;
+	// exp(+2 pi i k / n) for k < n/2.
+	std::vector<std::complex<float>> mTwiddles;
+};
+
+#endif // FFT_H
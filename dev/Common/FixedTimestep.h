@@ -0,0 +1,64 @@
+//***************************************************************************************
+// FixedTimestep.h by llyr-who (C) 2011 All Rights Reserved.
+//
+// Turns variable frame times into a whole number of fixed simulation steps.  Leftover
+// time stays in the accumulator for the next frame, and Alpha() says how far the
+// renderer should blend from the previous step towards the current one.
+//***************************************************************************************
+
+#ifndef FIXEDTIMESTEP_H
+#define FIXEDTIMESTEP_H
+
+#include <cmath>
+
+class FixedTimestep
+{
+public:
+	explicit FixedTimestep(float step, int maxSubsteps = 8) :
+		mStep(step), mMaxSubsteps(maxSubsteps)
+	{
+	}
+
+	// Adds frameTime to the accumulator and returns the number of steps to run now.
+	// At most MaxSubsteps are returned; time beyond that is dropped so a long stall
+	// does not send the simulation into a spiral of ever longer frames.
+	int Advance(float frameTime)
+	{
+		mAccumulator += frameTime;
+
+		int steps = 0;
+		while(mAccumulator >= mStep && steps < mMaxSubsteps)
+		{
+			mAccumulator -= mStep;
+			++steps;
+		}
+
+		// Hit the cap: keep only the partial step so Alpha() stays meaningful.
+		if(mAccumulator >= mStep)
+			mAccumulator = std::fmod(mAccumulator, mStep);
+
+		return steps;
+	}
+
+	// Fraction of a step left over after the last Advance, in [0, 1).
+	float Alpha()const
+	{
+		return static_cast<float>(mAccumulator / mStep);
+	}
+
+	float Step()const { return static_cast<float>(mStep); }
+	void SetStep(float step) { mStep = step; }
+
+	int MaxSubsteps()const { return mMaxSubsteps; }
+	void SetMaxSubsteps(int maxSubsteps) { mMaxSubsteps = maxSubsteps; }
+
+	void Reset() { mAccumulator = 0.0; }
+
+private:
+	// Kept in double so feeding exactly one step per frame never drifts.
+	double mStep;
+	double mAccumulator = 0.0;
+	int mMaxSubsteps;
+};
+
+#endif // FIXEDTIMESTEP_H
@@ -4,6 +4,7 @@
 
 #include "GeometryGenerator.h"
 #include <algorithm>
+#include <cassert>
 
 using namespace DirectX;
 
@@ -656,23 +657,76 @@ GeometryGenerator::MeshData GeometryGenerator::CreateQuad(float x, float y, floa
     return meshData;
 }
 
-std::vector<std::uint16_t> GeometryGenerator::CreateGridIndices(int n, int m, int tri_count) {
-	std::vector<std::uint16_t> indices(3 * tri_count);
-	int k = 0;
-	for (int i = 0; i < m - 1; ++i)
+std::vector<GeometryGenerator::uint32> GeometryGenerator::CreateGridIndices(std::size_t m, std::size_t n)
+{
+	assert(m*n <= std::size_t(UINT32_MAX) + 1);
+
+	std::vector<uint32> indices(6*(m - 1)*(n - 1));
+	std::size_t k = 0;
+	for(std::size_t i = 0; i < m - 1; ++i)
 	{
-		for (int j = 0; j < n - 1; ++j)
+		for(std::size_t j = 0; j < n - 1; ++j)
 		{
-			indices[k] = i * n + j;
-			indices[k + 1] = i * n + j + 1;
-			indices[k + 2] = (i + 1) * n + j;
+			indices[k] = uint32(i*n + j);
+			indices[k + 1] = uint32(i*n + j + 1);
+			indices[k + 2] = uint32((i + 1)*n + j);
 
-			indices[k + 3] = (i + 1) * n + j;
-			indices[k + 4] = i * n + j + 1;
-			indices[k + 5] = (i + 1) * n + j + 1;
+			indices[k + 3] = uint32((i + 1)*n + j);
+			indices[k + 4] = uint32(i*n + j + 1);
+			indices[k + 5] = uint32((i + 1)*n + j + 1);
 
 			k += 6; // next quad
 		}
 	}
 	return indices;
-}
\ No newline at end of file
+}
+
+namespace
+{
+	const std::size_t MaxIndices16 = std::size_t(UINT16_MAX) + 1;
+
+	// Neighbouring bands both transform the row they share.  With at least
+	// this many quad rows per band, that is at most one vertex in 8 twice,
+	// a fair price for halving the index buffer.
+	const std::size_t MinChunkQuadRows = 8;
+
+	// Vertex rows a band of an n-column grid spans.
+	std::size_t ChunkRows(std::size_t n)
+	{
+		return MaxIndices16 / n;
+	}
+}
+
+bool GeometryGenerator::UseGridIndices16(std::size_t m, std::size_t n)
+{
+	return m*n <= MaxIndices16 || ChunkRows(n) >= MinChunkQuadRows + 1;
+}
+
+std::vector<GeometryGenerator::IndexChunk> GeometryGenerator::ChunkGridIndices(const std::vector<uint32>& indices,
+	std::size_t n, std::vector<uint16>& indices16)
+{
+	assert(ChunkRows(n) >= 2);
+
+	// Band b holds the quads with their top row in [b*q, (b+1)*q), for q quad
+	// rows per band, so its vertices are the ChunkRows(n) rows from b*q on.
+	std::size_t bandQuadRows = ChunkRows(n) - 1;
+
+	std::vector<IndexChunk> chunks;
+	for(std::size_t t = 0; t < indices.size(); t += 3)
+	{
+		// The first vertex of a triangle of either kind is on the quad's top row.
+		std::size_t topRow = std::min(indices[t], std::min(indices[t + 1], indices[t + 2])) / n;
+		std::size_t base = (topRow / bandQuadRows)*bandQuadRows*n;
+
+		if(chunks.empty() || chunks.back().BaseVertex != base)
+		{
+			assert(chunks.empty() || chunks.back().BaseVertex < base);
+			chunks.push_back({ uint32(indices16.size()), 0, base });
+		}
+
+		for(std::size_t k = t; k < t + 3; ++k)
+			indices16.push_back(uint16(indices[k] - base));
+		chunks.back().IndexCount += 3;
+	}
+	return chunks;
+}
@@ -111,9 +111,36 @@ public:
     MeshData CreateQuad(float x, float y, float w, float h, float depth);
 
 	///<summary>
-	/// Generates a vector of CCW grid indices for a n by m grid
+	/// Generates CCW indices for a grid of vertices with m rows and n columns,
+	/// two triangles per quad and the quads in row-major order.
 	///</summary>
-	static std::vector<std::uint16_t> CreateGridIndices(int n, int m, int tri_count);
+	static std::vector<uint32> CreateGridIndices(std::size_t m, std::size_t n);
+
+	///<summary>
+	/// A run of a chunked index buffer, drawn with its own base vertex.
+	///</summary>
+	struct IndexChunk
+	{
+		uint32 StartIndex;
+		uint32 IndexCount;
+		std::size_t BaseVertex;
+	};
+
+	///<summary>
+	/// Whether an m x n grid should be drawn with 16-bit indices.  Small grids
+	/// are; larger ones only when ChunkGridIndices can split them into bands
+	/// thick enough that the rows neighbouring bands share cost little.
+	///</summary>
+	static bool UseGridIndices16(std::size_t m, std::size_t n);
+
+	///<summary>
+	/// Splits the indices of an n-column grid into bands of rows that 16-bit
+	/// indices can address.  The indices must be whole quads in row-major
+	/// order, as CreateGridIndices makes them, but may leave quads out.  Each
+	/// band is appended to indices16 relative to its first vertex.
+	///</summary>
+	static std::vector<IndexChunk> ChunkGridIndices(const std::vector<uint32>& indices, std::size_t n,
+		std::vector<uint16>& indices16);
 
 private:
 	void Subdivide(MeshData& meshData);
@@ -0,0 +1,186 @@
+//***************************************************************************************
+// ThreadPool.cpp by llyr-who (C) 2011 All Rights Reserved.
+//***************************************************************************************
+
+#include "ThreadPool.h"
+#include <algorithm>
+
+namespace
+{
+	// Set while a thread is executing chunks, so nested loops run inline.
+	thread_local bool tInsideJob = false;
+
+	// Sets tInsideJob for its lifetime, and puts back what was there before.
+	struct InsideJobScope
+	{
+		bool saved;
+		InsideJobScope() : saved(tInsideJob) { tInsideJob = true; }
+		~InsideJobScope() { tInsideJob = saved; }
+	};
+
+	std::atomic<ThreadPool*> gDefaultOverride(nullptr);
+}
+
+ThreadPool::ThreadPool(std::size_t threadCount)
+{
+	if(threadCount == 0)
+		threadCount = std::max<std::size_t>(1, std::thread::hardware_concurrency());
+
+	// Swapped in: the atomics keep a vector of slices from being moved.
+	std::vector<Slice, AlignedAllocator<Slice, 64>> slices(threadCount);
+	mSlices.swap(slices);
+	for(std::size_t i = 0; i < threadCount; ++i)
+	{
+		mSlices[i].Next = 0;
+		mSlices[i].End = 0;
+	}
+
+	// Slot 0 belongs to whichever thread calls ParallelFor.
+	for(std::size_t i = 1; i < threadCount; ++i)
+		mWorkers.emplace_back(&ThreadPool::WorkerLoop, this, i);
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mQuit = true;
+	}
+	mWake.notify_all();
+
+	for(auto& w : mWorkers)
+		w.join();
+}
+
+ThreadPool& ThreadPool::Default()
+{
+	ThreadPool* pool = gDefaultOverride.load(std::memory_order_acquire);
+	if(pool != nullptr)
+		return *pool;
+
+	static ThreadPool builtIn;
+	return builtIn;
+}
+
+void ThreadPool::SetDefault(ThreadPool* pool)
+{
+	gDefaultOverride.store(pool, std::memory_order_release);
+}
+
+void ThreadPool::Run(std::size_t begin, std::size_t end, std::size_t grain, RangeFn fn, const void* body)
+{
+	if(end <= begin)
+		return;
+
+	grain = std::max<std::size_t>(1, grain);
+	std::size_t chunkCount = (end - begin + grain - 1) / grain;
+
+	std::unique_lock<std::mutex> dispatch(mDispatchMutex, std::defer_lock);
+	if(mWorkers.empty() || chunkCount == 1 || tInsideJob || !dispatch.try_lock())
+	{
+		// Same chunking as the parallel path, so results do not depend on it.
+		for(std::size_t first = begin; first < end; first += grain)
+			fn(body, first, std::min(first + grain, end));
+		return;
+	}
+
+	mFn = fn;
+	mBody = body;
+	mFailed.store(false, std::memory_order_relaxed);
+	mError = nullptr;
+	mBegin = begin;
+	mEnd = end;
+	mGrain = grain;
+
+	std::size_t slotCount = ThreadCount();
+	for(std::size_t s = 0; s < slotCount; ++s)
+	{
+		mSlices[s].End = chunkCount * (s + 1) / slotCount;
+		mSlices[s].Next.store(chunkCount * s / slotCount, std::memory_order_relaxed);
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mBusyWorkers = mWorkers.size();
+		++mGeneration;
+	}
+	mWake.notify_all();
+
+	Participate(0);
+
+	// Workers may still be reading the job; wait until every one has left it,
+	// even if a chunk threw, and only then pass the first exception on.
+	std::exception_ptr error;
+	{
+		std::unique_lock<std::mutex> lock(mMutex);
+		mDone.wait(lock, [this] { return mBusyWorkers == 0; });
+		error = mError;
+		mError = nullptr;
+	}
+	if(error)
+		std::rethrow_exception(error);
+}
+
+void ThreadPool::RunChunk(std::size_t chunk)
+{
+	std::size_t first = mBegin + chunk * mGrain;
+	mFn(mBody, first, std::min(first + mGrain, mEnd));
+}
+
+void ThreadPool::Participate(std::size_t slot)
+{
+	InsideJobScope inside;
+
+	// Drain our own run first, then steal from the others in order.
+	std::size_t slotCount = ThreadCount();
+	for(std::size_t k = 0; k < slotCount; ++k)
+	{
+		Slice& slice = mSlices[(slot + k) % slotCount];
+		for(;;)
+		{
+			std::size_t chunk = slice.Next.fetch_add(1, std::memory_order_relaxed);
+			if(chunk >= slice.End)
+				break;
+
+			// Once a chunk has thrown, the rest are only drained, not run.
+			if(mFailed.load(std::memory_order_relaxed))
+				continue;
+			try
+			{
+				RunChunk(chunk);
+			}
+			catch(...)
+			{
+				std::lock_guard<std::mutex> lock(mMutex);
+				if(!mError)
+					mError = std::current_exception();
+				mFailed.store(true, std::memory_order_relaxed);
+			}
+		}
+	}
+}
+
+void ThreadPool::WorkerLoop(std::size_t slot)
+{
+	std::uint64_t seen = 0;
+	for(;;)
+	{
+		{
+			std::unique_lock<std::mutex> lock(mMutex);
+			mWake.wait(lock, [&] { return mQuit || mGeneration != seen; });
+			if(mQuit)
+				return;
+			seen = mGeneration;
+		}
+
+		Participate(slot);
+
+		bool last;
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			last = --mBusyWorkers == 0;
+		}
+		if(last)
+			mDone.notify_one();
+	}
+}
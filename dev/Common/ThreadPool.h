@@ -0,0 +1,114 @@
+//***************************************************************************************
+// ThreadPool.h by llyr-who (C) 2011 All Rights Reserved.
+//
+// Small persistent thread pool with a work-stealing parallel-for.  It only uses the
+// standard library, so the solvers built on it compile anywhere (no PPL needed).
+//
+// A ParallelFor splits [begin, end) into chunks of at most grain indices and gives
+// each thread a contiguous run of chunks.  Threads that finish their own run steal
+// the remaining chunks of the others.  Calls made from inside a running task, or
+// while another thread is dispatching on the same pool, run inline on the caller.
+// If a body throws, the chunks not yet started are skipped, every thread is waited
+// for, and the first exception is rethrown to the caller of ParallelFor.
+//***************************************************************************************
+
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "AlignedAllocator.h"
+
+class ThreadPool
+{
+public:
+	// threadCount counts the calling thread; 0 means one per hardware thread.
+	explicit ThreadPool(std::size_t threadCount = 0);
+	ThreadPool(const ThreadPool& rhs) = delete;
+	ThreadPool& operator=(const ThreadPool& rhs) = delete;
+	~ThreadPool();
+
+	// Number of threads that execute work, including the caller of ParallelFor.
+	std::size_t ThreadCount()const { return mWorkers.size() + 1; }
+
+	// Calls body(first, last) for consecutive sub-ranges of [begin, end), each at
+	// most grain indices long, and returns once all of them have completed.
+	template<typename Body>
+	void ParallelForRange(std::size_t begin, std::size_t end, std::size_t grain, const Body& body)
+	{
+		Run(begin, end, grain, &ThreadPool::Invoke<Body>, &body);
+	}
+
+	// Calls body(i) for every i in [begin, end).
+	template<typename Body>
+	void ParallelFor(std::size_t begin, std::size_t end, std::size_t grain, const Body& body)
+	{
+		ParallelForRange(begin, end, grain, [&body](std::size_t first, std::size_t last)
+		{
+			for(std::size_t i = first; i < last; ++i)
+				body(i);
+		});
+	}
+
+	// The pool the solvers dispatch on.  SetDefault plugs in another pool (for
+	// example a single-threaded one); passing nullptr restores the built-in pool.
+	static ThreadPool& Default();
+	static void SetDefault(ThreadPool* pool);
+
+private:
+	typedef void (*RangeFn)(const void* body, std::size_t first, std::size_t last);
+
+	template<typename Body>
+	static void Invoke(const void* body, std::size_t first, std::size_t last)
+	{
+		(*static_cast<const Body*>(body))(first, last);
+	}
+
+	void Run(std::size_t begin, std::size_t end, std::size_t grain, RangeFn fn, const void* body);
+	void RunChunk(std::size_t chunk);
+	void Participate(std::size_t slot);
+	void WorkerLoop(std::size_t slot);
+
+	// The run of chunks first handed to one thread.  Its owner and any thief
+	// take chunks from the front, so a single counter is all it needs.
+	struct alignas(64) Slice
+	{
+		std::atomic<std::size_t> Next;
+		std::size_t End;
+	};
+
+	std::vector<std::thread> mWorkers;
+	// Plain new[] only honours alignas(64) from C++17 on, and the slices
+	// must not share cache lines.
+	std::vector<Slice, AlignedAllocator<Slice, 64>> mSlices;
+
+	// Serialises dispatch; a second concurrent caller runs its loop inline.
+	std::mutex mDispatchMutex;
+
+	std::mutex mMutex;
+	std::condition_variable mWake;
+	std::condition_variable mDone;
+	std::uint64_t mGeneration = 0;
+	std::size_t mBusyWorkers = 0;
+	bool mQuit = false;
+
+	// The job being run.
+	RangeFn mFn = nullptr;
+	const void* mBody = nullptr;
+	std::size_t mBegin = 0;
+	std::size_t mEnd = 0;
+	std::size_t mGrain = 1;
+
+	// The first exception a chunk of the job threw, guarded by mMutex.
+	std::exception_ptr mError;
+	std::atomic<bool> mFailed{ false };
+};
+
+#endif // THREADPOOL_H
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "d3dUtil.h"
+#include "UploadWriter.h"
 
 template<typename T>
 class UploadBuffer
@@ -24,12 +25,13 @@ public:
         ThrowIfFailed(device->CreateCommittedResource(
             &CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD),
             D3D12_HEAP_FLAG_NONE,
-            &CD3DX12_RESOURCE_DESC::Buffer(mElementByteSize*elementCount),
+            &CD3DX12_RESOURCE_DESC::Buffer(UINT64(mElementByteSize)*elementCount),
 			D3D12_RESOURCE_STATE_GENERIC_READ,
             nullptr,
             IID_PPV_ARGS(&mUploadBuffer)));
 
         ThrowIfFailed(mUploadBuffer->Map(0, nullptr, reinterpret_cast<void**>(&mMappedData)));
+        mWriter = UploadWriter<T>(mMappedData, elementCount, mElementByteSize);
 
         // We do not need to unmap until we are done with the resource.  However, we must not write to
         // the resource while it is in use by the GPU (so we must use synchronization techniques).
@@ -50,14 +52,28 @@ public:
         return mUploadBuffer.Get();
     }
 
-    void CopyData(int elementIndex, const T& data)
+    // The mapped elements, for writing in place.  Only packed for buffers
+    // that are not constant buffers.  Write-combined: write, never read.
+    T* MappedData()const
     {
-        memcpy(&mMappedData[elementIndex*mElementByteSize], &data, sizeof(T));
+        return reinterpret_cast<T*>(mMappedData);
+    }
+
+    void CopyData(std::size_t elementIndex, const T& data)
+    {
+        mWriter.CopyData(elementIndex, data);
+    }
+
+    // Range, strided and parallel copies into the mapped memory.
+    UploadWriter<T>& Writer()
+    {
+        return mWriter;
     }
 
 private:
     Microsoft::WRL::ComPtr<ID3D12Resource> mUploadBuffer;
     BYTE* mMappedData = nullptr;
+    UploadWriter<T> mWriter;
 
     UINT mElementByteSize = 0;
     bool mIsConstantBuffer = false;
@@ -0,0 +1,200 @@
+//***************************************************************************************
+// UploadWriter.h by llyr-who (C) 2011 All Rights Reserved.
+//
+// Fills mapped upload memory with elements of type T.  It only needs a pointer, so the
+// same code runs on plain host memory in tests and benchmarks; UploadBuffer hands out
+// one for its mapped resource.
+//
+// Upload heaps are write-combined: writes are gathered into whole cache lines and
+// go out in bursts, but a read is an uncached round trip.  Everything below only
+// writes, front to back.  The non-temporal mode goes further and streams past the
+// cache altogether, which also keeps large uploads from evicting the solver's data.
+//
+// Header-only, so every project that includes UploadBuffer.h keeps linking as before.
+//***************************************************************************************
+
+#ifndef UPLOADWRITER_H
+#define UPLOADWRITER_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define UPLOAD_STREAM_X86 1
+#include <emmintrin.h>
+#endif
+
+enum class UploadCopyMode
+{
+	// Plain memcpy.  Best for small ranges, which are over before the
+	// write-combining buffers matter.
+	Cached,
+
+	// Non-temporal 16-byte stores that bypass the cache.  Best for ranges
+	// much larger than L2, and whatever the range, it leaves the cache alone.
+	NonTemporal
+};
+
+namespace UploadCopy
+{
+	// Makes the streaming stores issued so far visible before any later
+	// store, such as the one that signals the GPU.
+	inline void StoreFence()
+	{
+#if defined(UPLOAD_STREAM_X86)
+		_mm_sfence();
+#endif
+	}
+
+	// memcpy with non-temporal stores where the CPU has them, but no fence:
+	// for callers that stream many pieces and fence once at the end.
+	inline void StreamBytesUnfenced(void* dst, const void* src, std::size_t bytes)
+	{
+#if defined(UPLOAD_STREAM_X86)
+		unsigned char* d = static_cast<unsigned char*>(dst);
+		const unsigned char* s = static_cast<const unsigned char*>(src);
+
+		// Streaming stores need 16-byte aligned destinations.
+		std::size_t head = (16 - (reinterpret_cast<std::uintptr_t>(d) & 15)) & 15;
+		head = std::min(head, bytes);
+		std::memcpy(d, s, head);
+		d += head;
+		s += head;
+		bytes -= head;
+
+		for(; bytes >= 64; bytes -= 64, d += 64, s += 64)
+		{
+			__m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s));
+			__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + 16));
+			__m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + 32));
+			__m128i e = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + 48));
+			_mm_stream_si128(reinterpret_cast<__m128i*>(d), a);
+			_mm_stream_si128(reinterpret_cast<__m128i*>(d + 16), b);
+			_mm_stream_si128(reinterpret_cast<__m128i*>(d + 32), c);
+			_mm_stream_si128(reinterpret_cast<__m128i*>(d + 48), e);
+		}
+		for(; bytes >= 16; bytes -= 16, d += 16, s += 16)
+			_mm_stream_si128(reinterpret_cast<__m128i*>(d), _mm_loadu_si128(reinterpret_cast<const __m128i*>(s)));
+
+		std::memcpy(d, s, bytes);
+#else
+		std::memcpy(dst, src, bytes);
+#endif
+	}
+
+	// StreamBytesUnfenced followed by StoreFence, so the data is out before
+	// the caller signals the GPU.
+	inline void StreamBytes(void* dst, const void* src, std::size_t bytes)
+	{
+		StreamBytesUnfenced(dst, src, bytes);
+		StoreFence();
+	}
+
+	inline void CopyBytes(void* dst, const void* src, std::size_t bytes, UploadCopyMode mode)
+	{
+		if(mode == UploadCopyMode::NonTemporal)
+			StreamBytes(dst, src, bytes);
+		else
+			std::memcpy(dst, src, bytes);
+	}
+}
+
+template<typename T>
+class UploadWriter
+{
+public:
+	UploadWriter() = default;
+
+	// elementCount elements at data, elementByteSize apart (at least sizeof(T);
+	// constant buffer elements are padded to 256 bytes).
+	UploadWriter(void* data, std::size_t elementCount, std::size_t elementByteSize = sizeof(T)) :
+		mData(static_cast<unsigned char*>(data)),
+		mElementCount(elementCount),
+		mElementByteSize(elementByteSize)
+	{
+	}
+
+	std::size_t ElementCount()const { return mElementCount; }
+	std::size_t ElementByteSize()const { return mElementByteSize; }
+
+	// Whether the elements are back to back, so ranges copy in one piece.
+	bool IsPacked()const { return mElementByteSize == sizeof(T); }
+
+	void* Element(std::size_t i)const { return mData + i*mElementByteSize; }
+
+	void CopyData(std::size_t elementIndex, const T& data)
+	{
+		std::memcpy(Element(elementIndex), &data, sizeof(T));
+	}
+
+	// Copies src[0, count) to elements [first, first + count).
+	void CopyRange(std::size_t first, const T* src, std::size_t count, UploadCopyMode mode = UploadCopyMode::Cached)
+	{
+		if(IsPacked())
+		{
+			UploadCopy::CopyBytes(Element(first), src, count*sizeof(T), mode);
+			return;
+		}
+
+		if(mode == UploadCopyMode::NonTemporal)
+		{
+			// One fence for the whole range rather than one per element.
+			for(std::size_t k = 0; k < count; ++k)
+				UploadCopy::StreamBytesUnfenced(Element(first + k), &src[k], sizeof(T));
+			UploadCopy::StoreFence();
+			return;
+		}
+
+		for(std::size_t k = 0; k < count; ++k)
+			std::memcpy(Element(first + k), &src[k], sizeof(T));
+	}
+
+	// CopyRange split into chunks of about ParallelChunkBytes, copied on pool
+	// (anything with ThreadPool's ParallelForRange).  One thread rarely fills
+	// the bus on its own, least of all with the cached mode.
+	template<typename Pool>
+	void ParallelCopyRange(std::size_t first, const T* src, std::size_t count, Pool& pool,
+		UploadCopyMode mode = UploadCopyMode::NonTemporal)
+	{
+		std::size_t grain = std::max<std::size_t>(1, ParallelChunkBytes / mElementByteSize);
+		pool.ParallelForRange(0, count, grain, [this, first, src, mode](std::size_t a, std::size_t b)
+		{
+			CopyRange(first + a, src + a, b - a, mode);
+		});
+	}
+
+	// Interleaves three float arrays, the components of a structure of arrays,
+	// into the 3 floats at byteOffset of elements [first, first + count).
+	void CopyFloat3s(std::size_t first, std::size_t count, std::size_t byteOffset,
+		const float* x, const float* y, const float* z)
+	{
+		for(std::size_t k = 0; k < count; ++k)
+		{
+			float v[3] = { x[k], y[k], z[k] };
+			std::memcpy(static_cast<unsigned char*>(Element(first + k)) + byteOffset, v, sizeof(v));
+		}
+	}
+
+	// Copies count values byteStride apart from src into the member at
+	// byteOffset of elements [first, first + count): an array of structures
+	// of one layout into another.
+	template<typename M>
+	void CopyStrided(std::size_t first, std::size_t count, std::size_t byteOffset,
+		const M* src, std::size_t byteStride)
+	{
+		const unsigned char* s = reinterpret_cast<const unsigned char*>(src);
+		for(std::size_t k = 0; k < count; ++k, s += byteStride)
+			std::memcpy(static_cast<unsigned char*>(Element(first + k)) + byteOffset, s, sizeof(M));
+	}
+
+	static const std::size_t ParallelChunkBytes = 256*1024;
+
+private:
+	unsigned char* mData = nullptr;
+	std::size_t mElementCount = 0;
+	std::size_t mElementByteSize = sizeof(T);
+};
+
+#endif // UPLOADWRITER_H
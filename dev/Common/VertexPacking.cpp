@@ -0,0 +1,119 @@
+//***************************************************************************************
+// VertexPacking.cpp by llyr-who (C) 2011 All Rights Reserved.
+//***************************************************************************************
+
+#include "VertexPacking.h"
+#include <cstring>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define VERTEX_PACKING_SSE 1
+#include <emmintrin.h>
+#endif
+
+using namespace DirectX;
+
+namespace
+{
+#if defined(VERTEX_PACKING_SSE)
+	// Four consecutive XMFLOAT3s as x, y and z of four lanes.
+	inline void LoadFloat3x4(const XMFLOAT3* src, __m128& x, __m128& y, __m128& z)
+	{
+		const float* f = &src->x;
+		__m128 a = _mm_loadu_ps(f);     // x0 y0 z0 x1
+		__m128 b = _mm_loadu_ps(f + 4); // y1 z1 x2 y2
+		__m128 c = _mm_loadu_ps(f + 8); // z2 x3 y3 z3
+
+		__m128 bc = _mm_shuffle_ps(b, c, _MM_SHUFFLE(1, 0, 3, 2));   // x2 y2 z2 x3
+		__m128 ab = _mm_shuffle_ps(a, b, _MM_SHUFFLE(1, 0, 3, 2));   // z0 x1 y1 z1
+		x = _mm_shuffle_ps(a, bc, _MM_SHUFFLE(3, 0, 3, 0));
+		z = _mm_shuffle_ps(ab, c, _MM_SHUFFLE(3, 0, 3, 0));
+
+		__m128 a1b0 = _mm_shuffle_ps(a, b, _MM_SHUFFLE(0, 0, 1, 1)); // y0 y0 y1 y1
+		__m128 b3c2 = _mm_shuffle_ps(b, c, _MM_SHUFFLE(2, 2, 3, 3)); // y2 y2 y3 y3
+		y = _mm_shuffle_ps(a1b0, b3c2, _MM_SHUFFLE(2, 0, 2, 0));
+	}
+
+	// QuantizeUnorm of four lanes, as 32-bit integers.
+	inline __m128i QuantizeUnorm4(__m128 v, float min, float scale)
+	{
+		__m128 u = _mm_mul_ps(_mm_sub_ps(v, _mm_set1_ps(min)), _mm_set1_ps(scale));
+		u = _mm_min_ps(_mm_max_ps(u, _mm_setzero_ps()), _mm_set1_ps(65535.0f));
+		return _mm_cvttps_epi32(_mm_add_ps(u, _mm_set1_ps(0.5f)));
+	}
+
+	// QuantizeSnorm of four lanes: rounds half away from zero like the scalar.
+	inline __m128i QuantizeSnorm4(__m128 v, __m128 signMask)
+	{
+		__m128 t = _mm_mul_ps(v, _mm_set1_ps(32767.0f));
+		__m128 half = _mm_or_ps(_mm_set1_ps(0.5f), _mm_and_ps(t, signMask));
+		return _mm_cvttps_epi32(_mm_add_ps(t, half));
+	}
+
+	// One PackedVertex from the low 8 bytes of position and low 4 of normal,
+	// stored straight from the registers.
+	inline void StoreVertex(unsigned char* d, __m128i position, __m128i normal)
+	{
+		_mm_storel_epi64(reinterpret_cast<__m128i*>(d), position);
+		std::int32_t n = _mm_cvtsi128_si32(normal);
+		std::memcpy(d + 8, &n, sizeof(n));
+	}
+#endif
+}
+
+void VertexPacking::PackVertices(const XMFLOAT3* positions, const XMFLOAT3* normals, std::size_t count,
+	const PackedVertexBounds& bounds, void* dst, std::size_t stride)
+{
+	unsigned char* d = static_cast<unsigned char*>(dst);
+	std::size_t k = 0;
+
+#if defined(VERTEX_PACKING_SSE)
+	const __m128 signMask = _mm_castsi128_ps(_mm_set1_epi32(int(0x80000000u)));
+	const __m128 one = _mm_set1_ps(1.0f);
+
+	for(; k + 4 <= count; k += 4)
+	{
+		__m128 px, py, pz;
+		LoadFloat3x4(positions + k, px, py, pz);
+		__m128i qx = QuantizeUnorm4(px, bounds.Min.x, bounds.Scale.x);
+		__m128i qy = QuantizeUnorm4(py, bounds.Min.y, bounds.Scale.y);
+		__m128i qz = QuantizeUnorm4(pz, bounds.Min.z, bounds.Scale.z);
+
+		__m128 nx, ny, nz;
+		LoadFloat3x4(normals + k, nx, ny, nz);
+		__m128 ax = _mm_andnot_ps(signMask, nx);
+		__m128 ay = _mm_andnot_ps(signMask, ny);
+		__m128 az = _mm_andnot_ps(signMask, nz);
+		__m128 s = _mm_add_ps(_mm_add_ps(ax, ay), az);
+		__m128 ex = _mm_div_ps(nx, s);
+		__m128 ez = _mm_div_ps(nz, s);
+
+		// The lower half folds over the edges of the upper one.
+		__m128 fx = _mm_or_ps(_mm_sub_ps(one, _mm_andnot_ps(signMask, ez)), _mm_and_ps(ex, signMask));
+		__m128 fz = _mm_or_ps(_mm_sub_ps(one, _mm_andnot_ps(signMask, ex)), _mm_and_ps(ez, signMask));
+		__m128 below = _mm_cmplt_ps(ny, _mm_setzero_ps());
+		ex = _mm_or_ps(_mm_and_ps(below, fx), _mm_andnot_ps(below, ex));
+		ez = _mm_or_ps(_mm_and_ps(below, fz), _mm_andnot_ps(below, ez));
+
+		__m128i qnx = QuantizeSnorm4(ex, signMask);
+		__m128i qnz = QuantizeSnorm4(ez, signMask);
+
+		// Each vertex is three dwords: x | y << 16, z (w is 0), nx | nz << 16.
+		__m128i xy = _mm_or_si128(qx, _mm_slli_epi32(qy, 16));
+		__m128i nxz = _mm_or_si128(_mm_and_si128(qnx, _mm_set1_epi32(0xffff)), _mm_slli_epi32(qnz, 16));
+		__m128i lo = _mm_unpacklo_epi32(xy, qz);
+		__m128i hi = _mm_unpackhi_epi32(xy, qz);
+
+		StoreVertex(d, lo, nxz);
+		StoreVertex(d + stride, _mm_srli_si128(lo, 8), _mm_srli_si128(nxz, 4));
+		StoreVertex(d + 2*stride, hi, _mm_srli_si128(nxz, 8));
+		StoreVertex(d + 3*stride, _mm_srli_si128(hi, 8), _mm_srli_si128(nxz, 12));
+		d += 4*stride;
+	}
+#endif
+
+	for(; k < count; ++k, d += stride)
+	{
+		PackedVertex v = PackVertex(positions[k], normals[k], bounds);
+		std::memcpy(d, &v, sizeof(v));
+	}
+}
@@ -0,0 +1,123 @@
+//***************************************************************************************
+// VertexPacking.h by llyr-who (C) 2011 All Rights Reserved.
+//
+// A 12 byte vertex for meshes rewritten every frame, half the size of float3 Pos and
+// Normal.  The position is quantized to 16 bits per axis within a box chosen per mesh
+// (R16G16B16A16_UNORM), the normal is octahedral encoded into two 16 bit values
+// (R16G16_SNORM).  Positions outside the box are clamped to it.
+//
+// The octahedron is folded about y, so normals near +y, which water and hanging cloth
+// mostly have, land on the unfolded half and keep the most precision.  The shader
+// decodes with
+//
+//     n = float3(e.x, 1 - |e.x| - |e.y|, e.y);
+//     t = saturate(-n.y);  n.xz += n.xz >= 0 ? -t : t;  n = normalize(n);
+//
+// PackVertex and PackVertices produce identical bits for the same input, so spans may
+// mix them freely.
+//***************************************************************************************
+
+#ifndef VERTEXPACKING_H
+#define VERTEXPACKING_H
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <DirectXMath.h>
+
+struct PackedVertex
+{
+	// x, y, z within the bounds, w unused.
+	std::uint16_t Pos[4];
+	std::int16_t Normal[2];
+};
+
+struct PackedVertexBounds
+{
+	DirectX::XMFLOAT3 Min = { 0.0f, 0.0f, 0.0f };
+	DirectX::XMFLOAT3 Extent = { 1.0f, 1.0f, 1.0f };
+
+	// 65535 / Extent.
+	DirectX::XMFLOAT3 Scale = { 65535.0f, 65535.0f, 65535.0f };
+};
+
+namespace VertexPacking
+{
+	inline PackedVertexBounds MakeBounds(const DirectX::XMFLOAT3& min, const DirectX::XMFLOAT3& max)
+	{
+		PackedVertexBounds b;
+		b.Min = min;
+		b.Extent = DirectX::XMFLOAT3(
+			std::fmax(max.x - min.x, 1e-6f),
+			std::fmax(max.y - min.y, 1e-6f),
+			std::fmax(max.z - min.z, 1e-6f));
+		b.Scale = DirectX::XMFLOAT3(65535.0f / b.Extent.x, 65535.0f / b.Extent.y, 65535.0f / b.Extent.z);
+		return b;
+	}
+
+	inline std::uint16_t QuantizeUnorm(float v, float min, float scale)
+	{
+		// Written like the SSE max and min, which also send NaN to 0.
+		float u = (v - min)*scale;
+		u = u > 0.0f ? u : 0.0f;
+		u = u < 65535.0f ? u : 65535.0f;
+		return std::uint16_t(u + 0.5f);
+	}
+
+	inline std::int16_t QuantizeSnorm(float v)
+	{
+		float t = v*32767.0f;
+		return std::int16_t(t + (t < 0.0f ? -0.5f : 0.5f));
+	}
+
+	inline PackedVertex PackVertex(const DirectX::XMFLOAT3& position, const DirectX::XMFLOAT3& normal,
+		const PackedVertexBounds& bounds)
+	{
+		PackedVertex v;
+		v.Pos[0] = QuantizeUnorm(position.x, bounds.Min.x, bounds.Scale.x);
+		v.Pos[1] = QuantizeUnorm(position.y, bounds.Min.y, bounds.Scale.y);
+		v.Pos[2] = QuantizeUnorm(position.z, bounds.Min.z, bounds.Scale.z);
+		v.Pos[3] = 0;
+
+		float s = std::fabs(normal.x) + std::fabs(normal.y) + std::fabs(normal.z);
+		float ex = normal.x / s;
+		float ez = normal.z / s;
+		if(normal.y < 0.0f)
+		{
+			float fx = (1.0f - std::fabs(ez))*(std::signbit(ex) ? -1.0f : 1.0f);
+			float fz = (1.0f - std::fabs(ex))*(std::signbit(ez) ? -1.0f : 1.0f);
+			ex = fx;
+			ez = fz;
+		}
+		v.Normal[0] = QuantizeSnorm(ex);
+		v.Normal[1] = QuantizeSnorm(ez);
+		return v;
+	}
+
+	// What the shader reads back.
+	inline void UnpackVertex(const PackedVertex& v, const PackedVertexBounds& bounds,
+		DirectX::XMFLOAT3& position, DirectX::XMFLOAT3& normal)
+	{
+		position.x = bounds.Min.x + float(v.Pos[0]) / 65535.0f*bounds.Extent.x;
+		position.y = bounds.Min.y + float(v.Pos[1]) / 65535.0f*bounds.Extent.y;
+		position.z = bounds.Min.z + float(v.Pos[2]) / 65535.0f*bounds.Extent.z;
+
+		float ex = std::fmax(float(v.Normal[0]) / 32767.0f, -1.0f);
+		float ez = std::fmax(float(v.Normal[1]) / 32767.0f, -1.0f);
+		float nx = ex;
+		float ny = 1.0f - std::fabs(ex) - std::fabs(ez);
+		float nz = ez;
+		float t = std::fmax(-ny, 0.0f);
+		nx += nx >= 0.0f ? -t : t;
+		nz += nz >= 0.0f ? -t : t;
+		float invLen = 1.0f / std::sqrt(nx*nx + ny*ny + nz*nz);
+		normal = DirectX::XMFLOAT3(nx*invLen, ny*invLen, nz*invLen);
+	}
+
+	// Packs count vertices into the PackedVertex every stride bytes from dst,
+	// four at a time with SSE where the CPU has it.  dst is only written, in order.
+	void PackVertices(const DirectX::XMFLOAT3* positions, const DirectX::XMFLOAT3* normals, std::size_t count,
+		const PackedVertexBounds& bounds, void* dst, std::size_t stride);
+}
+
+#endif // VERTEXPACKING_H
@@ -0,0 +1,151 @@
+//***************************************************************************************
+// VertexSpan.h by llyr-who (C) 2011 All Rights Reserved.
+//
+// Where a solver writes its output for rendering: Count vertices, Stride bytes apart,
+// each with a float3 position and a float3 normal at the given byte offsets, or each
+// a PackedVertex (see VertexPacking.h).  This is usually the mapped memory of an upload
+// buffer, which is write-combined, so writers fill it in order and never read it back.
+// Any host memory will do as well.
+//
+// Solvers that write runs of consecutive vertices go through VertexSpanWriter, which
+// hands packed spans whole batches to pack at once.
+//***************************************************************************************
+
+#ifndef VERTEXSPAN_H
+#define VERTEXSPAN_H
+
+#include <cstddef>
+#include <cstring>
+#include <DirectXMath.h>
+#include "VertexPacking.h"
+
+enum class VertexFormat
+{
+	// float3 at PositionOffset and NormalOffset.
+	Float3,
+
+	// A PackedVertex relative to Bounds; the offsets are unused.
+	Packed
+};
+
+struct VertexSpan
+{
+	void* Data = nullptr;
+	std::size_t Count = 0;
+	std::size_t Stride = 0;
+	std::size_t PositionOffset = 0;
+	std::size_t NormalOffset = 0;
+
+	VertexFormat Format = VertexFormat::Float3;
+	PackedVertexBounds Bounds;
+
+	// Vertices [first, first + count) of this span.
+	VertexSpan Sub(std::size_t first, std::size_t count)const
+	{
+		VertexSpan s = *this;
+		s.Data = static_cast<char*>(Data) + first*Stride;
+		s.Count = count;
+		return s;
+	}
+
+	void Write(std::size_t i, const DirectX::XMFLOAT3& position, const DirectX::XMFLOAT3& normal)const
+	{
+		char* v = static_cast<char*>(Data) + i*Stride;
+		if(Format == VertexFormat::Packed)
+		{
+			PackedVertex p = VertexPacking::PackVertex(position, normal, Bounds);
+			std::memcpy(v, &p, sizeof(p));
+			return;
+		}
+		std::memcpy(v + PositionOffset, &position, sizeof(position));
+		std::memcpy(v + NormalOffset, &normal, sizeof(normal));
+	}
+
+	// Vertices [first, first + count) from arrays of positions and normals.
+	void WriteRange(std::size_t first, std::size_t count,
+		const DirectX::XMFLOAT3* positions, const DirectX::XMFLOAT3* normals)const
+	{
+		if(Format == VertexFormat::Packed)
+		{
+			VertexPacking::PackVertices(positions, normals, count, Bounds,
+				static_cast<char*>(Data) + first*Stride, Stride);
+			return;
+		}
+		for(std::size_t k = 0; k < count; ++k)
+			Write(first + k, positions[k], normals[k]);
+	}
+};
+
+// Writes consecutive vertices of a span from first on.  Float3 spans are
+// written straight through; packed ones collect BatchSize vertices and pack
+// them together.  Whatever is left goes out on Flush or destruction.
+class VertexSpanWriter
+{
+public:
+	VertexSpanWriter(const VertexSpan& out, std::size_t first) :
+		mOut(out),
+		mNext(first)
+	{
+	}
+	VertexSpanWriter(const VertexSpanWriter& rhs) = delete;
+	VertexSpanWriter& operator=(const VertexSpanWriter& rhs) = delete;
+	~VertexSpanWriter() { Flush(); }
+
+	void Write(const DirectX::XMFLOAT3& position, const DirectX::XMFLOAT3& normal)
+	{
+		if(mOut.Format != VertexFormat::Packed)
+		{
+			mOut.Write(mNext++, position, normal);
+			return;
+		}
+
+		mPositions[mPending] = position;
+		mNormals[mPending] = normal;
+		if(++mPending == BatchSize)
+			Flush();
+	}
+
+	void Flush()
+	{
+		mOut.WriteRange(mNext, mPending, mPositions, mNormals);
+		mNext += mPending;
+		mPending = 0;
+	}
+
+	static const std::size_t BatchSize = 64;
+
+private:
+	const VertexSpan& mOut;
+	std::size_t mNext = 0;
+	std::size_t mPending = 0;
+	DirectX::XMFLOAT3 mPositions[BatchSize];
+	DirectX::XMFLOAT3 mNormals[BatchSize];
+};
+
+// A span over an array of count vertices of any type with XMFLOAT3 members Pos
+// and Normal.
+template<typename V>
+VertexSpan MakeVertexSpan(V* vertices, std::size_t count)
+{
+	VertexSpan s;
+	s.Data = vertices;
+	s.Count = count;
+	s.Stride = sizeof(V);
+	s.PositionOffset = offsetof(V, Pos);
+	s.NormalOffset = offsetof(V, Normal);
+	return s;
+}
+
+// A packed span over count PackedVertex, positions relative to bounds.
+inline VertexSpan MakePackedVertexSpan(PackedVertex* vertices, std::size_t count, const PackedVertexBounds& bounds)
+{
+	VertexSpan s;
+	s.Data = vertices;
+	s.Count = count;
+	s.Stride = sizeof(PackedVertex);
+	s.Format = VertexFormat::Packed;
+	s.Bounds = bounds;
+	return s;
+}
+
+#endif // VERTEXSPAN_H
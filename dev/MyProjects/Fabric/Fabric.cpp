@@ -1,15 +1,33 @@
-
 #include"Fabric.h"
-#include"../../Common/MathHelper.h"
+#include"../../Common/ThreadPool.h"
 
-#include <ppl.h>
 #include <algorithm>
 #include <vector>
 #include <cassert>
+#include <cmath>
 
 using DirectX::XMFLOAT3;
 
+static const float sqrt_2 = 1.41421356f;
+
+// The computational molecule: every spring leaving a vertex, as a row/column step.
+const Fabric::SpringDirection Fabric::springDirections[Fabric::SpringDirectionCount] =
+{
+	{ 0, 1, 1.0f, false },    // "from left to right" horizontal connection
+	{ 1, 0, 1.0f, false },    // "up to down" connection
+	{ 1, 1, sqrt_2, false },  // the "from left to right" diagonal connection
+	{ 1, -1, sqrt_2, false }, // the "from right to left" diagonal connection
+	{ 0, 2, 2.0f, true },     // the double links
+	{ 2, 0, 2.0f, true },
+};
+
 Fabric::Fabric(std::size_t m, std::size_t n, float ddx, float ddt, float spring1, float spring2, float damp1, float damp2, float M)
+	: Fabric(nullptr, m, n, ddx, ddt, spring1, spring2, damp1, damp2, M)
+{
+}
+
+Fabric::Fabric(float* pool, std::size_t m, std::size_t n, float ddx, float ddt, float spring1, float spring2, float damp1, float damp2, float M)
+	: stepper(ddt)
 {
 	mass = M;
 	numRows = m;
@@ -20,19 +38,34 @@ Fabric::Fabric(std::size_t m, std::size_t n, float ddx, float ddt, float spring1
 
 	dt = ddt;
 	dx = ddx;
+	collisionThickness = 0.5f * dx;
 
 	shortDamp = damp1;
 	longDamp = damp2;
 	shortSpring = spring1;
 	longSpring = spring2;
 
-	prevPos.resize(m * n);
-	currPos.resize(m * n);
-	velocity.resize(m * n);
-	force.resize(m * n);
-	normals.resize(m * n);
-	tangents.resize(m * n);
-	bitangents.resize(m * n);
+	SetSimdLevel(DetectSimdLevel());
+
+	// Either our own storage or a slice of a FabricWorld's pool.
+	if (pool == nullptr)
+	{
+		storage.resize(StorageSize(vertexCount));
+		pool = storage.data();
+	}
+	std::fill(pool, pool + StorageSize(vertexCount), 0.0f);
+
+	// One padded block per component keeps every array 32-byte aligned.
+	std::size_t stride = (vertexCount + 7) & ~std::size_t(7);
+	Float3SoA* fields[] = { &prevPos, &currPos, &velocity, &normals, &tangents, &bitangents, &force };
+	float* p = base = pool;
+	for (Float3SoA* f : fields)
+	{
+		f->x = p;
+		f->y = p + stride;
+		f->z = p + 2 * stride;
+		p += 3 * stride;
+	}
 
 	// Generate grid vertices in system memory.
 
@@ -44,16 +77,37 @@ Fabric::Fabric(std::size_t m, std::size_t n, float ddx, float ddt, float spring1
 		for (std::size_t j = 0; j < n; ++j)
 		{
 			float x = -halfWidth + j * dx;
+			float y = 0.1f * sinf(x * z);
 
-			prevPos[i * n + j] = XMFLOAT3(x, 0.1 * sin(x * z), z);
-			currPos[i * n + j] = XMFLOAT3(x, 0.1 * sin(x * z), z);
-			velocity[i * n + j] = XMFLOAT3(0, 0, 0);
-			normals[i * n + j] = XMFLOAT3(0, 1, 0);
+			prevPos.x[i * n + j] = currPos.x[i * n + j] = x;
+			prevPos.y[i * n + j] = currPos.y[i * n + j] = y;
+			prevPos.z[i * n + j] = currPos.z[i * n + j] = z;
+			normals.y[i * n + j] = 1.0f;
 		}
 	}
 }
 
 
+std::size_t Fabric::StorageSize(std::size_t vertexCount)
+{
+	std::size_t stride = (vertexCount + 7) & ~std::size_t(7);
+	return 3 * stride * 7;
+}
+
+void Fabric::MoveStorage(float* to)
+{
+	std::copy(base, base + StorageSize(vertexCount), to);
+
+	// prevPos and currPos swap every step, so rebase each field on its own.
+	for (Float3SoA* f : { &prevPos, &currPos, &velocity, &normals, &tangents, &bitangents, &force })
+	{
+		f->x = to + (f->x - base);
+		f->y = to + (f->y - base);
+		f->z = to + (f->z - base);
+	}
+	base = to;
+}
+
 std::size_t Fabric::RowCount()const
 {
 	return numRows;
@@ -84,462 +138,306 @@ float Fabric::Depth()const
 	return numRows * dx;
 }
 
-void Fabric::Update(float ddt, float windX, float windY, float windZ)
+void Fabric::SetSimdLevel(SimdLevel level)
+{
+	simdLevel = std::min(level, DetectSimdLevel());
+	springKernel = GetSpringKernel(simdLevel);
+	proximityKernel = GetProximityKernel(simdLevel);
+	capsuleKernel = GetCapsuleKernel(simdLevel);
+	boundsKernel = GetBoundsKernel(simdLevel);
+}
+
+SpringParams Fabric::ParamsFor(const SpringDirection& d) const
+{
+	// NOTE THE SQUARE ROOT IN DIAG CONNECTIONS
+	if (d.isLong)
+		return SpringParams{ d.restScale * dx, longSpring, longDamp };
+	return SpringParams{ d.restScale * dx, shortSpring, shortDamp };
+}
+
+void Fabric::AccumulateSprings(std::size_t j)
 {
-	static float t = 0;
-	t += ddt;
 	std::size_t n = numCols;
 	std::size_t m = numRows;
-	if (t >= dt)
-	{
-
-		for (std::size_t j = 0; j < m; ++j)
-		{
-			for (std::size_t i = 0; i < n; ++i)
-			{
-				force[j * n + i].x = 0;
-				force[j * n + i].y = 0;
-				force[j * n + i].z = 0;
-			}
-		}
 
+	for (const SpringDirection& d : springDirections)
+	{
+		if (j + d.dRow >= m)
+			continue;
+
+		// A spring leaving column i ends on column i + dCol, so only
+		// n - |dCol| origins on this row have a partner inside the grid.
+		std::size_t skip = std::size_t(d.dCol < 0 ? -d.dCol : d.dCol);
+		std::size_t first = j * n + (d.dCol < 0 ? skip : 0);
+		std::size_t offset = d.dRow * n + d.dCol;
+		springKernel(currPos, velocity, force, first, offset, n - skip, ParamsFor(d));
+	}
+}
 
-		// Wind update function
-		// does this make sence for the wind update?
-		concurrency::parallel_for(0, int(m), [this, &windX, &windY, &windZ, &n](int j)
-			{
-				for (std::size_t i = 0; i < n; i++)
-				{
-					std::size_t j_times_n_plus_i = j * n + i;
-					float WFx, WFy, WFz;
-					// if the wind and the velocity are in opposite directions
-					// it would make sence for the particle to be unaffected.
-					WFx = normals[j_times_n_plus_i].x * (windX + velocity[j_times_n_plus_i].x);
-					WFy = normals[j_times_n_plus_i].y * (windY + velocity[j_times_n_plus_i].y);
-					WFz = normals[j_times_n_plus_i].z * (windZ + velocity[j_times_n_plus_i].z);
-					force[j_times_n_plus_i].x += wind_infl * WFx;
-					force[j_times_n_plus_i].y += mass * gravity + wind_infl * WFx;
-					force[j_times_n_plus_i].z += wind_infl * WFx;
-
-				}
-			});
+void Fabric::AccumulateSpringBlock(std::size_t block)
+{
+	static_assert(BlockRows >= 2, "blocks of one parity must not share rows");
 
-		//we do the double links first
-		concurrency::parallel_for(0, int(m - 2), [this, &n](int j)
-			{
-				for (std::size_t i = 0; i < n - 2; i++)
-				{
-					// not sure how much this "optimisation" makes much of
-					// a difference - if at all
-					std::size_t j_plus_2_times_n_plus_i = (j + 2) * n + i;
-					std::size_t j_times_n_plus_i = j * n + i;
-					std::size_t j_times_n_plus_i_plus_2 = j * n + i + 2;
-
-					float F1x, F1y, F1z;
-					float F2x, F2y, F2z;
-					float diffx;
-					float diffy;
-					float diffz;
-					float velDiffx;
-					float velDiffy;
-					float velDiffz;
-					float diffNorm;
-					float k;
-
-					diffx = currPos[j_plus_2_times_n_plus_i].x - currPos[j_times_n_plus_i].x;
-					diffy = currPos[j_plus_2_times_n_plus_i].y - currPos[j_times_n_plus_i].y;
-					diffz = currPos[j_plus_2_times_n_plus_i].z - currPos[j_times_n_plus_i].z;
-					diffNorm = sqrt(diffx * diffx + diffy * diffy + diffz * diffz);
-					k = longSpring * (diffNorm - 2 * dx) * (1 / diffNorm);
-					//now force due to damper
-					velDiffx = velocity[j_plus_2_times_n_plus_i].x - velocity[j_times_n_plus_i].x;
-					velDiffy = velocity[j_plus_2_times_n_plus_i].y - velocity[j_times_n_plus_i].y;
-					velDiffz = velocity[j_plus_2_times_n_plus_i].z - velocity[j_times_n_plus_i].z;
-
-					F1x = k * diffx + longDamp * velDiffx;
-					F1y = k * diffy + longDamp * velDiffy;
-					F1z = k * diffz + longDamp * velDiffz;
-
-					diffx = currPos[j_times_n_plus_i_plus_2].x - currPos[j_times_n_plus_i].x;
-					diffy = currPos[j_times_n_plus_i_plus_2].y - currPos[j_times_n_plus_i].y;
-					diffz = currPos[j_times_n_plus_i_plus_2].z - currPos[j_times_n_plus_i].z;
-					diffNorm = sqrt(diffx * diffx + diffy * diffy + diffz * diffz);
-					k = longSpring * (diffNorm - 2 * dx) * (1 / diffNorm);
-					//now force due to damper
-					velDiffx = velocity[j_times_n_plus_i_plus_2].x - velocity[j_times_n_plus_i].x;
-					velDiffy = velocity[j_times_n_plus_i_plus_2].y - velocity[j_times_n_plus_i].y;
-					velDiffz = velocity[j_times_n_plus_i_plus_2].z - velocity[j_times_n_plus_i].z;
-
-					F2x = k * diffx + longDamp * velDiffx;
-					F2y = k * diffy + longDamp * velDiffy;
-					F2z = k * diffz + longDamp * velDiffz;
-
-					force[j_plus_2_times_n_plus_i].x -= F1x;
-					force[j_plus_2_times_n_plus_i].y -= F1y;
-					force[j_plus_2_times_n_plus_i].z -= F1z;
-
-					force[j_times_n_plus_i].x += F1x;
-					force[j_times_n_plus_i].y += F1y;
-					force[j_times_n_plus_i].z += F1z;
-					force[j_times_n_plus_i].x += F2x;
-					force[j_times_n_plus_i].y += F2y;
-					force[j_times_n_plus_i].z += F2z;
-
-					force[j_times_n_plus_i_plus_2].x -= F2x;
-					force[j_times_n_plus_i_plus_2].y -= F2y;
-					force[j_times_n_plus_i_plus_2].z -= F2z;
-				}
-			});
+	std::size_t end = std::min((block + 1) * BlockRows, numRows);
+	for (std::size_t j = block * BlockRows; j < end; ++j)
+		AccumulateSprings(j);
+}
 
-		for (std::size_t i = 0; i < n - 2; i++)
-		{
+void Fabric::SetSolverLimits(int maxIterations, float tolerance)
+{
+	cgMaxIterations = maxIterations;
+	cgTolerance = tolerance;
+}
 
+void Fabric::SetTimeStep(float step)
+{
+	dt = step;
+	stepper.SetStep(step);
+}
 
-			float F2x, F2y, F2z;
-			float diffx;
-			float diffy;
-			float diffz;
-			float velDiffx;
-			float velDiffy;
-			float velDiffz;
-			float diffNorm;
-			float k;
+void Fabric::Update(float frameTime, float windX, float windY, float windZ)
+{
+	int steps = stepper.Advance(frameTime);
+	for (int s = 0; s < steps; ++s)
+		Step(windX, windY, windZ);
+}
 
+void Fabric::Update(float frameTime, float windX, float windY, float windZ, const VertexSpan& out)
+{
+	int steps = stepper.Advance(frameTime);
+	if (steps == 0)
+		WriteVertices(out);
+	for (int s = 0; s < steps; ++s)
+		Step(windX, windY, windZ, s == steps - 1 ? &out : nullptr);
+}
 
-			diffx = currPos[(m - 1) * n + i + 2].x - currPos[(m - 1) * n + i].x;
-			diffy = currPos[(m - 1) * n + i + 2].y - currPos[(m - 1) * n + i].y;
-			diffz = currPos[(m - 1) * n + i + 2].z - currPos[(m - 1) * n + i].z;
-			// is this sqrt necc? - probably not
-			diffNorm = sqrt(diffx * diffx + diffy * diffy + diffz * diffz);
-			k = longSpring * (diffNorm - 2 * dx) * (1 / diffNorm);
-			//now force due to damper
-			velDiffx = velocity[(m - 1) * n + i + 2].x - velocity[(m - 1) * n + i].x;
-			velDiffy = velocity[(m - 1) * n + i + 2].y - velocity[(m - 1) * n + i].y;
-			velDiffz = velocity[(m - 1) * n + i + 2].z - velocity[(m - 1) * n + i].z;
+void Fabric::WriteVertices(const VertexSpan& out) const
+{
+	ThreadPool::Default().ParallelForRange(0, numRows, BlockRows, [this, &out](std::size_t first, std::size_t last)
+		{
+			WriteVertexRows(first, last, out);
+		});
+}
 
-			F2x = k * diffx + longDamp * velDiffx;
-			F2y = k * diffy + longDamp * velDiffy;
-			F2z = k * diffz + longDamp * velDiffz;
+void Fabric::WriteVertexRows(std::size_t first, std::size_t last, const VertexSpan& out) const
+{
+	float a = clock->Alpha();
+	VertexSpanWriter writer(out, first * numCols);
+	for (std::size_t i = first * numCols; i < last * numCols; ++i)
+	{
+		XMFLOAT3 p(
+			prevPos.x[i] + (currPos.x[i] - prevPos.x[i]) * a,
+			prevPos.y[i] + (currPos.y[i] - prevPos.y[i]) * a,
+			prevPos.z[i] + (currPos.z[i] - prevPos.z[i]) * a);
+		writer.Write(p, Load(normals, i));
+	}
+}
 
+void Fabric::Step(float windX, float windY, float windZ, const VertexSpan* out)
+{
+	// A cloth asleep all over has nothing to do but pass its vertices on.
+	if (CheckSleep(windX, windY, windZ))
+	{
+		if (out != nullptr)
+			WriteVertices(*out);
+		return;
+	}
 
-			force[(m - 1) * n + i + 2].x -= F2x;
-			force[(m - 1) * n + i + 2].y -= F2y;
-			force[(m - 1) * n + i + 2].z -= F2z;
+	if (integrator == FabricIntegrator::XPBD)
+	{
+		// The springs are constraints here, so only wind and gravity are forces.
+		ApplyExternalForces(windX, windY, windZ);
+		IntegrateXPBD();
+	}
+	else
+	{
+		ComputeForces(windX, windY, windZ);
 
-			force[(m - 1) * n + i].x += F2x;
-			force[(m - 1) * n + i].y += F2y;
-			force[(m - 1) * n + i].z += F2z;
+		if (integrator == FabricIntegrator::Implicit)
+			IntegrateImplicit();
+		else
+			IntegrateExplicit();
+	}
 
+	if (selfCollision)
+		CollideSelf();
+	if (HasColliders())
+		CollideColliders();
 
+	// prevPos now holds the new positions; make them current and
+	// rebuild the normal frame from them.
+	std::swap(prevPos, currPos);
+	UpdateNormalFrame(out);
 
-		}
+	if (!blockSleep.empty())
+		UpdateSleep();
+}
 
-		for (std::size_t j = 0; j < m - 2; j++)
+void Fabric::ApplyExternalForces(float windX, float windY, float windZ)
+{
+	ThreadPool::Default().ParallelFor(0, BlockCount(), 1, [this, windX, windY, windZ](std::size_t block)
 		{
-			float F1x, F1y, F1z;
-
-			float diffx;
-			float diffy;
-			float diffz;
-			float velDiffx;
-			float velDiffy;
-			float velDiffz;
-			float diffNorm;
-			float k;
-
-			diffx = currPos[(j + 2) * n + n - 1].x - currPos[j * n + n - 1].x;
-			diffy = currPos[(j + 2) * n + n - 1].y - currPos[j * n + n - 1].y;
-			diffz = currPos[(j + 2) * n + n - 1].z - currPos[j * n + n - 1].z;
-			diffNorm = sqrt(diffx * diffx + diffy * diffy + diffz * diffz);
-			k = longSpring * (diffNorm - 2 * dx) * (1 / diffNorm);
-			//now force due to damper
-			velDiffx = velocity[(j + 2) * n + n - 1].x - velocity[j * n + n - 1].x;
-			velDiffy = velocity[(j + 2) * n + n - 1].y - velocity[j * n + n - 1].y;
-			velDiffz = velocity[(j + 2) * n + n - 1].z - velocity[j * n + n - 1].z;
-
-			F1x = k * diffx + longDamp * velDiffx;
-			F1y = k * diffy + longDamp * velDiffy;
-			F1z = k * diffz + longDamp * velDiffz;
-
-			force[(j + 2) * n + n - 1].x -= F1x;
-			force[(j + 2) * n + n - 1].y -= F1y;
-			force[(j + 2) * n + n - 1].z -= F1z;
-
-
-			force[j * n + n - 1].x += F1x;
-			force[j * n + n - 1].y += F1y;
-			force[j * n + n - 1].z += F1z;
+			if (BlockAwake(block))
+				ApplyExternalForceBlock(block, windX, windY, windZ);
+		});
+}
 
-		}
+// Every axis is pushed by the x wind term, as the cloth always has been, so
+// windY and windZ only matter to the sleep check.
+void Fabric::ApplyExternalForceBlock(std::size_t block, float windX, float, float)
+{
+	std::size_t n = numCols;
+	std::size_t first = block * BlockRows * n;
+	std::size_t last = std::min((block + 1) * BlockRows, numRows) * n;
 
-		concurrency::parallel_for(0, int(m - 1), [this, &n](int j)
+	// Wind update function
+	// does this make sence for the wind update?
+	// This pass also starts the force accumulation, so it overwrites.
+	for (std::size_t i = first; i < last; i++)
+	{
+		// if the wind and the velocity are in opposite directions
+		// it would make sence for the particle to be unaffected.
+		float WFx = normals.x[i] * (windX + velocity.x[i]);
+		force.x[i] = wind_infl * WFx;
+		force.y[i] = mass * gravity + wind_infl * WFx;
+		force.z[i] = wind_infl * WFx;
+	}
+}
+
+void Fabric::ComputeForces(float windX, float windY, float windZ)
+{
+	ApplyExternalForces(windX, windY, windZ);
+
+	ThreadPool& pool = ThreadPool::Default();
+
+	// Short, diagonal and double links, one row of origins at a time.
+	// The last row and column need no special cases: each kernel call
+	// only covers the springs that stay inside the grid.
+	// Even blocks first, then odd blocks, so no two threads share a row.
+	// A sleeping block's forces are never used, but the block before an
+	// awake one still has springs ending in it.
+	std::size_t blockCount = BlockCount();
+	for (std::size_t parity = 0; parity < 2; ++parity)
+	{
+		pool.ParallelFor(0, (blockCount + 1 - parity) / 2, 1, [this, parity](std::size_t k)
 			{
-				for (std::size_t i = 0; i < n - 1; i++)
-				{
-					float F1x, F1y, F1z;
-					float F2x, F2y, F2z;
-					float F3x, F3y, F3z;
-					float F4x, F4y, F4z;
-					float diffx;
-					float diffy;
-					float diffz;
-					float velDiffx;
-					float velDiffy;
-					float velDiffz;
-					float diffNorm;
-					float k;
-					//the "from left to right" diagonal connection in our computational molecule
-					//force due to spring first
-					// NOTE THE SQUARE ROOT IN DIAG CONNECTIONS
-
-					diffx = currPos[(j + 1) * n + (i + 1)].x - currPos[j * n + i].x;
-					diffy = currPos[(j + 1) * n + (i + 1)].y - currPos[j * n + i].y;
-					diffz = currPos[(j + 1) * n + (i + 1)].z - currPos[j * n + i].z;
-					diffNorm = sqrt(diffx * diffx + diffy * diffy + diffz * diffz);
-					k = shortSpring * (diffNorm - MathHelper::sqrt_2 * dx) * (1 / diffNorm);
-					//now force due to damper
-					velDiffx = velocity[(j + 1) * n + (i + 1)].x - velocity[j * n + i].x;
-					velDiffy = velocity[(j + 1) * n + (i + 1)].y - velocity[j * n + i].y;
-					velDiffz = velocity[(j + 1) * n + (i + 1)].z - velocity[j * n + i].z;
-
-					F1x = k * diffx + shortDamp * velDiffx;
-					F1y = k * diffy + shortDamp * velDiffy;
-					F1z = k * diffz + shortDamp * velDiffz;
-
-					//the "from right to left" diagonal connection in our computational molecule
-					//force due to spring first
-					// NOTE THE SQUARE ROOT IN DIAG CONNECTIONS
-
-					diffx = currPos[(j + 1) * n + i].x - currPos[j * n + (i + 1)].x;
-					diffy = currPos[(j + 1) * n + i].y - currPos[j * n + (i + 1)].y;
-					diffz = currPos[(j + 1) * n + i].z - currPos[j * n + (i + 1)].z;
-					diffNorm = sqrt(diffx * diffx + diffy * diffy + diffz * diffz);
-					k = shortSpring * (diffNorm - MathHelper::sqrt_2 * dx) * (1 / diffNorm);
-					//now force due to damper
-					velDiffx = velocity[(j + 1) * n + i].x - velocity[j * n + (i + 1)].x;
-					velDiffy = velocity[(j + 1) * n + i].y - velocity[j * n + (i + 1)].y;
-					velDiffz = velocity[(j + 1) * n + i].z - velocity[j * n + (i + 1)].z;
-
-					F2x = k * diffx + shortDamp * velDiffx;
-					F2y = k * diffy + shortDamp * velDiffy;
-					F2z = k * diffz + shortDamp * velDiffz;
-
-					//non-diag connection "up to down" horizontal component
-
-					diffx = currPos[(j + 1) * n + i].x - currPos[j * n + i].x;
-					diffy = currPos[(j + 1) * n + i].y - currPos[j * n + i].y;
-					diffz = currPos[(j + 1) * n + i].z - currPos[j * n + i].z;
-					diffNorm = sqrt(diffx * diffx + diffy * diffy + diffz * diffz);
-					k = shortSpring * (diffNorm - dx) * (1 / diffNorm);
-					//now force due to damper
-					velDiffx = velocity[(j + 1) * n + i].x - velocity[j * n + i].x;
-					velDiffy = velocity[(j + 1) * n + i].y - velocity[j * n + i].y;
-					velDiffz = velocity[(j + 1) * n + i].z - velocity[j * n + i].z;
-
-					F4x = k * diffx + shortDamp * velDiffx;
-					F4y = k * diffy + shortDamp * velDiffy;
-					F4z = k * diffz + shortDamp * velDiffz;
-
-					// this is the "from dleft to right" horizontal component
-
-					diffx = currPos[j * n + (i + 1)].x - currPos[j * n + i].x;
-					diffy = currPos[j * n + (i + 1)].y - currPos[j * n + i].y;
-					diffz = currPos[j * n + (i + 1)].z - currPos[j * n + i].z;
-					diffNorm = sqrt(diffx * diffx + diffy * diffy + diffz * diffz);
-					k = shortSpring * (diffNorm - dx) * (1 / diffNorm);
-					//now force due to damper
-					velDiffx = velocity[j * n + (i + 1)].x - velocity[j * n + i].x;
-					velDiffy = velocity[j * n + (i + 1)].y - velocity[j * n + i].y;
-					velDiffz = velocity[j * n + (i + 1)].z - velocity[j * n + i].z;
-
-					F3x = k * diffx + shortDamp * velDiffx;
-					F3y = k * diffy + shortDamp * velDiffy;
-					F3z = k * diffz + shortDamp * velDiffz;
-					/*
-					*here is where we add the force to the force array
-					*/
-
-
-					force[j * n + i].x += F1x;
-					force[j * n + i].y += F1y;
-					force[j * n + i].z += F1z;
-
-					force[j * n + i].x += F3x;
-					force[j * n + i].y += F3y;
-					force[j * n + i].z += F3z;
-
-					force[j * n + i].x += F4x;
-					force[j * n + i].y += F4y;
-					force[j * n + i].z += F4z;
-
-					force[(j + 1) * n + (i + 1)].x -= F1x;
-					force[(j + 1) * n + (i + 1)].y -= F1y;
-					force[(j + 1) * n + (i + 1)].z -= F1z;
-
-					force[j * n + (i + 1)].x -= F3x;
-					force[j * n + (i + 1)].y -= F3y;
-					force[j * n + (i + 1)].z -= F3z;
-
-					force[j * n + (i + 1)].x += F2x;
-					force[j * n + (i + 1)].y += F2y;
-					force[j * n + (i + 1)].z += F2z;
-
-					force[(j + 1) * n + i].x -= F4x;
-					force[(j + 1) * n + i].y -= F4y;
-					force[(j + 1) * n + i].z -= F4z;
-
-					force[(j + 1) * n + i].x -= F2x;
-					force[(j + 1) * n + i].y -= F2y;
-					force[(j + 1) * n + i].z -= F2z;
-				}
+				if (BlockOrNextAwake(2 * k + parity))
+					AccumulateSpringBlock(2 * k + parity);
 			});
+	}
+}
 
-		for (std::size_t i = 0; i < n - 1; i++)
+void Fabric::IntegrateExplicit()
+{
+	ThreadPool::Default().ParallelFor(0, BlockCount(), 1, [this](std::size_t block)
 		{
-			float F4x, F4y, F4z;
-			float diffx;
-			float diffy;
-			float diffz;
-			float velDiffx;
-			float velDiffy;
-			float velDiffz;
-			float diffNorm;
-			float k;
-
-			//non-diag connection "up to down" horizontal component
-
-			diffx = currPos[(m - 1) * n + i + 1].x - currPos[(m - 1) * n + i].x;
-			diffy = currPos[(m - 1) * n + i + 1].y - currPos[(m - 1) * n + i].y;
-			diffz = currPos[(m - 1) * n + i + 1].z - currPos[(m - 1) * n + i].z;
-			diffNorm = sqrt(diffx * diffx + diffy * diffy + diffz * diffz);
-			k = shortSpring * (diffNorm - dx) * (1 / diffNorm);
-			//now force due to damper
-			velDiffx = velocity[(m - 1) * n + i + 1].x - velocity[(m - 1) * n + i].x;
-			velDiffy = velocity[(m - 1) * n + i + 1].y - velocity[(m - 1) * n + i].y;
-			velDiffz = velocity[(m - 1) * n + i + 1].z - velocity[(m - 1) * n + i].z;
-
-			F4x = k * diffx + shortDamp * velDiffx;
-			F4y = k * diffy + shortDamp * velDiffy;
-			F4z = k * diffz + shortDamp * velDiffz;
-
-
-			force[(m - 1) * n + i + 1].x -= F4x;
-			force[(m - 1) * n + i + 1].y -= F4y;
-			force[(m - 1) * n + i + 1].z -= F4z;
-
-
-			force[(m - 1) * n + i].x += F4x;
-			force[(m - 1) * n + i].y += F4y;
-			force[(m - 1) * n + i].z += F4z;
-
+			if (BlockAwake(block))
+				IntegrateExplicitBlock(block);
+		});
+}
 
-		}
+void Fabric::IntegrateExplicitBlock(std::size_t block)
+{
+	std::size_t n = numCols;
+	std::size_t end = std::min((block + 1) * BlockRows, numRows);
 
-		for (std::size_t j = 0; j < m - 1; j++)
+	//update the position's of the elements and velocities
+	//column 0 is pinned, so it is never moved
+	const float accel = 0.5f * (1 / mass) * dt * dt;
+	const float invDt = 1 / dt;
+	for (std::size_t j = block * BlockRows; j < end; ++j)
+	{
+		for (std::size_t i = j * n + 1; i < (j + 1) * n; ++i)
 		{
-			float F4x, F4y, F4z;
-			float diffx;
-			float diffy;
-			float diffz;
-			float velDiffx;
-			float velDiffy;
-			float velDiffz;
-			float diffNorm;
-			float k;
-
-			//non-diag connection "up to down" horizontal component
-
-			diffx = currPos[(j + 1) * n + n - 1].x - currPos[j * n + n - 1].x;
-			diffy = currPos[(j + 1) * n + n - 1].y - currPos[j * n + n - 1].y;
-			diffz = currPos[(j + 1) * n + n - 1].z - currPos[j * n + n - 1].z;
-			diffNorm = sqrt(diffx * diffx + diffy * diffy + diffz * diffz);
-			k = shortSpring * (diffNorm - dx) * (1 / diffNorm);
-			//now force due to damper
-			velDiffx = velocity[(j + 1) * n + n - 1].x - velocity[j * n + n - 1].x;
-			velDiffy = velocity[(j + 1) * n + n - 1].y - velocity[j * n + n - 1].y;
-			velDiffz = velocity[(j + 1) * n + n - 1].z - velocity[j * n + n - 1].z;
-
-			F4x = k * diffx + shortDamp * velDiffx;
-			F4y = k * diffy + shortDamp * velDiffy;
-			F4z = k * diffz + shortDamp * velDiffz;
-
-
-			force[j * n + n - 1].x += F4x;
-			force[j * n + n - 1].y += F4y;
-			force[j * n + n - 1].z += F4z;
-
-
-			force[(j + 1) * n + n - 1].x -= F4x;
-			force[(j + 1) * n + n - 1].y -= F4y;
-			force[(j + 1) * n + n - 1].z -= F4z;
+			prevPos.x[i] = currPos.x[i] + velocity.x[i] * dt + force.x[i] * accel;
+			prevPos.y[i] = currPos.y[i] + velocity.y[i] * dt + force.y[i] * accel;
+			prevPos.z[i] = currPos.z[i] + velocity.z[i] * dt + force.z[i] * accel;
 
+			velocity.x[i] = (prevPos.x[i] - currPos.x[i]) * invDt;
+			velocity.y[i] = (prevPos.y[i] - currPos.y[i]) * invDt;
+			velocity.z[i] = (prevPos.z[i] - currPos.z[i]) * invDt;
 		}
+	}
+}
 
-		//update the position's of the elements and velocities
-		concurrency::parallel_for(0, int(m), [this, &n](int j)
-			{
-				for (std::size_t i = 1; i < n; ++i)
-				{
-
-					prevPos[j * numRows + i].x = currPos[j * n + i].x
-						+ velocity[j * n + i].x * dt
-						+ force[j * n + i].x * 0.5 * (1 / mass) * dt * dt;
-
-					prevPos[j * numRows + i].y = currPos[j * n + i].y
-						+ velocity[j * n + i].y * dt
-						+ force[j * n + i].y * 0.5 * (1 / mass) * dt * dt;
-
-					prevPos[j * numRows + i].z = currPos[j * n + i].z
-						+ velocity[j * n + i].z * dt
-						+ force[j * n + i].z * 0.5 * (1 / mass) * dt * dt;
-
-					velocity[j * n + i].x = (prevPos[j * n + i].x - currPos[j * n + i].x) * (1 / dt);
-					velocity[j * n + i].y = (prevPos[j * n + i].y - currPos[j * n + i].y) * (1 / dt);
-					velocity[j * n + i].z = (prevPos[j * n + i].z - currPos[j * n + i].z) * (1 / dt);
-
-				}
-			});
-
-
-
-
-
-
-		concurrency::parallel_for(0, int(m - 1), [this, &n](int j)
-			{
-				for (std::size_t i = 0; i < n - 1; ++i)
-				{
-					tangents[j * n + i].x = currPos[(j + 1) * n + i].x - currPos[j * n + i].x;
-					tangents[j * n + i].y = currPos[(j + 1) * n + i].y - currPos[j * n + i].y;
-					tangents[j * n + i].z = currPos[(j + 1) * n + i].z - currPos[j * n + i].z;
-					MathHelper::Normalize(tangents[j * n + i]);
-
-					bitangents[j * n + i].x = currPos[j * n + i + 1].x - currPos[j * n + i].x;
-					bitangents[j * n + i].y = currPos[j * n + i + 1].y - currPos[j * n + i].y;
-					bitangents[j * n + i].z = currPos[j * n + i + 1].z - currPos[j * n + i].z;
-					MathHelper::Normalize(bitangents[j * n + i]);
-
-					normals[j * n + i] = MathHelper::XMVectorf3Cross(bitangents[j * n + i], tangents[j * n + i]);
-
-				}
-			});
-
-
-		for (std::size_t j = 0; j < m; j++)
+void Fabric::UpdateNormalFrame(const VertexSpan* out)
+{
+	ThreadPool::Default().ParallelFor(0, BlockCount(), 1, [this, out](std::size_t block)
 		{
-			normals[j * n + n - 1] = normals[j * n + n - 2];
+			// The normals of a block's last row lean on the next block's first.
+			if (BlockOrNextAwake(block))
+				UpdateNormalBlock(block, out);
+			else if (out != nullptr)
+				WriteVertexBlock(block, *out);
+		});
+}
 
-		}
-		for (std::size_t i = 0; i < n; i++)
-		{
-			normals[(m - 1) * n + i] = normals[(m - 2) * n + i];
+void Fabric::UpdateNormalBlock(std::size_t block, const VertexSpan* out)
+{
+	std::size_t n = numCols;
+	std::size_t m = numRows;
+	std::size_t end = std::min((block + 1) * BlockRows, m);
 
+	for (std::size_t j = block * BlockRows; j < end && j < m - 1; ++j)
+	{
+		for (std::size_t i = j * n; i < (j + 1) * n - 1; ++i)
+		{
+			float tx = currPos.x[i + n] - currPos.x[i];
+			float ty = currPos.y[i + n] - currPos.y[i];
+			float tz = currPos.z[i + n] - currPos.z[i];
+			float invLen = 1 / std::sqrt(tx * tx + ty * ty + tz * tz);
+			tx *= invLen;
+			ty *= invLen;
+			tz *= invLen;
+
+			float bx = currPos.x[i + 1] - currPos.x[i];
+			float by = currPos.y[i + 1] - currPos.y[i];
+			float bz = currPos.z[i + 1] - currPos.z[i];
+			invLen = 1 / std::sqrt(bx * bx + by * by + bz * bz);
+			bx *= invLen;
+			by *= invLen;
+			bz *= invLen;
+
+			tangents.x[i] = tx;
+			tangents.y[i] = ty;
+			tangents.z[i] = tz;
+			bitangents.x[i] = bx;
+			bitangents.y[i] = by;
+			bitangents.z[i] = bz;
+
+			normals.x[i] = by * tz - bz * ty;
+			normals.y[i] = bz * tx - bx * tz;
+			normals.z[i] = bx * ty - by * tx;
 		}
 
+		// The last column copies its neighbour.
+		std::size_t last = (j + 1) * n - 1;
+		normals.x[last] = normals.x[last - 1];
+		normals.y[last] = normals.y[last - 1];
+		normals.z[last] = normals.z[last - 1];
 
-		std::swap(prevPos, currPos);
+		// So does the last row, written by whichever block finishes the one
+		// before it.
+		if (j == m - 2)
+		{
+			std::copy(normals.x + j * n, normals.x + (j + 1) * n, normals.x + (j + 1) * n);
+			std::copy(normals.y + j * n, normals.y + (j + 1) * n, normals.y + (j + 1) * n);
+			std::copy(normals.z + j * n, normals.z + (j + 1) * n, normals.z + (j + 1) * n);
+		}
+	}
 
-		t = 0.0f;
+	if (out != nullptr)
+		WriteVertexBlock(block, *out);
+}
 
-	}
+void Fabric::WriteVertexBlock(std::size_t block, const VertexSpan& out) const
+{
+	// Output the rows whose normals are done, the last row with the one
+	// before it, since that is the block that writes its normals.
+	std::size_t m = numRows;
+	std::size_t first = block * BlockRows;
+	std::size_t end = std::min((block + 1) * BlockRows, m);
+	if (first == m - 1 && m > 1)
+		return;
+	WriteVertexRows(first, end >= m - 1 ? m : end, out);
 }
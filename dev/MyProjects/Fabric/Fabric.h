@@ -4,17 +4,66 @@
 // Performs the calculations for the wave simulation.  After the simulation has been
 // updated, the client must copy the current solution into vertex buffers for rendering.
 // This class only does the calculations, it does not do any drawing.
+//
+// The particle state is kept as a structure of arrays (separate x, y and z arrays,
+// each 32-byte aligned) so the spring passes can run on SIMD kernels.
 //***************************************************************************************
 
 #ifndef FABRIC_H
 #define FABRIC_H
 
+#include <atomic>
+#include <cstdint>
+#include <memory>
 #include <vector>
 #include <DirectXMath.h>
+#include "../../Common/AlignedAllocator.h"
+#include "../../Common/FixedTimestep.h"
+#include "../../Common/VertexSpan.h"
+#include "FabricKernels.h"
+
+enum class FabricIntegrator
+{
+	// The original explicit step.  Cheap, but stiff springs need a tiny dt.
+	Explicit,
+	// Backward Euler, solved with a matrix-free preconditioned conjugate
+	// gradient.  Stable at far larger steps for the same springs.
+	Implicit,
+	// Extended position-based dynamics: the springs become distance
+	// constraints with compliance 1/stiffness, projected a fixed number of
+	// times per step.  Unconditionally stable, with a fixed cost per step.
+	XPBD
+};
+
+// A collider the cloth is kept out of: the points within radius of the segment from
+// a to b.  A sphere is a capsule whose ends meet.  friction is the share of the
+// sliding velocity a vertex touching it loses per step, from 0 to 1.
+struct FabricCapsule
+{
+	DirectX::XMFLOAT3 a;
+	DirectX::XMFLOAT3 b;
+	float radius;
+	float friction;
+};
+
+// A box collider: its centre, its half extents along its own axes, and the rotation
+// quaternion taking those axes into the cloth's space.
+struct FabricBox
+{
+	DirectX::XMFLOAT3 center;
+	DirectX::XMFLOAT3 extents;
+	DirectX::XMFLOAT4 orientation;
+	float friction;
+};
+
 class Fabric
 {
+	friend class FabricWorld;
 public:
 	Fabric(std::size_t m, std::size_t n, float ddx, float ddt, float spring1, float spring2, float damp1, float damp2, float M);
+	Fabric(const Fabric& rhs) = delete;
+	Fabric& operator=(const Fabric& rhs) = delete;
+
 	std::size_t RowCount() const;
 	std::size_t ColumnCount() const;
 	std::size_t TriangleCount() const;
@@ -23,17 +72,230 @@ public:
 	float Depth() const;
 
 	// this returns the solution at the ith grid point
-	const DirectX::XMFLOAT3& Position(int i)const { return currPos[i]; }
+	DirectX::XMFLOAT3 Position(std::size_t i)const { return Load(currPos, i); }
+
+	// Returns the ith grid point blended between the last two steps by
+	// InterpolationAlpha(), for smooth rendering between fixed steps.
+	DirectX::XMFLOAT3 InterpolatedPosition(std::size_t i)const
+	{
+		float a = clock->Alpha();
+		return DirectX::XMFLOAT3(
+			prevPos.x[i] + (currPos.x[i] - prevPos.x[i]) * a,
+			prevPos.y[i] + (currPos.y[i] - prevPos.y[i]) * a,
+			prevPos.z[i] + (currPos.z[i] - prevPos.z[i]) * a);
+	}
 
 	// Returns the solution normal at the ith grid point.
-	const DirectX::XMFLOAT3& Normal(int i)const { return normals[i]; }
+	DirectX::XMFLOAT3 Normal(std::size_t i)const { return Load(normals, i); }
 	// Returns the unit tangent vector at the ith grid point
-	const DirectX::XMFLOAT3& Tangent(int i)const { return tangents[i]; }
+	DirectX::XMFLOAT3 Tangent(std::size_t i)const { return Load(tangents, i); }
 	// Returns the unit bitangent vector at the ith grid point
-	const DirectX::XMFLOAT3& Bitangent(int i)const { return bitangents[i]; }
+	DirectX::XMFLOAT3 Bitangent(std::size_t i)const { return Load(bitangents, i); }
+
+	// Picks the instruction set used by the spring passes.  Defaults to the
+	// widest one the CPU supports; asking for more than that is clamped.
+	void SetSimdLevel(SimdLevel level);
+	SimdLevel GetSimdLevel() const { return simdLevel; }
+
+	// The fixed step the solver integrates with.  Smaller steps are more stable
+	// but need more substeps per frame.
+	float TimeStep() const { return dt; }
+	void SetTimeStep(float step);
+
+	// Upper bound on steps per Update; time past it is dropped.
+	void SetMaxSubsteps(int maxSubsteps) { stepper.SetMaxSubsteps(maxSubsteps); }
+	float InterpolationAlpha() const { return clock->Alpha(); }
+
+	void SetIntegrator(FabricIntegrator mode) { integrator = mode; Wake(); }
+	FabricIntegrator Integrator() const { return integrator; }
+
+	// Implicit mode only: the conjugate gradient stops after maxIterations, or
+	// once the residual has shrunk to tolerance times the right-hand side.
+	void SetSolverLimits(int maxIterations, float tolerance);
+	int LastSolverIterations() const { return cgIterations; }
+
+	// XPBD mode only: constraint projection sweeps per step.
+	void SetConstraintIterations(int iterations) { xpbdIterations = iterations; }
+	int ConstraintIterations() const { return xpbdIterations; }
+
+	// Keeps the cloth from passing through itself: at the end of every step,
+	// vertices closer than the collision thickness to another vertex or to a
+	// triangle are pushed apart.  Off by default.
+	void SetSelfCollision(bool enabled) { selfCollision = enabled; }
+	bool SelfCollision() const { return selfCollision; }
+
+	// The gap self-collision keeps between layers; half the grid spacing by default.
+	void SetCollisionThickness(float thickness) { collisionThickness = thickness; }
+	float CollisionThickness() const { return collisionThickness; }
+
+	// The broadphase budget: how many candidates self-collision may test per
+	// step, as an average per vertex.  Every row block gets its share, and a
+	// vertex may use what the ones before it in the block left over, so a
+	// crumpled cloth costs no more than a flat one of the same size.  Contacts
+	// past the budget are left for the next step.
+	void SetCollisionBudget(std::size_t candidatesPerVertex) { collisionBudget = candidatesPerVertex; }
+	std::size_t CollisionBudget() const { return collisionBudget; }
+
+	// Candidates tested and vertices pushed by the last step's self-collision.
+	std::size_t LastCollisionCandidates() const { return collisionCandidates; }
+	std::size_t LastCollisionContacts() const { return collisionContacts; }
+
+	// Colliders, in the cloth's own space.  At the end of every step, after
+	// self-collision, vertices found inside one are moved out to its surface
+	// and stop moving into it.  Colliders may be moved between steps through
+	// Capsule and Box.  The cloth is tested in tiles of a row block, and a
+	// tile skips every collider its bounding box misses, so colliders away
+	// from the cloth cost next to nothing.
+	std::size_t AddSphere(const DirectX::XMFLOAT3& center, float radius, float friction = 0.0f);
+	std::size_t AddCapsule(const FabricCapsule& capsule);
+	std::size_t AddBox(const FabricBox& box);
+	FabricCapsule& Capsule(std::size_t i) { return capsules[i]; }
+	FabricBox& Box(std::size_t i) { return boxes[i]; }
+	std::size_t CapsuleCount() const { return capsules.size(); }
+	std::size_t BoxCount() const { return boxes.size(); }
+
+	// Ground sampled on a grid: heights[r * columns + c] is the height at
+	// x = originX + c * spacing, z = originZ + r * spacing, interpolated
+	// bilinearly in between.  Vertices below it are lifted onto it; past its
+	// edges there is no ground.
+	void SetHeightfield(float originX, float originZ, float spacing, std::size_t columns, std::size_t rows,
+		const float* heights, float friction = 0.0f);
+
+	// Removes every collider and the heightfield.
+	void ClearColliders();
+
+	// Vertices moved by the last step's colliders.
+	std::size_t LastColliderContacts() const { return colliderContacts; }
+
+	// Sleeping: a row block all of whose vertices have had less kinetic
+	// energy than energy for steps steps in a row freezes where it is, and
+	// every pass skips it.  Once all blocks sleep, so does the cloth, and a
+	// step costs next to nothing.  A block with more energy than that keeps
+	// its neighbours awake; a change of wind wakes the whole cloth, and a
+	// collider that is moved, added or removed wakes the blocks whose bounds
+	// it overlaps, before or after.  The implicit and XPBD integrators solve
+	// the cloth as a whole, so it only sleeps as a whole there.  An energy of
+	// 0 turns sleeping off, which is the default.
+	void SetSleeping(float energy, int steps);
+	float SleepEnergy() const { return sleepEnergy; }
+	int SleepSteps() const { return sleepSteps; }
+
+	// Wakes every block, for changes the cloth does not watch.
+	void Wake();
+	bool IsAsleep() const { return !blockSleep.empty() && sleepingBlocks == BlockCount(); }
+	std::size_t SleepingBlocks() const { return sleepingBlocks; }
 
-	void Update(float dt, float windX, float windY, float windZ);
+	// Advances the simulation by frameTime, running as many fixed steps as
+	// fit and carrying the remainder over to the next call.  Cloths owned by a
+	// FabricWorld are advanced by the world instead.
+	void Update(float frameTime, float windX, float windY, float windZ);
+
+	// Update that also leaves InterpolatedPosition and Normal of every vertex
+	// in out, which must hold VertexCount() vertices.  The last step's normal
+	// pass writes them as it goes, so the state is not read a second time.
+	void Update(float frameTime, float windX, float windY, float windZ, const VertexSpan& out);
+
+	// Writes InterpolatedPosition and Normal of every vertex into out, in
+	// parallel; for cloths stepped by a FabricWorld.
+	void WriteVertices(const VertexSpan& out) const;
 private:
+	// Used by FabricWorld: builds the cloth in pool, which must hold
+	// StorageSize(m * n) floats and be 32-byte aligned.
+	Fabric(float* pool, std::size_t m, std::size_t n, float ddx, float ddt, float spring1, float spring2, float damp1, float damp2, float M);
+
+	// Floats of per-vertex state a cloth of vertexCount vertices needs.
+	static std::size_t StorageSize(std::size_t vertexCount);
+	// Copies the per-vertex state to to and points every field at the copy.
+	void MoveStorage(float* to);
+
+	// One spring of the computational molecule, as the row/column step from
+	// its first end point to its second.
+	struct SpringDirection
+	{
+		std::size_t dRow;
+		int dCol;
+		float restScale;
+		bool isLong;
+	};
+
+	static const std::size_t SpringDirectionCount = 6;
+	static const SpringDirection springDirections[SpringDirectionCount];
+
+	SpringParams ParamsFor(const SpringDirection& d) const;
+
+	void Step(float windX, float windY, float windZ, const VertexSpan* out = nullptr);
+	void ApplyExternalForces(float windX, float windY, float windZ);
+	void ComputeForces(float windX, float windY, float windZ);
+	void IntegrateExplicit();
+	void UpdateNormalFrame(const VertexSpan* out);
+
+	// The passes above, for the rows of one block.
+	void ApplyExternalForceBlock(std::size_t block, float windX, float windY, float windZ);
+	void IntegrateExplicitBlock(std::size_t block);
+	void UpdateNormalBlock(std::size_t block, const VertexSpan* out = nullptr);
+	void WriteVertexBlock(std::size_t block, const VertexSpan& out) const;
+	void WriteVertexRows(std::size_t first, std::size_t last, const VertexSpan& out) const;
+
+	// Implicit integration, in FabricImplicit.cpp.
+	void IntegrateImplicit();
+	void BuildSpringJacobians();
+	void MultiplySystem(const Float3SoA& in, const Float3SoA& out);
+	double Dot(const Float3SoA& a, const Float3SoA& b);
+	template<typename Visit>
+	void ForEachSpring(std::size_t j, std::size_t i, const Visit& visit) const;
+
+	// XPBD integration, in FabricXPBD.cpp.
+	void IntegrateXPBD();
+	void ProjectConstraintBlock(std::size_t block);
+
+	// Self-collision, in FabricCollision.cpp.  Runs on the new positions in
+	// prevPos, before Step swaps them in.
+	void CollideSelf();
+	void BuildCollisionHash();
+	void CollideBlock(std::size_t block);
+	static std::uint32_t CollisionCell(int cx, int cy, int cz);
+
+	// Colliders, in FabricColliders.cpp.  Also run on prevPos, after
+	// self-collision.
+	bool HasColliders() const { return !capsules.empty() || !boxes.empty() || !heightfield.heights.empty(); }
+	void PrepareColliders();
+	void CollideColliders();
+	std::size_t CollideColliderBlock(std::size_t block);
+
+	// Sleeping, in FabricSleep.cpp.  A block is asleep once it has been calm
+	// for sleepSteps steps.  The spring and normal passes of a block reach into
+	// the next one, so they run if either is awake.
+	bool BlockAwake(std::size_t block) const { return blockSleep.empty() || blockSleep[block] < std::uint32_t(sleepSteps); }
+	bool BlockOrNextAwake(std::size_t block) const
+	{
+		return BlockAwake(block) || (block + 1 < BlockCount() && BlockAwake(block + 1));
+	}
+	// Wakes what the wind or the colliders disturbed since the last step, and
+	// returns whether the whole cloth still sleeps.
+	bool CheckSleep(float windX, float windY, float windZ);
+	void UpdateSleep();
+	void MeasureEnergyBlock(std::size_t block);
+	void SettleBlocks();
+	void FreezeBlock(std::size_t block);
+	void WakeBlock(std::size_t block);
+	void WakeOverlapping(const float lo[3], const float hi[3]);
+
+	static DirectX::XMFLOAT3 Load(const Float3SoA& v, std::size_t i)
+	{
+		return DirectX::XMFLOAT3(v.x[i], v.y[i], v.z[i]);
+	}
+
+	// Rows are processed in blocks of BlockRows.  The springs of a block reach at
+	// most two rows past its end, so two blocks of the same parity never write the
+	// same force entries.  All even blocks run in parallel, then all odd ones, which
+	// keeps the force pass lock-free and its result independent of the thread count.
+	static const std::size_t BlockRows = 8;
+
+	std::size_t BlockCount() const { return (numRows + BlockRows - 1) / BlockRows; }
+
+	// Accumulates every spring whose first end point lies on row j.
+	void AccumulateSprings(std::size_t j);
+	void AccumulateSpringBlock(std::size_t block);
 
 	std::size_t numRows;
 	std::size_t numCols;
@@ -44,9 +306,9 @@ private:
 	float dt; //time step
 	float dx; //spatial step
 	float mass;
-	//all we want is the magnitude in the y-direction.
-	//as gravity always points in the neg y direction.
-	float gravity;
+	//gravity always points in the neg y direction, so
+	//all we want is its (signed) y-component.
+	float gravity = -9.81f;
 
 	float wind_infl = 0.5f;
 
@@ -54,13 +316,145 @@ private:
 	float shortSpring;
 	float longDamp;
 	float longSpring;
-	std::vector<DirectX::XMFLOAT3> prevPos;
-	std::vector<DirectX::XMFLOAT3> currPos;
-	std::vector<DirectX::XMFLOAT3> velocity;
-	std::vector<DirectX::XMFLOAT3> normals;
-	std::vector<DirectX::XMFLOAT3> tangents;
-	std::vector<DirectX::XMFLOAT3> bitangents;
-	std::vector<DirectX::XMFLOAT3> force;
+
+	FixedTimestep stepper;
+	// Where InterpolatedPosition takes its blend factor from: stepper, or the
+	// owning FabricWorld's.
+	const FixedTimestep* clock = &stepper;
+
+	SimdLevel simdLevel;
+	SpringKernel springKernel;
+	ProximityKernel proximityKernel;
+	CapsuleKernel capsuleKernel;
+	BoundsKernel boundsKernel;
+
+	// Every component array below points into base and is padded to a
+	// multiple of 8 floats, so each one starts on a 32-byte boundary.  base is
+	// storage, unless the cloth lives in a FabricWorld's pool.
+	std::vector<float, AlignedAllocator<float, 32>> storage;
+	float* base;
+	Float3SoA prevPos;
+	Float3SoA currPos;
+	Float3SoA velocity;
+	Float3SoA normals;
+	Float3SoA tangents;
+	Float3SoA bitangents;
+	Float3SoA force;
+
+	FabricIntegrator integrator = FabricIntegrator::Explicit;
+	int cgMaxIterations = 50;
+	float cgTolerance = 1e-3f;
+	int cgIterations = 0;
+
+	// Implicit state, allocated the first time it is used.  For each spring
+	// direction, the unit spring axis at its first end point and the weights of
+	// K = a*I + b*axis*axis^T, the spring's block of the system matrix.
+	struct SpringJacobian
+	{
+		Float3SoA axis;
+		float* a = nullptr;
+		float* b = nullptr;
+	};
+	SpringJacobian jacobians[SpringDirectionCount];
+	Float3SoA cgX; // velocity change; kept as the next step's initial guess
+	Float3SoA cgR;
+	Float3SoA cgZ;
+	Float3SoA cgP;
+	Float3SoA cgAp;
+	Float3SoA cgInvDiag;
+	std::vector<float, AlignedAllocator<float, 32>> implicitStorage;
+	std::vector<double> blockSums;
+
+	// XPBD state, allocated the first time it is used: the accumulated
+	// Lagrange multiplier of every constraint, per spring direction and
+	// stored at the constraint's first end point.
+	int xpbdIterations = 8;
+	float* lambdas[SpringDirectionCount] = {};
+	std::vector<float, AlignedAllocator<float, 32>> xpbdStorage;
+
+	bool selfCollision = false;
+	float collisionThickness;
+	std::size_t collisionBudget = 64;
+	std::size_t collisionCandidates = 0;
+	std::size_t collisionContacts = 0;
+
+	// Self-collision state, allocated the first time it is used.  Each vertex
+	// is hashed by its site, the centre of the quad it starts, into the cell of
+	// side collisionCell that holds it; the low bits of the cell's hash pick
+	// one of bucketMask + 1 buckets.  bucketEntries lists the vertices bucket
+	// by bucket, from bucketStart[b] to bucketStart[b + 1], each bucket in
+	// index order.
+	struct CollisionEntry
+	{
+		std::uint32_t cell;
+		std::uint32_t vertex;
+	};
+	float collisionCell = 1.0f;
+	std::uint32_t bucketMask = 0;
+	std::vector<std::uint32_t> vertexCells;
+	std::vector<std::uint32_t> bucketStart;
+	std::vector<CollisionEntry> bucketEntries;
+	std::unique_ptr<std::atomic<std::uint32_t>[]> bucketCursors;
+	std::vector<std::uint32_t> scanSums;
+	// The sites, the push each vertex gets, and per block the candidates and
+	// contacts.  Each block gathers a vertex's candidates in its own scratch
+	// list, which keeps its capacity from step to step.
+	Float3SoA collisionSites;
+	Float3SoA collisionDelta;
+	std::vector<float, AlignedAllocator<float, 32>> collisionStorage;
+	std::vector<std::size_t> blockCandidates;
+	std::vector<std::size_t> blockContacts;
+	std::vector<std::vector<std::uint32_t>> candidateScratch;
+
+	// The colliders as the client set them.
+	std::vector<FabricCapsule> capsules;
+	std::vector<FabricBox> boxes;
+	struct Heightfield
+	{
+		float originX = 0.0f;
+		float originZ = 0.0f;
+		float spacing = 1.0f;
+		std::size_t columns = 0;
+		std::size_t rows = 0;
+		std::vector<float> heights;
+		float maxHeight = 0.0f;
+		float friction = 0.0f;
+	};
+	Heightfield heightfield;
+	std::size_t colliderContacts = 0;
+
+	// Rebuilt from them at the start of every collider pass: the kernel
+	// parameters, a box's axes as rows of its rotation, and the bounding
+	// box of each, which the tiles test theirs against.
+	struct ColliderBounds
+	{
+		float lo[3];
+		float hi[3];
+	};
+	struct BoxFrame
+	{
+		float center[3];
+		float axes[3][3];
+		float extents[3];
+		float friction;
+	};
+	std::vector<CapsuleParams> capsuleParams;
+	std::vector<ColliderBounds> capsuleBounds;
+	std::vector<BoxFrame> boxFrames;
+	std::vector<ColliderBounds> boxBounds;
+	std::vector<std::size_t> blockColliderContacts;
+
+	// Sleeping state.  blockSleep counts the calm steps of every block, and is
+	// empty while sleeping is off.  blockEnergy is the largest kinetic energy
+	// of a vertex of the block in the last step, and sleepBounds the bounding
+	// box it froze in.  sleepWind is the wind of the last step.
+	float sleepEnergy = 0.0f;
+	int sleepSteps = 0;
+	std::size_t sleepingBlocks = 0;
+	std::vector<std::uint32_t> blockSleep;
+	std::vector<float> blockEnergy;
+	std::vector<ColliderBounds> sleepBounds;
+	float sleepWind[3] = {};
 };
 
-#endif
\ No newline at end of file
+#endif
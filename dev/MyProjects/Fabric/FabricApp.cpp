@@ -11,7 +11,12 @@
 #include "../../Common/GeometryGenerator.h"
 #include "Fabric.h"
 #include "FrameResource.h"
-#include "Waves.h"
+#include "WaveClipmap.h"
+#include "SpectralOcean.h"
+#include "SimulationThread.h"
+#include <algorithm>
+#include <cstring>
+#include <iterator>
 
 using Microsoft::WRL::ComPtr;
 using namespace DirectX;
@@ -22,6 +27,17 @@ using namespace DirectX::PackedVector;
 
 const int gNumFrameResources = 3;
 
+// Packed water vertices keep their heights within this of sea level.
+const float gWavesPackHeight = 10.0f;
+
+// The land: a square grid of gLandVertices per side, gLandSize across, raised
+// gLandHeight above the hills.  The hills sit around sea level, where the cloth
+// starts out flat, so the cloth drapes over them as it falls; land raised above
+// the cloth would be the inside of the heightfield and lift the cloth onto it.
+const float gLandSize = 20.0f;
+const int gLandVertices = 50;
+const float gLandHeight = 0.0f;
+
 // Lightweight structure stores parameters to draw a shape.  This will
 // vary from app-to-app.
 struct RenderItem
@@ -44,6 +60,9 @@ struct RenderItem
 	// Index into GPU constant buffer corresponding to the ObjectCB for this render item.
 	UINT ObjCBIndex = -1;
 
+	// Box the positions of packed vertices are quantized in.
+	PackedVertexBounds PackBounds;
+
 	Material* Mat = nullptr;
 	MeshGeometry* Geo = nullptr;
 
@@ -56,9 +75,25 @@ struct RenderItem
 	int BaseVertexLocation = 0;
 };
 
+// What simulating one frame needs from the main thread, copied so the main
+// thread can carry on while it runs.
+struct SimulationFrame
+{
+	// Where the vertices go; free once the GPU has passed Fence.
+	FrameResource* Target = nullptr;
+	UINT64 Fence = 0;
+
+	float DeltaTime = 0.0f;
+	float TotalTime = 0.0f;
+	XMFLOAT3 EyePos = { 0.0f, 0.0f, 0.0f };
+	bool UseSpectralOcean = false;
+	bool FabricSelfCollision = false;
+};
+
 enum class RenderLayer : int
 {
 	Opaque = 0,
+	OpaquePacked,
 	Count
 };
 
@@ -86,18 +121,33 @@ private:
 	void UpdateObjectCBs(const GameTimer& gt);
 	void UpdateMaterialCBs(const GameTimer& gt);
 	void UpdateMainPassCB(const GameTimer& gt);
-	void UpdateWaves(const GameTimer& gt);
-	void UpdateFabric(const GameTimer& gt);
+	void UpdateWaves(const SimulationFrame& frame);
+	void UpdateFabric(const SimulationFrame& frame);
+	void SubmitSimulation(const GameTimer& gt, FrameResource* target);
+	void WaitForFence(UINT64 fence);
 
     void BuildRootSignature();
     void BuildShadersAndInputLayout();
     void BuildLandGeometry();
+	void BuildFabricColliders();
     void BuildWavesGeometryBuffers();
 	void BuildFabricGeometryBuffers();
+	void BuildGridIndexBuffer(MeshGeometry* geo, std::size_t m, std::size_t n,
+		const std::vector<std::pair<std::string, std::vector<std::uint32_t>>>& lists);
     void BuildPSOs();
     void BuildFrameResources();
     void BuildMaterials();
     void BuildRenderItems();
+	RenderItem* AddGridRenderItems(MeshGeometry* geo, const std::string& name, Material* mat, std::size_t baseVertex,
+		RenderLayer layer);
+	void SetPackBounds(MeshGeometry* geo, const PackedVertexBounds& bounds);
+	void SetPackDynamicVertices(bool pack);
+	PackedVertexBounds FabricPackBounds()const;
+	PackedVertexBounds WavesPackBounds()const;
+	UINT DynamicVertexByteSize()const { return mPackDynamicVertices ? sizeof(PackedVertex) : sizeof(Vertex); }
+	VertexSpan DynamicVertexSpan(UploadBuffer<Vertex>* vb, UploadBuffer<PackedVertex>* packedVB,
+		std::size_t count, const PackedVertexBounds& bounds)const;
+	ID3D12Resource* DynamicVertexBuffer(UploadBuffer<Vertex>* vb, UploadBuffer<PackedVertex>* packedVB)const;
 	void DrawRenderItems(ID3D12GraphicsCommandList* cmdList, const std::vector<RenderItem*>& ritems);
 
     float GetHillsHeight(float x, float z)const;
@@ -120,7 +170,17 @@ private:
 	std::unordered_map<std::string, ComPtr<ID3D12PipelineState>> mPSOs;
 
 	std::vector<D3D12_INPUT_ELEMENT_DESC> mInputLayout;
+	std::vector<D3D12_INPUT_ELEMENT_DESC> mPackedInputLayout;
+
+	// Cloth and water upload a PackedVertex per vertex instead of a Vertex,
+	// half the bytes every frame, and draw with the "opaquePacked" PSO.  'V'
+	// switches between the two, rebuilding the frame resources.
+	bool mPackDynamicVertices = true;
+	bool mPackKeyDown = false;
+	PackedVertexBounds mFabricBounds;
+	PackedVertexBounds mWavesBounds;
 
+	// The first render item of each; the others share its geometry.
 	RenderItem* mWavesRitem = nullptr;
 	RenderItem* mFabricRitem = nullptr;
 
@@ -131,7 +191,27 @@ private:
 	std::vector<RenderItem*> mRitemLayer[(int)RenderLayer::Count];
 
 	std::unique_ptr<Fabric> mFabric;
-	std::unique_ptr<Waves> mWaves;
+	std::unique_ptr<WaveClipmap> mWaves;
+
+	// Fills the grids of mWaves from its tiling instead; 'O' switches
+	// between the two.
+	std::unique_ptr<SpectralOcean> mOcean;
+	bool mUseSpectralOcean = false;
+	bool mOceanKeyDown = false;
+
+	// Cloth and water run on mSimulation, which fills the next frame
+	// resource while the current one is drawn; 'P' switches to simulating
+	// each frame before it is drawn.  Only the simulation touches the
+	// solvers and the dynamic VBs after Initialize.
+	std::unique_ptr<SimulationThread> mSimulation;
+	std::uint64_t mSimulationTicket = 0;
+	FrameResource* mSimulationTarget = nullptr;
+	bool mPipelineSimulation = true;
+	bool mPipelineKeyDown = false;
+
+	// 'C' turns the cloth's self-collision on and off.
+	bool mFabricSelfCollision = false;
+	bool mCollisionKeyDown = false;
 
     PassConstants mMainPassCB;
 
@@ -179,6 +259,9 @@ FabricApp::FabricApp(HINSTANCE hInstance)
 
 FabricApp::~FabricApp()
 {
+	// Let the last simulation job finish before anything it uses goes.
+	mSimulation.reset();
+
     if(md3dDevice != nullptr)
         FlushCommandQueue();
 }
@@ -195,14 +278,18 @@ bool FabricApp::Initialize()
     // to query this information.
     mCbvSrvDescriptorSize = md3dDevice->GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
 
-	mWaves = std::make_unique<Waves>(128, 128, 1.0f , 0.03f, 4.0f, 0.1f);
+	mWaves = std::make_unique<WaveClipmap>(4, 129, 1.0f , 0.03f, 4.0f, 0.1f);
+	mWaves->SetAbsorbingLayer(16);
+	mOcean = std::make_unique<SpectralOcean>(128, 1.0f, 8.0f, 0.5f);
 	mFabric = std::make_unique<Fabric>(128, 128, 0.5f, 0.02f, 1000.0f, 1500.0f, 2.5f, 2.0f, 0.9f);
+	mSimulation = std::make_unique<SimulationThread>(gNumFrameResources);
 
 	BuildRootSignature();			// Determines the types of data the shaders should expect,
 									// but does not define the actual memory or data.
 
     BuildShadersAndInputLayout();   // self-explainatory 
 	BuildLandGeometry();
+	BuildFabricColliders();
     BuildWavesGeometryBuffers();
 	BuildFabricGeometryBuffers();
 	BuildMaterials();
@@ -244,19 +331,68 @@ void FabricApp::Update(const GameTimer& gt)
 
 	// Has the GPU finished processing the commands of the current frame resource?
 	// If not, wait until the GPU has completed commands up to this fence point.
-	if(mCurrFrameResource->Fence != 0 && mFence->GetCompletedValue() < mCurrFrameResource->Fence)
+	WaitForFence(mCurrFrameResource->Fence);
+
+	// This frame's cloth and water were simulated while the last frame was
+	// drawn, unless pipelining is off (or this is the first frame).
+	if(mSimulationTarget != mCurrFrameResource)
+		SubmitSimulation(gt, mCurrFrameResource);
+	mSimulation->Wait(mSimulationTicket);
+
+	mFabricRitem->Geo->VertexBufferGPU = DynamicVertexBuffer(mCurrFrameResource->FabricVB.get(),
+		mCurrFrameResource->FabricPackedVB.get());
+	mWavesRitem->Geo->VertexBufferGPU = DynamicVertexBuffer(mCurrFrameResource->WavesVB.get(),
+		mCurrFrameResource->WavesPackedVB.get());
+
+	// The water's pack box moves with the camera; it has to reach this
+	// frame's object constants.
+	if(std::memcmp(&mCurrFrameResource->WavesBounds, &mWavesBounds, sizeof(mWavesBounds)) != 0)
 	{
-		HANDLE eventHandle = CreateEventEx(nullptr, false, false, EVENT_ALL_ACCESS);
-		ThrowIfFailed(mFence->SetEventOnCompletion(mCurrFrameResource->Fence, eventHandle));
-		WaitForSingleObject(eventHandle, INFINITE);
-		CloseHandle(eventHandle);
+		mWavesBounds = mCurrFrameResource->WavesBounds;
+		SetPackBounds(mWavesRitem->Geo, mWavesBounds);
 	}
 
 	UpdateObjectCBs(gt);
 	UpdateMaterialCBs(gt);
 	UpdateMainPassCB(gt);
-	UpdateWaves(gt);
-	UpdateFabric(gt);
+
+	// Start on the next frame's while this one is drawn.  It steps by this
+	// frame's time, the best guess for the next.
+	if(mPipelineSimulation)
+		SubmitSimulation(gt, mFrameResources[(mCurrFrameResourceIndex + 1) % gNumFrameResources].get());
+}
+
+// Queues cloth and water of one frame into target on mSimulation.  Called
+// after every Draw that used target, so its fence is the one to wait for.
+void FabricApp::SubmitSimulation(const GameTimer& gt, FrameResource* target)
+{
+	SimulationFrame frame;
+	frame.Target = target;
+	frame.Fence = target->Fence;
+	frame.DeltaTime = gt.DeltaTime();
+	frame.TotalTime = gt.TotalTime();
+	frame.EyePos = mEyePos;
+	frame.UseSpectralOcean = mUseSpectralOcean;
+	frame.FabricSelfCollision = mFabricSelfCollision;
+
+	mSimulationTarget = target;
+	mSimulationTicket = mSimulation->Submit([this, frame]
+	{
+		WaitForFence(frame.Fence);
+		UpdateWaves(frame);
+		UpdateFabric(frame);
+	});
+}
+
+void FabricApp::WaitForFence(UINT64 fence)
+{
+	if(fence != 0 && mFence->GetCompletedValue() < fence)
+	{
+		HANDLE eventHandle = CreateEventEx(nullptr, false, false, EVENT_ALL_ACCESS);
+		ThrowIfFailed(mFence->SetEventOnCompletion(fence, eventHandle));
+		WaitForSingleObject(eventHandle, INFINITE);
+		CloseHandle(eventHandle);
+	}
 }
 
 void FabricApp::Draw(const GameTimer& gt)
@@ -292,6 +428,9 @@ void FabricApp::Draw(const GameTimer& gt)
 
 	DrawRenderItems(mCommandList.Get(), mRitemLayer[(int)RenderLayer::Opaque]);
 
+	mCommandList->SetPipelineState(mPSOs["opaquePacked"].Get());
+	DrawRenderItems(mCommandList.Get(), mRitemLayer[(int)RenderLayer::OpaquePacked]);
+
 	// Indicate a state transition on the resource usage.
 	mCommandList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(CurrentBackBuffer(),
 		D3D12_RESOURCE_STATE_RENDER_TARGET, D3D12_RESOURCE_STATE_PRESENT));
@@ -378,6 +517,26 @@ void FabricApp::OnKeyboardInput(const GameTimer& gt)
 		mSunPhi += 1.0f*dt;
 
 	mSunPhi = MathHelper::Clamp(mSunPhi, 0.1f, XM_PIDIV2);
+
+	bool oceanKeyDown = (GetAsyncKeyState('O') & 0x8000) != 0;
+	if(oceanKeyDown && !mOceanKeyDown)
+		mUseSpectralOcean = !mUseSpectralOcean;
+	mOceanKeyDown = oceanKeyDown;
+
+	bool pipelineKeyDown = (GetAsyncKeyState('P') & 0x8000) != 0;
+	if(pipelineKeyDown && !mPipelineKeyDown)
+		mPipelineSimulation = !mPipelineSimulation;
+	mPipelineKeyDown = pipelineKeyDown;
+
+	bool collisionKeyDown = (GetAsyncKeyState('C') & 0x8000) != 0;
+	if(collisionKeyDown && !mCollisionKeyDown)
+		mFabricSelfCollision = !mFabricSelfCollision;
+	mCollisionKeyDown = collisionKeyDown;
+
+	bool packKeyDown = (GetAsyncKeyState('V') & 0x8000) != 0;
+	if(packKeyDown && !mPackKeyDown)
+		SetPackDynamicVertices(!mPackDynamicVertices);
+	mPackKeyDown = packKeyDown;
 }
 
 void FabricApp::UpdateCamera(const GameTimer& gt)
@@ -410,6 +569,8 @@ void FabricApp::UpdateObjectCBs(const GameTimer& gt)
 
 			ObjectConstants objConstants;
 			XMStoreFloat4x4(&objConstants.World, XMMatrixTranspose(world));
+			objConstants.PackMin = e->PackBounds.Min;
+			objConstants.PackExtent = e->PackBounds.Extent;
 
 			currObjectCB->CopyData(e->ObjCBIndex, objConstants);
 
@@ -478,58 +639,161 @@ void FabricApp::UpdateMainPassCB(const GameTimer& gt)
 	currPassCB->CopyData(0, mMainPassCB);
 }
 
-void FabricApp::UpdateFabric(const GameTimer& gt) 
+void FabricApp::UpdateFabric(const SimulationFrame& frame)
 {
-	mFabric->Update(gt.DeltaTime(),
-		MathHelper::RandF(1.0, 1.5) * std::abs(cos(0.1 * gt.TotalTime())),
+	// The solver writes the new vertices straight into the frame's VB.
+	VertexSpan out = DynamicVertexSpan(frame.Target->FabricVB.get(), frame.Target->FabricPackedVB.get(),
+		mFabric->VertexCount(), mFabricBounds);
+	mFabric->SetSelfCollision(frame.FabricSelfCollision);
+	mFabric->Update(frame.DeltaTime,
+		MathHelper::RandF(1.0, 1.5) * std::abs(cos(0.1 * frame.TotalTime)),
 		0.0f,
-		0.0f);
-	auto currFabricVB = mCurrFrameResource->FabricVB.get();
-	for (int i = 0; i < mFabric->VertexCount(); ++i)
+		0.0f,
+		out);
+}
+
+void FabricApp::UpdateWaves(const SimulationFrame& frame)
+{
+	// Keep the finest water around the camera.  The pack box moves with it.
+	mWaves->SetCenter(frame.EyePos.x, frame.EyePos.z);
+	frame.Target->WavesBounds = WavesPackBounds();
+
+	// The new solution goes straight into the frame's VB, one level after
+	// the other.  The spectral ocean fills the same grid points.
+	VertexSpan out = DynamicVertexSpan(frame.Target->WavesVB.get(), frame.Target->WavesPackedVB.get(),
+		mWaves->VertexCount(), frame.Target->WavesBounds);
+
+	if(frame.UseSpectralOcean)
+	{
+		mOcean->Update(frame.DeltaTime);
+
+		std::size_t count = mWaves->Level(0).VertexCount();
+		for(int l = 0; l < mWaves->LevelCount(); ++l)
+		{
+			const Waves& level = mWaves->Level(l);
+			XMFLOAT3 corner = level.Position(0);
+			mOcean->WriteTiledVertices(corner.x, corner.z, level.SpatialStep(),
+				level.RowCount(), level.ColumnCount(), out.Sub(l*count, count));
+		}
+	}
+	else
 	{
-		Vertex v;
+		// Every quarter second, generate a random wave.
+		static float t_base = 0.0f;
+		if((frame.TotalTime - t_base) >= 0.25f)
+		{
+			t_base += 0.25f;
+
+			float x = frame.EyePos.x + MathHelper::RandF(-50.0f, 50.0f);
+			float z = frame.EyePos.z + MathHelper::RandF(-50.0f, 50.0f);
+
+			float r = MathHelper::RandF(0.2f, 0.5f);
+
+			mWaves->Disturb(x, z, r, 1.0f);
+		}
 
-		v.Pos = mFabric->Position(i);
-		v.Normal = mFabric->Normal(i);
+		// Update the wave simulation.
+		mWaves->Update(frame.DeltaTime);
 
-		currFabricVB->CopyData(i, v);
+		mWaves->WriteVertices(out);
 	}
-	mFabricRitem->Geo->VertexBufferGPU = currFabricVB->Resource();
 }
 
-void FabricApp::UpdateWaves(const GameTimer& gt)
+// A span over the mapped memory of a frame's VB of a dynamic mesh of count
+// vertices, whichever of vb and packedVB the app uploads.
+VertexSpan FabricApp::DynamicVertexSpan(UploadBuffer<Vertex>* vb, UploadBuffer<PackedVertex>* packedVB,
+	std::size_t count, const PackedVertexBounds& bounds)const
 {
-	// Every quarter second, generate a random wave.
-	static float t_base = 0.0f;
-	if((mTimer.TotalTime() - t_base) >= 0.25f)
-	{
-		t_base += 0.25f;
+	if(mPackDynamicVertices)
+		return MakePackedVertexSpan(packedVB->MappedData(), count, bounds);
+	return MakeVertexSpan(vb->MappedData(), count);
+}
 
-		int i = MathHelper::Rand(4, mWaves->RowCount() - 5);
-		int j = MathHelper::Rand(4, mWaves->ColumnCount() - 5);
+ID3D12Resource* FabricApp::DynamicVertexBuffer(UploadBuffer<Vertex>* vb, UploadBuffer<PackedVertex>* packedVB)const
+{
+	return mPackDynamicVertices ? packedVB->Resource() : vb->Resource();
+}
 
-		float r = MathHelper::RandF(0.2f, 0.5f);
+// One box around every level, so the points levels share pack the same in
+// each.  The spectral ocean's points may sit up to half its spacing off the
+// level grids, hence the margin.
+PackedVertexBounds FabricApp::WavesPackBounds()const
+{
+	const Waves& coarsest = mWaves->Level(mWaves->LevelCount() - 1);
+	XMFLOAT3 a = coarsest.Position(0);
+	XMFLOAT3 b = coarsest.Position(coarsest.VertexCount() - 1);
+	float margin = coarsest.SpatialStep();
+
+	return VertexPacking::MakeBounds(
+		XMFLOAT3(std::fmin(a.x, b.x) - margin, -gWavesPackHeight, std::fmin(a.z, b.z) - margin),
+		XMFLOAT3(std::fmax(a.x, b.x) + margin, gWavesPackHeight, std::fmax(a.z, b.z) + margin));
+}
 
-		//mWaves->Disturb(i, j, r);
+// The rest pose grown by its own diagonal on every side: no point of the
+// cloth swings further than the cloth is across, short of overstretching.
+PackedVertexBounds FabricApp::FabricPackBounds()const
+{
+	XMFLOAT3 lo = mFabric->Position(0);
+	XMFLOAT3 hi = lo;
+	for(std::size_t i = 1; i < mFabric->VertexCount(); ++i)
+	{
+		XMFLOAT3 p = mFabric->Position(i);
+		lo = XMFLOAT3(std::fmin(lo.x, p.x), std::fmin(lo.y, p.y), std::fmin(lo.z, p.z));
+		hi = XMFLOAT3(std::fmax(hi.x, p.x), std::fmax(hi.y, p.y), std::fmax(hi.z, p.z));
 	}
 
-	// Update the wave simulation.
-	//mWaves->Update(gt.DeltaTime());
+	float reach = XMVectorGetX(XMVector3Length(XMLoadFloat3(&hi) - XMLoadFloat3(&lo)));
+	return VertexPacking::MakeBounds(
+		XMFLOAT3(lo.x - reach, lo.y - reach, lo.z - reach),
+		XMFLOAT3(hi.x + reach, hi.y + reach, hi.z + reach));
+}
 
-	// Update the wave vertex buffer with the new solution.
-	auto currWavesVB = mCurrFrameResource->WavesVB.get();
-	for(int i = 0; i < mWaves->VertexCount(); ++i)
+// Gives every render item of geo the pack box bounds.
+void FabricApp::SetPackBounds(MeshGeometry* geo, const PackedVertexBounds& bounds)
+{
+	for(auto& e : mAllRitems)
 	{
-		Vertex v;
+		if(e->Geo == geo)
+		{
+			e->PackBounds = bounds;
+			e->NumFramesDirty = gNumFrameResources;
+		}
+	}
+}
 
-		v.Pos = mWaves->Position(i);
-		v.Normal = mWaves->Normal(i);
+// Switches the cloth and water between Vertex and PackedVertex uploads.  A
+// frame resource only holds the one kind of VB, so once the simulation and
+// the GPU are done with them they are built again, and the dynamic render
+// items move to the layer drawn with the other PSO.
+void FabricApp::SetPackDynamicVertices(bool pack)
+{
+	mSimulation->WaitAll();
+	FlushCommandQueue();
 
-		currWavesVB->CopyData(i, v);
+	mPackDynamicVertices = pack;
+	for(const char* name : { "fabricGeo", "waterGeo" })
+	{
+		MeshGeometry* geo = mGeometries[name].get();
+		UINT count = geo->VertexBufferByteSize/geo->VertexByteStride;
+		geo->VertexByteStride = DynamicVertexByteSize();
+		geo->VertexBufferByteSize = count*DynamicVertexByteSize();
 	}
 
-	// Set the dynamic VB of the wave renderitem to the current frame VB.
-	mWavesRitem->Geo->VertexBufferGPU = currWavesVB->Resource();
+	auto& from = mRitemLayer[(int)(pack ? RenderLayer::Opaque : RenderLayer::OpaquePacked)];
+	auto& to = mRitemLayer[(int)(pack ? RenderLayer::OpaquePacked : RenderLayer::Opaque)];
+	auto dynamic = [this](RenderItem* e) { return e->Geo == mFabricRitem->Geo || e->Geo == mWavesRitem->Geo; };
+	std::copy_if(from.begin(), from.end(), std::back_inserter(to), dynamic);
+	from.erase(std::remove_if(from.begin(), from.end(), dynamic), from.end());
+
+	// The new frame resources start with empty constant buffers.
+	mFrameResources.clear();
+	BuildFrameResources();
+	mCurrFrameResource = mFrameResources[mCurrFrameResourceIndex].get();
+	mSimulationTarget = nullptr;
+	for(auto& e : mAllRitems)
+		e->NumFramesDirty = gNumFrameResources;
+	for(auto& e : mMaterials)
+		e.second->NumFramesDirty = gNumFrameResources;
 }
 
 void FabricApp::BuildRootSignature()
@@ -574,17 +838,31 @@ void FabricApp::BuildShadersAndInputLayout()
 	mShaders["standardVS"] = d3dUtil::CompileShader(L"Shaders\\Default.hlsl", nullptr, "VS", "vs_5_0");
 	mShaders["opaquePS"] = d3dUtil::CompileShader(L"Shaders\\Default.hlsl", nullptr, "PS", "ps_5_0");
 
+	const D3D_SHADER_MACRO packedDefines[] =
+	{
+		"PACKED_VERTICES", "1",
+		NULL, NULL
+	};
+	mShaders["packedVS"] = d3dUtil::CompileShader(L"Shaders\\Default.hlsl", packedDefines, "VS", "vs_5_0");
+
     mInputLayout =
     {
         { "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
         { "NORMAL", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 12, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 }
     };
+
+	// PackedVertex.
+	mPackedInputLayout =
+	{
+		{ "POSITION", 0, DXGI_FORMAT_R16G16B16A16_UNORM, 0, 0, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+		{ "NORMAL", 0, DXGI_FORMAT_R16G16_SNORM, 0, 8, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 }
+	};
 }
 
 void FabricApp::BuildLandGeometry()
 {
 	GeometryGenerator geoGen;
-	GeometryGenerator::MeshData grid = geoGen.CreateGrid(20.0f, 20.0f, 50, 50);
+	GeometryGenerator::MeshData grid = geoGen.CreateGrid(gLandSize, gLandSize, gLandVertices, gLandVertices);
 
 	//
 	// Extract the vertex elements we are interested and apply the height function to
@@ -597,7 +875,7 @@ void FabricApp::BuildLandGeometry()
 	{
 		auto& p = grid.Vertices[i].Position;
 		vertices[i].Pos = p;
-		vertices[i].Pos.y = GetHillsHeight(p.x, p.z) + 20;
+		vertices[i].Pos.y = GetHillsHeight(p.x, p.z) + gLandHeight;
 		vertices[i].Normal = GetHillsNormal(p.x, p.z);
 	}
 
@@ -636,82 +914,121 @@ void FabricApp::BuildLandGeometry()
 	mGeometries["landGeo"] = std::move(geo);
 }
 
-void FabricApp::BuildFabricGeometryBuffers() {
-	assert(mFabric->VertexCount() < 0x0000ffff);
+// The cloth lands on the same heights the land mesh is built from.
+void FabricApp::BuildFabricColliders()
+{
+	float spacing = gLandSize / (gLandVertices - 1);
+	float origin = -0.5f*gLandSize;
+
+	std::vector<float> heights(gLandVertices*gLandVertices);
+	for(int r = 0; r < gLandVertices; ++r)
+	{
+		for(int c = 0; c < gLandVertices; ++c)
+			heights[r*gLandVertices + c] = GetHillsHeight(origin + c*spacing, origin + r*spacing) + gLandHeight;
+	}
 
-	// Iterate over each quad.
-	int m = mFabric->RowCount();
-	int n = mFabric->ColumnCount();
-	int tri_cnt = mFabric->TriangleCount();
-	auto indices = GeometryGenerator::CreateGridIndices(m, n, tri_cnt);
+	mFabric->SetHeightfield(origin, origin, spacing, gLandVertices, gLandVertices, heights.data(), 0.5f);
+}
+
+void FabricApp::BuildFabricGeometryBuffers() {
+	std::size_t m = mFabric->RowCount();
+	std::size_t n = mFabric->ColumnCount();
 
-	UINT vbByteSize = mFabric->VertexCount() * sizeof(Vertex);
-	UINT ibByteSize = (UINT)indices.size() * sizeof(std::uint16_t);
 	auto geo = std::make_unique<MeshGeometry>();
 	geo->Name = "fabricGeo";
 
 	// Set dynamically.
 	geo->VertexBufferCPU = nullptr;
+	geo->VertexByteStride = DynamicVertexByteSize();
+	geo->VertexBufferByteSize = (UINT)(mFabric->VertexCount()*DynamicVertexByteSize());
 
-	ThrowIfFailed(D3DCreateBlob(ibByteSize, &geo->IndexBufferCPU));
-	CopyMemory(geo->IndexBufferCPU->GetBufferPointer(), indices.data(), ibByteSize);
-
-	geo->IndexBufferGPU = d3dUtil::CreateDefaultBuffer(md3dDevice.Get(),
-		mCommandList.Get(), indices.data(), ibByteSize, geo->IndexBufferUploader);
-
-	geo->VertexByteStride = sizeof(Vertex);
-	geo->VertexBufferByteSize = vbByteSize;
-	geo->IndexFormat = DXGI_FORMAT_R16_UINT;
-	geo->IndexBufferByteSize = ibByteSize;
-
-	SubmeshGeometry submesh;
-	submesh.IndexCount = (UINT)indices.size();
-	submesh.StartIndexLocation = 0;
-	submesh.BaseVertexLocation = 0;
-
-	geo->DrawArgs["grid"] = submesh;
+	BuildGridIndexBuffer(geo.get(), m, n, { { "grid", GeometryGenerator::CreateGridIndices(m, n) } });
 
 	mGeometries["fabricGeo"] = std::move(geo);
 }
 
 void FabricApp::BuildWavesGeometryBuffers()
 {
-	assert(mWaves->VertexCount() < 0x0000ffff);
-
-	// Iterate over each quad.
-	int m = mWaves->RowCount();
-	int n = mWaves->ColumnCount();
-	int tri_cnt = mWaves->TriangleCount();
-	auto indices = GeometryGenerator::CreateGridIndices(m,n,tri_cnt);
-
-	UINT vbByteSize = mWaves->VertexCount()*sizeof(Vertex);
-	UINT ibByteSize = (UINT)indices.size()*sizeof(std::uint16_t);
+	const Waves& finest = mWaves->Level(0);
+	std::size_t m = finest.RowCount();
+	std::size_t n = finest.ColumnCount();
+	auto indices = GeometryGenerator::CreateGridIndices(m, n);
+
+	// The coarser levels leave out the quads the next finer level covers.
+	// Each level is drawn over its own vertices, so the index format only
+	// depends on the size of one level.
+	std::vector<std::uint32_t> ring;
+	for(std::size_t i = 0; i < m - 1; ++i)
+	{
+		for(std::size_t j = 0; j < n - 1; ++j)
+		{
+			bool hole = i >= std::size_t(mWaves->HoleBegin()) && i < std::size_t(mWaves->HoleEnd()) &&
+				j >= std::size_t(mWaves->HoleBegin()) && j < std::size_t(mWaves->HoleEnd());
+			if(!hole)
+				ring.insert(ring.end(), indices.begin() + 6*(i*(n - 1) + j), indices.begin() + 6*(i*(n - 1) + j + 1));
+		}
+	}
 
 	auto geo = std::make_unique<MeshGeometry>();
 	geo->Name = "waterGeo";
 
 	// Set dynamically.
 	geo->VertexBufferCPU = nullptr;
+	geo->VertexByteStride = DynamicVertexByteSize();
+	geo->VertexBufferByteSize = (UINT)(mWaves->VertexCount()*DynamicVertexByteSize());
 
-	ThrowIfFailed(D3DCreateBlob(ibByteSize, &geo->IndexBufferCPU));
-	CopyMemory(geo->IndexBufferCPU->GetBufferPointer(), indices.data(), ibByteSize);
+	BuildGridIndexBuffer(geo.get(), m, n, { { "grid", std::move(indices) }, { "ring", std::move(ring) } });
 
-	geo->IndexBufferGPU = d3dUtil::CreateDefaultBuffer(md3dDevice.Get(),
-		mCommandList.Get(), indices.data(), ibByteSize, geo->IndexBufferUploader);
+	mGeometries["waterGeo"] = std::move(geo);
+}
 
-	geo->VertexByteStride = sizeof(Vertex);
-	geo->VertexBufferByteSize = vbByteSize;
-	geo->IndexFormat = DXGI_FORMAT_R16_UINT;
-	geo->IndexBufferByteSize = ibByteSize;
+// Puts the index lists of an m x n grid into one index buffer of geo and
+// adds submeshes name0, name1, ... for each list.  Grids too big for 16-bit
+// indices are split into bands of rows that are not, one submesh per band,
+// unless the bands would be so thin that 32-bit indices are cheaper.
+void FabricApp::BuildGridIndexBuffer(MeshGeometry* geo, std::size_t m, std::size_t n,
+	const std::vector<std::pair<std::string, std::vector<std::uint32_t>>>& lists)
+{
+	std::vector<std::uint16_t> indices16;
+	std::vector<std::uint32_t> indices32;
+	bool use16 = GeometryGenerator::UseGridIndices16(m, n);
 
-	SubmeshGeometry submesh;
-	submesh.IndexCount = (UINT)indices.size();
-	submesh.StartIndexLocation = 0;
-	submesh.BaseVertexLocation = 0;
+	for(const auto& list : lists)
+	{
+		std::vector<GeometryGenerator::IndexChunk> chunks;
+		if(use16)
+		{
+			chunks = GeometryGenerator::ChunkGridIndices(list.second, n, indices16);
+		}
+		else
+		{
+			chunks.push_back({ (UINT)indices32.size(), (UINT)list.second.size(), 0 });
+			indices32.insert(indices32.end(), list.second.begin(), list.second.end());
+		}
 
-	geo->DrawArgs["grid"] = submesh;
+		for(std::size_t k = 0; k < chunks.size(); ++k)
+		{
+			SubmeshGeometry submesh;
+			submesh.IndexCount = chunks[k].IndexCount;
+			submesh.StartIndexLocation = chunks[k].StartIndex;
+			submesh.BaseVertexLocation = (INT)chunks[k].BaseVertex;
 
-	mGeometries["waterGeo"] = std::move(geo);
+			geo->DrawArgs[list.first + std::to_string(k)] = submesh;
+		}
+	}
+
+	const void* data = use16 ? (const void*)indices16.data() : (const void*)indices32.data();
+	UINT ibByteSize = use16 ? (UINT)(indices16.size()*sizeof(std::uint16_t)) :
+		(UINT)(indices32.size()*sizeof(std::uint32_t));
+
+	ThrowIfFailed(D3DCreateBlob(ibByteSize, &geo->IndexBufferCPU));
+	CopyMemory(geo->IndexBufferCPU->GetBufferPointer(), data, ibByteSize);
+
+	geo->IndexBufferGPU = d3dUtil::CreateDefaultBuffer(md3dDevice.Get(),
+		mCommandList.Get(), data, ibByteSize, geo->IndexBufferUploader);
+
+	geo->IndexFormat = use16 ? DXGI_FORMAT_R16_UINT : DXGI_FORMAT_R32_UINT;
+	geo->IndexBufferByteSize = ibByteSize;
 }
 
 // Build pipeline state objects (PSO)
@@ -746,6 +1063,18 @@ void FabricApp::BuildPSOs()
 	opaquePsoDesc.SampleDesc.Quality = m4xMsaaState ? (m4xMsaaQuality - 1) : 0;
 	opaquePsoDesc.DSVFormat = mDepthStencilFormat;
 	ThrowIfFailed(md3dDevice->CreateGraphicsPipelineState(&opaquePsoDesc, IID_PPV_ARGS(&mPSOs["opaque"])));
+
+	//
+	// PSO for cloth and water in PackedVertex.
+	//
+	D3D12_GRAPHICS_PIPELINE_STATE_DESC packedPsoDesc = opaquePsoDesc;
+	packedPsoDesc.InputLayout = { mPackedInputLayout.data(), (UINT)mPackedInputLayout.size() };
+	packedPsoDesc.VS =
+	{
+		reinterpret_cast<BYTE*>(mShaders["packedVS"]->GetBufferPointer()),
+		mShaders["packedVS"]->GetBufferSize()
+	};
+	ThrowIfFailed(md3dDevice->CreateGraphicsPipelineState(&packedPsoDesc, IID_PPV_ARGS(&mPSOs["opaquePacked"])));
 }
 
 void FabricApp::BuildFrameResources()
@@ -753,7 +1082,8 @@ void FabricApp::BuildFrameResources()
     for(int i = 0; i < gNumFrameResources; ++i)
     {
         mFrameResources.push_back(std::make_unique<FrameResource>(md3dDevice.Get(),
-            1, (UINT)mAllRitems.size(), (UINT)mMaterials.size(), mWaves->VertexCount()));
+            1, (UINT)mAllRitems.size(), (UINT)mMaterials.size(),
+            (UINT)mWaves->VertexCount(), (UINT)mFabric->VertexCount(), mPackDynamicVertices));
     }
 }
 
@@ -800,38 +1130,51 @@ void FabricApp::BuildRenderItems()
 	gridRitem->BaseVertexLocation = gridRitem->Geo->DrawArgs["grid"].BaseVertexLocation;
 
 	mRitemLayer[(int)RenderLayer::Opaque].push_back(gridRitem.get());
+	mAllRitems.push_back(std::move(gridRitem));
 
-	auto fabricRitem = std::make_unique<RenderItem>();
-	fabricRitem->World = MathHelper::Identity4x4();
-	fabricRitem->ObjCBIndex = 1;
-	fabricRitem->Mat = mMaterials["fabric"].get();
-	fabricRitem->Geo = mGeometries["fabricGeo"].get();
-	fabricRitem->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	fabricRitem->IndexCount = fabricRitem->Geo->DrawArgs["grid"].IndexCount;
-	fabricRitem->StartIndexLocation = fabricRitem->Geo->DrawArgs["grid"].StartIndexLocation;
-	fabricRitem->BaseVertexLocation = fabricRitem->Geo->DrawArgs["grid"].BaseVertexLocation;
-
-	mFabricRitem = fabricRitem.get();
-
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(fabricRitem.get());
-
-	auto wavesRitem = std::make_unique<RenderItem>();
-	wavesRitem->World = MathHelper::Identity4x4();
-	wavesRitem->ObjCBIndex = 2;
-	wavesRitem->Mat = mMaterials["water"].get();
-	wavesRitem->Geo = mGeometries["waterGeo"].get();
-	wavesRitem->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	wavesRitem->IndexCount = wavesRitem->Geo->DrawArgs["grid"].IndexCount;
-	wavesRitem->StartIndexLocation = wavesRitem->Geo->DrawArgs["grid"].StartIndexLocation;
-	wavesRitem->BaseVertexLocation = wavesRitem->Geo->DrawArgs["grid"].BaseVertexLocation;
+	RenderLayer dynamicLayer = mPackDynamicVertices ? RenderLayer::OpaquePacked : RenderLayer::Opaque;
+	mFabricRitem = AddGridRenderItems(mGeometries["fabricGeo"].get(), "grid", mMaterials["fabric"].get(), 0, dynamicLayer);
+	mWavesRitem = AddGridRenderItems(mGeometries["waterGeo"].get(), "grid", mMaterials["water"].get(), 0, dynamicLayer);
 
-	mWavesRitem = wavesRitem.get();
+	// The coarser water levels, each over its own part of the vertex buffer.
+	for(int l = 1; l < mWaves->LevelCount(); ++l)
+	{
+		AddGridRenderItems(mGeometries["waterGeo"].get(), "ring", mMaterials["water"].get(),
+			l*mWaves->Level(0).VertexCount(), dynamicLayer);
+	}
 
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(wavesRitem.get());
+	// The cloth keeps its box; the water's follows the camera in UpdateWaves.
+	mFabricBounds = FabricPackBounds();
+	SetPackBounds(mFabricRitem->Geo, mFabricBounds);
+}
 
-	mAllRitems.push_back(std::move(gridRitem));
-	mAllRitems.push_back(std::move(fabricRitem));
-	mAllRitems.push_back(std::move(wavesRitem));
+// Adds a render item to layer for every submesh name0, name1, ... of geo,
+// with baseVertex added to their base vertices.  Returns the first.
+RenderItem* FabricApp::AddGridRenderItems(MeshGeometry* geo, const std::string& name, Material* mat, std::size_t baseVertex,
+	RenderLayer layer)
+{
+	RenderItem* first = nullptr;
+	for(std::size_t k = 0; geo->DrawArgs.count(name + std::to_string(k)) != 0; ++k)
+	{
+		const SubmeshGeometry& submesh = geo->DrawArgs[name + std::to_string(k)];
+
+		auto ritem = std::make_unique<RenderItem>();
+		ritem->World = MathHelper::Identity4x4();
+		ritem->ObjCBIndex = (UINT)mAllRitems.size();
+		ritem->Mat = mat;
+		ritem->Geo = geo;
+		ritem->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
+		ritem->IndexCount = submesh.IndexCount;
+		ritem->StartIndexLocation = submesh.StartIndexLocation;
+		ritem->BaseVertexLocation = submesh.BaseVertexLocation + (int)baseVertex;
+
+		if(first == nullptr)
+			first = ritem.get();
+
+		mRitemLayer[(int)layer].push_back(ritem.get());
+		mAllRitems.push_back(std::move(ritem));
+	}
+	return first;
 }
 
 void FabricApp::DrawRenderItems(ID3D12GraphicsCommandList* cmdList, const std::vector<RenderItem*>& ritems)
@@ -0,0 +1,328 @@
+//***************************************************************************************
+// FabricColliders.cpp by llyr-who (C) 2011 All Rights Reserved.
+//
+// Keeps the cloth out of spheres, capsules, boxes and a heightfield.  The pass runs
+// once per step on the new positions.  It starts by turning every collider into the
+// form the tests want, with its bounding box; then each row block is cut into tiles
+// of a few dozen columns, takes the bounding box of every tile's vertices and only
+// tests a tile against the colliders that overlap it.  A cloth hanging clear of
+// everything pays one min/max sweep and a few box tests per tile.
+//
+// Spheres and capsules go through the capsule kernel a row at a time.  A vertex inside
+// a box leaves by the nearest face; one under the heightfield is lifted straight up
+// onto it.  Either way the velocity loses what heads into the surface and part of
+// what slides along it, as in the capsule kernel.  Every vertex only touches itself,
+// so the blocks run in parallel and the result does not depend on the thread count.
+//***************************************************************************************
+
+#include"Fabric.h"
+#include"../../Common/ThreadPool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+using DirectX::XMFLOAT3;
+using DirectX::XMFLOAT4;
+
+namespace
+{
+	// Columns of a tile.  A row block is bounded tile by tile, so a collider
+	// has to come near part of a row, not just the whole block, to be tested.
+	const std::size_t TileColumns = 32;
+
+	// Drops the part of v heading into the surface with unit normal n, and
+	// scales the rest of what slides along it by 1 - friction.
+	void RespondVelocity(const Float3SoA& vel, std::size_t e, float nx, float ny, float nz, float friction)
+	{
+		float vx = vel.x[e];
+		float vy = vel.y[e];
+		float vz = vel.z[e];
+		float vn = vx * nx + vy * ny + vz * nz;
+		float vOut = vn > 0.0f ? vn : 0.0f;
+		vel.x[e] = vOut * nx + (vx - vn * nx) * (1 - friction);
+		vel.y[e] = vOut * ny + (vy - vn * ny) * (1 - friction);
+		vel.z[e] = vOut * nz + (vz - vn * nz) * (1 - friction);
+	}
+}
+
+std::size_t Fabric::AddSphere(const XMFLOAT3& center, float radius, float friction)
+{
+	return AddCapsule(FabricCapsule{ center, center, radius, friction });
+}
+
+std::size_t Fabric::AddCapsule(const FabricCapsule& capsule)
+{
+	capsules.push_back(capsule);
+	return capsules.size() - 1;
+}
+
+std::size_t Fabric::AddBox(const FabricBox& box)
+{
+	boxes.push_back(box);
+	return boxes.size() - 1;
+}
+
+void Fabric::SetHeightfield(float originX, float originZ, float spacing, std::size_t columns, std::size_t rows,
+	const float* heights, float friction)
+{
+	heightfield = Heightfield();
+	Wake();
+	if (columns < 2 || rows < 2)
+		return;
+
+	heightfield.originX = originX;
+	heightfield.originZ = originZ;
+	heightfield.spacing = spacing;
+	heightfield.columns = columns;
+	heightfield.rows = rows;
+	heightfield.heights.assign(heights, heights + columns * rows);
+	heightfield.friction = friction;
+
+	heightfield.maxHeight = *std::max_element(heightfield.heights.begin(), heightfield.heights.end());
+}
+
+void Fabric::ClearColliders()
+{
+	capsules.clear();
+	boxes.clear();
+	heightfield = Heightfield();
+	Wake();
+}
+
+void Fabric::PrepareColliders()
+{
+	// A sleeping cloth wakes where a collider was or now is, if it changed
+	// since the last step.  Colliders only go all at once, which wakes it all.
+	std::size_t oldCapsules = capsuleParams.size();
+	capsuleParams.resize(capsules.size());
+	capsuleBounds.resize(capsules.size());
+	for (std::size_t c = 0; c < capsules.size(); ++c)
+	{
+		const FabricCapsule& s = capsules[c];
+		CapsuleParams params = { s.a.x, s.a.y, s.a.z, s.b.x, s.b.y, s.b.z, s.radius, s.friction };
+		bool changed = c >= oldCapsules || std::memcmp(&params, &capsuleParams[c], sizeof(params)) != 0;
+		if (changed && sleepingBlocks > 0 && c < oldCapsules)
+			WakeOverlapping(capsuleBounds[c].lo, capsuleBounds[c].hi);
+		capsuleParams[c] = params;
+
+		const float a[3] = { s.a.x, s.a.y, s.a.z };
+		const float b[3] = { s.b.x, s.b.y, s.b.z };
+		for (int k = 0; k < 3; ++k)
+		{
+			capsuleBounds[c].lo[k] = std::min(a[k], b[k]) - s.radius;
+			capsuleBounds[c].hi[k] = std::max(a[k], b[k]) + s.radius;
+		}
+		if (changed && sleepingBlocks > 0)
+			WakeOverlapping(capsuleBounds[c].lo, capsuleBounds[c].hi);
+	}
+
+	std::size_t oldBoxes = boxFrames.size();
+	boxFrames.resize(boxes.size());
+	boxBounds.resize(boxes.size());
+	for (std::size_t c = 0; c < boxes.size(); ++c)
+	{
+		const FabricBox& box = boxes[c];
+		BoxFrame f;
+		ColliderBounds bounds;
+
+		// The rotated x, y and z axes, from the normalized quaternion.
+		XMFLOAT4 q = box.orientation;
+		float len = std::sqrt(q.x * q.x + q.y * q.y + q.z * q.z + q.w * q.w);
+		float inv = len > 0.0f ? 1 / len : 0.0f;
+		float x = q.x * inv, y = q.y * inv, z = q.z * inv, w = len > 0.0f ? q.w * inv : 1.0f;
+		const float axes[3][3] =
+		{
+			{ 1 - 2 * (y * y + z * z), 2 * (x * y + w * z), 2 * (x * z - w * y) },
+			{ 2 * (x * y - w * z), 1 - 2 * (x * x + z * z), 2 * (y * z + w * x) },
+			{ 2 * (x * z + w * y), 2 * (y * z - w * x), 1 - 2 * (x * x + y * y) },
+		};
+
+		const float center[3] = { box.center.x, box.center.y, box.center.z };
+		const float extents[3] = { box.extents.x, box.extents.y, box.extents.z };
+		for (int k = 0; k < 3; ++k)
+		{
+			f.center[k] = center[k];
+			f.extents[k] = extents[k];
+			for (int l = 0; l < 3; ++l)
+				f.axes[k][l] = axes[k][l];
+
+			float reach = std::fabs(axes[0][k]) * extents[0] + std::fabs(axes[1][k]) * extents[1]
+				+ std::fabs(axes[2][k]) * extents[2];
+			bounds.lo[k] = center[k] - reach;
+			bounds.hi[k] = center[k] + reach;
+		}
+		f.friction = box.friction;
+
+		bool changed = c >= oldBoxes || std::memcmp(&f, &boxFrames[c], sizeof(f)) != 0;
+		if (changed && sleepingBlocks > 0)
+		{
+			if (c < oldBoxes)
+				WakeOverlapping(boxBounds[c].lo, boxBounds[c].hi);
+			WakeOverlapping(bounds.lo, bounds.hi);
+		}
+		boxFrames[c] = f;
+		boxBounds[c] = bounds;
+	}
+}
+
+void Fabric::CollideColliders()
+{
+	PrepareColliders();
+
+	// A sleeping block stays where the colliders last left it.
+	blockColliderContacts.resize(BlockCount());
+	ThreadPool::Default().ParallelFor(0, BlockCount(), 1, [this](std::size_t block)
+		{
+			blockColliderContacts[block] = BlockAwake(block) ? CollideColliderBlock(block) : 0;
+		});
+
+	colliderContacts = 0;
+	for (std::size_t contacts : blockColliderContacts)
+		colliderContacts += contacts;
+}
+
+std::size_t Fabric::CollideColliderBlock(std::size_t block)
+{
+	std::size_t n = numCols;
+	std::size_t firstRow = block * BlockRows;
+	std::size_t endRow = std::min((block + 1) * BlockRows, numRows);
+
+	// Column 0 is pinned, so it is neither bounded nor moved.
+	std::size_t contacts = 0;
+	for (std::size_t firstCol = 1; firstCol < n; firstCol += TileColumns)
+	{
+		std::size_t endCol = std::min(firstCol + TileColumns, n);
+
+		ColliderBounds bounds =
+		{
+			{ INFINITY, INFINITY, INFINITY },
+			{ -INFINITY, -INFINITY, -INFINITY }
+		};
+		boundsKernel(prevPos, firstRow * n + firstCol, endCol - firstCol, endRow - firstRow, n, bounds.lo, bounds.hi);
+
+		// A tile of nothing but NaNs keeps an empty box, which overlaps nothing.
+		auto overlaps = [&bounds](const ColliderBounds& c)
+		{
+			for (int k = 0; k < 3; ++k)
+			{
+				if (!(c.hi[k] >= bounds.lo[k] && bounds.hi[k] >= c.lo[k]))
+					return false;
+			}
+			return true;
+		};
+
+		for (std::size_t c = 0; c < capsuleParams.size(); ++c)
+		{
+			if (!overlaps(capsuleBounds[c]))
+				continue;
+			for (std::size_t j = firstRow; j < endRow; ++j)
+				contacts += capsuleKernel(prevPos, velocity, j * n + firstCol, endCol - firstCol, capsuleParams[c]);
+		}
+
+		for (std::size_t c = 0; c < boxFrames.size(); ++c)
+		{
+			if (!overlaps(boxBounds[c]))
+				continue;
+
+			const BoxFrame& f = boxFrames[c];
+			for (std::size_t j = firstRow; j < endRow; ++j)
+			{
+				for (std::size_t i = j * n + firstCol; i < j * n + endCol; ++i)
+				{
+					float px = prevPos.x[i] - f.center[0];
+					float py = prevPos.y[i] - f.center[1];
+					float pz = prevPos.z[i] - f.center[2];
+
+					// Inside if within the extents along every axis; the face
+					// with the least depth is the way out.
+					int face = -1;
+					float depth = 0.0f;
+					float side = 0.0f;
+					for (int k = 0; k < 3; ++k)
+					{
+						float local = px * f.axes[k][0] + py * f.axes[k][1] + pz * f.axes[k][2];
+						float d = f.extents[k] - std::fabs(local);
+						if (!(d > 0.0f))
+						{
+							face = -1;
+							break;
+						}
+						if (face < 0 || d < depth)
+						{
+							face = k;
+							depth = d;
+							side = local < 0.0f ? -1.0f : 1.0f;
+						}
+					}
+					if (face < 0)
+						continue;
+
+					float nx = side * f.axes[face][0];
+					float ny = side * f.axes[face][1];
+					float nz = side * f.axes[face][2];
+					prevPos.x[i] += depth * nx;
+					prevPos.y[i] += depth * ny;
+					prevPos.z[i] += depth * nz;
+					RespondVelocity(velocity, i, nx, ny, nz, f.friction);
+					++contacts;
+				}
+			}
+		}
+
+		const Heightfield& h = heightfield;
+		if (!h.heights.empty())
+		{
+			// Everything below the surface is solid, so the ground reaches all the
+			// way down: a tile that fell through still gets pushed back out.
+			ColliderBounds ground =
+			{
+				{ h.originX, -INFINITY, h.originZ },
+				{ h.originX + (h.columns - 1) * h.spacing, h.maxHeight, h.originZ + (h.rows - 1) * h.spacing }
+			};
+			if (overlaps(ground))
+			{
+				const float invSpacing = 1 / h.spacing;
+				const float maxU = float(h.columns - 1);
+				const float maxV = float(h.rows - 1);
+				for (std::size_t j = firstRow; j < endRow; ++j)
+				{
+					for (std::size_t i = j * n + firstCol; i < j * n + endCol; ++i)
+					{
+						if (prevPos.y[i] >= h.maxHeight)
+							continue;
+
+						float u = (prevPos.x[i] - h.originX) * invSpacing;
+						float v = (prevPos.z[i] - h.originZ) * invSpacing;
+						if (!(u >= 0.0f && u <= maxU && v >= 0.0f && v <= maxV))
+							continue;
+
+						// The cell, with the far edge folded into the last one.
+						std::size_t c = std::min(std::size_t(u), h.columns - 2);
+						std::size_t r = std::min(std::size_t(v), h.rows - 2);
+						float fu = u - float(c);
+						float fv = v - float(r);
+						const float* row0 = h.heights.data() + r * h.columns + c;
+						const float* row1 = row0 + h.columns;
+						float bottom = row0[0] + (row0[1] - row0[0]) * fu;
+						float top = row1[0] + (row1[1] - row1[0]) * fu;
+						float height = bottom + (top - bottom) * fv;
+						if (prevPos.y[i] >= height)
+							continue;
+
+						// The normal of the bilinear patch, (-dh/dx, 1, -dh/dz).
+						float slopeX = ((row0[1] - row0[0]) * (1 - fv) + (row1[1] - row1[0]) * fv) * invSpacing;
+						float slopeZ = (top - bottom) * invSpacing;
+						float invLen = 1 / std::sqrt(slopeX * slopeX + 1 + slopeZ * slopeZ);
+
+						prevPos.y[i] = height;
+						RespondVelocity(velocity, i, -slopeX * invLen, invLen, -slopeZ * invLen, h.friction);
+						++contacts;
+					}
+				}
+			}
+		}
+	}
+
+	return contacts;
+}
@@ -0,0 +1,446 @@
+//***************************************************************************************
+// FabricCollision.cpp by llyr-who (C) 2011 All Rights Reserved.
+//
+// Self-collision for the cloth.  After the integrator has moved the vertices, every
+// vertex is hashed into a uniform grid by its site: the centre of the quad it starts
+// (the one to its lower right), or the vertex itself on the last row and column.  The
+// hash is rebuilt every step with a counting sort: the sites are counted per bucket,
+// the counts are scanned into bucket offsets and the vertices are scattered to them,
+// each pass in parallel.  Buckets are then sorted by vertex index, so the order of the
+// candidates, and with it the result, does not depend on the thread count.
+//
+// Each vertex then gathers the sites in the 27 cells around it, drops the ones in its
+// own computational molecule, and keeps those within reach with the proximity kernel.
+// A site in reach stands for a vertex and a quad.  The vertex is pushed away from the
+// site's vertex if they are closer than the thickness (half the overlap each, the
+// other vertex moves the other half), and off the quad's two triangles, on the side it
+// was on before the step, so layers that crossed during the step are pulled back.  A
+// vertex only ever writes its own push, so the blocks run in parallel with no
+// colouring; the pushes are averaged and applied in a second pass, with the velocity
+// changed to match.
+//
+// The cost is linear in the vertex count: each vertex tests a bounded neighbourhood,
+// and a row block never tests more than its share of the broadphase budget.
+//***************************************************************************************
+
+#include"Fabric.h"
+#include"../../Common/ThreadPool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+using DirectX::XMFLOAT3;
+
+namespace
+{
+	// Buckets scanned by one task of the prefix sum.
+	const std::size_t ScanGrain = 4096;
+
+	// How far, in grid spacings, a quad's vertices may lie from its centre and
+	// still be found: half the diagonal, with room for some stretch.
+	const float QuadRadius = 0.75f;
+
+	// Rows and columns apart within which two vertices share springs, so never
+	// collide.
+	const int MoleculeReach = 2;
+
+	const std::uint32_t CellHashX = 73856093u;
+	const std::uint32_t CellHashY = 19349663u;
+	const std::uint32_t CellHashZ = 83492791u;
+
+	// How far outside a triangle, in barycentric terms, still counts as over it.
+	const float BarycentricSlack = 0.01f;
+
+	XMFLOAT3 Sub3(const XMFLOAT3& a, const XMFLOAT3& b)
+	{
+		return XMFLOAT3(a.x - b.x, a.y - b.y, a.z - b.z);
+	}
+
+	float Dot3(const XMFLOAT3& a, const XMFLOAT3& b)
+	{
+		return a.x * b.x + a.y * b.y + a.z * b.z;
+	}
+
+	// floor(v) as an int, without the library call.
+	int FloorToInt(float v)
+	{
+		int i = int(v);
+		return i - (v < float(i) ? 1 : 0);
+	}
+
+	XMFLOAT3 Cross3(const XMFLOAT3& a, const XMFLOAT3& b)
+	{
+		return XMFLOAT3(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x);
+	}
+
+	// The push that keeps p at least thickness off triangle abc, on the side
+	// p0 was on of a0b0c0, the same points at the start of the step.  Returns
+	// false if p is not over the triangle or already clear of it.
+	bool TrianglePush(const XMFLOAT3& p, const XMFLOAT3& a, const XMFLOAT3& b, const XMFLOAT3& c,
+		const XMFLOAT3& p0, const XMFLOAT3& a0, const XMFLOAT3& b0, const XMFLOAT3& c0,
+		float thickness, XMFLOAT3& push)
+	{
+		// Barycentric coordinates of p projected onto the plane, scaled by
+		// denom.  A little past the edges still counts, so a vertex right over
+		// one is not missed by both triangles.
+		XMFLOAT3 e1 = Sub3(b, a);
+		XMFLOAT3 e2 = Sub3(c, a);
+		XMFLOAT3 ap = Sub3(p, a);
+		float d11 = Dot3(e1, e1);
+		float d12 = Dot3(e1, e2);
+		float d22 = Dot3(e2, e2);
+		float d1p = Dot3(e1, ap);
+		float d2p = Dot3(e2, ap);
+		float denom = d11 * d22 - d12 * d12;
+		float v = d22 * d1p - d12 * d2p;
+		float w = d11 * d2p - d12 * d1p;
+		float slack = BarycentricSlack * denom;
+		if (v < -slack || w < -slack || v + w > denom + slack || denom <= 0.0f)
+			return false;
+
+		XMFLOAT3 normal = Cross3(e1, e2);
+		float invLen = 1 / std::sqrt(Dot3(normal, normal));
+		normal = XMFLOAT3(normal.x * invLen, normal.y * invLen, normal.z * invLen);
+		float height = Dot3(ap, normal);
+
+		float side = Dot3(Sub3(p0, a0), Cross3(Sub3(b0, a0), Sub3(c0, a0)));
+		if (side == 0.0f)
+			side = height;
+		side = side < 0.0f ? -1.0f : 1.0f;
+
+		float gap = thickness - side * height;
+		if (gap <= 0.0f)
+			return false;
+
+		// Half the gap; the vertices of the other layer push the triangle for the rest.
+		float s = 0.5f * gap * side;
+		push = XMFLOAT3(normal.x * s, normal.y * s, normal.z * s);
+		return true;
+	}
+}
+
+std::uint32_t Fabric::CollisionCell(int cx, int cy, int cz)
+{
+	// Linear in the coordinates, so the cells around one are its hash plus a
+	// fixed offset.  No combination of the three factors with weights in
+	// [-2, 2] is 0 mod 2^32, so the 27 cells around any cell have distinct
+	// hashes.
+	return std::uint32_t(cx) * CellHashX + std::uint32_t(cy) * CellHashY + std::uint32_t(cz) * CellHashZ;
+}
+
+void Fabric::BuildCollisionHash()
+{
+	std::size_t n = numCols;
+	ThreadPool& pool = ThreadPool::Default();
+
+	if (vertexCells.empty())
+	{
+		// Twice as many buckets as vertices keeps most of them to one cell.
+		std::size_t bucketCount = 1;
+		while (bucketCount < 2 * vertexCount)
+			bucketCount *= 2;
+		bucketMask = std::uint32_t(bucketCount - 1);
+
+		vertexCells.resize(vertexCount);
+		bucketStart.resize(bucketCount + 1);
+		bucketEntries.resize(vertexCount);
+		bucketCursors.reset(new std::atomic<std::uint32_t>[bucketCount]);
+		scanSums.resize((bucketCount + ScanGrain - 1) / ScanGrain);
+
+		std::size_t stride = (vertexCount + 7) & ~std::size_t(7);
+		collisionStorage.assign(6 * stride, 0.0f);
+		float* p = collisionStorage.data();
+		for (Float3SoA* f : { &collisionSites, &collisionDelta })
+		{
+			f->x = p;
+			f->y = p + stride;
+			f->z = p + 2 * stride;
+			p += 3 * stride;
+		}
+		blockCandidates.resize(BlockCount());
+		blockContacts.resize(BlockCount());
+		candidateScratch.resize(BlockCount());
+		for (std::vector<std::uint32_t>& scratch : candidateScratch)
+			scratch.reserve(collisionBudget);
+	}
+
+	// A cell reaches as far as the furthest test: a quad's triangles may lie
+	// QuadRadius from its centre.
+	collisionCell = collisionThickness + QuadRadius * dx;
+	std::size_t bucketCount = std::size_t(bucketMask) + 1;
+
+	pool.ParallelForRange(0, bucketCount, ScanGrain, [this](std::size_t first, std::size_t last)
+		{
+			for (std::size_t b = first; b < last; ++b)
+				bucketCursors[b].store(0, std::memory_order_relaxed);
+		});
+
+	// Count.
+	const float invCell = 1 / collisionCell;
+	pool.ParallelForRange(0, numRows, BlockRows, [this, n, invCell](std::size_t first, std::size_t last)
+		{
+			for (std::size_t j = first; j < last; ++j)
+			{
+				for (std::size_t i = j * n; i < (j + 1) * n; ++i)
+				{
+					std::size_t corner = (j + 1 < numRows && i + 1 < (j + 1) * n) ? i + n + 1 : i;
+					collisionSites.x[i] = 0.5f * (prevPos.x[i] + prevPos.x[corner]);
+					collisionSites.y[i] = 0.5f * (prevPos.y[i] + prevPos.y[corner]);
+					collisionSites.z[i] = 0.5f * (prevPos.z[i] + prevPos.z[corner]);
+
+					std::uint32_t cell = CollisionCell(
+						FloorToInt(collisionSites.x[i] * invCell),
+						FloorToInt(collisionSites.y[i] * invCell),
+						FloorToInt(collisionSites.z[i] * invCell));
+					vertexCells[i] = cell;
+					bucketCursors[cell & bucketMask].fetch_add(1, std::memory_order_relaxed);
+				}
+			}
+		});
+
+	// Scan: each task sums its buckets, the sums are scanned in order, then each
+	// task turns its counts into offsets, which also start the scatter cursors.
+	std::size_t chunkCount = scanSums.size();
+	pool.ParallelFor(0, chunkCount, 1, [this, bucketCount](std::size_t c)
+		{
+			std::size_t last = std::min((c + 1) * ScanGrain, bucketCount);
+			std::uint32_t sum = 0;
+			for (std::size_t b = c * ScanGrain; b < last; ++b)
+				sum += bucketCursors[b].load(std::memory_order_relaxed);
+			scanSums[c] = sum;
+		});
+
+	std::uint32_t offset = 0;
+	for (std::uint32_t& sum : scanSums)
+	{
+		std::uint32_t count = sum;
+		sum = offset;
+		offset += count;
+	}
+	bucketStart[bucketCount] = offset;
+
+	pool.ParallelFor(0, chunkCount, 1, [this, bucketCount](std::size_t c)
+		{
+			std::size_t last = std::min((c + 1) * ScanGrain, bucketCount);
+			std::uint32_t offset = scanSums[c];
+			for (std::size_t b = c * ScanGrain; b < last; ++b)
+			{
+				std::uint32_t count = bucketCursors[b].load(std::memory_order_relaxed);
+				bucketStart[b] = offset;
+				bucketCursors[b].store(offset, std::memory_order_relaxed);
+				offset += count;
+			}
+		});
+
+	// Scatter.  Threads race for the slots within a bucket, so each bucket is
+	// put back in index order afterwards.
+	pool.ParallelForRange(0, numRows, BlockRows, [this, n](std::size_t first, std::size_t last)
+		{
+			for (std::size_t i = first * n; i < last * n; ++i)
+			{
+				CollisionEntry entry = { vertexCells[i], std::uint32_t(i) };
+				bucketEntries[bucketCursors[entry.cell & bucketMask].fetch_add(1, std::memory_order_relaxed)] = entry;
+			}
+		});
+
+	pool.ParallelForRange(0, bucketCount, ScanGrain, [this](std::size_t first, std::size_t last)
+		{
+			for (std::size_t b = first; b < last; ++b)
+			{
+				if (bucketStart[b + 1] - bucketStart[b] > 1)
+					std::sort(bucketEntries.begin() + bucketStart[b], bucketEntries.begin() + bucketStart[b + 1],
+						[](const CollisionEntry& a, const CollisionEntry& b) { return a.vertex < b.vertex; });
+			}
+		});
+}
+
+void Fabric::CollideBlock(std::size_t block)
+{
+	const int n = int(numCols);
+	const int m = int(numRows);
+	const int firstRow = int(block * BlockRows);
+	const int endRow = std::min(firstRow + int(BlockRows), m);
+
+	const float thickness = collisionThickness;
+	const float contactSq = thickness * thickness;
+	const float reachSq = collisionCell * collisionCell;
+	const float invCell = 1 / collisionCell;
+	std::uint32_t neighbourOffsets[27];
+	for (int k = 0; k < 27; ++k)
+		neighbourOffsets[k] = CollisionCell(k % 3 - 1, k / 3 % 3 - 1, k / 9 - 1);
+	// q / numCols without the division: q + 0.5 is never within rounding
+	// error of a multiple of numCols.
+	const double invCols = 1.0 / double(numCols);
+
+	std::size_t budget = collisionBudget * std::size_t(endRow - firstRow) * numCols;
+	std::size_t candidateCount = 0;
+	std::size_t contactCount = 0;
+	std::vector<std::uint32_t>& candidates = candidateScratch[block];
+
+	for (int j = firstRow; j < endRow; ++j)
+	{
+		for (int i = 0; i < n; ++i)
+		{
+			std::size_t p = std::size_t(j) * numCols + i;
+			collisionDelta.x[p] = 0.0f;
+			collisionDelta.y[p] = 0.0f;
+			collisionDelta.z[p] = 0.0f;
+
+			// Column 0 is pinned.
+			if (i == 0)
+				continue;
+
+			XMFLOAT3 pos = Load(prevPos, p);
+			int cx = FloorToInt(pos.x * invCell);
+			int cy = FloorToInt(pos.y * invCell);
+			int cz = FloorToInt(pos.z * invCell);
+
+			// What is left of the block's budget, split evenly over the vertices
+			// still to come: a vertex can use what the ones before it did not,
+			// but never leaves the ones after it with less than their own share.
+			std::size_t verticesLeft = std::size_t(endRow - j) * numCols - i;
+			std::size_t share = (budget - candidateCount) / verticesLeft;
+
+			// A bucket may hold other cells too, and two neighbouring cells may
+			// share a bucket; taking only the entries of the cell being visited
+			// sorts out both.
+			std::uint32_t cell = CollisionCell(cx, cy, cz);
+			candidates.clear();
+			for (std::uint32_t offset : neighbourOffsets)
+			{
+				if (candidates.size() == share)
+					break;
+				std::uint32_t bucket = (cell + offset) & bucketMask;
+				for (std::uint32_t e = bucketStart[bucket]; e < bucketStart[bucket + 1]; ++e)
+				{
+					if (bucketEntries[e].cell != cell + offset)
+						continue;
+					std::uint32_t q = bucketEntries[e].vertex;
+					int row = int((double(q) + 0.5) * invCols);
+					int col = int(q - std::size_t(row) * numCols);
+					if (std::abs(row - j) <= MoleculeReach && std::abs(col - i) <= MoleculeReach)
+						continue;
+					candidates.push_back(q);
+					if (candidates.size() == share)
+						break;
+				}
+			}
+
+			candidateCount += candidates.size();
+			std::size_t hitCount = proximityKernel(collisionSites, pos.x, pos.y, pos.z,
+				candidates.data(), candidates.size(), reachSq, candidates.data());
+
+			XMFLOAT3 push(0.0f, 0.0f, 0.0f);
+			int pushCount = 0;
+			XMFLOAT3 start = Load(currPos, p);
+			for (std::size_t k = 0; k < hitCount; ++k)
+			{
+				std::uint32_t q = candidates[k];
+				XMFLOAT3 qPos = Load(prevPos, q);
+				XMFLOAT3 d = Sub3(pos, qPos);
+				if (Dot3(d, d) < contactSq)
+				{
+					// Apart along the line between them, or back along the one
+					// they started on if they passed each other this step.
+					XMFLOAT3 axis = Sub3(start, Load(currPos, q));
+					if (Dot3(d, axis) >= 0.0f)
+						axis = d;
+					float lenSq = Dot3(axis, axis);
+					if (lenSq > 0.0f)
+					{
+						float invLen = 1 / std::sqrt(lenSq);
+						float s = 0.5f * (thickness - Dot3(d, axis) * invLen) * invLen;
+						push.x += axis.x * s;
+						push.y += axis.y * s;
+						push.z += axis.z * s;
+						++pushCount;
+					}
+				}
+
+				// The two triangles of the quad q starts, unless p is one of
+				// their vertices or shares springs with one.
+				int row = int((double(q) + 0.5) * invCols);
+				int col = int(q - std::size_t(row) * numCols);
+				if (row + 1 >= m || col + 1 >= n)
+					continue;
+				if (j >= row - MoleculeReach && j <= row + 1 + MoleculeReach &&
+					i >= col - MoleculeReach && i <= col + 1 + MoleculeReach)
+					continue;
+
+				const std::size_t quad[2][3] =
+				{
+					{ q, q + 1, q + numCols },
+					{ q + numCols, q + 1, q + numCols + 1 }
+				};
+				for (const std::size_t (&t)[3] : quad)
+				{
+					XMFLOAT3 tp;
+					if (TrianglePush(pos, Load(prevPos, t[0]), Load(prevPos, t[1]), Load(prevPos, t[2]),
+						start, Load(currPos, t[0]), Load(currPos, t[1]), Load(currPos, t[2]), thickness, tp))
+					{
+						push.x += tp.x;
+						push.y += tp.y;
+						push.z += tp.z;
+						++pushCount;
+					}
+				}
+			}
+
+			if (pushCount > 0)
+			{
+				float average = 1.0f / float(pushCount);
+				collisionDelta.x[p] = push.x * average;
+				collisionDelta.y[p] = push.y * average;
+				collisionDelta.z[p] = push.z * average;
+				++contactCount;
+			}
+		}
+	}
+
+	blockCandidates[block] = candidateCount;
+	blockContacts[block] = contactCount;
+}
+
+void Fabric::CollideSelf()
+{
+	std::size_t n = numCols;
+	ThreadPool& pool = ThreadPool::Default();
+
+	BuildCollisionHash();
+
+	// Every block only writes the pushes of its own vertices.  A sleeping
+	// block still pushes the others away, but is not pushed itself.
+	pool.ParallelFor(0, BlockCount(), 1, [this](std::size_t block)
+		{
+			if (BlockAwake(block))
+				CollideBlock(block);
+			else
+				blockCandidates[block] = blockContacts[block] = 0;
+		});
+
+	pool.ParallelForRange(0, numRows, BlockRows, [this, n](std::size_t first, std::size_t last)
+		{
+			if (!BlockAwake(first / BlockRows))
+				return;
+
+			const float invDt = 1 / dt;
+			for (std::size_t i = first * n; i < last * n; ++i)
+			{
+				prevPos.x[i] += collisionDelta.x[i];
+				prevPos.y[i] += collisionDelta.y[i];
+				prevPos.z[i] += collisionDelta.z[i];
+				velocity.x[i] += collisionDelta.x[i] * invDt;
+				velocity.y[i] += collisionDelta.y[i] * invDt;
+				velocity.z[i] += collisionDelta.z[i] * invDt;
+			}
+		});
+
+	collisionCandidates = 0;
+	collisionContacts = 0;
+	for (std::size_t block = 0; block < BlockCount(); ++block)
+	{
+		collisionCandidates += blockCandidates[block];
+		collisionContacts += blockContacts[block];
+	}
+}
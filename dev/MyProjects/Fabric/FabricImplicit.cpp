@@ -0,0 +1,329 @@
+//***************************************************************************************
+// FabricImplicit.cpp by llyr-who (C) 2011 All Rights Reserved.
+//
+// Backward Euler step for the cloth.  Linearising the spring and damper forces
+// around the current state gives, for the velocity change dv,
+//
+//     (M - h*dF/dv - h^2*dF/dx) dv = h*(f0 + h*dF/dx*v0)
+//
+// Every spring contributes a 3x3 block K = h^2*J + h*c*I to the system, where J is
+// its stiffness Jacobian, so the matrix is never assembled: each multiply gathers
+// the springs around a vertex straight from the grid.  The system is solved with
+// conjugate gradients and a Jacobi preconditioner; the pinned column is filtered
+// out, so its rows and columns act as if they were removed.
+//
+// Every pass writes only the vertices of its own rows and dot products are summed
+// per row block in a fixed order, so the result does not depend on thread count.
+//***************************************************************************************
+
+#include"Fabric.h"
+#include"../../Common/ThreadPool.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+	// out += (a*I + b*axis*axis^T) * u
+	inline void AddBlock(float a, float b, float ax, float ay, float az,
+		float ux, float uy, float uz, float& ox, float& oy, float& oz)
+	{
+		float s = b * (ax * ux + ay * uy + az * uz);
+		ox += a * ux + s * ax;
+		oy += a * uy + s * ay;
+		oz += a * uz + s * az;
+	}
+}
+
+// Calls visit(d, owner, other) for every spring touching vertex (j, i): d is the
+// spring direction, owner the end point its Jacobian is stored at and other the
+// vertex at the far end.
+template<typename Visit>
+void Fabric::ForEachSpring(std::size_t j, std::size_t i, const Visit& visit) const
+{
+	std::size_t v = j * numCols + i;
+	for (std::size_t d = 0; d < SpringDirectionCount; ++d)
+	{
+		const SpringDirection& dir = springDirections[d];
+		std::size_t offset = dir.dRow * numCols + dir.dCol;
+
+		// (j, i) as the first end point.
+		std::size_t col = i + dir.dCol;
+		if (j + dir.dRow < numRows && col < numCols)
+			visit(d, v, v + offset);
+
+		// (j, i) as the second end point.
+		col = i - dir.dCol;
+		if (j >= dir.dRow && col < numCols)
+			visit(d, v - offset, v - offset);
+	}
+}
+
+void Fabric::BuildSpringJacobians()
+{
+	std::size_t n = numCols;
+	std::size_t m = numRows;
+
+	if (implicitStorage.empty())
+	{
+		// Per direction: axis (3) plus a and b; then six solver vectors.
+		std::size_t stride = (vertexCount + 7) & ~std::size_t(7);
+		implicitStorage.assign(stride * (SpringDirectionCount * 5 + 6 * 3), 0.0f);
+		float* p = implicitStorage.data();
+		for (SpringJacobian& jac : jacobians)
+		{
+			jac.axis = Float3SoA{ p, p + stride, p + 2 * stride };
+			jac.a = p + 3 * stride;
+			jac.b = p + 4 * stride;
+			p += 5 * stride;
+		}
+		for (Float3SoA* f : { &cgX, &cgR, &cgZ, &cgP, &cgAp, &cgInvDiag })
+		{
+			*f = Float3SoA{ p, p + stride, p + 2 * stride };
+			p += 3 * stride;
+		}
+	}
+
+	const float h = dt;
+
+	// Each row writes only the springs it is the first end point of.
+	ThreadPool::Default().ParallelForRange(0, m, BlockRows, [this, h, n, m](std::size_t first, std::size_t last)
+		{
+			for (std::size_t d = 0; d < SpringDirectionCount; ++d)
+			{
+				const SpringDirection& dir = springDirections[d];
+				const SpringParams params = ParamsFor(dir);
+				const SpringJacobian& jac = jacobians[d];
+				std::size_t offset = dir.dRow * n + dir.dCol;
+
+				for (std::size_t j = first; j < last; ++j)
+				{
+					for (std::size_t i = 0; i < n; ++i)
+					{
+						std::size_t v = j * n + i;
+						std::size_t col = i + dir.dCol;
+						if (j + dir.dRow >= m || col >= n)
+						{
+							jac.a[v] = jac.b[v] = 0.0f;
+							continue;
+						}
+
+						float ex = currPos.x[v + offset] - currPos.x[v];
+						float ey = currPos.y[v + offset] - currPos.y[v];
+						float ez = currPos.z[v + offset] - currPos.z[v];
+						float len = std::sqrt(ex * ex + ey * ey + ez * ez);
+						float invLen = 1 / len;
+
+						// J = k*(c*I + (1 - c)*axis*axis^T) with c = 1 - rest/len.
+						// A compressed spring has c < 0, which would make the system
+						// indefinite; clamping c at 0 keeps only its axial stiffness.
+						float c = std::max(0.0f, 1 - params.rest * invLen);
+						float hk = h * h * params.stiffness;
+
+						jac.axis.x[v] = ex * invLen;
+						jac.axis.y[v] = ey * invLen;
+						jac.axis.z[v] = ez * invLen;
+						jac.a[v] = hk * c + h * params.damping;
+						jac.b[v] = hk * (1 - c);
+					}
+				}
+			}
+		});
+
+	// Jacobi preconditioner: the inverse of the system's diagonal.
+	ThreadPool::Default().ParallelForRange(0, m, BlockRows, [this, n](std::size_t first, std::size_t last)
+		{
+			for (std::size_t j = first; j < last; ++j)
+			{
+				for (std::size_t i = 0; i < n; ++i)
+				{
+					float dx2 = mass, dy2 = mass, dz2 = mass;
+					ForEachSpring(j, i, [&](std::size_t d, std::size_t owner, std::size_t)
+						{
+							const SpringJacobian& jac = jacobians[d];
+							float ax = jac.axis.x[owner], ay = jac.axis.y[owner], az = jac.axis.z[owner];
+							dx2 += jac.a[owner] + jac.b[owner] * ax * ax;
+							dy2 += jac.a[owner] + jac.b[owner] * ay * ay;
+							dz2 += jac.a[owner] + jac.b[owner] * az * az;
+						});
+
+					std::size_t v = j * n + i;
+					cgInvDiag.x[v] = 1 / dx2;
+					cgInvDiag.y[v] = 1 / dy2;
+					cgInvDiag.z[v] = 1 / dz2;
+				}
+			}
+		});
+}
+
+void Fabric::MultiplySystem(const Float3SoA& in, const Float3SoA& out)
+{
+	std::size_t n = numCols;
+
+	ThreadPool::Default().ParallelForRange(0, numRows, BlockRows, [this, &in, &out, n](std::size_t first, std::size_t last)
+		{
+			for (std::size_t j = first; j < last; ++j)
+			{
+				// Column 0 is pinned: filtered out of the system.
+				out.x[j * n] = out.y[j * n] = out.z[j * n] = 0.0f;
+
+				for (std::size_t i = 1; i < n; ++i)
+				{
+					std::size_t v = j * n + i;
+					float ox = mass * in.x[v];
+					float oy = mass * in.y[v];
+					float oz = mass * in.z[v];
+
+					ForEachSpring(j, i, [&](std::size_t d, std::size_t owner, std::size_t other)
+						{
+							const SpringJacobian& jac = jacobians[d];
+							AddBlock(jac.a[owner], jac.b[owner],
+								jac.axis.x[owner], jac.axis.y[owner], jac.axis.z[owner],
+								in.x[v] - in.x[other], in.y[v] - in.y[other], in.z[v] - in.z[other],
+								ox, oy, oz);
+						});
+
+					out.x[v] = ox;
+					out.y[v] = oy;
+					out.z[v] = oz;
+				}
+			}
+		});
+}
+
+double Fabric::Dot(const Float3SoA& a, const Float3SoA& b)
+{
+	std::size_t n = numCols;
+
+	// One partial per block, added up in block order afterwards, so the sum
+	// does not depend on how the blocks were spread over threads.
+	blockSums.assign(BlockCount(), 0.0);
+	ThreadPool::Default().ParallelFor(0, BlockCount(), 1, [this, &a, &b, n](std::size_t block)
+		{
+			std::size_t first = block * BlockRows * n;
+			std::size_t last = std::min((block + 1) * BlockRows, numRows) * n;
+
+			double sum = 0.0;
+			for (std::size_t i = first; i < last; ++i)
+				sum += a.x[i] * b.x[i] + a.y[i] * b.y[i] + a.z[i] * b.z[i];
+			blockSums[block] = sum;
+		});
+
+	double total = 0.0;
+	for (double s : blockSums)
+		total += s;
+	return total;
+}
+
+void Fabric::IntegrateImplicit()
+{
+	std::size_t n = numCols;
+	std::size_t m = numRows;
+	ThreadPool& pool = ThreadPool::Default();
+	const float h = dt;
+
+	BuildSpringJacobians();
+
+	// Right-hand side h*f0 - h^2*J*v0 into cgR.  h^2*J is K with the damping
+	// term h*c taken back out of its a weight.
+	pool.ParallelForRange(0, m, BlockRows, [this, h, n](std::size_t first, std::size_t last)
+		{
+			for (std::size_t j = first; j < last; ++j)
+			{
+				cgR.x[j * n] = cgR.y[j * n] = cgR.z[j * n] = 0.0f;
+
+				for (std::size_t i = 1; i < n; ++i)
+				{
+					std::size_t v = j * n + i;
+					float rx = 0.0f, ry = 0.0f, rz = 0.0f;
+
+					ForEachSpring(j, i, [&](std::size_t d, std::size_t owner, std::size_t other)
+						{
+							const SpringJacobian& jac = jacobians[d];
+							float a = jac.a[owner] - h * ParamsFor(springDirections[d]).damping;
+							AddBlock(a, jac.b[owner],
+								jac.axis.x[owner], jac.axis.y[owner], jac.axis.z[owner],
+								velocity.x[v] - velocity.x[other], velocity.y[v] - velocity.y[other],
+								velocity.z[v] - velocity.z[other], rx, ry, rz);
+						});
+
+					cgR.x[v] = h * force.x[v] - rx;
+					cgR.y[v] = h * force.y[v] - ry;
+					cgR.z[v] = h * force.z[v] - rz;
+				}
+			}
+		});
+
+	// The last step's dv is the initial guess: r = rhs - A*dv.
+	double rhsNorm2 = Dot(cgR, cgR);
+	MultiplySystem(cgX, cgAp);
+
+	auto forEachVertex = [this, &pool](const auto& body)
+		{
+			pool.ParallelForRange(0, vertexCount, BlockRows * numCols, [&body](std::size_t first, std::size_t last)
+				{
+					for (std::size_t i = first; i < last; ++i)
+						body(i);
+				});
+		};
+
+	forEachVertex([this](std::size_t i)
+		{
+			cgR.x[i] -= cgAp.x[i];
+			cgR.y[i] -= cgAp.y[i];
+			cgR.z[i] -= cgAp.z[i];
+			cgP.x[i] = cgZ.x[i] = cgR.x[i] * cgInvDiag.x[i];
+			cgP.y[i] = cgZ.y[i] = cgR.y[i] * cgInvDiag.y[i];
+			cgP.z[i] = cgZ.z[i] = cgR.z[i] * cgInvDiag.z[i];
+		});
+
+	double limit = double(cgTolerance) * double(cgTolerance) * rhsNorm2;
+	double rz = Dot(cgR, cgZ);
+
+	cgIterations = 0;
+	while (cgIterations < cgMaxIterations && Dot(cgR, cgR) > limit)
+	{
+		MultiplySystem(cgP, cgAp);
+		double pAp = Dot(cgP, cgAp);
+		if (pAp <= 0.0)
+			break;
+
+		float alpha = float(rz / pAp);
+		forEachVertex([this, alpha](std::size_t i)
+			{
+				cgX.x[i] += alpha * cgP.x[i];
+				cgX.y[i] += alpha * cgP.y[i];
+				cgX.z[i] += alpha * cgP.z[i];
+				cgR.x[i] -= alpha * cgAp.x[i];
+				cgR.y[i] -= alpha * cgAp.y[i];
+				cgR.z[i] -= alpha * cgAp.z[i];
+				cgZ.x[i] = cgR.x[i] * cgInvDiag.x[i];
+				cgZ.y[i] = cgR.y[i] * cgInvDiag.y[i];
+				cgZ.z[i] = cgR.z[i] * cgInvDiag.z[i];
+			});
+
+		double rzNext = Dot(cgR, cgZ);
+		float beta = float(rzNext / rz);
+		rz = rzNext;
+		forEachVertex([this, beta](std::size_t i)
+			{
+				cgP.x[i] = cgZ.x[i] + beta * cgP.x[i];
+				cgP.y[i] = cgZ.y[i] + beta * cgP.y[i];
+				cgP.z[i] = cgZ.z[i] + beta * cgP.z[i];
+			});
+
+		++cgIterations;
+	}
+
+	// v += dv, then step the positions with the new velocity.  The pinned
+	// column keeps dv = 0 and v = 0, so it stays where it is.
+	forEachVertex([this, h](std::size_t i)
+		{
+			velocity.x[i] += cgX.x[i];
+			velocity.y[i] += cgX.y[i];
+			velocity.z[i] += cgX.z[i];
+			prevPos.x[i] = currPos.x[i] + h * velocity.x[i];
+			prevPos.y[i] = currPos.y[i] + h * velocity.y[i];
+			prevPos.z[i] = currPos.z[i] + h * velocity.z[i];
+		});
+}
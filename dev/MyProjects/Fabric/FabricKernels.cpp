@@ -0,0 +1,814 @@
+#include "FabricKernels.h"
+
+#include <cmath>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define FABRIC_SIMD_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+// MSVC lets us use any intrinsic without per-function target flags.
+#define FABRIC_TARGET_AVX2
+#define FABRIC_TARGET_SSE
+#else
+#define FABRIC_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#define FABRIC_TARGET_SSE __attribute__((target("sse2")))
+#endif
+#endif
+
+static void SpringsScalar(const Float3SoA& pos, const Float3SoA& vel, const Float3SoA& force,
+	std::size_t first, std::size_t offset, std::size_t count, const SpringParams& params)
+{
+	const std::size_t end = first + count;
+	for (std::size_t a = first; a < end; ++a)
+	{
+		std::size_t b = a + offset;
+
+		float diffx = pos.x[b] - pos.x[a];
+		float diffy = pos.y[b] - pos.y[a];
+		float diffz = pos.z[b] - pos.z[a];
+		float diffNorm = std::sqrt(diffx * diffx + diffy * diffy + diffz * diffz);
+		float k = params.stiffness * (diffNorm - params.rest) * (1 / diffNorm);
+
+		//now force due to damper
+		float Fx = k * diffx + params.damping * (vel.x[b] - vel.x[a]);
+		float Fy = k * diffy + params.damping * (vel.y[b] - vel.y[a]);
+		float Fz = k * diffz + params.damping * (vel.z[b] - vel.z[a]);
+
+		force.x[a] += Fx;
+		force.y[a] += Fy;
+		force.z[a] += Fz;
+
+		force.x[b] -= Fx;
+		force.y[b] -= Fy;
+		force.z[b] -= Fz;
+	}
+}
+
+static std::size_t IndexedSpringsScalar(const Float3SoA& pos, const Float3SoA& vel, const std::uint32_t* ends0,
+	const std::uint32_t* ends1, const float* rest, std::size_t first, std::size_t count,
+	float stiffness, float damping, float breakStretch, const Float3SoA& force, std::uint32_t* broken)
+{
+	std::size_t brokenCount = 0;
+	const std::size_t end = first + count;
+	for (std::size_t s = first; s < end; ++s)
+	{
+		std::uint32_t a = ends0[s];
+		std::uint32_t b = ends1[s];
+
+		float diffx = pos.x[b] - pos.x[a];
+		float diffy = pos.y[b] - pos.y[a];
+		float diffz = pos.z[b] - pos.z[a];
+		float diffNorm = std::sqrt(diffx * diffx + diffy * diffy + diffz * diffz);
+		float k = stiffness * (diffNorm - rest[s]) * (1 / diffNorm);
+
+		force.x[s] = k * diffx + damping * (vel.x[b] - vel.x[a]);
+		force.y[s] = k * diffy + damping * (vel.y[b] - vel.y[a]);
+		force.z[s] = k * diffz + damping * (vel.z[b] - vel.z[a]);
+
+		if (diffNorm > rest[s] * breakStretch)
+			broken[brokenCount++] = static_cast<std::uint32_t>(s);
+	}
+	return brokenCount;
+}
+
+static std::size_t ProximityScalar(const Float3SoA& pos, float px, float py, float pz,
+	const std::uint32_t* candidates, std::size_t count, float radiusSq, std::uint32_t* hits)
+{
+	std::size_t hitCount = 0;
+	for (std::size_t k = 0; k < count; ++k)
+	{
+		std::uint32_t q = candidates[k];
+		float dx = pos.x[q] - px;
+		float dy = pos.y[q] - py;
+		float dz = pos.z[q] - pz;
+		if (dx * dx + dy * dy + dz * dz < radiusSq)
+			hits[hitCount++] = q;
+	}
+	return hitCount;
+}
+
+// The closest point of the capsule's segment to each vertex is a + t * (b - a), with t
+// clamped to [0, 1]; a sphere's segment has no length, so t is 0.  A vertex sitting
+// exactly on the segment has no direction to leave by and stays put.
+static const float CapsuleMinDistance = 1e-12f;
+
+static std::size_t CapsuleScalar(const Float3SoA& pos, const Float3SoA& vel,
+	std::size_t first, std::size_t count, const CapsuleParams& capsule)
+{
+	const float sx = capsule.bx - capsule.ax;
+	const float sy = capsule.by - capsule.ay;
+	const float sz = capsule.bz - capsule.az;
+	const float lenSq = sx * sx + sy * sy + sz * sz;
+	const float invLenSq = lenSq > 0.0f ? 1 / lenSq : 0.0f;
+	const float radiusSq = capsule.radius * capsule.radius;
+
+	std::size_t contacts = 0;
+	const std::size_t end = first + count;
+	for (std::size_t e = first; e < end; ++e)
+	{
+		float px = pos.x[e] - capsule.ax;
+		float py = pos.y[e] - capsule.ay;
+		float pz = pos.z[e] - capsule.az;
+		float t = (px * sx + py * sy + pz * sz) * invLenSq;
+		t = t > 0.0f ? t : 0.0f;
+		t = t < 1.0f ? t : 1.0f;
+
+		float rx = px - t * sx;
+		float ry = py - t * sy;
+		float rz = pz - t * sz;
+		float distSq = rx * rx + ry * ry + rz * rz;
+		if (!(distSq < radiusSq))
+			continue;
+
+		float dist = std::sqrt(distSq);
+		float invDist = 1 / (dist > CapsuleMinDistance ? dist : CapsuleMinDistance);
+		float nx = rx * invDist;
+		float ny = ry * invDist;
+		float nz = rz * invDist;
+
+		float depth = capsule.radius - dist;
+		pos.x[e] += depth * nx;
+		pos.y[e] += depth * ny;
+		pos.z[e] += depth * nz;
+
+		// Keep the normal velocity only if it leaves the surface, then rub
+		// off part of the tangential one.
+		float vx = vel.x[e];
+		float vy = vel.y[e];
+		float vz = vel.z[e];
+		float vn = vx * nx + vy * ny + vz * nz;
+		float vOut = vn > 0.0f ? vn : 0.0f;
+		vel.x[e] = vOut * nx + (vx - vn * nx) * (1 - capsule.friction);
+		vel.y[e] = vOut * ny + (vy - vn * ny) * (1 - capsule.friction);
+		vel.z[e] = vOut * nz + (vz - vn * nz) * (1 - capsule.friction);
+		++contacts;
+	}
+	return contacts;
+}
+
+static void BoundsScalar(const Float3SoA& pos, std::size_t first, std::size_t count, std::size_t rows,
+	std::size_t stride, float lo[3], float hi[3])
+{
+	for (std::size_t r = 0; r < rows; ++r)
+	{
+		const std::size_t end = first + r * stride + count;
+		for (std::size_t e = first + r * stride; e < end; ++e)
+		{
+			lo[0] = pos.x[e] < lo[0] ? pos.x[e] : lo[0];
+			lo[1] = pos.y[e] < lo[1] ? pos.y[e] : lo[1];
+			lo[2] = pos.z[e] < lo[2] ? pos.z[e] : lo[2];
+			hi[0] = pos.x[e] > hi[0] ? pos.x[e] : hi[0];
+			hi[1] = pos.y[e] > hi[1] ? pos.y[e] : hi[1];
+			hi[2] = pos.z[e] > hi[2] ? pos.z[e] : hi[2];
+		}
+	}
+}
+
+#if defined(FABRIC_SIMD_X86)
+
+// When offset is smaller than the vector width the "a" and "b" force lanes overlap,
+// so the += store must land before the -= load.  Writing the two updates in that
+// order keeps the vector loops correct for horizontal springs too.
+
+FABRIC_TARGET_SSE
+static void SpringsSSE(const Float3SoA& pos, const Float3SoA& vel, const Float3SoA& force,
+	std::size_t first, std::size_t offset, std::size_t count, const SpringParams& params)
+{
+	const __m128 rest = _mm_set1_ps(params.rest);
+	const __m128 stiffness = _mm_set1_ps(params.stiffness);
+	const __m128 damping = _mm_set1_ps(params.damping);
+
+	const std::size_t end = first + count;
+	std::size_t a = first;
+	for (; a + 4 <= end; a += 4)
+	{
+		std::size_t b = a + offset;
+
+		__m128 diffx = _mm_sub_ps(_mm_loadu_ps(pos.x + b), _mm_loadu_ps(pos.x + a));
+		__m128 diffy = _mm_sub_ps(_mm_loadu_ps(pos.y + b), _mm_loadu_ps(pos.y + a));
+		__m128 diffz = _mm_sub_ps(_mm_loadu_ps(pos.z + b), _mm_loadu_ps(pos.z + a));
+		__m128 diffNorm = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(
+			_mm_mul_ps(diffx, diffx), _mm_mul_ps(diffy, diffy)), _mm_mul_ps(diffz, diffz)));
+		__m128 k = _mm_div_ps(_mm_mul_ps(stiffness, _mm_sub_ps(diffNorm, rest)), diffNorm);
+
+		__m128 Fx = _mm_add_ps(_mm_mul_ps(k, diffx),
+			_mm_mul_ps(damping, _mm_sub_ps(_mm_loadu_ps(vel.x + b), _mm_loadu_ps(vel.x + a))));
+		__m128 Fy = _mm_add_ps(_mm_mul_ps(k, diffy),
+			_mm_mul_ps(damping, _mm_sub_ps(_mm_loadu_ps(vel.y + b), _mm_loadu_ps(vel.y + a))));
+		__m128 Fz = _mm_add_ps(_mm_mul_ps(k, diffz),
+			_mm_mul_ps(damping, _mm_sub_ps(_mm_loadu_ps(vel.z + b), _mm_loadu_ps(vel.z + a))));
+
+		_mm_storeu_ps(force.x + a, _mm_add_ps(_mm_loadu_ps(force.x + a), Fx));
+		_mm_storeu_ps(force.y + a, _mm_add_ps(_mm_loadu_ps(force.y + a), Fy));
+		_mm_storeu_ps(force.z + a, _mm_add_ps(_mm_loadu_ps(force.z + a), Fz));
+
+		_mm_storeu_ps(force.x + b, _mm_sub_ps(_mm_loadu_ps(force.x + b), Fx));
+		_mm_storeu_ps(force.y + b, _mm_sub_ps(_mm_loadu_ps(force.y + b), Fy));
+		_mm_storeu_ps(force.z + b, _mm_sub_ps(_mm_loadu_ps(force.z + b), Fz));
+	}
+
+	SpringsScalar(pos, vel, force, a, offset, end - a, params);
+}
+
+FABRIC_TARGET_AVX2
+static void SpringsAVX2(const Float3SoA& pos, const Float3SoA& vel, const Float3SoA& force,
+	std::size_t first, std::size_t offset, std::size_t count, const SpringParams& params)
+{
+	const __m256 rest = _mm256_set1_ps(params.rest);
+	const __m256 stiffness = _mm256_set1_ps(params.stiffness);
+	const __m256 damping = _mm256_set1_ps(params.damping);
+
+	const std::size_t end = first + count;
+	std::size_t a = first;
+	for (; a + 8 <= end; a += 8)
+	{
+		std::size_t b = a + offset;
+
+		__m256 diffx = _mm256_sub_ps(_mm256_loadu_ps(pos.x + b), _mm256_loadu_ps(pos.x + a));
+		__m256 diffy = _mm256_sub_ps(_mm256_loadu_ps(pos.y + b), _mm256_loadu_ps(pos.y + a));
+		__m256 diffz = _mm256_sub_ps(_mm256_loadu_ps(pos.z + b), _mm256_loadu_ps(pos.z + a));
+		__m256 diffNorm = _mm256_sqrt_ps(_mm256_fmadd_ps(diffz, diffz,
+			_mm256_fmadd_ps(diffy, diffy, _mm256_mul_ps(diffx, diffx))));
+		__m256 k = _mm256_div_ps(_mm256_mul_ps(stiffness, _mm256_sub_ps(diffNorm, rest)), diffNorm);
+
+		__m256 Fx = _mm256_fmadd_ps(k, diffx,
+			_mm256_mul_ps(damping, _mm256_sub_ps(_mm256_loadu_ps(vel.x + b), _mm256_loadu_ps(vel.x + a))));
+		__m256 Fy = _mm256_fmadd_ps(k, diffy,
+			_mm256_mul_ps(damping, _mm256_sub_ps(_mm256_loadu_ps(vel.y + b), _mm256_loadu_ps(vel.y + a))));
+		__m256 Fz = _mm256_fmadd_ps(k, diffz,
+			_mm256_mul_ps(damping, _mm256_sub_ps(_mm256_loadu_ps(vel.z + b), _mm256_loadu_ps(vel.z + a))));
+
+		_mm256_storeu_ps(force.x + a, _mm256_add_ps(_mm256_loadu_ps(force.x + a), Fx));
+		_mm256_storeu_ps(force.y + a, _mm256_add_ps(_mm256_loadu_ps(force.y + a), Fy));
+		_mm256_storeu_ps(force.z + a, _mm256_add_ps(_mm256_loadu_ps(force.z + a), Fz));
+
+		_mm256_storeu_ps(force.x + b, _mm256_sub_ps(_mm256_loadu_ps(force.x + b), Fx));
+		_mm256_storeu_ps(force.y + b, _mm256_sub_ps(_mm256_loadu_ps(force.y + b), Fy));
+		_mm256_storeu_ps(force.z + b, _mm256_sub_ps(_mm256_loadu_ps(force.z + b), Fz));
+	}
+
+	SpringsScalar(pos, vel, force, a, offset, end - a, params);
+}
+
+// The indexed spring kernels load the end points of four or eight springs lane by
+// lane (SSE) or with gathers (AVX2); the arithmetic is that of the grid kernels.  The
+// AVX2 tail repeats the last spring in the unused lanes and masks them out of the
+// stores, so the kernel never drops to scalar code with the upper halves dirty.
+
+FABRIC_TARGET_SSE
+static std::size_t IndexedSpringsSSE(const Float3SoA& pos, const Float3SoA& vel, const std::uint32_t* ends0,
+	const std::uint32_t* ends1, const float* rest, std::size_t first, std::size_t count,
+	float stiffness, float damping, float breakStretch, const Float3SoA& force, std::uint32_t* broken)
+{
+	const __m128 k0 = _mm_set1_ps(stiffness);
+	const __m128 d0 = _mm_set1_ps(damping);
+	const __m128 b0 = _mm_set1_ps(breakStretch);
+
+	std::size_t brokenCount = 0;
+	const std::size_t end = first + count;
+	std::size_t s = first;
+	for (; s + 4 <= end; s += 4)
+	{
+		const std::uint32_t* a = ends0 + s;
+		const std::uint32_t* b = ends1 + s;
+
+		__m128 diffx = _mm_sub_ps(_mm_setr_ps(pos.x[b[0]], pos.x[b[1]], pos.x[b[2]], pos.x[b[3]]),
+			_mm_setr_ps(pos.x[a[0]], pos.x[a[1]], pos.x[a[2]], pos.x[a[3]]));
+		__m128 diffy = _mm_sub_ps(_mm_setr_ps(pos.y[b[0]], pos.y[b[1]], pos.y[b[2]], pos.y[b[3]]),
+			_mm_setr_ps(pos.y[a[0]], pos.y[a[1]], pos.y[a[2]], pos.y[a[3]]));
+		__m128 diffz = _mm_sub_ps(_mm_setr_ps(pos.z[b[0]], pos.z[b[1]], pos.z[b[2]], pos.z[b[3]]),
+			_mm_setr_ps(pos.z[a[0]], pos.z[a[1]], pos.z[a[2]], pos.z[a[3]]));
+		__m128 diffNorm = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(
+			_mm_mul_ps(diffx, diffx), _mm_mul_ps(diffy, diffy)), _mm_mul_ps(diffz, diffz)));
+		__m128 r = _mm_loadu_ps(rest + s);
+		__m128 k = _mm_div_ps(_mm_mul_ps(k0, _mm_sub_ps(diffNorm, r)), diffNorm);
+
+		__m128 dvx = _mm_sub_ps(_mm_setr_ps(vel.x[b[0]], vel.x[b[1]], vel.x[b[2]], vel.x[b[3]]),
+			_mm_setr_ps(vel.x[a[0]], vel.x[a[1]], vel.x[a[2]], vel.x[a[3]]));
+		__m128 dvy = _mm_sub_ps(_mm_setr_ps(vel.y[b[0]], vel.y[b[1]], vel.y[b[2]], vel.y[b[3]]),
+			_mm_setr_ps(vel.y[a[0]], vel.y[a[1]], vel.y[a[2]], vel.y[a[3]]));
+		__m128 dvz = _mm_sub_ps(_mm_setr_ps(vel.z[b[0]], vel.z[b[1]], vel.z[b[2]], vel.z[b[3]]),
+			_mm_setr_ps(vel.z[a[0]], vel.z[a[1]], vel.z[a[2]], vel.z[a[3]]));
+
+		_mm_storeu_ps(force.x + s, _mm_add_ps(_mm_mul_ps(k, diffx), _mm_mul_ps(d0, dvx)));
+		_mm_storeu_ps(force.y + s, _mm_add_ps(_mm_mul_ps(k, diffy), _mm_mul_ps(d0, dvy)));
+		_mm_storeu_ps(force.z + s, _mm_add_ps(_mm_mul_ps(k, diffz), _mm_mul_ps(d0, dvz)));
+
+		int mask = _mm_movemask_ps(_mm_cmpgt_ps(diffNorm, _mm_mul_ps(r, b0)));
+		for (int lane = 0; mask != 0; ++lane, mask >>= 1)
+		{
+			if (mask & 1)
+				broken[brokenCount++] = static_cast<std::uint32_t>(s + lane);
+		}
+	}
+
+	return brokenCount + IndexedSpringsScalar(pos, vel, ends0, ends1, rest, s, end - s,
+		stiffness, damping, breakStretch, force, broken + brokenCount);
+}
+
+FABRIC_TARGET_AVX2
+static std::size_t IndexedSpringsAVX2(const Float3SoA& pos, const Float3SoA& vel, const std::uint32_t* ends0,
+	const std::uint32_t* ends1, const float* rest, std::size_t first, std::size_t count,
+	float stiffness, float damping, float breakStretch, const Float3SoA& force, std::uint32_t* broken)
+{
+	const __m256 k0 = _mm256_set1_ps(stiffness);
+	const __m256 d0 = _mm256_set1_ps(damping);
+	const __m256 b0 = _mm256_set1_ps(breakStretch);
+
+	std::size_t brokenCount = 0;
+	const std::size_t end = first + count;
+	for (std::size_t s = first; s < end; s += 8)
+	{
+		__m256i a, b, mask;
+		__m256 r;
+		if (s + 8 <= end)
+		{
+			a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ends0 + s));
+			b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ends1 + s));
+			r = _mm256_loadu_ps(rest + s);
+			mask = _mm256_set1_epi32(-1);
+		}
+		else
+		{
+			alignas(32) std::uint32_t tailA[8];
+			alignas(32) std::uint32_t tailB[8];
+			alignas(32) float tailRest[8];
+			alignas(32) std::int32_t tailMask[8];
+			for (std::size_t lane = 0; lane < 8; ++lane)
+			{
+				std::size_t t = s + lane < end ? s + lane : end - 1;
+				tailA[lane] = ends0[t];
+				tailB[lane] = ends1[t];
+				tailRest[lane] = rest[t];
+				tailMask[lane] = s + lane < end ? -1 : 0;
+			}
+			a = _mm256_load_si256(reinterpret_cast<const __m256i*>(tailA));
+			b = _mm256_load_si256(reinterpret_cast<const __m256i*>(tailB));
+			r = _mm256_load_ps(tailRest);
+			mask = _mm256_load_si256(reinterpret_cast<const __m256i*>(tailMask));
+		}
+
+		__m256 diffx = _mm256_sub_ps(_mm256_i32gather_ps(pos.x, b, 4), _mm256_i32gather_ps(pos.x, a, 4));
+		__m256 diffy = _mm256_sub_ps(_mm256_i32gather_ps(pos.y, b, 4), _mm256_i32gather_ps(pos.y, a, 4));
+		__m256 diffz = _mm256_sub_ps(_mm256_i32gather_ps(pos.z, b, 4), _mm256_i32gather_ps(pos.z, a, 4));
+		__m256 diffNorm = _mm256_sqrt_ps(_mm256_fmadd_ps(diffz, diffz,
+			_mm256_fmadd_ps(diffy, diffy, _mm256_mul_ps(diffx, diffx))));
+		__m256 k = _mm256_div_ps(_mm256_mul_ps(k0, _mm256_sub_ps(diffNorm, r)), diffNorm);
+
+		__m256 dvx = _mm256_sub_ps(_mm256_i32gather_ps(vel.x, b, 4), _mm256_i32gather_ps(vel.x, a, 4));
+		__m256 dvy = _mm256_sub_ps(_mm256_i32gather_ps(vel.y, b, 4), _mm256_i32gather_ps(vel.y, a, 4));
+		__m256 dvz = _mm256_sub_ps(_mm256_i32gather_ps(vel.z, b, 4), _mm256_i32gather_ps(vel.z, a, 4));
+
+		_mm256_maskstore_ps(force.x + s, mask, _mm256_fmadd_ps(k, diffx, _mm256_mul_ps(d0, dvx)));
+		_mm256_maskstore_ps(force.y + s, mask, _mm256_fmadd_ps(k, diffy, _mm256_mul_ps(d0, dvy)));
+		_mm256_maskstore_ps(force.z + s, mask, _mm256_fmadd_ps(k, diffz, _mm256_mul_ps(d0, dvz)));
+
+		int stretched = _mm256_movemask_ps(_mm256_and_ps(_mm256_castsi256_ps(mask),
+			_mm256_cmp_ps(diffNorm, _mm256_mul_ps(r, b0), _CMP_GT_OQ)));
+		for (int lane = 0; stretched != 0; ++lane, stretched >>= 1)
+		{
+			if (stretched & 1)
+				broken[brokenCount++] = static_cast<std::uint32_t>(s + lane);
+		}
+	}
+	return brokenCount;
+}
+
+// The proximity kernel gathers the candidates' coordinates, tests four of them at
+// once and appends the lanes that passed.  No fused multiply-add, so the squared
+// distance rounds exactly as in the scalar kernel.
+
+FABRIC_TARGET_SSE
+static std::size_t ProximitySSE(const Float3SoA& pos, float px, float py, float pz,
+	const std::uint32_t* candidates, std::size_t count, float radiusSq, std::uint32_t* hits)
+{
+	const __m128 x = _mm_set1_ps(px);
+	const __m128 y = _mm_set1_ps(py);
+	const __m128 z = _mm_set1_ps(pz);
+	const __m128 r2 = _mm_set1_ps(radiusSq);
+
+	std::size_t hitCount = 0;
+	std::size_t k = 0;
+	for (; k + 4 <= count; k += 4)
+	{
+		const std::uint32_t* q = candidates + k;
+		__m128 dx = _mm_sub_ps(_mm_setr_ps(pos.x[q[0]], pos.x[q[1]], pos.x[q[2]], pos.x[q[3]]), x);
+		__m128 dy = _mm_sub_ps(_mm_setr_ps(pos.y[q[0]], pos.y[q[1]], pos.y[q[2]], pos.y[q[3]]), y);
+		__m128 dz = _mm_sub_ps(_mm_setr_ps(pos.z[q[0]], pos.z[q[1]], pos.z[q[2]], pos.z[q[3]]), z);
+		__m128 d2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+
+		int mask = _mm_movemask_ps(_mm_cmplt_ps(d2, r2));
+		for (int lane = 0; mask != 0; ++lane, mask >>= 1)
+		{
+			if (mask & 1)
+				hits[hitCount++] = q[lane];
+		}
+	}
+
+	return hitCount + ProximityScalar(pos, px, py, pz, candidates + k, count - k, radiusSq, hits + hitCount);
+}
+
+// The capsule kernels do the scalar kernel's work four or eight vertices at a time,
+// skip groups with no vertex inside and write the others back through a mask.  SSE2
+// has no blend, so the masks are applied with and/andnot.
+
+FABRIC_TARGET_SSE
+static std::size_t CapsuleSSE(const Float3SoA& pos, const Float3SoA& vel,
+	std::size_t first, std::size_t count, const CapsuleParams& capsule)
+{
+	const float sxs = capsule.bx - capsule.ax;
+	const float sys = capsule.by - capsule.ay;
+	const float szs = capsule.bz - capsule.az;
+	const float lenSq = sxs * sxs + sys * sys + szs * szs;
+
+	const __m128 ax = _mm_set1_ps(capsule.ax);
+	const __m128 ay = _mm_set1_ps(capsule.ay);
+	const __m128 az = _mm_set1_ps(capsule.az);
+	const __m128 sx = _mm_set1_ps(sxs);
+	const __m128 sy = _mm_set1_ps(sys);
+	const __m128 sz = _mm_set1_ps(szs);
+	const __m128 invLenSq = _mm_set1_ps(lenSq > 0.0f ? 1 / lenSq : 0.0f);
+	const __m128 radius = _mm_set1_ps(capsule.radius);
+	const __m128 radiusSq = _mm_set1_ps(capsule.radius * capsule.radius);
+	const __m128 slide = _mm_set1_ps(1 - capsule.friction);
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 minDist = _mm_set1_ps(CapsuleMinDistance);
+
+	std::size_t contacts = 0;
+	const std::size_t end = first + count;
+	std::size_t e = first;
+	for (; e + 4 <= end; e += 4)
+	{
+		__m128 x = _mm_loadu_ps(pos.x + e);
+		__m128 y = _mm_loadu_ps(pos.y + e);
+		__m128 z = _mm_loadu_ps(pos.z + e);
+		__m128 px = _mm_sub_ps(x, ax);
+		__m128 py = _mm_sub_ps(y, ay);
+		__m128 pz = _mm_sub_ps(z, az);
+		__m128 t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(px, sx), _mm_mul_ps(py, sy)), _mm_mul_ps(pz, sz)), invLenSq);
+		t = _mm_min_ps(_mm_max_ps(t, zero), one);
+
+		__m128 rx = _mm_sub_ps(px, _mm_mul_ps(t, sx));
+		__m128 ry = _mm_sub_ps(py, _mm_mul_ps(t, sy));
+		__m128 rz = _mm_sub_ps(pz, _mm_mul_ps(t, sz));
+		__m128 distSq = _mm_add_ps(_mm_add_ps(_mm_mul_ps(rx, rx), _mm_mul_ps(ry, ry)), _mm_mul_ps(rz, rz));
+		__m128 inside = _mm_cmplt_ps(distSq, radiusSq);
+		int mask = _mm_movemask_ps(inside);
+		if (mask == 0)
+			continue;
+
+		__m128 dist = _mm_sqrt_ps(distSq);
+		__m128 invDist = _mm_div_ps(one, _mm_max_ps(dist, minDist));
+		__m128 nx = _mm_mul_ps(rx, invDist);
+		__m128 ny = _mm_mul_ps(ry, invDist);
+		__m128 nz = _mm_mul_ps(rz, invDist);
+
+		__m128 depth = _mm_and_ps(inside, _mm_sub_ps(radius, dist));
+		_mm_storeu_ps(pos.x + e, _mm_add_ps(x, _mm_mul_ps(depth, nx)));
+		_mm_storeu_ps(pos.y + e, _mm_add_ps(y, _mm_mul_ps(depth, ny)));
+		_mm_storeu_ps(pos.z + e, _mm_add_ps(z, _mm_mul_ps(depth, nz)));
+
+		__m128 vx = _mm_loadu_ps(vel.x + e);
+		__m128 vy = _mm_loadu_ps(vel.y + e);
+		__m128 vz = _mm_loadu_ps(vel.z + e);
+		__m128 vn = _mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, nx), _mm_mul_ps(vy, ny)), _mm_mul_ps(vz, nz));
+		__m128 vOut = _mm_max_ps(vn, zero);
+		__m128 cx = _mm_add_ps(_mm_mul_ps(vOut, nx), _mm_mul_ps(_mm_sub_ps(vx, _mm_mul_ps(vn, nx)), slide));
+		__m128 cy = _mm_add_ps(_mm_mul_ps(vOut, ny), _mm_mul_ps(_mm_sub_ps(vy, _mm_mul_ps(vn, ny)), slide));
+		__m128 cz = _mm_add_ps(_mm_mul_ps(vOut, nz), _mm_mul_ps(_mm_sub_ps(vz, _mm_mul_ps(vn, nz)), slide));
+		_mm_storeu_ps(vel.x + e, _mm_or_ps(_mm_and_ps(inside, cx), _mm_andnot_ps(inside, vx)));
+		_mm_storeu_ps(vel.y + e, _mm_or_ps(_mm_and_ps(inside, cy), _mm_andnot_ps(inside, vy)));
+		_mm_storeu_ps(vel.z + e, _mm_or_ps(_mm_and_ps(inside, cz), _mm_andnot_ps(inside, vz)));
+
+		for (; mask != 0; mask &= mask - 1)
+			++contacts;
+	}
+
+	return contacts + CapsuleScalar(pos, vel, e, end - e, capsule);
+}
+
+FABRIC_TARGET_AVX2
+static std::size_t CapsuleAVX2(const Float3SoA& pos, const Float3SoA& vel,
+	std::size_t first, std::size_t count, const CapsuleParams& capsule)
+{
+	const float sxs = capsule.bx - capsule.ax;
+	const float sys = capsule.by - capsule.ay;
+	const float szs = capsule.bz - capsule.az;
+	const float lenSq = sxs * sxs + sys * sys + szs * szs;
+
+	const __m256 ax = _mm256_set1_ps(capsule.ax);
+	const __m256 ay = _mm256_set1_ps(capsule.ay);
+	const __m256 az = _mm256_set1_ps(capsule.az);
+	const __m256 sx = _mm256_set1_ps(sxs);
+	const __m256 sy = _mm256_set1_ps(sys);
+	const __m256 sz = _mm256_set1_ps(szs);
+	const __m256 invLenSq = _mm256_set1_ps(lenSq > 0.0f ? 1 / lenSq : 0.0f);
+	const __m256 radius = _mm256_set1_ps(capsule.radius);
+	const __m256 radiusSq = _mm256_set1_ps(capsule.radius * capsule.radius);
+	const __m256 slide = _mm256_set1_ps(1 - capsule.friction);
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 one = _mm256_set1_ps(1.0f);
+	const __m256 minDist = _mm256_set1_ps(CapsuleMinDistance);
+
+	std::size_t contacts = 0;
+	const std::size_t end = first + count;
+	std::size_t e = first;
+	for (; e + 8 <= end; e += 8)
+	{
+		__m256 x = _mm256_loadu_ps(pos.x + e);
+		__m256 y = _mm256_loadu_ps(pos.y + e);
+		__m256 z = _mm256_loadu_ps(pos.z + e);
+		__m256 px = _mm256_sub_ps(x, ax);
+		__m256 py = _mm256_sub_ps(y, ay);
+		__m256 pz = _mm256_sub_ps(z, az);
+		__m256 t = _mm256_mul_ps(_mm256_fmadd_ps(pz, sz, _mm256_fmadd_ps(py, sy, _mm256_mul_ps(px, sx))), invLenSq);
+		t = _mm256_min_ps(_mm256_max_ps(t, zero), one);
+
+		__m256 rx = _mm256_fnmadd_ps(t, sx, px);
+		__m256 ry = _mm256_fnmadd_ps(t, sy, py);
+		__m256 rz = _mm256_fnmadd_ps(t, sz, pz);
+		__m256 distSq = _mm256_fmadd_ps(rz, rz, _mm256_fmadd_ps(ry, ry, _mm256_mul_ps(rx, rx)));
+		__m256 inside = _mm256_cmp_ps(distSq, radiusSq, _CMP_LT_OQ);
+		int mask = _mm256_movemask_ps(inside);
+		if (mask == 0)
+			continue;
+
+		__m256 dist = _mm256_sqrt_ps(distSq);
+		__m256 invDist = _mm256_div_ps(one, _mm256_max_ps(dist, minDist));
+		__m256 nx = _mm256_mul_ps(rx, invDist);
+		__m256 ny = _mm256_mul_ps(ry, invDist);
+		__m256 nz = _mm256_mul_ps(rz, invDist);
+
+		__m256 depth = _mm256_and_ps(inside, _mm256_sub_ps(radius, dist));
+		_mm256_storeu_ps(pos.x + e, _mm256_fmadd_ps(depth, nx, x));
+		_mm256_storeu_ps(pos.y + e, _mm256_fmadd_ps(depth, ny, y));
+		_mm256_storeu_ps(pos.z + e, _mm256_fmadd_ps(depth, nz, z));
+
+		__m256 vx = _mm256_loadu_ps(vel.x + e);
+		__m256 vy = _mm256_loadu_ps(vel.y + e);
+		__m256 vz = _mm256_loadu_ps(vel.z + e);
+		__m256 vn = _mm256_fmadd_ps(vz, nz, _mm256_fmadd_ps(vy, ny, _mm256_mul_ps(vx, nx)));
+		__m256 vOut = _mm256_max_ps(vn, zero);
+		__m256 cx = _mm256_fmadd_ps(vOut, nx, _mm256_mul_ps(_mm256_fnmadd_ps(vn, nx, vx), slide));
+		__m256 cy = _mm256_fmadd_ps(vOut, ny, _mm256_mul_ps(_mm256_fnmadd_ps(vn, ny, vy), slide));
+		__m256 cz = _mm256_fmadd_ps(vOut, nz, _mm256_mul_ps(_mm256_fnmadd_ps(vn, nz, vz), slide));
+		_mm256_storeu_ps(vel.x + e, _mm256_blendv_ps(vx, cx, inside));
+		_mm256_storeu_ps(vel.y + e, _mm256_blendv_ps(vy, cy, inside));
+		_mm256_storeu_ps(vel.z + e, _mm256_blendv_ps(vz, cz, inside));
+
+		for (; mask != 0; mask &= mask - 1)
+			++contacts;
+	}
+
+	return contacts + CapsuleScalar(pos, vel, e, end - e, capsule);
+}
+
+// The bounds kernels keep a box per lane and fold the lanes together once per call.
+// A row's last few vertices are broadcast to every lane rather than finished in
+// scalar code.  minps and maxps return their second operand when either is NaN, so
+// passing the new coordinates first skips NaNs as the scalar kernel does.
+
+FABRIC_TARGET_SSE
+static void BoundsSSE(const Float3SoA& pos, std::size_t first, std::size_t count, std::size_t rows,
+	std::size_t stride, float lo[3], float hi[3])
+{
+	__m128 loX = _mm_set1_ps(lo[0]), loY = _mm_set1_ps(lo[1]), loZ = _mm_set1_ps(lo[2]);
+	__m128 hiX = _mm_set1_ps(hi[0]), hiY = _mm_set1_ps(hi[1]), hiZ = _mm_set1_ps(hi[2]);
+
+	for (std::size_t r = 0; r < rows; ++r)
+	{
+		const std::size_t end = first + r * stride + count;
+		std::size_t e = first + r * stride;
+		for (; e + 4 <= end; e += 4)
+		{
+			__m128 x = _mm_loadu_ps(pos.x + e);
+			__m128 y = _mm_loadu_ps(pos.y + e);
+			__m128 z = _mm_loadu_ps(pos.z + e);
+			loX = _mm_min_ps(x, loX);
+			loY = _mm_min_ps(y, loY);
+			loZ = _mm_min_ps(z, loZ);
+			hiX = _mm_max_ps(x, hiX);
+			hiY = _mm_max_ps(y, hiY);
+			hiZ = _mm_max_ps(z, hiZ);
+		}
+		for (; e < end; ++e)
+		{
+			__m128 x = _mm_set1_ps(pos.x[e]);
+			__m128 y = _mm_set1_ps(pos.y[e]);
+			__m128 z = _mm_set1_ps(pos.z[e]);
+			loX = _mm_min_ps(x, loX);
+			loY = _mm_min_ps(y, loY);
+			loZ = _mm_min_ps(z, loZ);
+			hiX = _mm_max_ps(x, hiX);
+			hiY = _mm_max_ps(y, hiY);
+			hiZ = _mm_max_ps(z, hiZ);
+		}
+	}
+
+	alignas(16) float lanes[6][4];
+	_mm_store_ps(lanes[0], loX);
+	_mm_store_ps(lanes[1], loY);
+	_mm_store_ps(lanes[2], loZ);
+	_mm_store_ps(lanes[3], hiX);
+	_mm_store_ps(lanes[4], hiY);
+	_mm_store_ps(lanes[5], hiZ);
+	for (int k = 0; k < 3; ++k)
+	{
+		for (int lane = 0; lane < 4; ++lane)
+		{
+			lo[k] = lanes[k][lane] < lo[k] ? lanes[k][lane] : lo[k];
+			hi[k] = lanes[k + 3][lane] > hi[k] ? lanes[k + 3][lane] : hi[k];
+		}
+	}
+}
+
+FABRIC_TARGET_AVX2
+static void BoundsAVX2(const Float3SoA& pos, std::size_t first, std::size_t count, std::size_t rows,
+	std::size_t stride, float lo[3], float hi[3])
+{
+	__m256 loX = _mm256_set1_ps(lo[0]), loY = _mm256_set1_ps(lo[1]), loZ = _mm256_set1_ps(lo[2]);
+	__m256 hiX = _mm256_set1_ps(hi[0]), hiY = _mm256_set1_ps(hi[1]), hiZ = _mm256_set1_ps(hi[2]);
+
+	for (std::size_t r = 0; r < rows; ++r)
+	{
+		const std::size_t end = first + r * stride + count;
+		std::size_t e = first + r * stride;
+		for (; e + 8 <= end; e += 8)
+		{
+			__m256 x = _mm256_loadu_ps(pos.x + e);
+			__m256 y = _mm256_loadu_ps(pos.y + e);
+			__m256 z = _mm256_loadu_ps(pos.z + e);
+			loX = _mm256_min_ps(x, loX);
+			loY = _mm256_min_ps(y, loY);
+			loZ = _mm256_min_ps(z, loZ);
+			hiX = _mm256_max_ps(x, hiX);
+			hiY = _mm256_max_ps(y, hiY);
+			hiZ = _mm256_max_ps(z, hiZ);
+		}
+		for (; e < end; ++e)
+		{
+			__m256 x = _mm256_set1_ps(pos.x[e]);
+			__m256 y = _mm256_set1_ps(pos.y[e]);
+			__m256 z = _mm256_set1_ps(pos.z[e]);
+			loX = _mm256_min_ps(x, loX);
+			loY = _mm256_min_ps(y, loY);
+			loZ = _mm256_min_ps(z, loZ);
+			hiX = _mm256_max_ps(x, hiX);
+			hiY = _mm256_max_ps(y, hiY);
+			hiZ = _mm256_max_ps(z, hiZ);
+		}
+	}
+
+	alignas(32) float lanes[6][8];
+	_mm256_store_ps(lanes[0], loX);
+	_mm256_store_ps(lanes[1], loY);
+	_mm256_store_ps(lanes[2], loZ);
+	_mm256_store_ps(lanes[3], hiX);
+	_mm256_store_ps(lanes[4], hiY);
+	_mm256_store_ps(lanes[5], hiZ);
+	for (int k = 0; k < 3; ++k)
+	{
+		for (int lane = 0; lane < 8; ++lane)
+		{
+			lo[k] = lanes[k][lane] < lo[k] ? lanes[k][lane] : lo[k];
+			hi[k] = lanes[k + 3][lane] > hi[k] ? lanes[k + 3][lane] : hi[k];
+		}
+	}
+}
+
+#endif // FABRIC_SIMD_X86
+
+SimdLevel DetectSimdLevel()
+{
+#if defined(FABRIC_SIMD_X86)
+#if defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 0);
+	int maxLeaf = info[0];
+
+	__cpuid(info, 1);
+	bool sse2 = (info[3] & (1 << 26)) != 0;
+	bool fma = (info[2] & (1 << 12)) != 0;
+	bool osxsave = (info[2] & (1 << 27)) != 0;
+	bool avx = (info[2] & (1 << 28)) != 0;
+
+	bool avx2 = false;
+	if (maxLeaf >= 7)
+	{
+		__cpuidex(info, 7, 0);
+		avx2 = (info[1] & (1 << 5)) != 0;
+	}
+
+	// The OS must also save the upper halves of the ymm registers on a context switch.
+	bool osAvx = osxsave && avx && (_xgetbv(0) & 6) == 6;
+
+	if (osAvx && avx2 && fma)
+		return SimdLevel::AVX2;
+	if (sse2)
+		return SimdLevel::SSE;
+#else
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+		return SimdLevel::AVX2;
+	if (__builtin_cpu_supports("sse2"))
+		return SimdLevel::SSE;
+#endif
+#endif
+	return SimdLevel::Scalar;
+}
+
+SpringKernel GetSpringKernel(SimdLevel level)
+{
+#if defined(FABRIC_SIMD_X86)
+	switch (level)
+	{
+	case SimdLevel::AVX2:
+		return SpringsAVX2;
+	case SimdLevel::SSE:
+		return SpringsSSE;
+	default:
+		break;
+	}
+#endif
+	return SpringsScalar;
+}
+
+IndexedSpringKernel GetIndexedSpringKernel(SimdLevel level)
+{
+#if defined(FABRIC_SIMD_X86)
+	switch (level)
+	{
+	case SimdLevel::AVX2:
+		return IndexedSpringsAVX2;
+	case SimdLevel::SSE:
+		return IndexedSpringsSSE;
+	default:
+		break;
+	}
+#endif
+	return IndexedSpringsScalar;
+}
+
+ProximityKernel GetProximityKernel(SimdLevel level)
+{
+#if defined(FABRIC_SIMD_X86)
+	switch (level)
+	{
+	// A vertex has a dozen or so candidates, too few for eight lanes to pay
+	// for themselves, so AVX2 keeps the four-lane kernel.
+	case SimdLevel::AVX2:
+	case SimdLevel::SSE:
+		return ProximitySSE;
+	default:
+		break;
+	}
+#endif
+	return ProximityScalar;
+}
+
+CapsuleKernel GetCapsuleKernel(SimdLevel level)
+{
+#if defined(FABRIC_SIMD_X86)
+	switch (level)
+	{
+	case SimdLevel::AVX2:
+		return CapsuleAVX2;
+	case SimdLevel::SSE:
+		return CapsuleSSE;
+	default:
+		break;
+	}
+#endif
+	return CapsuleScalar;
+}
+
+BoundsKernel GetBoundsKernel(SimdLevel level)
+{
+#if defined(FABRIC_SIMD_X86)
+	switch (level)
+	{
+	case SimdLevel::AVX2:
+		return BoundsAVX2;
+	case SimdLevel::SSE:
+		return BoundsSSE;
+	default:
+		break;
+	}
+#endif
+	return BoundsScalar;
+}
+
+const char* SimdLevelName(SimdLevel level)
+{
+	switch (level)
+	{
+	case SimdLevel::AVX2:
+		return "avx2";
+	case SimdLevel::SSE:
+		return "sse";
+	default:
+		return "scalar";
+	}
+}
@@ -0,0 +1,101 @@
+//***************************************************************************************
+// FabricKernels.h by llyr-who (C) 2011 All Rights Reserved.
+//
+// Structure-of-arrays spring kernels used by Fabric::Update.  A kernel accumulates the
+// spring and damper forces for a run of springs joining vertex e to vertex e + offset,
+// for every e in [first, first + count).  The same kernel is written for AVX2, SSE and
+// plain scalar code; the widest one the CPU supports is picked at runtime.  The
+// indexed spring kernels of FabricMesh, the proximity kernels, the distance test of
+// the self-collision pass, and the bounds and capsule kernels of the collider pass
+// are dispatched the same way.
+//***************************************************************************************
+
+#ifndef FABRICKERNELS_H
+#define FABRICKERNELS_H
+
+#include <cstddef>
+#include <cstdint>
+
+// The x, y and z components of a vector field, each in its own array.
+struct Float3SoA
+{
+	float* x = nullptr;
+	float* y = nullptr;
+	float* z = nullptr;
+};
+
+struct SpringParams
+{
+	float rest;
+	float stiffness;
+	float damping;
+};
+
+// A capsule, the points within radius of the segment from a to b, and the friction of
+// its surface.  A sphere is a capsule whose ends meet.
+struct CapsuleParams
+{
+	float ax, ay, az;
+	float bx, by, bz;
+	float radius;
+	float friction;
+};
+
+enum class SimdLevel
+{
+	Scalar,
+	SSE,
+	AVX2
+};
+
+// pos and vel are only read; the force on e is incremented and the force on
+// e + offset decremented by the same amount.
+typedef void (*SpringKernel)(const Float3SoA& pos, const Float3SoA& vel, const Float3SoA& force,
+	std::size_t first, std::size_t offset, std::size_t count, const SpringParams& params);
+
+// Returns the widest instruction set both this build and the running CPU support.
+SimdLevel DetectSimdLevel();
+
+// Returns the spring kernel for the given level.  A level this build cannot
+// target falls back to the next narrower one.
+SpringKernel GetSpringKernel(SimdLevel level);
+
+// Writes to force[s] the force on vertex ends0[s] of the spring joining it to vertex
+// ends1[s], for every s in [first, first + count); the force on ends1[s] is its
+// opposite.  pos and vel are only read.  For FabricMesh, whose springs are listed
+// rather than laid out on a grid.  Every spring longer than breakStretch times its
+// rest length is also appended to broken, in order, and the count returned; pass
+// INFINITY to break none.
+typedef std::size_t (*IndexedSpringKernel)(const Float3SoA& pos, const Float3SoA& vel, const std::uint32_t* ends0,
+	const std::uint32_t* ends1, const float* rest, std::size_t first, std::size_t count,
+	float stiffness, float damping, float breakStretch, const Float3SoA& force, std::uint32_t* broken);
+
+IndexedSpringKernel GetIndexedSpringKernel(SimdLevel level);
+
+// Copies to hits, in order, the candidates whose position lies closer to (px, py, pz)
+// than sqrt(radiusSq), and returns how many it copied.  hits may alias candidates.
+// Every level keeps exactly the same candidates.
+typedef std::size_t (*ProximityKernel)(const Float3SoA& pos, float px, float py, float pz,
+	const std::uint32_t* candidates, std::size_t count, float radiusSq, std::uint32_t* hits);
+
+ProximityKernel GetProximityKernel(SimdLevel level);
+
+// Moves every vertex e in [first, first + count) that lies inside the capsule out to
+// its surface, drops the part of vel[e] heading into it and scales what slides along
+// it by 1 - friction.  Returns how many vertices it moved.
+typedef std::size_t (*CapsuleKernel)(const Float3SoA& pos, const Float3SoA& vel,
+	std::size_t first, std::size_t count, const CapsuleParams& capsule);
+
+CapsuleKernel GetCapsuleKernel(SimdLevel level);
+
+// Widens the box lo, hi to hold pos[e] for every e in [first, first + count) and the
+// same run on each of the next rows - 1 rows, stride vertices apart.  NaN
+// coordinates are skipped.
+typedef void (*BoundsKernel)(const Float3SoA& pos, std::size_t first, std::size_t count, std::size_t rows,
+	std::size_t stride, float lo[3], float hi[3]);
+
+BoundsKernel GetBoundsKernel(SimdLevel level);
+
+const char* SimdLevelName(SimdLevel level);
+
+#endif // FABRICKERNELS_H
@@ -0,0 +1,696 @@
+#include"FabricMesh.h"
+#include"../../Common/ThreadPool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <tuple>
+
+using DirectX::XMFLOAT3;
+
+namespace
+{
+	// An edge of a triangle: its vertices lo < hi and the corners they are,
+	// and the vertex and corner opposite it.
+	struct Edge
+	{
+		std::uint32_t lo;
+		std::uint32_t hi;
+		std::uint32_t opposite;
+		std::uint32_t corner0;
+		std::uint32_t corner1;
+		std::uint32_t oppositeCorner;
+	};
+
+	bool operator<(const Edge& a, const Edge& b)
+	{
+		return std::tie(a.lo, a.hi, a.opposite, a.corner0) < std::tie(b.lo, b.hi, b.opposite, b.corner0);
+	}
+
+	// A spring being built: its vertices and the corners they are.
+	struct SpringEnds
+	{
+		std::uint32_t a;
+		std::uint32_t b;
+		std::uint32_t cornerA;
+		std::uint32_t cornerB;
+	};
+
+	bool operator<(const SpringEnds& p, const SpringEnds& q)
+	{
+		return std::tie(p.a, p.b) < std::tie(q.a, q.b);
+	}
+}
+
+FabricMesh::FabricMesh(const GeometryGenerator::MeshData& mesh, float ddt, float spring1, float spring2,
+	float damp1, float damp2, float M, bool reorder)
+	: stepper(ddt)
+{
+	dt = ddt;
+	mass = M;
+
+	shortSpring = spring1;
+	shortDamp = damp1;
+	longSpring = spring2;
+	longDamp = damp2;
+
+	SetSimdLevel(DetectSimdLevel());
+	Build(mesh, reorder);
+}
+
+void FabricMesh::SetSimdLevel(SimdLevel level)
+{
+	simdLevel = std::min(level, DetectSimdLevel());
+	springKernel = GetIndexedSpringKernel(simdLevel);
+}
+
+void FabricMesh::Build(const GeometryGenerator::MeshData& mesh, bool reorder)
+{
+	// Weld vertices with the same position.  Each position is numbered by the
+	// first mesh vertex that has it, so the result does not depend on the sort.
+	std::size_t meshCount = mesh.Vertices.size();
+	auto position = [&mesh](std::size_t v)
+	{
+		const XMFLOAT3& p = mesh.Vertices[v].Position;
+		return std::make_tuple(p.x, p.y, p.z);
+	};
+	std::vector<std::uint32_t> byPosition(meshCount);
+	std::iota(byPosition.begin(), byPosition.end(), 0u);
+	std::sort(byPosition.begin(), byPosition.end(), [&position](std::uint32_t a, std::uint32_t b)
+		{
+			return position(a) < position(b) || (position(a) == position(b) && a < b);
+		});
+
+	std::vector<std::uint32_t> weld(meshCount);
+	for (std::size_t k = 0; k < meshCount; ++k)
+	{
+		std::uint32_t v = byPosition[k];
+		bool same = k > 0 && position(byPosition[k - 1]) == position(v);
+		weld[v] = same ? weld[byPosition[k - 1]] : v;
+	}
+
+	std::vector<std::uint32_t> unique(meshCount, UINT32_MAX);
+	std::vector<std::uint32_t> firstMeshVertex;
+	for (std::size_t v = 0; v < meshCount; ++v)
+	{
+		if (weld[v] == v)
+		{
+			unique[v] = static_cast<std::uint32_t>(firstMeshVertex.size());
+			firstMeshVertex.push_back(static_cast<std::uint32_t>(v));
+		}
+	}
+	for (std::size_t v = 0; v < meshCount; ++v)
+		weld[v] = unique[weld[v]];
+	vertexCount = firstMeshVertex.size();
+
+	// The welded triangles, dropping those that collapsed.
+	std::vector<std::uint32_t> triangles;
+	const std::vector<std::uint32_t>& source = mesh.Indices32;
+	for (std::size_t t = 0; t + 2 < source.size(); t += 3)
+	{
+		std::uint32_t a = weld[source[t]], b = weld[source[t + 1]], c = weld[source[t + 2]];
+		if (a == b || b == c || c == a)
+			continue;
+		triangles.insert(triangles.end(), { a, b, c });
+	}
+	std::size_t triangleCount = triangles.size() / 3;
+
+	// Every edge with the corners it joins and the corner opposite it, sorted
+	// so the triangles that share an edge sit next to each other.
+	std::vector<Edge> edges;
+	edges.reserve(triangles.size());
+	for (std::uint32_t t = 0; t < triangles.size(); t += 3)
+	{
+		for (std::uint32_t k = 0; k < 3; ++k)
+		{
+			std::uint32_t c0 = t + k;
+			std::uint32_t c1 = t + (k + 1) % 3;
+			if (triangles[c1] < triangles[c0])
+				std::swap(c0, c1);
+			edges.push_back(Edge{ triangles[c0], triangles[c1], triangles[t + (k + 2) % 3], c0, c1, t + (k + 2) % 3 });
+		}
+	}
+	std::sort(edges.begin(), edges.end());
+
+	std::vector<SpringEnds> stretch;
+	std::vector<SpringEnds> bend;
+	for (std::size_t e = 0; e < edges.size();)
+	{
+		std::size_t end = e + 1;
+		while (end < edges.size() && edges[end].lo == edges[e].lo && edges[end].hi == edges[e].hi)
+			++end;
+
+		stretch.push_back(SpringEnds{ edges[e].lo, edges[e].hi, edges[e].corner0, edges[e].corner1 });
+
+		// Only an edge between exactly two triangles bends; a boundary edge has
+		// nothing to bend against, and a non-manifold one no single hinge.
+		const Edge& f = edges[e];
+		const Edge& g = edges[e + 1 < end ? e + 1 : e];
+		if (end - e == 2 && f.opposite != g.opposite)
+		{
+			if (f.opposite < g.opposite)
+				bend.push_back(SpringEnds{ f.opposite, g.opposite, f.oppositeCorner, g.oppositeCorner });
+			else
+				bend.push_back(SpringEnds{ g.opposite, f.opposite, g.oppositeCorner, f.oppositeCorner });
+		}
+		e = end;
+	}
+
+	// A bend may already be an edge, as across the corner of a fan, or
+	// another hinge's bend.
+	std::stable_sort(bend.begin(), bend.end());
+	bend.erase(std::unique(bend.begin(), bend.end(), [](const SpringEnds& p, const SpringEnds& q)
+		{
+			return p.a == q.a && p.b == q.b;
+		}), bend.end());
+	bend.erase(std::remove_if(bend.begin(), bend.end(), [&stretch](const SpringEnds& p)
+		{
+			return std::binary_search(stretch.begin(), stretch.end(), p);
+		}), bend.end());
+
+	// Renumber the vertices by reverse Cuthill-McKee over the whole spring graph.
+	std::vector<std::uint32_t> order(vertexCount);
+	std::iota(order.begin(), order.end(), 0u);
+	if (reorder)
+	{
+		std::vector<std::uint32_t> start(vertexCount + 1, 0);
+		for (const std::vector<SpringEnds>* list : { &stretch, &bend })
+		{
+			for (const SpringEnds& p : *list)
+			{
+				++start[p.a + 1];
+				++start[p.b + 1];
+			}
+		}
+		std::partial_sum(start.begin(), start.end(), start.begin());
+
+		std::vector<std::uint32_t> adjacent(start.back());
+		std::vector<std::uint32_t> cursor(start.begin(), start.end() - 1);
+		for (const std::vector<SpringEnds>* list : { &stretch, &bend })
+		{
+			for (const SpringEnds& p : *list)
+			{
+				adjacent[cursor[p.a]++] = p.b;
+				adjacent[cursor[p.b]++] = p.a;
+			}
+		}
+		order = ReverseCuthillMcKee(vertexCount, start, adjacent);
+	}
+
+	std::vector<std::uint32_t> renumber(vertexCount);
+	for (std::size_t k = 0; k < vertexCount; ++k)
+		renumber[order[k]] = static_cast<std::uint32_t>(k);
+
+	meshVertex.resize(vertexCount);
+	for (std::size_t k = 0; k < vertexCount; ++k)
+		meshVertex[k] = firstMeshVertex[order[k]];
+	solverVertex.resize(meshCount);
+	for (std::size_t v = 0; v < meshCount; ++v)
+		solverVertex[v] = renumber[weld[v]];
+
+	// The triangles in the new numbering, ordered by their lowest vertex so
+	// they follow the vertices in memory too; the winding is kept.
+	for (std::uint32_t& v : triangles)
+		v = renumber[v];
+	std::vector<std::uint32_t> byLowest(triangleCount);
+	std::iota(byLowest.begin(), byLowest.end(), 0u);
+	std::stable_sort(byLowest.begin(), byLowest.end(), [&triangles](std::uint32_t a, std::uint32_t b)
+		{
+			return std::min({ triangles[3 * a], triangles[3 * a + 1], triangles[3 * a + 2] })
+				< std::min({ triangles[3 * b], triangles[3 * b + 1], triangles[3 * b + 2] });
+		});
+	std::vector<std::uint32_t> newTriangle(triangleCount);
+	indices.resize(triangles.size());
+	for (std::uint32_t t = 0; t < triangleCount; ++t)
+	{
+		newTriangle[byLowest[t]] = t;
+		std::copy(triangles.begin() + 3 * byLowest[t], triangles.begin() + 3 * byLowest[t] + 3, indices.begin() + 3 * t);
+	}
+	auto newCorner = [&newTriangle](std::uint32_t c) { return 3 * newTriangle[c / 3] + c % 3; };
+
+	// The springs in the new numbering, each kind sorted by its first end so
+	// the spring pass walks the vertices in order.
+	springA.clear();
+	springB.clear();
+	cornerA.clear();
+	cornerB.clear();
+	for (std::vector<SpringEnds>* list : { &stretch, &bend })
+	{
+		for (SpringEnds& q : *list)
+		{
+			q = SpringEnds{ renumber[q.a], renumber[q.b], newCorner(q.cornerA), newCorner(q.cornerB) };
+			if (q.b < q.a)
+				q = SpringEnds{ q.b, q.a, q.cornerB, q.cornerA };
+		}
+		std::sort(list->begin(), list->end());
+		if (list == &bend)
+			bendStart = springA.size();
+		for (const SpringEnds& q : *list)
+		{
+			springA.push_back(q.a);
+			springB.push_back(q.b);
+			cornerA.push_back(q.cornerA);
+			cornerB.push_back(q.cornerB);
+		}
+	}
+	stretchEnd = bendStart;
+	bendEnd = springA.size();
+
+	// The per-vertex state, in solver order.
+	AllocateVertices(vertexCount);
+	for (std::size_t k = 0; k < vertexCount; ++k)
+	{
+		const XMFLOAT3& q = mesh.Vertices[meshVertex[k]].Position;
+		prevPos.x[k] = currPos.x[k] = q.x;
+		prevPos.y[k] = currPos.y[k] = q.y;
+		prevPos.z[k] = currPos.z[k] = q.z;
+		normals.y[k] = 1.0f;
+	}
+
+	springRest.resize(springA.size());
+	for (std::size_t s = 0; s < springA.size(); ++s)
+	{
+		float dx = currPos.x[springB[s]] - currPos.x[springA[s]];
+		float dy = currPos.y[springB[s]] - currPos.y[springA[s]];
+		float dz = currPos.z[springB[s]] - currPos.z[springA[s]];
+		springRest[s] = std::sqrt(dx * dx + dy * dy + dz * dz);
+	}
+
+	// Each vertex's springs: first those it starts, then those it ends.  The
+	// springs are added in order, so every vertex sums its forces in the same
+	// order however the passes are split.
+	std::vector<std::uint32_t> start(vertexCount + 1, 0);
+	std::vector<std::uint32_t> firstCount(vertexCount, 0);
+	for (std::size_t s = 0; s < springA.size(); ++s)
+	{
+		++start[springA[s] + 1];
+		++start[springB[s] + 1];
+		++firstCount[springA[s]];
+	}
+	std::partial_sum(start.begin(), start.end(), start.begin());
+	std::vector<std::uint32_t> secondCursor(vertexCount);
+	for (std::size_t v = 0; v < vertexCount; ++v)
+	{
+		springBegin[v] = springEnd[v] = start[v];
+		springSplit[v] = secondCursor[v] = start[v] + firstCount[v];
+	}
+	vertexSprings.resize(start.back());
+	for (std::size_t s = 0; s < springA.size(); ++s)
+	{
+		vertexSprings[springEnd[springA[s]]++] = static_cast<std::uint32_t>(s);
+		vertexSprings[secondCursor[springB[s]]++] = static_cast<std::uint32_t>(s);
+	}
+	for (std::size_t v = 0; v < vertexCount; ++v)
+		springEnd[v] = secondCursor[v];
+
+	std::fill(start.begin(), start.end(), 0);
+	for (std::uint32_t v : indices)
+		++start[v + 1];
+	std::partial_sum(start.begin(), start.end(), start.begin());
+	std::copy(start.begin(), start.end() - 1, triangleBegin.begin());
+	std::copy(start.begin(), start.end() - 1, triangleEnd.begin());
+	vertexTriangles.resize(indices.size());
+	for (std::size_t k = 0; k < indices.size(); ++k)
+		vertexTriangles[triangleEnd[indices[k]]++] = static_cast<std::uint32_t>(k / 3);
+
+	// Per spring and per triangle state.
+	std::size_t springStride = (springA.size() + 7) & ~std::size_t(7);
+	std::size_t triangleStride = (triangleCount + 7) & ~std::size_t(7);
+	springStorage.assign(3 * (springStride + triangleStride), 0.0f);
+	float* p = springStorage.data();
+	springForce.x = p;
+	springForce.y = p + springStride;
+	springForce.z = p + 2 * springStride;
+	p += 3 * springStride;
+	faceNormals.x = p;
+	faceNormals.y = p + triangleStride;
+	faceNormals.z = p + 2 * triangleStride;
+
+	brokenSprings.resize(springA.size());
+	brokenCounts.assign((springA.size() + SpringGrain - 1) / SpringGrain, 0);
+	cutEdges.assign(triangleCount, 0);
+	triangleChanged.assign(triangleCount, 0);
+
+	UpdateNormals(nullptr);
+}
+
+void FabricMesh::AllocateVertices(std::size_t capacity)
+{
+	// Moves the state of the vertices there are into room for capacity.
+	std::size_t stride = (capacity + 7) & ~std::size_t(7);
+	std::vector<float, AlignedAllocator<float, 32>> resized(3 * stride * 4, 0.0f);
+	Float3SoA* fields[] = { &prevPos, &currPos, &velocity, &normals };
+	float* p = resized.data();
+	for (Float3SoA* f : fields)
+	{
+		if (f->x != nullptr)
+		{
+			std::copy(f->x, f->x + vertexCount, p);
+			std::copy(f->y, f->y + vertexCount, p + stride);
+			std::copy(f->z, f->z + vertexCount, p + 2 * stride);
+		}
+		f->x = p;
+		f->y = p + stride;
+		f->z = p + 2 * stride;
+		p += 3 * stride;
+	}
+	storage.swap(resized);
+
+	vertexCapacity = capacity;
+	pinned.resize(capacity, 0);
+	meshVertex.resize(capacity);
+	springBegin.resize(capacity);
+	springSplit.resize(capacity);
+	springEnd.resize(capacity);
+	triangleBegin.resize(capacity);
+	triangleEnd.resize(capacity);
+}
+
+// Cuthill-McKee numbers the vertices breadth first, taking the neighbours of each
+// vertex in order of increasing degree, from a start vertex far from the rest of its
+// component; reversing the order narrows the profile further.  The start vertex is
+// found with the George-Liu search: go to the lowest degree vertex of the last
+// breadth-first level for as long as that makes the levels deeper.
+std::vector<std::uint32_t> FabricMesh::ReverseCuthillMcKee(std::size_t count,
+	const std::vector<std::uint32_t>& start, const std::vector<std::uint32_t>& adjacent)
+{
+	auto degree = [&start](std::uint32_t v) { return start[v + 1] - start[v]; };
+	auto byDegree = [&degree](std::uint32_t a, std::uint32_t b)
+	{
+		return degree(a) < degree(b) || (degree(a) == degree(b) && a < b);
+	};
+
+	std::vector<std::uint32_t> order;
+	order.reserve(count);
+	std::vector<std::uint32_t> level(count, UINT32_MAX);
+	std::vector<std::uint8_t> numbered(count, 0);
+
+	// Components are started from their lowest degree vertex.
+	std::vector<std::uint32_t> candidates(count);
+	std::iota(candidates.begin(), candidates.end(), 0u);
+	std::sort(candidates.begin(), candidates.end(), byDegree);
+
+	std::vector<std::uint32_t> queue;
+	queue.reserve(count);
+
+	// Breadth first from root over the unnumbered vertices; leaves the visited
+	// ones in queue and returns the number of levels.
+	auto levels = [&](std::uint32_t root)
+	{
+		for (std::uint32_t v : queue)
+			level[v] = UINT32_MAX;
+		queue.assign(1, root);
+		level[root] = 0;
+		for (std::size_t k = 0; k < queue.size(); ++k)
+		{
+			std::uint32_t v = queue[k];
+			for (std::uint32_t e = start[v]; e < start[v + 1]; ++e)
+			{
+				std::uint32_t w = adjacent[e];
+				if (!numbered[w] && level[w] == UINT32_MAX)
+				{
+					level[w] = level[v] + 1;
+					queue.push_back(w);
+				}
+			}
+		}
+		return level[queue.back()] + 1;
+	};
+
+	std::vector<std::uint32_t> neighbours;
+	for (std::uint32_t seed : candidates)
+	{
+		if (numbered[seed])
+			continue;
+
+		std::uint32_t root = seed;
+		std::uint32_t depth = levels(root);
+		for (;;)
+		{
+			std::uint32_t last = level[queue.back()];
+			std::uint32_t best = queue.back();
+			for (std::uint32_t v : queue)
+			{
+				if (level[v] == last && byDegree(v, best))
+					best = v;
+			}
+			std::uint32_t bestDepth = levels(best);
+			if (bestDepth <= depth)
+				break;
+			root = best;
+			depth = bestDepth;
+		}
+		for (std::uint32_t v : queue)
+			level[v] = UINT32_MAX;
+		queue.clear();
+
+		std::size_t head = order.size();
+		order.push_back(root);
+		numbered[root] = 1;
+		for (; head < order.size(); ++head)
+		{
+			std::uint32_t v = order[head];
+			neighbours.clear();
+			for (std::uint32_t e = start[v]; e < start[v + 1]; ++e)
+			{
+				std::uint32_t w = adjacent[e];
+				if (!numbered[w])
+				{
+					numbered[w] = 1;
+					neighbours.push_back(w);
+				}
+			}
+			std::sort(neighbours.begin(), neighbours.end(), byDegree);
+			order.insert(order.end(), neighbours.begin(), neighbours.end());
+		}
+	}
+
+	std::reverse(order.begin(), order.end());
+	return order;
+}
+
+std::size_t FabricMesh::Bandwidth() const
+{
+	std::size_t width = 0;
+	for (std::size_t s = 0; s < bendEnd; ++s)
+	{
+		if (s == stretchEnd)
+			s = bendStart;
+		if (s < bendEnd)
+			width = std::max<std::size_t>(width, springA[s] < springB[s] ? springB[s] - springA[s] : springA[s] - springB[s]);
+	}
+	return width;
+}
+
+void FabricMesh::SetPinned(std::size_t i, bool pin)
+{
+	pinned[i] = pin ? 1 : 0;
+	velocity.x[i] = 0.0f;
+	velocity.y[i] = 0.0f;
+	velocity.z[i] = 0.0f;
+}
+
+void FabricMesh::SetPosition(std::size_t i, const XMFLOAT3& p)
+{
+	prevPos.x[i] = currPos.x[i] = p.x;
+	prevPos.y[i] = currPos.y[i] = p.y;
+	prevPos.z[i] = currPos.z[i] = p.z;
+}
+
+void FabricMesh::Update(float frameTime, float windX, float windY, float windZ)
+{
+	ResetChanges();
+	int steps = stepper.Advance(frameTime);
+	for (int s = 0; s < steps; ++s)
+		Step(windX, windY, windZ);
+}
+
+void FabricMesh::Update(float frameTime, float windX, float windY, float windZ, const VertexSpan& out)
+{
+	ResetChanges();
+	int steps = stepper.Advance(frameTime);
+	if (steps == 0)
+		WriteVertices(out);
+	for (int s = 0; s < steps; ++s)
+		Step(windX, windY, windZ, s == steps - 1 ? &out : nullptr);
+}
+
+void FabricMesh::WriteVertices(const VertexSpan& out) const
+{
+	ThreadPool::Default().ParallelForRange(0, vertexCount, VertexGrain, [this, &out](std::size_t first, std::size_t last)
+		{
+			WriteVertexRange(first, last, out);
+		});
+}
+
+void FabricMesh::WriteVertexRange(std::size_t first, std::size_t last, const VertexSpan& out) const
+{
+	float a = stepper.Alpha();
+	VertexSpanWriter writer(out, first);
+	for (std::size_t i = first; i < last; ++i)
+	{
+		XMFLOAT3 p(
+			prevPos.x[i] + (currPos.x[i] - prevPos.x[i]) * a,
+			prevPos.y[i] + (currPos.y[i] - prevPos.y[i]) * a,
+			prevPos.z[i] + (currPos.z[i] - prevPos.z[i]) * a);
+		writer.Write(p, Load(normals, i));
+	}
+}
+
+void FabricMesh::Step(float windX, float windY, float windZ, const VertexSpan* out)
+{
+	ThreadPool& pool = ThreadPool::Default();
+
+	pool.ParallelForRange(0, bendEnd, SpringGrain, [this](std::size_t first, std::size_t last)
+		{
+			ComputeSpringRange(first, last);
+		});
+	pool.ParallelForRange(0, vertexCount, VertexGrain, [this, windX, windY, windZ](std::size_t first, std::size_t last)
+		{
+			IntegrateRange(first, last, windX, windY, windZ);
+		});
+	if (tearStretch > 0.0f)
+		Tear();
+
+	// prevPos now holds the new positions; make them current and
+	// rebuild the normals from them.
+	std::swap(prevPos, currPos);
+	UpdateNormals(out);
+}
+
+void FabricMesh::ComputeSpringRange(std::size_t first, std::size_t last)
+{
+	// The range may take in the end of the stretch springs, the torn ones
+	// after them and the start of the bend springs.  Only stretch springs
+	// break.
+	const float breakStretch = tearStretch > 0.0f ? tearStretch : INFINITY;
+	std::uint32_t* broken = brokenSprings.data() + first;
+	std::size_t brokenCount = 0;
+
+	std::size_t split = std::min(stretchEnd, last);
+	if (first < split)
+	{
+		brokenCount = springKernel(currPos, velocity, springA.data(), springB.data(), springRest.data(),
+			first, split - first, shortSpring, shortDamp, breakStretch, springForce, broken);
+	}
+	split = std::max(first, bendStart);
+	if (split < last)
+	{
+		springKernel(currPos, velocity, springA.data(), springB.data(), springRest.data(),
+			split, last - split, longSpring, longDamp, INFINITY, springForce, broken);
+	}
+	brokenCounts[first / SpringGrain] = static_cast<std::uint32_t>(brokenCount);
+}
+
+void FabricMesh::IntegrateRange(std::size_t first, std::size_t last, float windX, float windY, float windZ)
+{
+	const float invMass = 1 / mass;
+	for (std::size_t i = first; i < last; ++i)
+	{
+		if (pinned[i])
+		{
+			prevPos.x[i] = currPos.x[i];
+			prevPos.y[i] = currPos.y[i];
+			prevPos.z[i] = currPos.z[i];
+			continue;
+		}
+
+		// Wind, each axis with its own component, and gravity; then the
+		// springs this vertex starts pull it along and the ones it ends push
+		// it back.
+		float fx = wind_infl * normals.x[i] * (windX + velocity.x[i]);
+		float fy = mass * gravity + wind_infl * normals.y[i] * (windY + velocity.y[i]);
+		float fz = wind_infl * normals.z[i] * (windZ + velocity.z[i]);
+
+		std::uint32_t k = springBegin[i];
+		for (; k < springSplit[i]; ++k)
+		{
+			std::uint32_t s = vertexSprings[k];
+			fx += springForce.x[s];
+			fy += springForce.y[s];
+			fz += springForce.z[s];
+		}
+		for (; k < springEnd[i]; ++k)
+		{
+			std::uint32_t s = vertexSprings[k];
+			fx -= springForce.x[s];
+			fy -= springForce.y[s];
+			fz -= springForce.z[s];
+		}
+
+		// Symplectic Euler: the velocity takes the whole step's acceleration,
+		// and the position moves by the new velocity.
+		velocity.x[i] += fx * invMass * dt;
+		velocity.y[i] += fy * invMass * dt;
+		velocity.z[i] += fz * invMass * dt;
+
+		prevPos.x[i] = currPos.x[i] + velocity.x[i] * dt;
+		prevPos.y[i] = currPos.y[i] + velocity.y[i] * dt;
+		prevPos.z[i] = currPos.z[i] + velocity.z[i] * dt;
+	}
+}
+
+void FabricMesh::UpdateNormals(const VertexSpan* out)
+{
+	ThreadPool& pool = ThreadPool::Default();
+
+	pool.ParallelForRange(0, indices.size() / 3, VertexGrain, [this](std::size_t first, std::size_t last)
+		{
+			ComputeFaceNormalRange(first, last);
+		});
+	pool.ParallelForRange(0, vertexCount, VertexGrain, [this, out](std::size_t first, std::size_t last)
+		{
+			UpdateNormalRange(first, last, out);
+		});
+}
+
+void FabricMesh::ComputeFaceNormalRange(std::size_t first, std::size_t last)
+{
+	// The cross product of two edges: twice the area, so bigger triangles
+	// weigh more in the vertex normals.
+	for (std::size_t t = first; t < last; ++t)
+	{
+		std::uint32_t a = indices[3 * t];
+		std::uint32_t b = indices[3 * t + 1];
+		std::uint32_t c = indices[3 * t + 2];
+
+		float ux = currPos.x[b] - currPos.x[a];
+		float uy = currPos.y[b] - currPos.y[a];
+		float uz = currPos.z[b] - currPos.z[a];
+		float vx = currPos.x[c] - currPos.x[a];
+		float vy = currPos.y[c] - currPos.y[a];
+		float vz = currPos.z[c] - currPos.z[a];
+
+		faceNormals.x[t] = uy * vz - uz * vy;
+		faceNormals.y[t] = uz * vx - ux * vz;
+		faceNormals.z[t] = ux * vy - uy * vx;
+	}
+}
+
+void FabricMesh::UpdateNormalRange(std::size_t first, std::size_t last, const VertexSpan* out)
+{
+	for (std::size_t i = first; i < last; ++i)
+	{
+		float nx = 0.0f, ny = 0.0f, nz = 0.0f;
+		for (std::uint32_t k = triangleBegin[i]; k < triangleEnd[i]; ++k)
+		{
+			std::uint32_t t = vertexTriangles[k];
+			nx += faceNormals.x[t];
+			ny += faceNormals.y[t];
+			nz += faceNormals.z[t];
+		}
+
+		// A vertex whose triangles all collapsed keeps the normal it had.
+		float lenSq = nx * nx + ny * ny + nz * nz;
+		if (lenSq > 0.0f)
+		{
+			float invLen = 1 / std::sqrt(lenSq);
+			normals.x[i] = nx * invLen;
+			normals.y[i] = ny * invLen;
+			normals.z[i] = nz * invLen;
+		}
+	}
+
+	if (out != nullptr)
+		WriteVertexRange(first, last, *out);
+}
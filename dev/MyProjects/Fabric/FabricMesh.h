@@ -0,0 +1,253 @@
+//***************************************************************************************
+// FabricMesh.h by llyr-who (C) 2011 All Rights Reserved.
+//
+// Cloth on any triangle mesh instead of Fabric's regular grid: sleeves, capes, sails.
+// The spring graph is built from the mesh once.  Every edge becomes a stretch spring
+// (the diagonal of a triangulated quad is a shear spring), and every edge between two
+// triangles gets a bend spring joining the two vertices opposite it.  Vertices that
+// share a position, as along the seam of a cylinder, are welded into one.
+//
+// The vertices are then renumbered by reverse Cuthill-McKee, so the ends of every
+// spring lie close together in memory, and the springs are sorted by their first end.
+// A step computes each spring's force once, in a streaming pass over the springs, and
+// each vertex sums the forces of its springs through a compressed sparse row list.
+// No two threads write the same entry, so the result does not depend on the thread
+// count, and a mesh authored in any vertex order runs about as fast as a grid.
+//
+// Vertices are numbered in solver order throughout; SolverVertex maps a vertex of the
+// source mesh to its solver vertex, and Indices gives the triangles renumbered to
+// match, for the index buffer.  Integration is symplectic Euler, which is explicit:
+// with Fabric's usual springs it needs a step of 0.01 s or less to stay stable.
+//
+// The cloth may tear (see SetTearing).  A torn spring is dropped from the lists in
+// place, and a vertex whose triangles the tear has cut into separate fans is
+// duplicated, one copy per fan, appended past the last vertex.  Only the indices of
+// the triangles that changed are rewritten, so a step costs as much more as it has
+// torn springs, not as the cloth is large.
+//***************************************************************************************
+
+#ifndef FABRICMESH_H
+#define FABRICMESH_H
+
+#include <cstdint>
+#include <vector>
+#include <DirectXMath.h>
+#include "../../Common/AlignedAllocator.h"
+#include "../../Common/FixedTimestep.h"
+#include "../../Common/GeometryGenerator.h"
+#include "../../Common/VertexSpan.h"
+#include "FabricKernels.h"
+
+class FabricMesh
+{
+public:
+	// spring1 and damp1 are the stretch and shear springs, spring2 and damp2
+	// the bend springs; their rest lengths are taken from the mesh.  reorder
+	// false keeps the mesh's own vertex order, for comparison.
+	FabricMesh(const GeometryGenerator::MeshData& mesh, float ddt, float spring1, float spring2,
+		float damp1, float damp2, float M, bool reorder = true);
+	FabricMesh(const FabricMesh& rhs) = delete;
+	FabricMesh& operator=(const FabricMesh& rhs) = delete;
+
+	// VertexCount grows as the cloth tears, up to VertexCapacity.
+	std::size_t VertexCount() const { return vertexCount; }
+	std::size_t VertexCapacity() const { return vertexCapacity; }
+	std::size_t TriangleCount() const { return indices.size() / 3; }
+	// Springs still holding.
+	std::size_t SpringCount() const { return stretchEnd + (bendEnd - bendStart); }
+
+	// The triangles in solver numbering, three indices each.
+	const std::vector<std::uint32_t>& Indices() const { return indices; }
+
+	// The solver vertex of vertex i of the source mesh, and a mesh vertex of
+	// solver vertex i (the first one, where several were welded).  A vertex a
+	// tear split off maps back to the mesh vertex it was split from; the
+	// mesh vertex keeps mapping to the original.
+	std::uint32_t SolverVertex(std::size_t meshVertex) const { return solverVertex[meshVertex]; }
+	std::uint32_t MeshVertex(std::size_t i) const { return meshVertex[i]; }
+
+	// The largest index distance between the ends of a spring; what the
+	// reordering brings down.
+	std::size_t Bandwidth() const;
+
+	DirectX::XMFLOAT3 Position(std::size_t i) const { return Load(currPos, i); }
+
+	// Returns the ith vertex blended between the last two steps by
+	// InterpolationAlpha(), for smooth rendering between fixed steps.
+	DirectX::XMFLOAT3 InterpolatedPosition(std::size_t i) const
+	{
+		float a = stepper.Alpha();
+		return DirectX::XMFLOAT3(
+			prevPos.x[i] + (currPos.x[i] - prevPos.x[i]) * a,
+			prevPos.y[i] + (currPos.y[i] - prevPos.y[i]) * a,
+			prevPos.z[i] + (currPos.z[i] - prevPos.z[i]) * a);
+	}
+
+	// The area-weighted normal of the triangles around the ith vertex.
+	DirectX::XMFLOAT3 Normal(std::size_t i) const { return Load(normals, i); }
+
+	// A pinned vertex never moves on its own; SetPosition moves it, and the
+	// cloth follows.  Nothing is pinned at first.
+	void SetPinned(std::size_t i, bool pinned);
+	bool IsPinned(std::size_t i) const { return pinned[i] != 0; }
+	void SetPosition(std::size_t i, const DirectX::XMFLOAT3& p);
+
+	// Picks the instruction set of the spring pass, as Fabric::SetSimdLevel.
+	void SetSimdLevel(SimdLevel level);
+	SimdLevel GetSimdLevel() const { return simdLevel; }
+
+	float TimeStep() const { return dt; }
+	void SetMaxSubsteps(int maxSubsteps) { stepper.SetMaxSubsteps(maxSubsteps); }
+	float InterpolationAlpha() const { return stepper.Alpha(); }
+
+	// Advances the simulation by frameTime, running as many fixed steps as
+	// fit and carrying the remainder over to the next call.
+	void Update(float frameTime, float windX, float windY, float windZ);
+
+	// Update that also leaves InterpolatedPosition and Normal of every vertex
+	// in out, which must hold VertexCount() vertices, written by the last
+	// step's normal pass.
+	void Update(float frameTime, float windX, float windY, float windZ, const VertexSpan& out);
+
+	// Writes InterpolatedPosition and Normal of every vertex into out, in parallel.
+	void WriteVertices(const VertexSpan& out) const;
+
+	// Tearing: a stretch spring longer than maxStretch times its rest length
+	// breaks, along with the bend spring across it, and the cloth splits
+	// along the broken edges.  Room is made for maxNewVertices vertices to be
+	// split off; once it is used up, springs still break but vertices stay
+	// whole.  A maxStretch of 0 turns tearing off, which is the default.
+	// Call between steps; the first call allocates the room.
+	void SetTearing(float maxStretch, std::size_t maxNewVertices);
+	float TearStretch() const { return tearStretch; }
+
+	// Springs torn by the last Update, and the triangles whose indices it
+	// changed, in the order they first changed.  The renderer re-uploads
+	// those triangles of Indices and grows its vertex buffer to VertexCount.
+	std::size_t LastTornSprings() const { return tornSprings; }
+	const std::vector<std::uint32_t>& ChangedTriangles() const { return changedTriangles; }
+
+	// Checks that the indices, the springs' corners and the spring and
+	// triangle rows of every vertex agree, as tearing must leave them.  Walks
+	// everything; for tests.
+	bool CheckTopology() const;
+private:
+	void Build(const GeometryGenerator::MeshData& mesh, bool reorder);
+	void AllocateVertices(std::size_t capacity);
+	static std::vector<std::uint32_t> ReverseCuthillMcKee(std::size_t count,
+		const std::vector<std::uint32_t>& start, const std::vector<std::uint32_t>& adjacent);
+
+	void Step(float windX, float windY, float windZ, const VertexSpan* out = nullptr);
+
+	// The passes of a step, each over a range of springs, vertices or triangles.
+	void ComputeSpringRange(std::size_t first, std::size_t last);
+	void IntegrateRange(std::size_t first, std::size_t last, float windX, float windY, float windZ);
+	void ComputeFaceNormalRange(std::size_t first, std::size_t last);
+	void UpdateNormalRange(std::size_t first, std::size_t last, const VertexSpan* out);
+	void UpdateNormals(const VertexSpan* out);
+	void WriteVertexRange(std::size_t first, std::size_t last, const VertexSpan& out) const;
+
+	// Tearing, in FabricMeshTearing.cpp.  Runs after the integrate pass, on
+	// the springs the spring pass found overstretched.
+	void Tear();
+	void TearSpring(std::uint32_t s);
+	void RemoveSpring(std::uint32_t s);
+	void RemoveSpringEntry(std::uint32_t v, std::uint32_t s);
+	void SplitVertex(std::uint32_t v);
+	std::uint32_t TriangleEdge(std::uint32_t t, std::uint32_t v0, std::uint32_t v1) const;
+	void MarkChanged(std::uint32_t t);
+	void ResetChanges();
+
+	static DirectX::XMFLOAT3 Load(const Float3SoA& v, std::size_t i)
+	{
+		return DirectX::XMFLOAT3(v.x[i], v.y[i], v.z[i]);
+	}
+
+	// Items per task of the parallel passes.
+	static const std::size_t VertexGrain = 1024;
+	static const std::size_t SpringGrain = 4096;
+
+	std::size_t vertexCount;
+	std::size_t vertexCapacity;
+
+	float dt;
+	float mass;
+	float gravity = -9.81f;
+	float wind_infl = 0.5f;
+
+	float shortSpring;
+	float shortDamp;
+	float longSpring;
+	float longDamp;
+
+	FixedTimestep stepper;
+
+	SimdLevel simdLevel;
+	IndexedSpringKernel springKernel;
+
+	// The springs: the stretch and shear ones from 0 to stretchEnd, the bend
+	// ones from bendStart to bendEnd; those between are torn.  Every spring
+	// also names the two triangle corners (3 * triangle + corner) its ends
+	// are the vertices of, which is how a split vertex finds its springs.
+	// Both runs start out sorted by springA, with springA < springB.
+	std::vector<std::uint32_t> springA;
+	std::vector<std::uint32_t> springB;
+	std::vector<std::uint32_t> cornerA;
+	std::vector<std::uint32_t> cornerB;
+	std::vector<float> springRest;
+	std::size_t stretchEnd;
+	std::size_t bendStart;
+	std::size_t bendEnd;
+
+	// The springs of vertex v in vertexSprings, from springBegin[v] to
+	// springEnd[v]: those it is springA of up to springSplit[v], then those
+	// it is springB of.  A split vertex gets its row appended at the end.
+	std::vector<std::uint32_t> springBegin;
+	std::vector<std::uint32_t> springSplit;
+	std::vector<std::uint32_t> springEnd;
+	std::vector<std::uint32_t> vertexSprings;
+
+	// The triangles of vertex v, as indices of the triangles in indices, in
+	// vertexTriangles from triangleBegin[v] to triangleEnd[v].
+	std::vector<std::uint32_t> indices;
+	std::vector<std::uint32_t> triangleBegin;
+	std::vector<std::uint32_t> triangleEnd;
+	std::vector<std::uint32_t> vertexTriangles;
+
+	std::vector<std::uint32_t> solverVertex;
+	std::vector<std::uint32_t> meshVertex;
+	std::vector<std::uint8_t> pinned;
+
+	// Tearing state.  The spring pass leaves the overstretched springs of the
+	// range starting at spring s in brokenSprings from s on, and their count
+	// in brokenCounts[s / SpringGrain].  cutEdges has a bit per edge of every
+	// triangle, edge k running from corner k to corner k + 1, set once torn.
+	float tearStretch = 0.0f;
+	std::vector<std::uint32_t> brokenSprings;
+	std::vector<std::uint32_t> brokenCounts;
+	std::vector<std::uint8_t> cutEdges;
+	std::vector<std::uint8_t> triangleChanged;
+	std::vector<std::uint32_t> changedTriangles;
+	std::size_t tornSprings = 0;
+
+	// SplitVertex's triangles, their fan numbers and its search stack, kept
+	// so a split allocates nothing once they have grown to the largest fan.
+	std::vector<std::uint32_t> splitTriangles;
+	std::vector<std::uint32_t> splitLabels;
+	std::vector<std::uint32_t> splitStack;
+
+	// Each component array is padded to a multiple of 8 floats, so each one
+	// starts on a 32-byte boundary.
+	std::vector<float, AlignedAllocator<float, 32>> storage;
+	Float3SoA prevPos;
+	Float3SoA currPos;
+	Float3SoA velocity;
+	Float3SoA normals;
+	// The force of every spring on its first end, and the doubled-area
+	// normal of every triangle.
+	Float3SoA springForce;
+	Float3SoA faceNormals;
+	std::vector<float, AlignedAllocator<float, 32>> springStorage;
+};
+
+#endif
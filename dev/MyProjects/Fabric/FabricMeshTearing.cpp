@@ -0,0 +1,342 @@
+//***************************************************************************************
+// FabricMeshTearing.cpp by llyr-who (C) 2011 All Rights Reserved.
+//
+// Tears a FabricMesh along its overstretched springs.  The spring pass already lists
+// them, so a step without a tear pays nothing here.  Each torn spring is taken out of
+// the spring lists and the rows of its two vertices, the bend spring hinged on the same
+// edge goes with it, and the edge is marked cut in both its triangles.
+//
+// Then each end of the edge is checked for a split: its triangles are grouped into
+// fans, two triangles being in the same fan when they share an uncut edge at the
+// vertex.  The first fan keeps the vertex; every other one gets a copy of it, appended
+// past the last vertex, and its triangles' corners are pointed at the copy.  A spring
+// names the corners its ends are, so it follows its corners to the copy.  All of it
+// runs on one thread, in spring order, so at a given SIMD level a tear comes out the
+// same on any thread count.
+//***************************************************************************************
+
+#include"FabricMesh.h"
+
+#include <algorithm>
+
+void FabricMesh::SetTearing(float maxStretch, std::size_t maxNewVertices)
+{
+	tearStretch = maxStretch;
+	if (vertexCount + maxNewVertices > vertexCapacity)
+	{
+		AllocateVertices(vertexCount + maxNewVertices);
+
+		// A split vertex appends its rows, a few dozen entries at most.
+		vertexSprings.reserve(vertexSprings.size() + 16 * maxNewVertices);
+		vertexTriangles.reserve(vertexTriangles.size() + 8 * maxNewVertices);
+	}
+}
+
+void FabricMesh::ResetChanges()
+{
+	for (std::uint32_t t : changedTriangles)
+		triangleChanged[t] = 0;
+	changedTriangles.clear();
+	tornSprings = 0;
+}
+
+void FabricMesh::MarkChanged(std::uint32_t t)
+{
+	if (!triangleChanged[t])
+	{
+		triangleChanged[t] = 1;
+		changedTriangles.push_back(t);
+	}
+}
+
+void FabricMesh::Tear()
+{
+	// Move the spring pass's lists together, range by range.  A range's list
+	// starts at its first spring, never before where the previous one ended.
+	std::size_t count = 0;
+	std::size_t rangeCount = (bendEnd + SpringGrain - 1) / SpringGrain;
+	for (std::size_t r = 0; r < rangeCount; ++r)
+	{
+		const std::uint32_t* list = brokenSprings.data() + r * SpringGrain;
+		std::copy(list, list + brokenCounts[r], brokenSprings.data() + count);
+		count += brokenCounts[r];
+	}
+
+	// Highest first: removing a spring moves the last one into its place,
+	// and the last one is then never still to come.
+	while (count > 0)
+		TearSpring(brokenSprings[--count]);
+}
+
+void FabricMesh::TearSpring(std::uint32_t s)
+{
+	std::uint32_t a = springA[s];
+	std::uint32_t b = springB[s];
+	std::uint32_t t0 = cornerA[s] / 3;
+	RemoveSpring(s);
+	++tornSprings;
+
+	std::uint32_t e0 = TriangleEdge(t0, a, b);
+	cutEdges[t0] |= 1 << e0;
+
+	// The triangle across the edge, if any, loses its half of the edge, and
+	// the bend spring between the two corners facing it goes.
+	for (std::uint32_t k = triangleBegin[a]; k < triangleEnd[a]; ++k)
+	{
+		std::uint32_t t1 = vertexTriangles[k];
+		std::uint32_t e1 = TriangleEdge(t1, a, b);
+		if (t1 == t0 || e1 == 3)
+			continue;
+
+		cutEdges[t1] |= 1 << e1;
+		std::uint32_t o0 = 3 * t0 + (e0 + 2) % 3;
+		std::uint32_t o1 = 3 * t1 + (e1 + 2) % 3;
+		std::uint32_t c = indices[o0];
+		for (std::uint32_t j = springBegin[c]; j < springEnd[c]; ++j)
+		{
+			std::uint32_t q = vertexSprings[j];
+			if (q >= bendStart && ((cornerA[q] == o0 && cornerB[q] == o1) || (cornerA[q] == o1 && cornerB[q] == o0)))
+			{
+				RemoveSpring(q);
+				break;
+			}
+		}
+		break;
+	}
+
+	SplitVertex(a);
+	SplitVertex(b);
+}
+
+std::uint32_t FabricMesh::TriangleEdge(std::uint32_t t, std::uint32_t v0, std::uint32_t v1) const
+{
+	// The edge of t from corner k to corner k + 1 that joins v0 and v1, or 3.
+	for (std::uint32_t k = 0; k < 3; ++k)
+	{
+		std::uint32_t i0 = indices[3 * t + k];
+		std::uint32_t i1 = indices[3 * t + (k + 1) % 3];
+		if ((i0 == v0 && i1 == v1) || (i0 == v1 && i1 == v0))
+			return k;
+	}
+	return 3;
+}
+
+void FabricMesh::RemoveSpring(std::uint32_t s)
+{
+	RemoveSpringEntry(springA[s], s);
+	RemoveSpringEntry(springB[s], s);
+
+	// The last live spring of the same kind fills the hole, and the rows of
+	// its ends are pointed at its new place.
+	std::uint32_t last = static_cast<std::uint32_t>(s < bendStart ? --stretchEnd : --bendEnd);
+	if (last == s)
+		return;
+
+	springA[s] = springA[last];
+	springB[s] = springB[last];
+	cornerA[s] = cornerA[last];
+	cornerB[s] = cornerB[last];
+	springRest[s] = springRest[last];
+	for (std::uint32_t v : { springA[s], springB[s] })
+	{
+		for (std::uint32_t k = springBegin[v]; k < springEnd[v]; ++k)
+		{
+			if (vertexSprings[k] == last)
+				vertexSprings[k] = s;
+		}
+	}
+}
+
+void FabricMesh::RemoveSpringEntry(std::uint32_t v, std::uint32_t s)
+{
+	std::uint32_t* row = vertexSprings.data();
+	std::uint32_t* entry = std::find(row + springBegin[v], row + springEnd[v], s);
+	if (entry == row + springEnd[v])
+		return;
+
+	// Shifting the rest down keeps the order the forces are summed in.
+	std::copy(entry + 1, row + springEnd[v], entry);
+	if (entry < row + springSplit[v])
+		--springSplit[v];
+	--springEnd[v];
+}
+
+void FabricMesh::SplitVertex(std::uint32_t v)
+{
+	std::vector<std::uint32_t>& fan = splitTriangles;
+	fan.assign(vertexTriangles.begin() + triangleBegin[v], vertexTriangles.begin() + triangleEnd[v]);
+
+	// Two triangles at v are in the same fan when they share an edge from v
+	// that neither has cut.
+	auto joined = [this, v](std::uint32_t t0, std::uint32_t t1)
+	{
+		for (std::uint32_t k = 0; k < 3; ++k)
+		{
+			std::uint32_t w = indices[3 * t0 + k];
+			if (w == v)
+				continue;
+			std::uint32_t e0 = TriangleEdge(t0, v, w);
+			std::uint32_t e1 = TriangleEdge(t1, v, w);
+			if (e1 != 3 && !(cutEdges[t0] & (1 << e0)) && !(cutEdges[t1] & (1 << e1)))
+				return true;
+		}
+		return false;
+	};
+
+	std::vector<std::uint32_t>& label = splitLabels;
+	std::vector<std::uint32_t>& stack = splitStack;
+	label.assign(fan.size(), UINT32_MAX);
+	std::uint32_t fanCount = 0;
+	for (std::uint32_t i = 0; i < fan.size(); ++i)
+	{
+		if (label[i] != UINT32_MAX)
+			continue;
+		label[i] = fanCount;
+		stack.assign(1, i);
+		while (!stack.empty())
+		{
+			std::uint32_t j = stack.back();
+			stack.pop_back();
+			for (std::uint32_t k = 0; k < fan.size(); ++k)
+			{
+				if (label[k] == UINT32_MAX && joined(fan[j], fan[k]))
+				{
+					label[k] = fanCount;
+					stack.push_back(k);
+				}
+			}
+		}
+		++fanCount;
+	}
+
+	for (std::uint32_t f = 1; f < fanCount && vertexCount < vertexCapacity; ++f)
+	{
+		std::uint32_t copy = static_cast<std::uint32_t>(vertexCount++);
+		for (const Float3SoA* field : { &prevPos, &currPos, &velocity, &normals })
+		{
+			field->x[copy] = field->x[v];
+			field->y[copy] = field->y[v];
+			field->z[copy] = field->z[v];
+		}
+		pinned[copy] = pinned[v];
+		meshVertex[copy] = meshVertex[v];
+
+		triangleBegin[copy] = static_cast<std::uint32_t>(vertexTriangles.size());
+		for (std::size_t i = 0; i < fan.size(); ++i)
+		{
+			if (label[i] != f)
+				continue;
+			std::uint32_t t = fan[i];
+			for (std::uint32_t k = 0; k < 3; ++k)
+			{
+				if (indices[3 * t + k] == v)
+					indices[3 * t + k] = copy;
+			}
+			vertexTriangles.push_back(t);
+			MarkChanged(t);
+		}
+		triangleEnd[copy] = static_cast<std::uint32_t>(vertexTriangles.size());
+
+		// The springs whose corners went to the copy, in the order v had them.
+		springBegin[copy] = static_cast<std::uint32_t>(vertexSprings.size());
+		for (std::uint32_t k = springBegin[v]; k < springSplit[v]; ++k)
+		{
+			std::uint32_t q = vertexSprings[k];
+			if (springA[q] == v && indices[cornerA[q]] == copy)
+			{
+				springA[q] = copy;
+				vertexSprings.push_back(q);
+			}
+		}
+		springSplit[copy] = static_cast<std::uint32_t>(vertexSprings.size());
+		for (std::uint32_t k = springSplit[v]; k < springEnd[v]; ++k)
+		{
+			std::uint32_t q = vertexSprings[k];
+			if (springB[q] == v && indices[cornerB[q]] == copy)
+			{
+				springB[q] = copy;
+				vertexSprings.push_back(q);
+			}
+		}
+		springEnd[copy] = static_cast<std::uint32_t>(vertexSprings.size());
+	}
+
+	// Close up v's rows over what its copies took.
+	std::uint32_t* tri = vertexTriangles.data();
+	triangleEnd[v] = static_cast<std::uint32_t>(std::remove_if(tri + triangleBegin[v], tri + triangleEnd[v],
+		[this, v](std::uint32_t t)
+		{
+			return indices[3 * t] != v && indices[3 * t + 1] != v && indices[3 * t + 2] != v;
+		}) - tri);
+
+	std::uint32_t* row = vertexSprings.data();
+	std::uint32_t* split = std::remove_if(row + springBegin[v], row + springSplit[v],
+		[this, v](std::uint32_t q) { return springA[q] != v; });
+	std::uint32_t* end = std::remove_if(row + springSplit[v], row + springEnd[v],
+		[this, v](std::uint32_t q) { return springB[q] != v; });
+	end = std::copy(row + springSplit[v], end, split);
+	springSplit[v] = static_cast<std::uint32_t>(split - row);
+	springEnd[v] = static_cast<std::uint32_t>(end - row);
+}
+
+bool FabricMesh::CheckTopology() const
+{
+	for (std::uint32_t v : indices)
+	{
+		if (v >= vertexCount)
+			return false;
+	}
+
+	auto live = [this](std::uint32_t q) { return q < stretchEnd || (q >= bendStart && q < bendEnd); };
+	for (std::size_t q = 0; q < bendEnd; ++q)
+	{
+		if (live(std::uint32_t(q)) && (indices[cornerA[q]] != springA[q] || indices[cornerB[q]] != springB[q]))
+			return false;
+	}
+
+	// Every entry of a spring row is a live spring with v at the right end,
+	// and every live spring is in both its ends' rows: with as many entries
+	// as twice the live springs, each is there exactly once.
+	std::vector<std::uint8_t> seen(bendEnd, 0);
+	std::size_t springEntries = 0;
+	std::size_t triangleEntries = 0;
+	for (std::uint32_t v = 0; v < vertexCount; ++v)
+	{
+		if (springBegin[v] > springSplit[v] || springSplit[v] > springEnd[v] || triangleBegin[v] > triangleEnd[v])
+			return false;
+
+		for (std::uint32_t k = springBegin[v]; k < springEnd[v]; ++k)
+		{
+			std::uint32_t q = vertexSprings[k];
+			bool first = k < springSplit[v];
+			if (q >= bendEnd || !live(q) || (first ? springA[q] : springB[q]) != v)
+				return false;
+			seen[q] |= first ? 1 : 2;
+		}
+		springEntries += springEnd[v] - springBegin[v];
+
+		// Likewise every triangle in v's row has v as a corner, and every
+		// corner is in its vertex's row.
+		for (std::uint32_t k = triangleBegin[v]; k < triangleEnd[v]; ++k)
+		{
+			std::uint32_t t = vertexTriangles[k];
+			if (indices[3 * t] != v && indices[3 * t + 1] != v && indices[3 * t + 2] != v)
+				return false;
+		}
+		triangleEntries += triangleEnd[v] - triangleBegin[v];
+	}
+
+	for (std::size_t q = 0; q < bendEnd; ++q)
+	{
+		if (live(std::uint32_t(q)) && seen[q] != 3)
+			return false;
+	}
+	for (std::uint32_t c = 0; c < indices.size(); ++c)
+	{
+		const std::uint32_t* row = vertexTriangles.data();
+		std::uint32_t v = indices[c];
+		if (std::find(row + triangleBegin[v], row + triangleEnd[v], c / 3) == row + triangleEnd[v])
+			return false;
+	}
+	return springEntries == 2 * SpringCount() && triangleEntries == indices.size();
+}
@@ -0,0 +1,172 @@
+//***************************************************************************************
+// FabricSleep.cpp by llyr-who (C) 2011 All Rights Reserved.
+//
+// Puts the calm parts of a cloth to sleep.  After every step each awake row block
+// finds the largest kinetic energy of its vertices.  A block below the threshold
+// counts one more calm step, and once it has counted sleepSteps of them it freezes:
+// its velocities are zeroed and its old positions set to its new ones, so the swap at
+// the end of a step leaves it as it is, and its bounding box is kept for the colliders.
+// A block above the threshold resets the count of itself and both its neighbours,
+// waking them if they sleep, so motion spreads into a sleeping region the way it
+// would through its springs, and a block next to a moving one never falls asleep.
+//
+// The passes skip a sleeping block, except where a block beside it needs its springs
+// or normals.  A cloth whose blocks all sleep skips the step entirely, after checking
+// the wind and the colliders.  The decisions are made on one thread, in block order,
+// so they do not depend on the thread count.
+//***************************************************************************************
+
+#include"Fabric.h"
+#include"../../Common/ThreadPool.h"
+
+#include <algorithm>
+#include <cmath>
+
+void Fabric::SetSleeping(float energy, int steps)
+{
+	sleepEnergy = energy;
+	sleepSteps = std::max(steps, 1);
+	sleepingBlocks = 0;
+	if (energy > 0.0f)
+	{
+		blockSleep.assign(BlockCount(), 0);
+		blockEnergy.assign(BlockCount(), 0.0f);
+		sleepBounds.resize(BlockCount());
+	}
+	else
+	{
+		blockSleep.clear();
+		blockEnergy.clear();
+		sleepBounds.clear();
+	}
+}
+
+void Fabric::Wake()
+{
+	std::fill(blockSleep.begin(), blockSleep.end(), 0);
+	sleepingBlocks = 0;
+}
+
+bool Fabric::CheckSleep(float windX, float windY, float windZ)
+{
+	if (blockSleep.empty())
+		return false;
+
+	if (windX != sleepWind[0] || windY != sleepWind[1] || windZ != sleepWind[2])
+	{
+		sleepWind[0] = windX;
+		sleepWind[1] = windY;
+		sleepWind[2] = windZ;
+		Wake();
+	}
+
+	// An awake cloth looks at its colliders in the collider pass.
+	if (IsAsleep() && HasColliders())
+		PrepareColliders();
+	return IsAsleep();
+}
+
+void Fabric::MeasureEnergyBlock(std::size_t block)
+{
+	std::size_t n = numCols;
+	std::size_t first = block * BlockRows * n;
+	std::size_t last = std::min((block + 1) * BlockRows, numRows) * n;
+
+	float speedSq = 0.0f;
+	for (std::size_t i = first; i < last; ++i)
+	{
+		float v = velocity.x[i] * velocity.x[i] + velocity.y[i] * velocity.y[i] + velocity.z[i] * velocity.z[i];
+		speedSq = std::max(speedSq, v);
+	}
+
+	// A NaN counts as moving, so a cloth that blew up never freezes.
+	float energy = 0.5f * mass * speedSq;
+	blockEnergy[block] = std::isnan(energy) ? INFINITY : energy;
+}
+
+void Fabric::UpdateSleep()
+{
+	ThreadPool::Default().ParallelFor(0, BlockCount(), 1, [this](std::size_t block)
+		{
+			if (BlockAwake(block))
+				MeasureEnergyBlock(block);
+		});
+	SettleBlocks();
+}
+
+void Fabric::SettleBlocks()
+{
+	// The other integrators move every vertex at once, so the cloth is one
+	// region there: any block moving keeps all of them awake.
+	std::size_t blockCount = BlockCount();
+	bool whole = integrator != FabricIntegrator::Explicit;
+	bool anyMoving = whole && std::any_of(blockEnergy.begin(), blockEnergy.end(),
+		[this](float e) { return !(e < sleepEnergy); });
+
+	auto moving = [&](std::size_t block)
+	{
+		return whole ? anyMoving : !(blockEnergy[block] < sleepEnergy);
+	};
+
+	for (std::size_t block = 0; block < blockCount; ++block)
+	{
+		if (moving(block) || (block > 0 && moving(block - 1)) || (block + 1 < blockCount && moving(block + 1)))
+			WakeBlock(block);
+		else if (BlockAwake(block) && ++blockSleep[block] == std::uint32_t(sleepSteps))
+			FreezeBlock(block);
+	}
+}
+
+void Fabric::FreezeBlock(std::size_t block)
+{
+	std::size_t n = numCols;
+	std::size_t firstRow = block * BlockRows;
+	std::size_t endRow = std::min((block + 1) * BlockRows, numRows);
+	std::size_t first = firstRow * n;
+	std::size_t last = endRow * n;
+
+	std::copy(currPos.x + first, currPos.x + last, prevPos.x + first);
+	std::copy(currPos.y + first, currPos.y + last, prevPos.y + first);
+	std::copy(currPos.z + first, currPos.z + last, prevPos.z + first);
+	std::fill(velocity.x + first, velocity.x + last, 0.0f);
+	std::fill(velocity.y + first, velocity.y + last, 0.0f);
+	std::fill(velocity.z + first, velocity.z + last, 0.0f);
+	blockEnergy[block] = 0.0f;
+
+	ColliderBounds& bounds = sleepBounds[block];
+	std::fill(bounds.lo, bounds.lo + 3, INFINITY);
+	std::fill(bounds.hi, bounds.hi + 3, -INFINITY);
+	boundsKernel(currPos, first, n, endRow - firstRow, n, bounds.lo, bounds.hi);
+
+	++sleepingBlocks;
+}
+
+void Fabric::WakeBlock(std::size_t block)
+{
+	if (!BlockAwake(block))
+	{
+		if (integrator != FabricIntegrator::Explicit)
+		{
+			Wake();
+			return;
+		}
+		--sleepingBlocks;
+	}
+	blockSleep[block] = 0;
+}
+
+void Fabric::WakeOverlapping(const float lo[3], const float hi[3])
+{
+	for (std::size_t block = 0; block < BlockCount(); ++block)
+	{
+		if (BlockAwake(block))
+			continue;
+
+		const ColliderBounds& b = sleepBounds[block];
+		bool overlaps = true;
+		for (int k = 0; k < 3; ++k)
+			overlaps = overlaps && hi[k] >= b.lo[k] && b.hi[k] >= lo[k];
+		if (overlaps)
+			WakeBlock(block);
+	}
+}
@@ -0,0 +1,144 @@
+//***************************************************************************************
+// FabricWorld.cpp by llyr-who (C) 2011 All Rights Reserved.
+//***************************************************************************************
+
+#include "FabricWorld.h"
+#include "../../Common/ThreadPool.h"
+
+#include <algorithm>
+#include <utility>
+
+FabricWorld::FabricWorld(float dt)
+	: stepper(dt)
+{
+}
+
+Fabric& FabricWorld::Add(std::size_t m, std::size_t n, float dx, float spring1, float spring2, float damp1, float damp2, float M)
+{
+	std::size_t size = Fabric::StorageSize(m * n);
+	if (poolUsed + size > pool.size())
+	{
+		std::vector<float, AlignedAllocator<float, 32>> grown(std::max(2 * pool.size(), poolUsed + size));
+		for (auto& f : fabrics)
+			f->MoveStorage(grown.data() + (f->base - pool.data()));
+		pool.swap(grown);
+	}
+
+	// Owned before the list grows, so a failed push_back does not leak it.
+	std::unique_ptr<Fabric> fabric(new Fabric(pool.data() + poolUsed, m, n, dx, stepper.Step(), spring1, spring2, damp1, damp2, M));
+	fabric->clock = &stepper;
+	fabrics.push_back(std::move(fabric));
+	poolUsed += size;
+	return *fabrics.back();
+}
+
+void FabricWorld::Update(float frameTime, float windX, float windY, float windZ)
+{
+	int steps = stepper.Advance(frameTime);
+	if (steps == 0)
+		return;
+
+	// The lists are rebuilt every step, as Fabric::Step checks its sleep: a
+	// cloth can fall asleep, or be woken, between two steps of one update.
+	for (int s = 0; s < steps; ++s)
+	{
+		BuildWorkItems(windX, windY, windZ);
+		Step(windX, windY, windZ);
+	}
+}
+
+void FabricWorld::BuildWorkItems(float windX, float windY, float windZ)
+{
+	items.clear();
+	parityItems[0].clear();
+	parityItems[1].clear();
+	batched.clear();
+	unbatched.clear();
+
+	for (auto& f : fabrics)
+	{
+		if (f->Integrator() != FabricIntegrator::Explicit)
+		{
+			unbatched.push_back(f.get());
+			continue;
+		}
+
+		// A sleeping cloth stays out of the passes until something wakes it.
+		if (f->CheckSleep(windX, windY, windZ))
+			continue;
+		batched.push_back(f.get());
+
+		for (std::size_t block = 0; block < f->BlockCount(); ++block)
+		{
+			WorkItem item = { f.get(), block };
+			items.push_back(item);
+			parityItems[block % 2].push_back(item);
+		}
+	}
+}
+
+void FabricWorld::Step(float windX, float windY, float windZ)
+{
+	ThreadPool& pool = ThreadPool::Default();
+
+	// The passes of Fabric::Step, each one dispatch over the blocks of all
+	// explicit cloths.  Cloths share no memory, so only the spring pass needs
+	// the even/odd split, exactly as within a single cloth.
+	pool.ParallelFor(0, items.size(), 1, [this, windX, windY, windZ](std::size_t k)
+		{
+			if (items[k].fabric->BlockAwake(items[k].block))
+				items[k].fabric->ApplyExternalForceBlock(items[k].block, windX, windY, windZ);
+		});
+
+	for (const std::vector<WorkItem>& parity : parityItems)
+	{
+		pool.ParallelFor(0, parity.size(), 1, [&parity](std::size_t k)
+			{
+				if (parity[k].fabric->BlockOrNextAwake(parity[k].block))
+					parity[k].fabric->AccumulateSpringBlock(parity[k].block);
+			});
+	}
+
+	pool.ParallelFor(0, items.size(), 1, [this](std::size_t k)
+		{
+			if (items[k].fabric->BlockAwake(items[k].block))
+				items[k].fabric->IntegrateExplicitBlock(items[k].block);
+		});
+
+	// Self-collision and the colliders have passes of their own; each cloth runs
+	// them over its blocks.
+	for (Fabric* f : batched)
+	{
+		if (f->SelfCollision())
+			f->CollideSelf();
+		if (f->HasColliders())
+			f->CollideColliders();
+		std::swap(f->prevPos, f->currPos);
+	}
+
+	pool.ParallelFor(0, items.size(), 1, [this](std::size_t k)
+		{
+			if (items[k].fabric->BlockOrNextAwake(items[k].block))
+				items[k].fabric->UpdateNormalBlock(items[k].block);
+		});
+
+	// The sleep decisions are each cloth's own, on this thread.
+	bool sleeping = std::any_of(batched.begin(), batched.end(), [](const Fabric* f) { return !f->blockSleep.empty(); });
+	if (sleeping)
+	{
+		pool.ParallelFor(0, items.size(), 1, [this](std::size_t k)
+			{
+				Fabric* f = items[k].fabric;
+				if (!f->blockSleep.empty() && f->BlockAwake(items[k].block))
+					f->MeasureEnergyBlock(items[k].block);
+			});
+		for (Fabric* f : batched)
+		{
+			if (!f->blockSleep.empty())
+				f->SettleBlocks();
+		}
+	}
+
+	for (Fabric* f : unbatched)
+		f->Step(windX, windY, windZ);
+}
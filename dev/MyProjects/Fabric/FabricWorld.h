@@ -0,0 +1,73 @@
+//***************************************************************************************
+// FabricWorld.h by llyr-who (C) 2011 All Rights Reserved.
+//
+// Owns many cloths and steps them together.  The per-vertex state of every cloth
+// lives in one contiguous pool, and each pass of a step is a single parallel loop
+// over the row blocks of all cloths.  Small cloths then cost a few blocks in a
+// shared dispatch instead of a dispatch of their own, and the pool's work stealing
+// balances cloths of different sizes.
+//
+// All cloths share the world's time step.  Explicit cloths are batched; cloths
+// switched to the implicit or XPBD integrator are stepped one after the other,
+// each with its own parallel passes.  A cloth that has fallen asleep (see
+// Fabric::SetSleeping) is left out of the batch, so idle cloths cost only the
+// check that nothing has woken them.
+//***************************************************************************************
+
+#ifndef FABRICWORLD_H
+#define FABRICWORLD_H
+
+#include <memory>
+#include <vector>
+#include "Fabric.h"
+
+class FabricWorld
+{
+public:
+	explicit FabricWorld(float dt);
+	FabricWorld(const FabricWorld& rhs) = delete;
+	FabricWorld& operator=(const FabricWorld& rhs) = delete;
+
+	// Adds a cloth; the arguments are those of the Fabric constructor without
+	// the time step.  The reference stays valid for the lifetime of the world.
+	Fabric& Add(std::size_t m, std::size_t n, float dx, float spring1, float spring2, float damp1, float damp2, float M);
+
+	std::size_t Count() const { return fabrics.size(); }
+	Fabric& Instance(std::size_t i) { return *fabrics[i]; }
+	const Fabric& Instance(std::size_t i) const { return *fabrics[i]; }
+
+	float TimeStep() const { return stepper.Step(); }
+	void SetMaxSubsteps(int maxSubsteps) { stepper.SetMaxSubsteps(maxSubsteps); }
+	float InterpolationAlpha() const { return stepper.Alpha(); }
+
+	// Advances every cloth by frameTime in fixed steps, like Fabric::Update.
+	void Update(float frameTime, float windX, float windY, float windZ);
+
+private:
+	struct WorkItem
+	{
+		Fabric* fabric;
+		std::size_t block;
+	};
+
+	void Step(float windX, float windY, float windZ);
+	void BuildWorkItems(float windX, float windY, float windZ);
+
+	FixedTimestep stepper;
+
+	std::vector<std::unique_ptr<Fabric>> fabrics;
+
+	// The state of every cloth, back to back.  Grows by doubling; the cloths
+	// are moved over when it does.
+	std::vector<float, AlignedAllocator<float, 32>> pool;
+	std::size_t poolUsed = 0;
+
+	// Every row block of every explicit cloth that is not asleep, and the
+	// same split by block parity for the spring pass.
+	std::vector<WorkItem> items;
+	std::vector<WorkItem> parityItems[2];
+	std::vector<Fabric*> batched;
+	std::vector<Fabric*> unbatched;
+};
+
+#endif // FABRICWORLD_H
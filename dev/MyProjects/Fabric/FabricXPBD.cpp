@@ -0,0 +1,155 @@
+//***************************************************************************************
+// FabricXPBD.cpp by llyr-who (C) 2011 All Rights Reserved.
+//
+// Extended position-based dynamics step for the cloth (Macklin, Mueller and
+// Chentanez, "XPBD: Position-Based Simulation of Compliant Constrained Dynamics").
+// Every spring of the molecule becomes the distance constraint |xb - xa| = rest,
+// with the same stretch, shear and bend rest lengths as the force model.  Its
+// compliance is 1/stiffness and its damping comes from the spring's damper, so
+// the material is tuned with the same constants.
+//
+// The constraints are projected Gauss-Seidel style, one row block at a time.
+// Blocks use the same even/odd colouring as the force pass, so every sweep is
+// race-free and the result does not depend on the thread count.
+//***************************************************************************************
+
+#include"Fabric.h"
+#include"../../Common/ThreadPool.h"
+
+#include <algorithm>
+#include <cmath>
+
+void Fabric::ProjectConstraintBlock(std::size_t block)
+{
+	std::size_t n = numCols;
+	std::size_t m = numRows;
+	const float h = dt;
+	const float invMass = 1 / mass;
+
+	std::size_t end = std::min((block + 1) * BlockRows, m);
+	for (std::size_t j = block * BlockRows; j < end; ++j)
+	{
+		for (std::size_t d = 0; d < SpringDirectionCount; ++d)
+		{
+			const SpringDirection& dir = springDirections[d];
+			if (j + dir.dRow >= m)
+				continue;
+
+			const SpringParams params = ParamsFor(dir);
+			// alpha~ = compliance / h^2 and gamma = alpha~ * (h^2 * damping) / h.
+			const float alpha = 1 / (params.stiffness * h * h);
+			const float gamma = params.damping / (params.stiffness * h);
+			std::size_t offset = dir.dRow * n + dir.dCol;
+			float* lambda = lambdas[d];
+
+			for (std::size_t i = 0; i < n; ++i)
+			{
+				std::size_t col = i + dir.dCol;
+				if (col >= n)
+					continue;
+
+				// Column 0 is pinned: it has infinite mass.
+				float wa = (i == 0) ? 0.0f : invMass;
+				float wb = (col == 0) ? 0.0f : invMass;
+				if (wa + wb == 0.0f)
+					continue;
+
+				std::size_t a = j * n + i;
+				std::size_t b = a + offset;
+
+				float ex = prevPos.x[b] - prevPos.x[a];
+				float ey = prevPos.y[b] - prevPos.y[a];
+				float ez = prevPos.z[b] - prevPos.z[a];
+				float len = std::sqrt(ex * ex + ey * ey + ez * ez);
+				if (len == 0.0f)
+					continue;
+				float invLen = 1 / len;
+				ex *= invLen;
+				ey *= invLen;
+				ez *= invLen;
+
+				// Relative motion along the constraint this step, for damping.
+				float drift = ex * ((prevPos.x[b] - currPos.x[b]) - (prevPos.x[a] - currPos.x[a])) +
+					ey * ((prevPos.y[b] - currPos.y[b]) - (prevPos.y[a] - currPos.y[a])) +
+					ez * ((prevPos.z[b] - currPos.z[b]) - (prevPos.z[a] - currPos.z[a]));
+
+				float C = len - params.rest;
+				float dLambda = (-C - alpha * lambda[a] - gamma * drift) / ((1 + gamma) * (wa + wb) + alpha);
+				lambda[a] += dLambda;
+
+				prevPos.x[a] -= wa * dLambda * ex;
+				prevPos.y[a] -= wa * dLambda * ey;
+				prevPos.z[a] -= wa * dLambda * ez;
+				prevPos.x[b] += wb * dLambda * ex;
+				prevPos.y[b] += wb * dLambda * ey;
+				prevPos.z[b] += wb * dLambda * ez;
+			}
+		}
+	}
+}
+
+void Fabric::IntegrateXPBD()
+{
+	std::size_t n = numCols;
+	std::size_t m = numRows;
+	ThreadPool& pool = ThreadPool::Default();
+
+	if (xpbdStorage.empty())
+	{
+		std::size_t stride = (vertexCount + 7) & ~std::size_t(7);
+		xpbdStorage.assign(stride * SpringDirectionCount, 0.0f);
+		for (std::size_t d = 0; d < SpringDirectionCount; ++d)
+			lambdas[d] = xpbdStorage.data() + d * stride;
+	}
+	else
+	{
+		std::fill(xpbdStorage.begin(), xpbdStorage.end(), 0.0f);
+	}
+
+	// Predict the new positions from the external forces alone.  They are built
+	// in prevPos, which Step swaps in as the current positions afterwards.
+	pool.ParallelForRange(0, m, BlockRows, [this, n](std::size_t first, std::size_t last)
+		{
+			const float h = dt;
+			const float accel = h / mass;
+			for (std::size_t j = first; j < last; ++j)
+			{
+				for (std::size_t i = j * n + 1; i < (j + 1) * n; ++i)
+				{
+					velocity.x[i] += force.x[i] * accel;
+					velocity.y[i] += force.y[i] * accel;
+					velocity.z[i] += force.z[i] * accel;
+					prevPos.x[i] = currPos.x[i] + velocity.x[i] * h;
+					prevPos.y[i] = currPos.y[i] + velocity.y[i] * h;
+					prevPos.z[i] = currPos.z[i] + velocity.z[i] * h;
+				}
+			}
+		});
+
+	std::size_t blockCount = BlockCount();
+	for (int iteration = 0; iteration < xpbdIterations; ++iteration)
+	{
+		for (std::size_t parity = 0; parity < 2; ++parity)
+		{
+			pool.ParallelFor(0, (blockCount + 1 - parity) / 2, 1, [this, parity](std::size_t k)
+				{
+					ProjectConstraintBlock(2 * k + parity);
+				});
+		}
+	}
+
+	// The velocity is whatever moved the particles there.
+	pool.ParallelForRange(0, m, BlockRows, [this, n](std::size_t first, std::size_t last)
+		{
+			const float invDt = 1 / dt;
+			for (std::size_t j = first; j < last; ++j)
+			{
+				for (std::size_t i = j * n + 1; i < (j + 1) * n; ++i)
+				{
+					velocity.x[i] = (prevPos.x[i] - currPos.x[i]) * invDt;
+					velocity.y[i] = (prevPos.y[i] - currPos.y[i]) * invDt;
+					velocity.z[i] = (prevPos.z[i] - currPos.z[i]) * invDt;
+				}
+			}
+		});
+}
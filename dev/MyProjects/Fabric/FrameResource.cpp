@@ -1,6 +1,7 @@
 #include "FrameResource.h"
 
-FrameResource::FrameResource(ID3D12Device* device, UINT passCount, UINT objectCount, UINT materialCount, UINT waveVertCount)
+FrameResource::FrameResource(ID3D12Device* device, UINT passCount, UINT objectCount, UINT materialCount, UINT waveVertCount, UINT fabricVertCount,
+    bool packedVertices)
 {
     ThrowIfFailed(device->CreateCommandAllocator(
         D3D12_COMMAND_LIST_TYPE_DIRECT,
@@ -11,12 +12,19 @@ FrameResource::FrameResource(ID3D12Device* device, UINT passCount, UINT objectCo
     MaterialCB = std::make_unique<UploadBuffer<MaterialConstants>>(device, materialCount, true);
     ObjectCB = std::make_unique<UploadBuffer<ObjectConstants>>(device, objectCount, true);
 
+    if(packedVertices)
+    {
+        WavesPackedVB = std::make_unique<UploadBuffer<PackedVertex>>(device, waveVertCount, false);
+        FabricPackedVB = std::make_unique<UploadBuffer<PackedVertex>>(device, fabricVertCount, false);
+        return;
+    }
+
     WavesVB = std::make_unique<UploadBuffer<Vertex>>(device, waveVertCount, false);
 
 	// this is just a hack, we should have a higharchy of
 	// frame resources! but at the very least fabric and wave should
 	// have different Frame resources!
-	FabricVB = std::make_unique<UploadBuffer<Vertex>>(device, waveVertCount, false);
+	FabricVB = std::make_unique<UploadBuffer<Vertex>>(device, fabricVertCount, false);
 }
 
 FrameResource::~FrameResource()
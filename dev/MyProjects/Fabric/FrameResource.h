@@ -3,10 +3,17 @@
 #include "../../Common/d3dUtil.h"
 #include "../../Common/MathHelper.h"
 #include "../../Common/UploadBuffer.h"
+#include "../../Common/VertexPacking.h"
 
 struct ObjectConstants
 {
     DirectX::XMFLOAT4X4 World = MathHelper::Identity4x4();
+
+    // Box of the object's packed vertices, if it has any.
+    DirectX::XMFLOAT3 PackMin = { 0.0f, 0.0f, 0.0f };
+    float PackPad0 = 0.0f;
+    DirectX::XMFLOAT3 PackExtent = { 1.0f, 1.0f, 1.0f };
+    float PackPad1 = 0.0f;
 };
 
 struct PassConstants
@@ -47,7 +54,8 @@ struct FrameResource
 {
 public:
     
-    FrameResource(ID3D12Device* device, UINT passCount, UINT objectCount, UINT materialCount, UINT waveVertCount);
+    FrameResource(ID3D12Device* device, UINT passCount, UINT objectCount, UINT materialCount, UINT waveVertCount, UINT fabricVertCount,
+        bool packedVertices);
     FrameResource(const FrameResource& rhs) = delete;
     FrameResource& operator=(const FrameResource& rhs) = delete;
     ~FrameResource();
@@ -64,9 +72,15 @@ public:
     std::unique_ptr<UploadBuffer<ObjectConstants>> ObjectCB = nullptr;
 
     // We cannot update a dynamic vertex buffer until the GPU is done processing
-    // the commands that reference it.  So each frame needs their own.
+    // the commands that reference it.  So each frame needs their own.  Only
+    // the Vertex or only the PackedVertex buffers exist.
     std::unique_ptr<UploadBuffer<Vertex>> WavesVB = nullptr;
 	std::unique_ptr<UploadBuffer<Vertex>> FabricVB = nullptr;
+    std::unique_ptr<UploadBuffer<PackedVertex>> WavesPackedVB = nullptr;
+	std::unique_ptr<UploadBuffer<PackedVertex>> FabricPackedVB = nullptr;
+
+    // Box the vertices in WavesPackedVB were packed in.
+    PackedVertexBounds WavesBounds;
     // Fence value to mark commands up to this fence point.  This lets us
     // check if these frame resources are still in use by the GPU.
     UINT64 Fence = 0;
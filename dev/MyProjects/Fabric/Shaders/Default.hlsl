@@ -25,6 +25,12 @@
 cbuffer cbPerObject : register(b0)
 {
     float4x4 gWorld;
+
+    // Box the packed positions are quantized in (see VertexPacking.h).
+    float3 gPackMin;
+    float gPackPad0;
+    float3 gPackExtent;
+    float gPackPad1;
 };
 
 cbuffer cbMaterial : register(b1)
@@ -61,11 +67,27 @@ cbuffer cbPass : register(b2)
     Light gLights[MaxLights];
 };
  
+#ifdef PACKED_VERTICES
+struct VertexIn
+{
+	float4 PosL    : POSITION;  // R16G16B16A16_UNORM within the box
+    float2 NormalL : NORMAL;    // R16G16_SNORM, octahedral
+};
+
+float3 DecodeOctahedral(float2 e)
+{
+    float3 n = float3(e.x, 1.0f - abs(e.x) - abs(e.y), e.y);
+    float t = saturate(-n.y);
+    n.xz += n.xz >= 0.0f ? -t : t;
+    return normalize(n);
+}
+#else
 struct VertexIn
 {
 	float3 PosL    : POSITION;
     float3 NormalL : NORMAL;
 };
+#endif
 
 struct VertexOut
 {
@@ -77,13 +99,21 @@ struct VertexOut
 VertexOut VS(VertexIn vin)
 {
 	VertexOut vout = (VertexOut)0.0f;
+
+#ifdef PACKED_VERTICES
+    float3 posL = gPackMin + vin.PosL.xyz*gPackExtent;
+    float3 normalL = DecodeOctahedral(vin.NormalL);
+#else
+    float3 posL = vin.PosL;
+    float3 normalL = vin.NormalL;
+#endif
 	
     // Transform to world space.
-    float4 posW = mul(float4(vin.PosL, 1.0f), gWorld);
+    float4 posW = mul(float4(posL, 1.0f), gWorld);
     vout.PosW = posW.xyz;
 
     // Assumes nonuniform scaling; otherwise, need to use inverse-transpose of world matrix.
-    vout.NormalW = mul(vin.NormalL, (float3x3)gWorld);
+    vout.NormalW = mul(normalL, (float3x3)gWorld);
 
     // Transform to homogeneous clip space.
     vout.PosH = mul(posW, gViewProj);
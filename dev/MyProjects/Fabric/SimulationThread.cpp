@@ -0,0 +1,114 @@
+//***************************************************************************************
+// SimulationThread.cpp by llyr-who (C) 2011 All Rights Reserved.
+//***************************************************************************************
+
+#include "SimulationThread.h"
+#include <algorithm>
+
+SimulationThread::SimulationThread(std::size_t slotCount) :
+	mJobs(std::max<std::size_t>(1, slotCount)),
+	mErrors(mJobs.size()),
+	mSubmitted(0),
+	mCompleted(0),
+	mQuit(false),
+	mSleepers(0)
+{
+	mWorker = std::thread(&SimulationThread::WorkerLoop, this);
+}
+
+SimulationThread::~SimulationThread()
+{
+	mQuit.store(true);
+	Signal();
+	mWorker.join();
+}
+
+std::uint64_t SimulationThread::Submit(std::function<void()> job)
+{
+	// Only this thread moves mSubmitted.  The slot is free once the job that
+	// used it SlotCount tickets ago has completed.
+	std::uint64_t ticket = mSubmitted.load(std::memory_order_relaxed) + 1;
+	Await([this, ticket] { return ticket - mCompleted.load() <= mJobs.size(); });
+	if(ticket > mJobs.size())
+		RethrowErrors(ticket - mJobs.size());
+
+	mJobs[(ticket - 1) % mJobs.size()] = std::move(job);
+	mSubmitted.store(ticket);
+	Signal();
+	return ticket;
+}
+
+void SimulationThread::Wait(std::uint64_t ticket)
+{
+	Await([this, ticket] { return IsDone(ticket); });
+	RethrowErrors(ticket);
+}
+
+void SimulationThread::RethrowErrors(std::uint64_t ticket)
+{
+	for(; mChecked < ticket; ++mChecked)
+	{
+		std::exception_ptr& error = mErrors[mChecked % mJobs.size()];
+		if(error)
+		{
+			std::exception_ptr e = error;
+			error = nullptr;
+			++mChecked;
+			std::rethrow_exception(e);
+		}
+	}
+}
+
+template<typename Ready>
+void SimulationThread::Await(const Ready& ready)
+{
+	for(int spin = 0; spin < SpinCount; ++spin)
+	{
+		if(ready())
+			return;
+		std::this_thread::yield();
+	}
+
+	// Counting ourselves before the last check pairs with the counter store
+	// before the load in Signal: either we see the new count, or Signal sees
+	// a sleeper and takes the mutex, which it cannot get before we wait.
+	std::unique_lock<std::mutex> lock(mMutex);
+	mSleepers.fetch_add(1);
+	mWake.wait(lock, ready);
+	mSleepers.fetch_sub(1);
+}
+
+void SimulationThread::Signal()
+{
+	if(mSleepers.load() == 0)
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+	}
+	mWake.notify_all();
+}
+
+void SimulationThread::WorkerLoop()
+{
+	for(std::uint64_t next = 0; ; ++next)
+	{
+		Await([this, next] { return mSubmitted.load() > next || mQuit.load(); });
+		if(mSubmitted.load() <= next)
+			return;
+
+		std::function<void()>& job = mJobs[next % mJobs.size()];
+		try
+		{
+			job();
+		}
+		catch(...)
+		{
+			mErrors[next % mJobs.size()] = std::current_exception();
+		}
+		job = nullptr;
+
+		mCompleted.store(next + 1);
+		Signal();
+	}
+}
@@ -0,0 +1,83 @@
+//***************************************************************************************
+// SimulationThread.h by llyr-who (C) 2011 All Rights Reserved.
+//
+// One thread that runs jobs in the order they are submitted, so a frame's simulation
+// can run while the caller renders the previous one.  Jobs sit in a ring of SlotCount
+// entries; the caller and the thread hand them over through two counters, submitted
+// and completed, without taking a lock.  Either side spins briefly when it has to
+// wait and then sleeps; the mutex is only touched to sleep and to wake a sleeper.
+//
+// Meant for one thread that submits and waits.  A job that throws does not stop the
+// thread: the exception is rethrown by the first Wait that covers the job, or by the
+// Submit that reuses its slot.
+//***************************************************************************************
+
+#ifndef SIMULATIONTHREAD_H
+#define SIMULATIONTHREAD_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class SimulationThread
+{
+public:
+	// Up to slotCount jobs may be queued or running at once.
+	explicit SimulationThread(std::size_t slotCount);
+	SimulationThread(const SimulationThread& rhs) = delete;
+	SimulationThread& operator=(const SimulationThread& rhs) = delete;
+
+	// Finishes the submitted jobs first.
+	~SimulationThread();
+
+	std::size_t SlotCount()const { return mJobs.size(); }
+
+	// Queues job and returns its ticket, counting from 1.  Blocks while every
+	// slot holds an unfinished job.
+	std::uint64_t Submit(std::function<void()> job);
+
+	// Whether the job with this ticket and all before it have finished.
+	bool IsDone(std::uint64_t ticket)const { return mCompleted.load() >= ticket; }
+
+	// Blocks until IsDone(ticket).  Ticket 0 returns at once.
+	void Wait(std::uint64_t ticket);
+
+	// Wait for the last submitted job.
+	void WaitAll() { Wait(mSubmitted.load()); }
+
+private:
+	template<typename Ready>
+	void Await(const Ready& ready);
+	void Signal();
+	void RethrowErrors(std::uint64_t ticket);
+	void WorkerLoop();
+
+	// Rounds of yielding before a waiter goes to sleep.
+	static const int SpinCount = 64;
+
+	std::vector<std::function<void()>> mJobs;
+
+	// What each slot's job threw, written before it counts as completed.
+	std::vector<std::exception_ptr> mErrors;
+
+	// Tickets up to here have had their errors rethrown.
+	std::uint64_t mChecked = 0;
+
+	std::atomic<std::uint64_t> mSubmitted;
+	std::atomic<std::uint64_t> mCompleted;
+	std::atomic<bool> mQuit;
+
+	std::atomic<int> mSleepers;
+	std::mutex mMutex;
+	std::condition_variable mWake;
+
+	std::thread mWorker;
+};
+
+#endif // SIMULATIONTHREAD_H
@@ -0,0 +1,301 @@
+//***************************************************************************************
+// SpectralOcean.cpp by llyr-who (C) 2011 All Rights Reserved.
+//***************************************************************************************
+
+#include "SpectralOcean.h"
+#include "../../Common/ThreadPool.h"
+
+#include <cmath>
+#include <random>
+
+using namespace DirectX;
+
+namespace
+{
+	typedef std::complex<float> Complex;
+
+	const float Gravity = 9.81f;
+	const float Pi = 3.14159265f;
+	const double TwoPi = 6.283185307179586;
+
+	// Phillips' constant, the level of the k^-4 saturation range.
+	const float PhillipsAlpha = 0.0081f;
+
+	// JONSWAP peak enhancement and its widths below and above the peak.
+	const float JonswapGamma = 3.3f;
+	const float JonswapSigmaLow = 0.07f;
+	const float JonswapSigmaHigh = 0.09f;
+
+	inline Complex Mul(const Complex& a, const Complex& b)
+	{
+		return Complex(a.real()*b.real() - a.imag()*b.imag(), a.real()*b.imag() + a.imag()*b.real());
+	}
+
+	// Signed frequency of FFT bin k of n.
+	inline int SignedFrequency(int k, int n)
+	{
+		return k < n/2 ? k : k - n;
+	}
+}
+
+SpectralOcean::SpectralOcean(int n, float dx, float windSpeed, float windAngle,
+	OceanSpectrum spectrum, unsigned seed)
+	: mSpectrum(spectrum), mSeed(seed), mFFT(std::size_t(n))
+{
+	mNumRows = n;
+	mNumCols = n;
+
+	mVertexCount = std::size_t(n)*n;
+	mTriangleCount = std::size_t(n - 1)*(n - 1)*2;
+
+	mSpatialStep = dx;
+	mHalfWidth = (n - 1)*dx*0.5f;
+	mHalfDepth = (n - 1)*dx*0.5f;
+
+	mWindSpeed = windSpeed;
+	mWindX = std::cos(windAngle);
+	mWindZ = std::sin(windAngle);
+
+	for(auto& field : mFields)
+		field.assign(mVertexCount, Complex(0.0f, 0.0f));
+
+	BuildAmplitudes();
+	Evaluate();
+}
+
+XMFLOAT3 SpectralOcean::Position(std::size_t i)const
+{
+	float row = float(i / mNumCols);
+	float col = float(i % mNumCols);
+
+	// Grid rows run towards -z, so a displacement along the rows is one along -z.
+	return XMFLOAT3(
+		-mHalfWidth + col*mSpatialStep + mChoppiness*mFields[0][i].imag(),
+		mFields[0][i].real(),
+		mHalfDepth - row*mSpatialStep - mChoppiness*mFields[1][i].real());
+}
+
+XMFLOAT3 SpectralOcean::Normal(std::size_t i)const
+{
+	// dh/dx and dh/dz; z runs against the rows.
+	float sx = mFields[1][i].imag();
+	float sz = -mFields[2][i].real();
+
+	float invLen = 1.0f / std::sqrt(sx*sx + 1.0f + sz*sz);
+	return XMFLOAT3(-sx*invLen, invLen, -sz*invLen);
+}
+
+XMFLOAT3 SpectralOcean::TangentX(std::size_t i)const
+{
+	float sx = mFields[1][i].imag();
+
+	float invLen = 1.0f / std::sqrt(1.0f + sx*sx);
+	return XMFLOAT3(invLen, sx*invLen, 0.0f);
+}
+
+std::size_t SpectralOcean::TiledIndex(int row, int col)const
+{
+	int n = mNumCols;
+	row %= n;
+	col %= n;
+	return std::size_t(row < 0 ? row + n : row)*n + (col < 0 ? col + n : col);
+}
+
+XMFLOAT3 SpectralOcean::TiledPoint(int row, int col)const
+{
+	std::size_t i = TiledIndex(row, col);
+	return XMFLOAT3(
+		col*mSpatialStep + mChoppiness*mFields[0][i].imag(),
+		mFields[0][i].real(),
+		-row*mSpatialStep - mChoppiness*mFields[1][i].real());
+}
+
+XMFLOAT3 SpectralOcean::TiledPosition(float x, float z)const
+{
+	return TiledPoint(NearestTiledRow(z), NearestTiledColumn(x));
+}
+
+XMFLOAT3 SpectralOcean::TiledNormal(float x, float z)const
+{
+	return Normal(TiledIndex(NearestTiledRow(z), NearestTiledColumn(x)));
+}
+
+void SpectralOcean::WriteVertices(const VertexSpan& out)const
+{
+	std::size_t n = std::size_t(mNumCols);
+	ThreadPool::Default().ParallelForRange(0, std::size_t(mNumRows), 16, [this, &out, n](std::size_t first, std::size_t last)
+		{
+			VertexSpanWriter writer(out, first*n);
+			for(std::size_t i = first*n; i < last*n; ++i)
+				writer.Write(Position(i), Normal(i));
+		});
+}
+
+void SpectralOcean::WriteTiledVertices(float x0, float z0, float spacing, int rows, int cols, const VertexSpan& out)const
+{
+	int row0 = NearestTiledRow(z0);
+	int col0 = NearestTiledColumn(x0);
+	int step = int(std::floor(spacing / mSpatialStep + 0.5f));
+
+	ThreadPool::Default().ParallelForRange(0, std::size_t(rows), 16,
+		[this, &out, row0, col0, step, cols](std::size_t first, std::size_t last)
+		{
+			VertexSpanWriter writer(out, first*cols);
+			for(int i = int(first); i < int(last); ++i)
+			{
+				int row = row0 + i*step;
+				for(int j = 0; j < cols; ++j)
+				{
+					int col = col0 + j*step;
+					writer.Write(TiledPoint(row, col), Normal(TiledIndex(row, col)));
+				}
+			}
+		});
+}
+
+void SpectralOcean::SetFetch(float fetch)
+{
+	mFetch = fetch;
+	BuildAmplitudes();
+	Evaluate();
+}
+
+void SpectralOcean::Update(float dt)
+{
+	mTime += dt;
+	Evaluate();
+}
+
+void SpectralOcean::SetTime(double t)
+{
+	mTime = t;
+	Evaluate();
+}
+
+float SpectralOcean::SpectrumDensity(float kx, float kz)const
+{
+	float k2 = kx*kx + kz*kz;
+	if(k2 == 0.0f)
+		return 0.0f;
+	float k = std::sqrt(k2);
+
+	// cos^2 spreading about the wind, normalised over the full circle.
+	float c = (kx*mWindX + kz*mWindZ) / k;
+	float spread = c*c / Pi;
+
+	// Omnidirectional wavenumber spectrum F(k); the density over the (kx, kz)
+	// plane is F(k)/k times the spreading.
+	float F = 0.0f;
+	if(mSpectrum == OceanSpectrum::Phillips)
+	{
+		float L = mWindSpeed*mWindSpeed / Gravity;
+		float kL = k*L;
+		F = 0.5f*PhillipsAlpha / (k2*k) * std::exp(-1.0f / (kL*kL));
+	}
+	else
+	{
+		float U = mWindSpeed;
+		float alpha = 0.076f*std::pow(U*U / (mFetch*Gravity), 0.22f);
+		float omegaPeak = 22.0f*std::pow(Gravity*Gravity / (U*mFetch), 1.0f/3.0f);
+
+		float omega = std::sqrt(Gravity*k);
+		float sigma = omega <= omegaPeak ? JonswapSigmaLow : JonswapSigmaHigh;
+		float d = (omega - omegaPeak) / (sigma*omegaPeak);
+		float ratio = omegaPeak / omega;
+
+		float S = alpha*Gravity*Gravity / std::pow(omega, 5.0f) *
+			std::exp(-1.25f*ratio*ratio*ratio*ratio) * std::pow(JonswapGamma, std::exp(-0.5f*d*d));
+
+		// F(k) = S(w) dw/dk with w = sqrt(g k).
+		F = S*Gravity / (2.0f*omega);
+	}
+
+	return F / k * spread;
+}
+
+void SpectralOcean::BuildAmplitudes()
+{
+	int n = mNumCols;
+	float dk = float(TwoPi) / (n*mSpatialStep);
+
+	mH0.assign(mVertexCount, Complex(0.0f, 0.0f));
+	mH0MinusConj.assign(mVertexCount, Complex(0.0f, 0.0f));
+	mOmega.assign(mVertexCount, 0.0f);
+	mKCol.assign(mVertexCount, 0.0f);
+	mKRow.assign(mVertexCount, 0.0f);
+
+	std::mt19937 rng(mSeed);
+	std::normal_distribution<float> gauss(0.0f, 1.0f);
+
+	for(int row = 0; row < n; ++row)
+	{
+		for(int col = 0; col < n; ++col)
+		{
+			std::size_t idx = std::size_t(row)*n + col;
+			float kc = dk*SignedFrequency(col, n);
+			float kr = dk*SignedFrequency(row, n);
+			mKCol[idx] = kc;
+			mKRow[idx] = kr;
+			mOmega[idx] = std::sqrt(Gravity*std::sqrt(kc*kc + kr*kr));
+
+			float xi0 = gauss(rng);
+			float xi1 = gauss(rng);
+
+			// The Nyquist row and column have no opposite frequency to pair
+			// with, so they are left empty to keep every field real.
+			if(row == n/2 || col == n/2)
+				continue;
+
+			// E|h0|^2 = density * dk^2 / 2; h0(k) and h0(-k) together then
+			// carry the variance of the bin.  Rows run against world z.
+			float density = SpectrumDensity(kc, -kr);
+			float amplitude = 0.5f*dk*std::sqrt(density);
+			mH0[idx] = Complex(xi0*amplitude, xi1*amplitude);
+		}
+	}
+
+	for(int row = 0; row < n; ++row)
+	{
+		for(int col = 0; col < n; ++col)
+		{
+			std::size_t mirror = std::size_t((n - row) % n)*n + (n - col) % n;
+			mH0MinusConj[std::size_t(row)*n + col] = std::conj(mH0[mirror]);
+		}
+	}
+}
+
+void SpectralOcean::Evaluate()
+{
+	ThreadPool& pool = ThreadPool::Default();
+	std::size_t n = std::size_t(mNumCols);
+
+	pool.ParallelForRange(0, n, 8, [this, n](std::size_t first, std::size_t last)
+		{
+			for(std::size_t idx = first*n; idx < last*n; ++idx)
+			{
+				// Reduce in double so long running times keep their precision.
+				float phase = float(std::fmod(double(mOmega[idx])*mTime, TwoPi));
+				Complex e(std::cos(phase), std::sin(phase));
+
+				// h(k, t) = h0(k) e^{iwt} + conj(h0(-k)) e^{-iwt}
+				Complex h = Mul(mH0[idx], e) + Mul(mH0MinusConj[idx], std::conj(e));
+
+				float kc = mKCol[idx];
+				float kr = mKRow[idx];
+				float k = std::sqrt(kc*kc + kr*kr);
+				float invK = k > 0.0f ? 1.0f / k : 0.0f;
+
+				// Displacement i(k/|k|)h, which moves points towards the crests
+				// as in a Gerstner wave, and slope i k h, per axis, paired up:
+				//   h + i*Dcol          = h (1 - kc/|k|)
+				//   Drow + i*Scol       = h (-kc + i kr/|k|)
+				//   Srow                = h (i kr)
+				mFields[0][idx] = h*(1.0f - kc*invK);
+				mFields[1][idx] = Mul(h, Complex(-kc, kr*invK));
+				mFields[2][idx] = Mul(h, Complex(0.0f, kr));
+			}
+		});
+
+	for(auto& field : mFields)
+		mFFT.Inverse2D(field.data(), pool);
+}
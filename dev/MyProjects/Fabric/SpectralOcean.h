@@ -0,0 +1,143 @@
+//***************************************************************************************
+// SpectralOcean.h by llyr-who (C) 2011 All Rights Reserved.
+//
+// Deep-water ocean surface synthesised from a wave spectrum (Tessendorf, "Simulating
+// Ocean Water").  Each frequency of a periodic patch gets a random amplitude drawn
+// from the spectrum once; the surface at any time t is then the inverse FFT of those
+// amplitudes advanced by the dispersion relation w^2 = g|k|.  Nothing is integrated,
+// so there is no time step limit and Update may be called with any dt.
+//
+// Offers the same grid interface as Waves, so a renderer can switch between the two.
+// The patch tiles seamlessly.
+//***************************************************************************************
+
+#ifndef SPECTRALOCEAN_H
+#define SPECTRALOCEAN_H
+
+#include <cmath>
+#include <complex>
+#include <vector>
+#include <DirectXMath.h>
+#include "../../Common/FFT.h"
+#include "../../Common/VertexSpan.h"
+
+enum class OceanSpectrum
+{
+	// Tessendorf's fully developed sea: Phillips' k^-4 saturation range below
+	// the largest wave the wind can raise.
+	Phillips,
+
+	// Fetch-limited sea (Hasselmann et al.): a sharper peak, set by the distance
+	// the wind has blown over open water.
+	Jonswap
+};
+
+class SpectralOcean
+{
+public:
+	// An n x n grid, n a power of two, with spacing dx.  The wind blows at
+	// windSpeed m/s towards the angle windAngle in the xz-plane, measured from +x
+	// towards +z.  The same seed always gives the same sea.
+	SpectralOcean(int n, float dx, float windSpeed, float windAngle,
+		OceanSpectrum spectrum = OceanSpectrum::Phillips, unsigned seed = 1);
+	SpectralOcean(const SpectralOcean& rhs) = delete;
+	SpectralOcean& operator=(const SpectralOcean& rhs) = delete;
+
+	int RowCount()const { return mNumRows; }
+	int ColumnCount()const { return mNumCols; }
+	std::size_t VertexCount()const { return mVertexCount; }
+	std::size_t TriangleCount()const { return mTriangleCount; }
+	float Width()const { return mNumCols*mSpatialStep; }
+	float Depth()const { return mNumRows*mSpatialStep; }
+
+	// Returns the surface at the ith grid point, displaced sideways by the
+	// choppiness.
+	DirectX::XMFLOAT3 Position(std::size_t i)const;
+
+	// The surface is evaluated at the exact time, so there is nothing to blend;
+	// this only matches the Waves interface.
+	DirectX::XMFLOAT3 InterpolatedPosition(std::size_t i)const { return Position(i); }
+
+	// Returns the surface normal at the ith grid point.
+	DirectX::XMFLOAT3 Normal(std::size_t i)const;
+
+	// Returns the unit tangent vector at the ith grid point in the local x-axis direction.
+	DirectX::XMFLOAT3 TangentX(std::size_t i)const;
+
+	// The patch repeats every n*dx.  These return the surface and its normal
+	// at the grid point of that tiling nearest the world point (x, z), so any
+	// grid with a spacing that is a multiple of dx can be filled from it.
+	DirectX::XMFLOAT3 TiledPosition(float x, float z)const;
+	DirectX::XMFLOAT3 TiledNormal(float x, float z)const;
+
+	// Writes Position and Normal of every grid point into out.
+	void WriteVertices(const VertexSpan& out)const;
+
+	// Writes TiledPosition and TiledNormal for the rows x cols points from
+	// (x0, z0) on, spacing apart, rows towards -z: the points of a Waves grid.
+	void WriteTiledVertices(float x0, float z0, float spacing, int rows, int cols, const VertexSpan& out)const;
+
+	double Time()const { return mTime; }
+
+	// Scales the sideways displacement that sharpens crests; 0 gives plain
+	// heightfield waves.  Values much past 1 make the surface fold over.
+	void SetChoppiness(float lambda) { mChoppiness = lambda; }
+	float Choppiness()const { return mChoppiness; }
+
+	// Distance in metres the wind has blown over open water; only used by the
+	// JONSWAP spectrum.  Rebuilds the amplitudes.
+	void SetFetch(float fetch);
+
+	void Update(float dt);
+	void SetTime(double t);
+
+private:
+	void BuildAmplitudes();
+	float SpectrumDensity(float kx, float kz)const;
+	void Evaluate();
+	// Point (row, col) of the tiling, which has point (0, 0) at the origin.
+	std::size_t TiledIndex(int row, int col)const;
+	DirectX::XMFLOAT3 TiledPoint(int row, int col)const;
+	int NearestTiledRow(float z)const { return int(std::floor(-z / mSpatialStep + 0.5f)); }
+	int NearestTiledColumn(float x)const { return int(std::floor(x / mSpatialStep + 0.5f)); }
+
+	OceanSpectrum mSpectrum;
+	unsigned mSeed;
+
+	int mNumRows = 0;
+	int mNumCols = 0;
+	std::size_t mVertexCount = 0;
+	std::size_t mTriangleCount = 0;
+
+	float mSpatialStep = 0.0f;
+	float mHalfWidth = 0.0f;
+	float mHalfDepth = 0.0f;
+
+	float mWindSpeed = 0.0f;
+	float mWindX = 1.0f;
+	float mWindZ = 0.0f;
+	float mFetch = 100000.0f;
+	float mChoppiness = 1.0f;
+
+	double mTime = 0.0;
+
+	FFT mFFT;
+
+	// Per frequency, in FFT order: the amplitude h0(k), conj(h0(-k)), the
+	// angular frequency and the wave vector in grid (column, row) axes.
+	std::vector<std::complex<float>> mH0;
+	std::vector<std::complex<float>> mH0MinusConj;
+	std::vector<float> mOmega;
+	std::vector<float> mKCol;
+	std::vector<float> mKRow;
+
+	// Real fields are transformed in pairs, one in the real and one in the
+	// imaginary part, which is exact because each field's spectrum is
+	// Hermitian:
+	//   mFields[0] = height + i*(column displacement)
+	//   mFields[1] = (row displacement) + i*(column slope)
+	//   mFields[2] = (row slope)
+	std::vector<std::complex<float>> mFields[3];
+};
+
+#endif // SPECTRALOCEAN_H
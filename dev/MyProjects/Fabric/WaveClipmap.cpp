@@ -0,0 +1,206 @@
+//***************************************************************************************
+// WaveClipmap.cpp by llyr-who (C) 2011 All Rights Reserved.
+//***************************************************************************************
+
+#include "WaveClipmap.h"
+
+#include <cassert>
+#include <cmath>
+
+using namespace DirectX;
+
+WaveClipmap::WaveClipmap(int levels, int n, float dx, float dt, float speed, float damping)
+	: mNumPoints(n), mSpatialStep(dx), mInset((n - 1) / 4), mStepper(dt)
+{
+	assert(levels >= 1 && (n - 1) % 4 == 0);
+
+	// Centred on the origin with n - 1 a multiple of 4, level l spans
+	// [-2*mInset, 2*mInset] cells of its own spacing, which is [-mInset, mInset]
+	// cells of level l+1: the levels line up from the start.
+	for(int l = 0; l < levels; ++l)
+	{
+		float scale = float(1 << l);
+		mLevels.push_back(std::make_unique<Waves>(n, n, dx*scale, dt*scale, speed, damping));
+	}
+}
+
+void WaveClipmap::Update(float dt)
+{
+	int steps = mStepper.Advance(dt);
+	for(int s = 0; s < steps; ++s)
+		Step();
+}
+
+float WaveClipmap::PhaseInCoarser(int l)const
+{
+	int period = 2 << l;
+	return float(mPhase % period) / float(period);
+}
+
+void WaveClipmap::Step()
+{
+	int coarsest = LevelCount() - 1;
+
+	// Coarse levels go first, so a finer level can take its boundary from a
+	// coarser solution that is already past it in time.
+	for(int l = coarsest; l >= 0; --l)
+	{
+		if(mPhase % (1 << l) != 0)
+			continue;
+		if(l < coarsest)
+			SetBoundaryFromCoarser(l);
+		mLevels[l]->Step(1);
+	}
+
+	mPhase = (mPhase + 1) % (1 << coarsest);
+
+	// Finest first, so each restriction passes on the one below it.
+	for(int l = 0; l < coarsest; ++l)
+	{
+		if(mPhase % (2 << l) == 0)
+			Restrict(l);
+	}
+}
+
+void WaveClipmap::SampleCoarser(int l, int i, int j, float& prev, float& curr)const
+{
+	const Waves& coarse = *mLevels[l + 1];
+	int n = mNumPoints;
+
+	// Even points of level l sit on points of level l+1, odd ones halfway
+	// between two; averaging the four corners covers both cases.
+	int r0 = mInset + i/2;
+	int c0 = mInset + j/2;
+	int r1 = r0 + (i & 1);
+	int c1 = c0 + (j & 1);
+	std::size_t corners[4] = { std::size_t(r0)*n + c0, std::size_t(r0)*n + c1, std::size_t(r1)*n + c0, std::size_t(r1)*n + c1 };
+
+	prev = 0.0f;
+	curr = 0.0f;
+	for(std::size_t k : corners)
+	{
+		prev += 0.25f*coarse.PrevHeight(k);
+		curr += 0.25f*coarse.Height(k);
+	}
+}
+
+void WaveClipmap::SetBoundaryFromCoarser(int l)
+{
+	Waves& fine = *mLevels[l];
+	int n = mNumPoints;
+	float alpha = PhaseInCoarser(l);
+
+	auto setPoint = [this, &fine, l, n, alpha](int i, int j)
+	{
+		float prev, curr;
+		SampleCoarser(l, i, j, prev, curr);
+		float h = prev + (curr - prev)*alpha;
+		fine.SetHeight(std::size_t(i)*n + j, h, h);
+	};
+
+	for(int j = 0; j < n; ++j)
+	{
+		setPoint(0, j);
+		setPoint(n - 1, j);
+	}
+	for(int i = 1; i < n - 1; ++i)
+	{
+		setPoint(i, 0);
+		setPoint(i, n - 1);
+	}
+}
+
+void WaveClipmap::Restrict(int l)
+{
+	const Waves& fine = *mLevels[l];
+	Waves& coarse = *mLevels[l + 1];
+	int n = mNumPoints;
+
+	// Keep the coarse velocity: shift both of its steps by the correction.
+	for(int ci = mInset + RestrictMargin; ci <= 3*mInset - RestrictMargin; ++ci)
+	{
+		for(int cj = mInset + RestrictMargin; cj <= 3*mInset - RestrictMargin; ++cj)
+		{
+			float h = fine.Height(std::size_t(2*(ci - mInset))*n + 2*(cj - mInset));
+			std::size_t k = std::size_t(ci)*n + cj;
+			coarse.SetHeight(k, coarse.PrevHeight(k) + h - coarse.Height(k), h);
+		}
+	}
+}
+
+void WaveClipmap::SetCenter(float x, float z)
+{
+	int coarsest = LevelCount() - 1;
+	float spacing = mSpatialStep*float(1 << coarsest);
+	int row = int(std::floor(-z / spacing + 0.5f));
+	int col = int(std::floor(x / spacing + 0.5f));
+	if(row == mCenterRow && col == mCenterCol)
+		return;
+
+	int rows = row - mCenterRow;
+	int cols = col - mCenterCol;
+	mCenterRow = row;
+	mCenterCol = col;
+
+	// Outside in, so every level fills from a coarser one that has already
+	// moved.
+	for(int l = coarsest; l >= 0; --l)
+	{
+		int scale = 1 << (coarsest - l);
+		mLevels[l]->Scroll(rows*scale, cols*scale);
+		if(l < coarsest)
+			FillFromCoarser(l, rows*scale, cols*scale);
+	}
+}
+
+void WaveClipmap::FillFromCoarser(int l, int rows, int cols)
+{
+	Waves& fine = *mLevels[l];
+	int n = mNumPoints;
+	float alpha = PhaseInCoarser(l);
+
+	for(int i = 0; i < n; ++i)
+	{
+		bool newRow = (i + rows < 0 || i + rows >= n);
+		for(int j = 0; j < n; ++j)
+		{
+			if(!newRow && j + cols >= 0 && j + cols < n)
+				continue;
+
+			// The coarse level's time steps are twice as long, so half its
+			// change per step is this level's.
+			float prev, curr;
+			SampleCoarser(l, i, j, prev, curr);
+			float h = prev + (curr - prev)*alpha;
+			fine.SetHeight(std::size_t(i)*n + j, h - 0.5f*(curr - prev), h);
+		}
+	}
+}
+
+void WaveClipmap::Disturb(float x, float z, float magnitude, float radius)
+{
+	int n = mNumPoints;
+	for(int l = 0; l < LevelCount(); ++l)
+	{
+		Waves& level = *mLevels[l];
+		float spacing = mSpatialStep*float(1 << l);
+
+		// Point 0 is the corner at -x, +z.
+		XMFLOAT3 corner = level.Position(0);
+		int i = int(std::floor((corner.z - z) / spacing + 0.5f));
+		int j = int(std::floor((x - corner.x) / spacing + 0.5f));
+		if(i < 1 || i >= n - 1 || j < 1 || j >= n - 1)
+			continue;
+
+		WaveDisturbance d = { i, j, magnitude, radius / spacing };
+		level.Disturb(&d, 1);
+		return;
+	}
+}
+
+void WaveClipmap::WriteVertices(const VertexSpan& out)const
+{
+	std::size_t count = mLevels[0]->VertexCount();
+	for(int l = 0; l < LevelCount(); ++l)
+		mLevels[l]->WriteVertices(out.Sub(l*count, count));
+}
@@ -0,0 +1,94 @@
+//***************************************************************************************
+// WaveClipmap.h by llyr-who (C) 2011 All Rights Reserved.
+//
+// Nested Waves grids around a moving centre, for water much larger than one grid.
+// Every level has the same number of points; each one out doubles the spacing and
+// the time step of the one inside it, so all levels run at the same Courant number
+// and the cost per unit of time stays the same however far out the levels reach.
+//
+// Levels are coupled both ways.  A finer level takes its boundary from the coarser
+// level around it, interpolated in space and in time.  Whenever it has caught up
+// with the coarser level, it overwrites the coarser points it covers.
+//***************************************************************************************
+
+#ifndef WAVECLIPMAP_H
+#define WAVECLIPMAP_H
+
+#include <memory>
+#include <vector>
+#include "Waves.h"
+
+class WaveClipmap
+{
+public:
+	// levels grids of n x n points, centred on the origin.  Level 0 is the
+	// finest, with spacing dx and time step dt.  n - 1 must be a multiple of 4,
+	// so the points of each level fall on or halfway between those of the next.
+	WaveClipmap(int levels, int n, float dx, float dt, float speed, float damping);
+	WaveClipmap(const WaveClipmap& rhs) = delete;
+	WaveClipmap& operator=(const WaveClipmap& rhs) = delete;
+
+	int LevelCount()const { return int(mLevels.size()); }
+	const Waves& Level(int l)const { return *mLevels[l]; }
+	// Grid points of all levels together.
+	std::size_t VertexCount()const { return mLevels.size()*mLevels[0]->VertexCount(); }
+
+	// Every level but the finest has the quads [HoleBegin(), HoleEnd()) in both
+	// directions covered by the next finer level; they need not be drawn.
+	int HoleBegin()const { return mInset; }
+	int HoleEnd()const { return 3*mInset; }
+
+	// Moves the levels so they are centred as close to (x, z) as the coarsest
+	// spacing allows.  They move together, so the holes never move.  Water
+	// that a level moves over is filled in from the level around it.
+	void SetCenter(float x, float z);
+
+	// Gives the coarsest level an absorbing layer (see Waves::SetAbsorbingLayer),
+	// so waves leave the outermost level instead of reflecting back in.
+	void SetAbsorbingLayer(int width, float reflection = 1e-2f) { mLevels.back()->SetAbsorbingLayer(width, reflection); }
+
+	// Upper bound on finest steps per Update; time past it is dropped.
+	void SetMaxSubsteps(int maxSubsteps) { mStepper.SetMaxSubsteps(maxSubsteps); }
+
+	// Advances by dt in finest steps; level l steps once every 2^l of them.
+	void Update(float dt);
+
+	// Writes Position and Normal of every level into out, the finest first,
+	// each over VertexCount()/LevelCount() vertices.
+	void WriteVertices(const VertexSpan& out)const;
+
+	// Raises the water around world point (x, z) on the finest level that
+	// contains it, with a CosineProfile of the given radius in world units.
+	void Disturb(float x, float z, float magnitude, float radius);
+
+private:
+	void Step();
+	// Heights of level l+1 at point (i, j) of level l.
+	void SampleCoarser(int l, int i, int j, float& prev, float& curr)const;
+	void SetBoundaryFromCoarser(int l);
+	void FillFromCoarser(int l, int rows, int cols);
+	void Restrict(int l);
+	// Where level l is, between the two steps of level l+1 it has to match.
+	float PhaseInCoarser(int l)const;
+
+	std::vector<std::unique_ptr<Waves>> mLevels;
+	int mNumPoints = 0;
+	float mSpatialStep = 0.0f;
+
+	// Level l covers the points [mInset, 3*mInset] of level l+1.
+	int mInset = 0;
+
+	// Coarse points within this many cells of a finer level's edge are left
+	// to the coarse solver, away from the finer level's boundary.
+	static const int RestrictMargin = 2;
+
+	// Finest steps taken, modulo the coarsest period.
+	int mPhase = 0;
+	FixedTimestep mStepper;
+
+	// Centre in units of the coarsest spacing; columns along +x, rows along -z.
+	int mCenterRow = 0;
+	int mCenterCol = 0;
+};
+
+#endif // WAVECLIPMAP_H
@@ -3,23 +3,25 @@
 //***************************************************************************************
 
 #include "Waves.h"
-#include <ppl.h>
+#include "../../Common/ThreadPool.h"
 #include <algorithm>
 #include <vector>
-#include <cassert>
+#include <cmath>
 
 using namespace DirectX;
 
-Waves::Waves(int m, int n, float dx, float dt, float speed, float damping)
+Waves::Waves(int m, int n, float dx, float dt, float speed, float damping, WaveHeightFormat format)
+    : mStepper(dt), mFormat(format)
 {
     mNumRows = m;
     mNumCols = n;
 
-    mVertexCount = m*n;
-    mTriangleCount = (m - 1)*(n - 1) * 2;
+    mVertexCount = std::size_t(m)*n;
+    mTriangleCount = std::size_t(m - 1)*(n - 1) * 2;
 
     mTimeStep = dt;
     mSpatialStep = dx;
+    mSpeed = speed;
 
     float d = damping*dt + 2.0f;
     float e = (speed*speed)*(dt*dt) / (dx*dx);
@@ -27,27 +29,25 @@ Waves::Waves(int m, int n, float dx, float dt, float speed, float damping)
     mK2 = (4.0f - 8.0f*e) / d;
     mK3 = (2.0f*e) / d;
 
-    mPrevSolution.resize(m*n);
-    mCurrSolution.resize(m*n);
-    mNormals.resize(m*n);
-    mTangentX.resize(m*n);
+    // The grid is centred on the origin; see GridPoint.
+    mHalfWidth = (n - 1)*dx*0.5f;
+    mHalfDepth = (m - 1)*dx*0.5f;
 
-    // Generate grid vertices in system memory.
+    mTileRowCount = (m - 2 + TileRows - 1) / TileRows;
+    mTileColCount = (n - 2 + TileCols - 1) / TileCols;
 
-    float halfWidth = (n - 1)*dx*0.5f;
-    float halfDepth = (m - 1)*dx*0.5f;
-    for(int i = 0; i < m; ++i)
+    // The water starts flat, so every tile starts asleep.
+    mTileAwake.assign(mTileRowCount*mTileColCount, 0);
+    mTileCalm.assign(mTileRowCount*mTileColCount, 0);
+    if(mFormat == WaveHeightFormat::Float16)
     {
-        float z = halfDepth - i*dx;
-        for(int j = 0; j < n; ++j)
-        {
-            float x = -halfWidth + j*dx;
-
-            mPrevSolution[i*n + j] = XMFLOAT3(x, 0.0f, z);
-            mCurrSolution[i*n + j] = XMFLOAT3(x, 0.0f, z);
-            mNormals[i*n + j] = XMFLOAT3(0.0f, 1.0f, 0.0f);
-            mTangentX[i*n + j] = XMFLOAT3(1.0f, 0.0f, 0.0f);
-        }
+        mHalfHeights.Prev.assign(mVertexCount, PackedVector::XMConvertFloatToHalf(0.0f));
+        mHalfHeights.Curr = mHalfHeights.Next = mHalfHeights.Prev;
+    }
+    else
+    {
+        mHeights.Prev.assign(mVertexCount, 0.0f);
+        mHeights.Curr = mHeights.Next = mHeights.Prev;
     }
 }
 
@@ -65,12 +65,12 @@ int Waves::ColumnCount()const
 	return mNumCols;
 }
 
-int Waves::VertexCount()const
+std::size_t Waves::VertexCount()const
 {
 	return mVertexCount;
 }
 
-int Waves::TriangleCount()const
+std::size_t Waves::TriangleCount()const
 {
 	return mTriangleCount;
 }
@@ -85,88 +85,600 @@ float Waves::Depth()const
 	return mNumRows*mSpatialStep;
 }
 
+void Waves::SetAbsorbingLayer(int width, float reflection)
+{
+	width = std::max(0, std::min(width, (std::min(mNumRows, mNumCols) - 1) / 2));
+	if(width == 0)
+	{
+		mAbsorbing.clear();
+		return;
+	}
+
+	// Cerjan et al. (1985): every step, points at depth d into the layer are
+	// scaled by G(d) = exp(-(a (width - d))^2).  Unlike extra velocity damping,
+	// that also removes the slow, long-wavelength tail a 2D disturbance leaves
+	// behind, which a velocity sponge reflects.  A wave crosses a cell in
+	// 1/courant steps, so there and back through the layer it keeps about
+	// exp(-(2/courant) a^2 width^3/3); a is chosen to make that reflection.
+	float courant = mSpeed*mTimeStep / mSpatialStep;
+	float a2 = 1.5f*courant*std::log(1.0f / std::min(reflection, 1.0f)) / (float(width)*width*width);
+
+	// Scaling the new solution by G, and the old one it is built from by G
+	// as well, is the same as scaling the stencil: K1 by G^2, K2 and K3 by G.
+	mAbsorbing.resize(width);
+	for(int depth = 0; depth < width; ++depth)
+	{
+		float r = float(width - depth);
+		float g = std::exp(-a2*r*r);
+		mAbsorbing[depth].K1 = mK1*g*g;
+		mAbsorbing[depth].K2 = mK2*g;
+		mAbsorbing[depth].K3 = mK3*g;
+	}
+}
+
 void Waves::Update(float dt)
 {
-	static float t = 0;
+	// Only update the simulation at the specified time step; any
+	// leftover time carries over to the next call.
+	Step(mStepper.Advance(dt));
+}
+
+void Waves::Step(int steps)
+{
+	while(steps > 0)
+	{
+		int pass = std::min(steps, mStepsPerPass);
+		StepTiles(pass);
+		steps -= pass;
+	}
+}
 
-	// Accumulate time.
-	t += dt;
+namespace
+{
+	// Per-thread tile planes, reused from pass to pass.
+	thread_local std::vector<float> tPrevPlane;
+	thread_local std::vector<float> tCurrPlane;
 
-	// Only update the simulation at the specified time step.
-	if( t >= mTimeStep )
+	inline float ToFloat(float h) { return h; }
+	inline float ToFloat(PackedVector::HALF h) { return PackedVector::XMConvertHalfToFloat(h); }
+	inline void FromFloat(float v, float& h) { h = v; }
+	inline void FromFloat(float v, PackedVector::HALF& h) { h = PackedVector::XMConvertFloatToHalf(v); }
+}
+
+float Waves::Height(std::size_t i)const
+{
+	if(mFormat == WaveHeightFormat::Float16)
+		return ToFloat(mHalfHeights.Curr[i]);
+	return mHeights.Curr[i];
+}
+
+float Waves::PrevHeight(std::size_t i)const
+{
+	if(mFormat == WaveHeightFormat::Float16)
+		return ToFloat(mHalfHeights.Prev[i]);
+	return mHeights.Prev[i];
+}
+
+void Waves::SetHeight(std::size_t i, float prev, float curr)
+{
+	// The output grids too, so boundary points keep their value when the
+	// grids are swapped after a pass.
+	if(mFormat == WaveHeightFormat::Float16)
+		SetGridHeights(mHalfHeights, i, prev, curr);
+	else
+		SetGridHeights(mHeights, i, prev, curr);
+
+	// Sleeping tiles must stay all zero.
+	if(prev != 0.0f || curr != 0.0f)
+		mTileAwake[TileOf(int(i / mNumCols), int(i % mNumCols))] = 1;
+}
+
+template<typename T>
+void Waves::SetGridHeights(HeightGrids<T>& grids, std::size_t i, float prev, float curr)
+{
+	FromFloat(prev, grids.Prev[i]);
+	FromFloat(curr, grids.Curr[i]);
+	FromFloat(curr, grids.Next[i]);
+	if(!grids.NextPrev.empty())
+		FromFloat(prev, grids.NextPrev[i]);
+}
+
+int Waves::TileOf(int row, int col)const
+{
+	// Boundary points belong to the tile next to them.
+	int tr = std::min(std::max(row - 1, 0) / TileRows, mTileRowCount - 1);
+	int tc = std::min(std::max(col - 1, 0) / TileCols, mTileColCount - 1);
+	return tr*mTileColCount + tc;
+}
+
+void Waves::Scroll(int rows, int cols)
+{
+	if(rows == 0 && cols == 0)
+		return;
+
+	if(mFormat == WaveHeightFormat::Float16)
+		ScrollGrids(mHalfHeights, rows, cols);
+	else
+		ScrollGrids(mHeights, rows, cols);
+
+	mOffsetX += cols*mSpatialStep;
+	mOffsetZ -= rows*mSpatialStep;
+
+	// Cheaper than working out which tiles the water moved into; calm ones
+	// go back to sleep after the next pass.
+	std::fill(mTileAwake.begin(), mTileAwake.end(), 1);
+}
+
+template<typename T>
+void Waves::ScrollGrids(HeightGrids<T>& grids, int rows, int cols)
+{
+	T zero;
+	FromFloat(0.0f, zero);
+
+	std::vector<T> moved;
+	for(std::vector<T>* grid : { &grids.Prev, &grids.Curr, &grids.Next, &grids.NextPrev })
+	{
+		if(grid->empty())
+			continue;
+
+		// Point (i, j) now holds what was at (i + rows, j + cols).
+		moved.assign(grid->size(), zero);
+		int j0 = std::max(0, -cols);
+		int j1 = std::min(mNumCols, mNumCols - cols);
+		for(int i = std::max(0, -rows); i < std::min(mNumRows, mNumRows - rows) && j0 < j1; ++i)
+		{
+			std::copy(grid->begin() + Index(i + rows, j0 + cols),
+				grid->begin() + Index(i + rows, j1 + cols),
+				moved.begin() + Index(i, j0));
+		}
+		grid->swap(moved);
+	}
+}
+
+XMFLOAT3 Waves::Normal(std::size_t i)const
+{
+	int row = int(i / mNumCols);
+	int col = int(i % mNumCols);
+	if(row == 0 || row == mNumRows-1 || col == 0 || col == mNumCols-1)
+		return XMFLOAT3(0.0f, 1.0f, 0.0f);
+
+	//
+	// Compute normals using finite difference scheme.
+	//
+	float l = Height(i-1);
+	float r = Height(i+1);
+	float t = Height(i-mNumCols);
+	float b = Height(i+mNumCols);
+
+	float nx = -r+l;
+	float ny = 2.0f*mSpatialStep;
+	float nz = b-t;
+	float invLen = 1.0f / std::sqrt(nx*nx + ny*ny + nz*nz);
+	return XMFLOAT3(nx*invLen, ny*invLen, nz*invLen);
+}
+
+void Waves::Update(float dt, const VertexSpan& out)
+{
+	Update(dt);
+	WriteVertices(out);
+}
+
+void Waves::WriteVertices(const VertexSpan& out)const
+{
+	if(mFormat == WaveHeightFormat::Float16)
+		WriteGridVertices(mHalfHeights.Curr, out);
+	else
+		WriteGridVertices(mHeights.Curr, out);
+}
+
+template<typename T>
+void Waves::WriteGridVertices(const std::vector<T>& heights, const VertexSpan& out)const
+{
+	// Position and Normal, reading the rows directly.
+	ThreadPool::Default().ParallelForRange(0, mNumRows, 16, [this, &heights, &out](std::size_t first, std::size_t last)
 	{
-		// Only update interior points; we use zero boundary conditions.
-		concurrency::parallel_for(1, mNumRows - 1, [this](int i)
-		//for(int i = 1; i < mNumRows-1; ++i)
+		VertexSpanWriter writer(out, Index(int(first), 0));
+		for(int i = int(first); i < int(last); ++i)
 		{
-			for(int j = 1; j < mNumCols-1; ++j)
+			const T* row = &heights[Index(i, 0)];
+			bool edge = (i == 0 || i == mNumRows - 1);
+			float z = mOffsetZ + mHalfDepth - float(i)*mSpatialStep;
+			for(int j = 0; j < mNumCols; ++j)
 			{
-				// After this update we will be discarding the old previous
-				// buffer, so overwrite that buffer with the new update.
-				// Note how we can do this inplace (read/write to same element) 
-				// because we won't need prev_ij again and the assignment happens last.
-
-				// Note j indexes x and i indexes z: h(x_j, z_i, t_k)
-				// Moreover, our +z axis goes "down"; this is just to 
-				// keep consistent with our row indices going down.
-
-				mPrevSolution[i*mNumCols+j].y = 
-					mK1*mPrevSolution[i*mNumCols+j].y +
-					mK2*mCurrSolution[i*mNumCols+j].y +
-					mK3*(mCurrSolution[(i+1)*mNumCols+j].y + 
-					     mCurrSolution[(i-1)*mNumCols+j].y + 
-					     mCurrSolution[i*mNumCols+j+1].y + 
-						 mCurrSolution[i*mNumCols+j-1].y);
+				XMFLOAT3 p(mOffsetX - mHalfWidth + float(j)*mSpatialStep, ToFloat(row[j]), z);
+				XMFLOAT3 n(0.0f, 1.0f, 0.0f);
+				if(!edge && j != 0 && j != mNumCols - 1)
+				{
+					float nx = -ToFloat(row[j+1]) + ToFloat(row[j-1]);
+					float ny = 2.0f*mSpatialStep;
+					float nz = ToFloat(row[j+mNumCols]) - ToFloat(row[j-mNumCols]);
+					float invLen = 1.0f / std::sqrt(nx*nx + ny*ny + nz*nz);
+					n = XMFLOAT3(nx*invLen, ny*invLen, nz*invLen);
+				}
+				writer.Write(p, n);
 			}
-		});
+		}
+	});
+}
+
+XMFLOAT3 Waves::TangentX(std::size_t i)const
+{
+	int row = int(i / mNumCols);
+	int col = int(i % mNumCols);
+	if(row == 0 || row == mNumRows-1 || col == 0 || col == mNumCols-1)
+		return XMFLOAT3(1.0f, 0.0f, 0.0f);
+
+	float tx = 2.0f*mSpatialStep;
+	float ty = Height(i+1) - Height(i-1);
+	float invLen = 1.0f / std::sqrt(tx*tx + ty*ty);
+	return XMFLOAT3(tx*invLen, ty*invLen, 0.0f);
+}
 
-		// We just overwrote the previous buffer with the new data, so
-		// this data needs to become the current solution and the old
-		// current solution becomes the new previous solution.
-		std::swap(mPrevSolution, mCurrSolution);
+void Waves::StepTiles(int steps)
+{
+	if(mFormat == WaveHeightFormat::Float16)
+		StepTiles(mHalfHeights, steps);
+	else
+		StepTiles(mHeights, steps);
+}
 
-		t = 0.0f; // reset time
+template<typename T>
+void Waves::StepTiles(HeightGrids<T>& grids, int steps)
+{
+	if(steps > 1 && grids.NextPrev.empty())
+		grids.NextPrev = grids.Curr;
 
-		//
-		// Compute normals using finite difference scheme.
-		//
-		concurrency::parallel_for(1, mNumRows - 1, [this](int i)
-		//for(int i = 1; i < mNumRows - 1; ++i)
+	// Run the awake tiles and the ones next to them, which waves may be
+	// about to enter.  A pass reaches at most TileRows cells into a tile, so
+	// tiles further out cannot change.
+	mActiveTiles.clear();
+	for(int tr = 0; tr < mTileRowCount; ++tr)
+	{
+		for(int tc = 0; tc < mTileColCount; ++tc)
 		{
-			for(int j = 1; j < mNumCols-1; ++j)
+			bool active = false;
+			for(int r = std::max(tr-1, 0); r <= std::min(tr+1, mTileRowCount-1) && !active; ++r)
 			{
-				float l = mCurrSolution[i*mNumCols+j-1].y;
-				float r = mCurrSolution[i*mNumCols+j+1].y;
-				float t = mCurrSolution[(i-1)*mNumCols+j].y;
-				float b = mCurrSolution[(i+1)*mNumCols+j].y;
-				mNormals[i*mNumCols+j].x = -r+l;
-				mNormals[i*mNumCols+j].y = 2.0f*mSpatialStep;
-				mNormals[i*mNumCols+j].z = b-t;
-
-				XMVECTOR n = XMVector3Normalize(XMLoadFloat3(&mNormals[i*mNumCols+j]));
-				XMStoreFloat3(&mNormals[i*mNumCols+j], n);
-
-				mTangentX[i*mNumCols+j] = XMFLOAT3(2.0f*mSpatialStep, r-l, 0.0f);
-				XMVECTOR T = XMVector3Normalize(XMLoadFloat3(&mTangentX[i*mNumCols+j]));
-				XMStoreFloat3(&mTangentX[i*mNumCols+j], T);
+				for(int c = std::max(tc-1, 0); c <= std::min(tc+1, mTileColCount-1); ++c)
+					active = active || mTileAwake[r*mTileColCount + c];
 			}
-		});
+			if(active)
+				mActiveTiles.push_back(tr*mTileColCount + tc);
+		}
+	}
+
+	// Tiles only read the two input solutions and only write their own part
+	// of the outputs, so they need no ordering among themselves.  Sleeping
+	// tiles are all zero in every grid, so skipping them is exact.
+	ThreadPool& pool = ThreadPool::Default();
+	pool.ParallelFor(0, mActiveTiles.size(), 1, [this, &grids, steps](std::size_t k)
+	{
+		int tile = mActiveTiles[k];
+		mTileCalm[tile] = StepTile(grids, tile, steps);
+	});
+
+	// The step before last becomes the previous solution and the last step the
+	// current one.  With a single step that is just the old current solution.
+	if(steps == 1)
+		std::swap(grids.Prev, grids.Curr);
+	else
+		std::swap(grids.Prev, grids.NextPrev);
+	std::swap(grids.Curr, grids.Next);
+
+	// A calm tile only goes to sleep once its neighbours are calm too;
+	// otherwise the faint front of an arriving wave would be flattened away
+	// each pass and could never get in.
+	for(int tile : mActiveTiles)
+		mTileAwake[tile] = !mTileCalm[tile];
+	for(int tile : mActiveTiles)
+	{
+		int tr = tile / mTileColCount;
+		int tc = tile % mTileColCount;
+		for(int r = std::max(tr-1, 0); r <= std::min(tr+1, mTileRowCount-1); ++r)
+		{
+			for(int c = std::max(tc-1, 0); c <= std::min(tc+1, mTileColCount-1); ++c)
+				mTileCalm[tile] = mTileCalm[tile] && !mTileAwake[r*mTileColCount + c];
+		}
+	}
+
+	// Zeroing sleeping tiles in every grid keeps skipping them exact.  It has
+	// to wait until no tile reads them as halo any more.
+	pool.ParallelFor(0, mActiveTiles.size(), 1, [this, &grids](std::size_t k)
+	{
+		int tile = mActiveTiles[k];
+		if(mTileCalm[tile])
+			FlattenTile(grids, tile);
+		else
+			mTileAwake[tile] = 1;
+	});
+}
+
+template<typename T>
+void Waves::FlattenTile(HeightGrids<T>& grids, int tile)
+{
+	int r0 = 1 + (tile / mTileColCount)*TileRows;
+	int c0 = 1 + (tile % mTileColCount)*TileCols;
+	int r1 = std::min(r0 + TileRows, mNumRows - 1);
+	int c1 = std::min(c0 + TileCols, mNumCols - 1);
+
+	T zero;
+	FromFloat(0.0f, zero);
+	for(std::vector<T>* grid : { &grids.Prev, &grids.Curr, &grids.Next, &grids.NextPrev })
+	{
+		if(grid->empty())
+			continue;
+		for(int i = r0; i < r1; ++i)
+			std::fill(grid->begin() + Index(i, c0), grid->begin() + Index(i, c1), zero);
 	}
 }
 
+int Waves::AwakeTileCount()const
+{
+	return int(std::count(mTileAwake.begin(), mTileAwake.end(), 1));
+}
+
+namespace
+{
+	// Advances points [j0, j1) of a plane row with constant coefficients.
+	inline void StepSpan(float* p, const float* c, int w, int j0, int j1, float k1, float k2, float k3)
+	{
+		for(int j = j0; j < j1; ++j)
+		{
+			// Note j indexes x and i indexes z: h(x_j, z_i, t_k)
+			p[j] =
+				k1*p[j] +
+				k2*c[j] +
+				k3*(c[j+w] +
+				    c[j-w] +
+				    c[j+1] +
+					c[j-1]);
+		}
+	}
+}
+
+// Advances points [j0, j1) of plane rows p and c, which hold grid row `row`
+// from grid column colBase on.
+void Waves::StepRow(float* p, const float* c, int w, int row, int j0, int j1, int colBase)const
+{
+	int width = int(mAbsorbing.size());
+	int rowDepth = std::min(row, mNumRows - 1 - row);
+	if(width == 0)
+	{
+		StepSpan(p, c, w, j0, j1, mK1, mK2, mK3);
+		return;
+	}
+
+	// Inside the layer the coefficients go by the distance to the nearest
+	// edge.  Rows clear of it only need a lookup per point near the sides.
+	int inner0 = j0;
+	int inner1 = j0;
+	if(rowDepth >= width)
+	{
+		inner0 = std::min(std::max(width - colBase, j0), j1);
+		inner1 = std::min(std::max(mNumCols - 1 - width - colBase, inner0), j1);
+	}
+
+	auto stepLayerPoint = [this, p, c, w, width, rowDepth, colBase](int j)
+	{
+		int col = j + colBase;
+		int depth = std::min(rowDepth, std::min(col, mNumCols - 1 - col));
+		if(depth < width)
+			StepSpan(p, c, w, j, j + 1, mAbsorbing[depth].K1, mAbsorbing[depth].K2, mAbsorbing[depth].K3);
+		else
+			StepSpan(p, c, w, j, j + 1, mK1, mK2, mK3);
+	};
+
+	for(int j = j0; j < inner0; ++j)
+		stepLayerPoint(j);
+	StepSpan(p, c, w, inner0, inner1, mK1, mK2, mK3);
+	for(int j = inner1; j < j1; ++j)
+		stepLayerPoint(j);
+}
+
+// Returns whether the tile ended the pass calm enough to sleep.
+template<typename T>
+bool Waves::StepTile(HeightGrids<T>& grids, int tile, int steps)
+{
+	// Interior rows [r0, r1) and columns [c0, c1) this tile is responsible for.
+	int r0 = 1 + (tile / mTileColCount)*TileRows;
+	int c0 = 1 + (tile % mTileColCount)*TileCols;
+	int r1 = std::min(r0 + TileRows, mNumRows - 1);
+	int c1 = std::min(c0 + TileCols, mNumCols - 1);
+
+	// Every step spoils one more row and column at the edge of what was
+	// loaded, so load steps of halo.  The grid boundary is held fixed during
+	// a pass (zero unless set with SetHeight), so it never spoils.
+	int halo = steps;
+	int rowBase = std::max(r0 - halo, 0);
+	int colBase = std::max(c0 - halo, 0);
+	int rowEnd = std::min(r1 + halo, mNumRows);
+	int colEnd = std::min(c1 + halo, mNumCols);
+	int w = colEnd - colBase;
+
+	// Local float copies of the heights; point (i, j) of the grid is at
+	// (i - rowBase)*w + j - colBase.
+	std::vector<float>& prev = tPrevPlane;
+	std::vector<float>& curr = tCurrPlane;
+	prev.resize(std::size_t((rowEnd - rowBase)*w));
+	curr.resize(std::size_t((rowEnd - rowBase)*w));
+
+	for(int i = rowBase; i < rowEnd; ++i)
+	{
+		const T* p = &grids.Prev[Index(i, colBase)];
+		const T* c = &grids.Curr[Index(i, colBase)];
+		for(int k = 0; k < w; ++k)
+		{
+			prev[(i-rowBase)*w + k] = ToFloat(p[k]);
+			curr[(i-rowBase)*w + k] = ToFloat(c[k]);
+		}
+	}
+	// [lo, hi) x [left, right) is the part of the planes that is still exact.
+	int lo = rowBase;
+	int hi = rowEnd;
+	int left = colBase;
+	int right = colEnd;
+	for(int s = 0; s < steps; ++s)
+	{
+		// Overwrite the previous solution in place, exactly like the original
+		// full-grid pass, but only where all four neighbours are exact.
+		for(int i = lo + 1; i < hi - 1; ++i)
+			StepRow(&prev[(i-rowBase)*w], &curr[(i-rowBase)*w], w, i, left + 1 - colBase, right - 1 - colBase, colBase);
+		std::swap(prev, curr);
+
+		// The edge of the exact region moves in by one, unless it is the
+		// boundary of the grid, which is fixed.
+		lo = (lo == 0) ? lo : lo + 1;
+		hi = (hi == mNumRows) ? hi : hi - 1;
+		left = (left == 0) ? left : left + 1;
+		right = (right == mNumCols) ? right : right - 1;
+	}
+
+	float largest = 0.0f;
+	for(int i = r0; i < r1; ++i)
+	{
+		const float* p = &prev[(i-rowBase)*w + c0-colBase];
+		const float* c = &curr[(i-rowBase)*w + c0-colBase];
+		T* next = &grids.Next[Index(i, c0)];
+		T* nextPrev = (steps > 1) ? &grids.NextPrev[Index(i, c0)] : nullptr;
+		for(int k = 0; k < c1 - c0; ++k)
+		{
+			FromFloat(c[k], next[k]);
+			if(nextPrev != nullptr)
+				FromFloat(p[k], nextPrev[k]);
+
+			largest = std::max(largest, std::max(std::fabs(c[k]), std::fabs(c[k] - p[k])));
+		}
+	}
+	return largest < mSleepEpsilon;
+}
+
 void Waves::Disturb(int i, int j, float magnitude)
+{
+	WaveDisturbance d = { i, j, magnitude, 1.0f };
+	Disturb(&d, 1, &Waves::FivePointProfile);
+}
+
+void Waves::Disturb(const WaveDisturbance* disturbances, std::size_t count, WaveProfile profile)
+{
+	if(mFormat == WaveHeightFormat::Float16)
+		ApplyDisturbances(mHalfHeights.Curr, disturbances, count, profile);
+	else
+		ApplyDisturbances(mHeights.Curr, disturbances, count, profile);
+}
+
+bool Waves::Footprint(const WaveDisturbance& d, int& i0, int& i1, int& j0, int& j1)const
 {
 	// Don't disturb boundaries.
-	assert(i > 1 && i < mNumRows-2);
-	assert(j > 1 && j < mNumCols-2);
+	int reach = d.radius > 0.0f ? int(std::ceil(d.radius)) : 0;
+	i0 = std::max(d.i - reach, 1);
+	i1 = std::min(d.i + reach + 1, mNumRows - 1);
+	j0 = std::max(d.j - reach, 1);
+	j1 = std::min(d.j + reach + 1, mNumCols - 1);
+	return i0 < i1 && j0 < j1;
+}
+
+template<typename T>
+void Waves::ApplyDisturbances(std::vector<T>& heights, const WaveDisturbance* disturbances, std::size_t count, WaveProfile profile)
+{
+	// Counting sort of the disturbances into every tile their footprint
+	// overlaps, keeping the order they were given in.
+	int tileCount = mTileRowCount*mTileColCount;
+	mBinStart.assign(tileCount + 1, 0);
+	for(int pass = 0; pass < 2; ++pass)
+	{
+		for(std::size_t k = 0; k < count; ++k)
+		{
+			int i0, i1, j0, j1;
+			if(!Footprint(disturbances[k], i0, i1, j0, j1))
+				continue;
+
+			for(int tr = (i0-1) / TileRows; tr <= (i1-2) / TileRows; ++tr)
+			{
+				for(int tc = (j0-1) / TileCols; tc <= (j1-2) / TileCols; ++tc)
+				{
+					int tile = tr*mTileColCount + tc;
+					if(pass == 0)
+						++mBinStart[tile + 1];
+					else
+						mBinItems[mBinStart[tile]++] = k;
+				}
+			}
+		}
+
+		if(pass == 0)
+		{
+			for(int t = 0; t < tileCount; ++t)
+				mBinStart[t + 1] += mBinStart[t];
+			mBinItems.resize(mBinStart[tileCount]);
+		}
+	}
+	// The fill pass advanced every start to the next bin's start.
+	for(int t = tileCount; t > 0; --t)
+		mBinStart[t] = mBinStart[t - 1];
+	mBinStart[0] = 0;
+
+	mBinnedTiles.clear();
+	for(int t = 0; t < tileCount; ++t)
+	{
+		if(mBinStart[t + 1] != mBinStart[t])
+		{
+			mBinnedTiles.push_back(t);
+			mTileAwake[t] = 1;
+		}
+	}
+
+	// Tiles own disjoint rectangles of the grid, so they can run in parallel.
+	ThreadPool::Default().ParallelFor(0, mBinnedTiles.size(), 1, [this, &heights, disturbances, profile](std::size_t b)
+	{
+		int tile = mBinnedTiles[b];
+		int r0 = 1 + (tile / mTileColCount)*TileRows;
+		int c0 = 1 + (tile % mTileColCount)*TileCols;
+		int r1 = std::min(r0 + TileRows, mNumRows - 1);
+		int c1 = std::min(c0 + TileCols, mNumCols - 1);
+
+		for(std::size_t k = mBinStart[tile]; k < mBinStart[tile + 1]; ++k)
+		{
+			const WaveDisturbance& d = disturbances[mBinItems[k]];
+			int i0, i1, j0, j1;
+			Footprint(d, i0, i1, j0, j1);
+
+			for(int i = std::max(i0, r0); i < std::min(i1, r1); ++i)
+			{
+				for(int j = std::max(j0, c0); j < std::min(j1, c1); ++j)
+				{
+					float di = float(i - d.i);
+					float dj = float(j - d.j);
+					float distance = std::sqrt(di*di + dj*dj);
+					if(distance > d.radius && !(i == d.i && j == d.j))
+						continue;
+
+					T& h = heights[Index(i, j)];
+					FromFloat(ToFloat(h) + d.magnitude*profile(distance, d.radius), h);
+				}
+			}
+		}
+	});
+}
+
+// Disturb already keeps to the radius, so only the centre needs telling apart.
+float Waves::FivePointProfile(float distance, float)
+{
+	return distance == 0.0f ? 1.0f : 0.5f;
+}
+
+float Waves::ConeProfile(float distance, float radius)
+{
+	return radius > 0.0f ? 1.0f - distance/radius : 1.0f;
+}
 
-	float halfMag = 0.5f*magnitude;
+float Waves::CosineProfile(float distance, float radius)
+{
+	return radius > 0.0f ? 0.5f + 0.5f*std::cos(XM_PI*distance/radius) : 1.0f;
+}
 
-	// Disturb the ijth vertex height and its neighbors.
-	mCurrSolution[i*mNumCols+j].y     += magnitude;
-	mCurrSolution[i*mNumCols+j+1].y   += halfMag;
-	mCurrSolution[i*mNumCols+j-1].y   += halfMag;
-	mCurrSolution[(i+1)*mNumCols+j].y += halfMag;
-	mCurrSolution[(i-1)*mNumCols+j].y += halfMag;
+float Waves::GaussianProfile(float distance, float radius)
+{
+	// Three standard deviations out at the edge.
+	float s = radius > 0.0f ? 3.0f*distance/radius : 0.0f;
+	return std::exp(-0.5f*s*s);
 }
-	
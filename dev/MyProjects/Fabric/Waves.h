@@ -9,55 +9,249 @@
 #ifndef WAVES_H
 #define WAVES_H
 
+#include <algorithm>
 #include <vector>
 #include <DirectXMath.h>
+#include <DirectXPackedVector.h>
+#include "../../Common/FixedTimestep.h"
+#include "../../Common/VertexSpan.h"
+
+// How Waves stores its heights.  Half floats halve the solver's memory traffic
+// again; the update itself still runs in float, so they only round once per pass.
+enum class WaveHeightFormat
+{
+    Float32,
+    Float16
+};
+
+// One impulse for the batched Waves::Disturb: adds magnitude*profile(d, radius)
+// to every grid point at a distance d <= radius cells from point (i, j).
+struct WaveDisturbance
+{
+    int i;
+    int j;
+    float magnitude;
+    float radius;
+};
+
+// Shape of a disturbance as a function of the distance from its centre.
+typedef float (*WaveProfile)(float distance, float radius);
 
 class Waves
 {
 public:
-    Waves(int m, int n, float dx, float dt, float speed, float damping);
+    Waves(int m, int n, float dx, float dt, float speed, float damping,
+        WaveHeightFormat format = WaveHeightFormat::Float32);
     Waves(const Waves& rhs) = delete;
     Waves& operator=(const Waves& rhs) = delete;
     ~Waves();
 
 	int RowCount()const;
 	int ColumnCount()const;
-	int VertexCount()const;
-	int TriangleCount()const;
+	std::size_t VertexCount()const;
+	std::size_t TriangleCount()const;
 	float Width()const;
 	float Depth()const;
 
+	// Only heights are stored; x and z come from the grid, and normals and
+	// tangents are worked out from the neighbouring heights when asked for.
+
 	// Returns the solution at the ith grid point.
-    const DirectX::XMFLOAT3& Position(int i)const { return mCurrSolution[i]; }
+    DirectX::XMFLOAT3 Position(std::size_t i)const { return GridPoint(i, Height(i)); }
+
+	// Returns the solution at the ith grid point blended between the last two
+	// steps by InterpolationAlpha(), for smooth rendering between fixed steps.
+	DirectX::XMFLOAT3 InterpolatedPosition(std::size_t i)const
+	{
+		float prev = PrevHeight(i);
+		return GridPoint(i, prev + (Height(i) - prev)*mStepper.Alpha());
+	}
 
 	// Returns the solution normal at the ith grid point.
-    const DirectX::XMFLOAT3& Normal(int i)const { return mNormals[i]; }
+    DirectX::XMFLOAT3 Normal(std::size_t i)const;
 
 	// Returns the unit tangent vector at the ith grid point in the local x-axis direction.
-    const DirectX::XMFLOAT3& TangentX(int i)const { return mTangentX[i]; }
+    DirectX::XMFLOAT3 TangentX(std::size_t i)const;
 
+	WaveHeightFormat HeightFormat()const { return mFormat; }
+
+	// Upper bound on steps per Update; time past it is dropped.
+	void SetMaxSubsteps(int maxSubsteps) { mStepper.SetMaxSubsteps(maxSubsteps); }
+
+	// Temporal blocking: how many steps each tile advances per pass over the
+	// grid.  More steps per pass mean less memory traffic per step, paid for
+	// with redundant work in the overlap between tiles.  Defaults to 1; at
+	// most TileRows, so a pass never reaches past the neighbouring tiles.
+	void SetStepsPerPass(int steps) { mStepsPerPass = std::min(std::max(steps, 1), int(TileRows)); }
+	int StepsPerPass()const { return mStepsPerPass; }
+
+	// Tiles whose heights and last height change all stay below epsilon are
+	// flattened to zero and put to sleep; they are skipped until a neighbour
+	// or Disturb wakes them.  0 keeps every tile awake.
+	void SetSleepThreshold(float epsilon) { mSleepEpsilon = epsilon; }
+	int AwakeTileCount()const;
+
+	// Absorbing (sponge) layer: the outermost width cells damp the water more
+	// the closer they are to the boundary, so waves leave the grid instead of
+	// reflecting off it.  reflection is roughly the amplitude a wave keeps
+	// after crossing the layer and coming back; too small a value makes the
+	// layer's own gradient reflect.  0 width removes the layer.
+	void SetAbsorbingLayer(int width, float reflection = 1e-2f);
+	int AbsorbingLayerWidth()const { return int(mAbsorbing.size()); }
+	float InterpolationAlpha()const { return mStepper.Alpha(); }
+
+	// Advances the simulation by dt, running as many fixed steps as fit and
+	// carrying the remainder over to the next call.
 	void Update(float dt);
+
+	// Update, then WriteVertices.  Normals need the neighbouring tiles, and
+	// sleeping tiles are not stepped at all, so the output is its own pass.
+	void Update(float dt, const VertexSpan& out);
+
+	// Writes Position and Normal of every grid point into out, which must
+	// hold VertexCount() vertices, a band of rows per task.
+	void WriteVertices(const VertexSpan& out)const;
+
+	float SpatialStep()const { return mSpatialStep; }
+
+	// Raises the ijth point by magnitude and its four neighbours by half of it.
 	void Disturb(int i, int j, float magnitude);
 
+	// Runs steps fixed steps now, ignoring the time accumulated by Update.
+	void Step(int steps);
+
+	// Moves the grid by whole cells, rows towards -z and columns towards +x,
+	// leaving the water where it is in the world.  Cells that move in from
+	// outside start flat.
+	void Scroll(int rows, int cols);
+
+	// Heights of the ith grid point at the current and the previous step.
+	float Height(std::size_t i)const;
+	float PrevHeight(std::size_t i)const;
+
+	// Overwrites both steps of the ith grid point, boundary included, and
+	// wakes its tile.  For coupling grids to one another; see WaveClipmap.
+	void SetHeight(std::size_t i, float prev, float curr);
+
+	// Applies a batch of disturbances.  They are binned by tile and the tiles
+	// are processed in parallel; within a tile they are applied in the order
+	// given.  Parts that fall on or outside the boundary are clipped.  The
+	// tiles touched are woken for the next Update.
+	void Disturb(const WaveDisturbance* disturbances, std::size_t count, WaveProfile profile = &Waves::CosineProfile);
+
+	// Profiles for Disturb.  FivePointProfile gives the centre the whole magnitude
+	// and the rest of the radius half of it; with radius 1 that is the classic
+	// single-point disturbance.
+	static float FivePointProfile(float distance, float radius);
+	static float ConeProfile(float distance, float radius);
+	static float CosineProfile(float distance, float radius);
+	static float GaussianProfile(float distance, float radius);
+
 private:
+    struct StencilCoefficients
+    {
+        float K1;
+        float K2;
+        float K3;
+    };
+
+    // The four height grids of one storage format.  Tile passes never write
+    // their inputs, because neighbouring tiles read the same rows as halo:
+    // the new solution goes to Next and is swapped in.  NextPrev is only
+    // needed when a pass runs more than one step.
+    template<typename T>
+    struct HeightGrids
+    {
+        std::vector<T> Prev;
+        std::vector<T> Curr;
+        std::vector<T> Next;
+        std::vector<T> NextPrev;
+    };
+
+	DirectX::XMFLOAT3 GridPoint(std::size_t i, float y)const
+	{
+		return DirectX::XMFLOAT3(mOffsetX - mHalfWidth + float(i % mNumCols)*mSpatialStep, y,
+			mOffsetZ + mHalfDepth - float(i / mNumCols)*mSpatialStep);
+	}
+
+	// Rows and columns fit an int, but a grid of millions of points does not
+	// leave much room for their product.
+	std::size_t Index(int row, int col)const { return std::size_t(row)*mNumCols + col; }
+
+	// Advances the whole grid by steps time steps in one tiled pass.
+	void StepTiles(int steps);
+	template<typename T>
+	void StepTiles(HeightGrids<T>& grids, int steps);
+	template<typename T>
+	bool StepTile(HeightGrids<T>& grids, int tile, int steps);
+	template<typename T>
+	void FlattenTile(HeightGrids<T>& grids, int tile);
+	template<typename T>
+	void ScrollGrids(HeightGrids<T>& grids, int rows, int cols);
+	template<typename T>
+	void SetGridHeights(HeightGrids<T>& grids, std::size_t i, float prev, float curr);
+	template<typename T>
+	void WriteGridVertices(const std::vector<T>& heights, const VertexSpan& out)const;
+	int TileOf(int row, int col)const;
+	void StepRow(float* p, const float* c, int w, int row, int j0, int j1, int colBase)const;
+	template<typename T>
+	void ApplyDisturbances(std::vector<T>& heights, const WaveDisturbance* disturbances, std::size_t count, WaveProfile profile);
+	// Clips the footprint of d to the interior; false if nothing is left.
+	bool Footprint(const WaveDisturbance& d, int& i0, int& i1, int& j0, int& j1)const;
+
+    // Interior rows and columns covered by one tile.  Each tile also reads
+    // steps + 1 halo rows and columns around it, so the tile plus its halo
+    // (two float planes) should stay well inside L2.
+    static const int TileRows = 32;
+    static const int TileCols = 256;
+
+    int mTileRowCount = 0;
+    int mTileColCount = 0;
+
     int mNumRows = 0;
     int mNumCols = 0;
 
-    int mVertexCount = 0;
-    int mTriangleCount = 0;
+    std::size_t mVertexCount = 0;
+    std::size_t mTriangleCount = 0;
 
     // Simulation constants we can precompute.
     float mK1 = 0.0f;
     float mK2 = 0.0f;
     float mK3 = 0.0f;
 
+    // Coefficients of the absorbing layer by distance from the boundary;
+    // empty without one.
+    std::vector<StencilCoefficients> mAbsorbing;
+
+    float mSpeed = 0.0f;
+
     float mTimeStep = 0.0f;
     float mSpatialStep = 0.0f;
+    float mHalfWidth = 0.0f;
+    float mHalfDepth = 0.0f;
+    // Where Scroll has moved the grid's centre to.
+    float mOffsetX = 0.0f;
+    float mOffsetZ = 0.0f;
+
+    FixedTimestep mStepper;
+    int mStepsPerPass = 1;
+
+    // Activity per tile; a tile runs in a pass when it or a neighbour is awake.
+    float mSleepEpsilon = 1e-4f;
+    std::vector<unsigned char> mTileAwake;
+    std::vector<unsigned char> mTileCalm; // written by the tile's own task
+    std::vector<int> mActiveTiles;
+
+    // Disturbance bins, reused between calls: the disturbances overlapping
+    // tile t are mBinItems[mBinStart[t]] to mBinItems[mBinStart[t+1] - 1].
+    std::vector<std::size_t> mBinStart;
+    std::vector<std::size_t> mBinItems;
+    std::vector<int> mBinnedTiles;
 
-    std::vector<DirectX::XMFLOAT3> mPrevSolution;
-    std::vector<DirectX::XMFLOAT3> mCurrSolution;
-    std::vector<DirectX::XMFLOAT3> mNormals;
-    std::vector<DirectX::XMFLOAT3> mTangentX;
+    // Only the grids of mFormat are allocated.
+    WaveHeightFormat mFormat;
+    HeightGrids<float> mHeights;
+    HeightGrids<DirectX::PackedVector::HALF> mHalfHeights;
 };
 
 #endif // WAVES_H
\ No newline at end of file
@@ -0,0 +1,543 @@
+//***************************************************************************************
+// FabricTests.cpp by llyr-who (C) 2011 All Rights Reserved.
+//
+// Headless checks for the cloth solvers.  Each check prints what it compared and
+// whether it held; the program exits with 1 if any of them failed, so it can run
+// after a build.
+//
+// Thread-count determinism: the spring pass colours its row blocks so that every
+// force entry is summed in the same order whatever the thread count.  The same
+// cloth is stepped on one thread and on several, for every integrator and SIMD
+// level the machine has, at sizes that do and do not fill the last row block, and
+// the positions must match bit for bit.  Different SIMD levels are not compared
+// with each other: AVX2 uses FMA, so it rounds differently from the scalar code.
+//
+// Mesh tearing: a FabricMesh sheet hung by its top row is pulled apart at its top
+// corners until it tears.  Every few steps the mesh must pass CheckTopology (the
+// indices, the springs' corners and every vertex's spring and triangle rows agree),
+// and the torn sheet must come out the same, indices and positions, on one thread
+// and on several.
+//
+// Upload copies: UploadCopy::CopyBytes, cached and non-temporal, copies 1 to 1000
+// bytes to destinations at every offset from a 16-byte boundary, and must write
+// those bytes and no others.  UploadWriter's parallel copies, packed and padded to
+// 256 bytes, and its CopyFloat3s and CopyStrided are compared byte for byte,
+// padding and guard bytes around the buffer included, with a plain memcpy fill.
+//
+// Vertex spans: Fabric, Waves (float and half heights), WaveClipmap and the tiled
+// SpectralOcean write into a Float3 span and a packed span, each a Sub() of a larger
+// buffer.  The Float3 vertices must be the solver's positions and normals bit for bit,
+// the packed ones what PackVertex makes of them, and the vertices around the span and
+// the members around Pos and Normal must be left alone.  The grids are sized so that
+// each task's rows end partway through a VertexSpanWriter batch.
+//
+// Usage: FabricTests
+//***************************************************************************************
+
+#include "../Fabric/Fabric.h"
+#include "../Fabric/FabricMesh.h"
+#include "../Fabric/SpectralOcean.h"
+#include "../Fabric/WaveClipmap.h"
+#include "../Fabric/Waves.h"
+#include "../../Common/AlignedAllocator.h"
+#include "../../Common/ThreadPool.h"
+#include "../../Common/UploadWriter.h"
+#include "../../Common/VertexPacking.h"
+#include "../../Common/VertexSpan.h"
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+namespace
+{
+	const float FabricDt = 0.02f;
+	const float MeshDt = 0.01f;
+
+	int gFailures = 0;
+
+	void Report(bool passed, const char* what)
+	{
+		std::printf("%s  %s\n", passed ? "pass" : "FAIL", what);
+		if(!passed)
+			++gFailures;
+	}
+
+	// Steps a size x size cloth on a pool of threadCount threads and returns
+	// its positions.
+	std::vector<float> RunFabric(std::size_t size, FabricIntegrator integrator, SimdLevel level,
+		std::size_t threadCount, int steps)
+	{
+		ThreadPool pool(threadCount);
+		ThreadPool::SetDefault(&pool);
+
+		Fabric fabric(size, size, 0.5f, FabricDt, 1000.0f, 1500.0f, 2.5f, 2.0f, 0.9f);
+		fabric.SetSimdLevel(level);
+		fabric.SetIntegrator(integrator);
+		for(int s = 0; s < steps; ++s)
+			fabric.Update(FabricDt, 1.2f, 0.3f, -0.4f);
+
+		std::vector<float> out;
+		out.reserve(fabric.VertexCount() * 3);
+		for(std::size_t i = 0; i < fabric.VertexCount(); ++i)
+		{
+			DirectX::XMFLOAT3 p = fabric.Position(i);
+			out.push_back(p.x);
+			out.push_back(p.y);
+			out.push_back(p.z);
+		}
+
+		ThreadPool::SetDefault(nullptr);
+		return out;
+	}
+
+	void CheckThreadCountDeterminism()
+	{
+		const char* integrators[] = { "explicit", "implicit", "xpbd" };
+		const std::size_t sizes[] = { 37, 64 };
+		const std::size_t threadCounts[] = { 2, 3, 8 };
+
+		for(int level = 0; level <= int(DetectSimdLevel()); ++level)
+		{
+			for(int integrator = 0; integrator < 3; ++integrator)
+			{
+				for(std::size_t size : sizes)
+				{
+					std::vector<float> serial = RunFabric(size, FabricIntegrator(integrator), SimdLevel(level), 1, 48);
+					for(std::size_t threads : threadCounts)
+					{
+						std::vector<float> parallel = RunFabric(size, FabricIntegrator(integrator), SimdLevel(level), threads, 48);
+						bool same = serial.size() == parallel.size() &&
+							std::memcmp(serial.data(), parallel.data(), serial.size() * sizeof(float)) == 0;
+
+						char what[128];
+						std::snprintf(what, sizeof(what), "fabric %zu^2 %s %s: 1 vs %zu threads bitwise identical",
+							size, SimdLevelName(SimdLevel(level)), integrators[integrator], threads);
+						Report(same, what);
+					}
+				}
+			}
+		}
+	}
+
+	struct TornSheet
+	{
+		std::vector<std::uint32_t> Indices;
+		std::vector<float> Positions;
+		std::size_t TornSprings = 0;
+		std::size_t NewVertices = 0;
+		bool Consistent = true;
+	};
+
+	// A size x size sheet hanging in the xy plane from its top row, whose
+	// two top corners are pulled apart until it tears.
+	TornSheet TearSheet(std::size_t size, SimdLevel level, std::size_t threadCount)
+	{
+		ThreadPool pool(threadCount);
+		ThreadPool::SetDefault(&pool);
+
+		GeometryGenerator::MeshData mesh;
+		mesh.Vertices.resize(size * size);
+		for(std::size_t i = 0; i < size; ++i)
+		{
+			for(std::size_t j = 0; j < size; ++j)
+			{
+				float x = j*0.5f;
+				float y = -(i*0.5f);
+				mesh.Vertices[i*size + j].Position = DirectX::XMFLOAT3(x, y, 0.01f*std::sin(x*y));
+			}
+		}
+		for(std::size_t i = 0; i + 1 < size; ++i)
+		{
+			for(std::size_t j = 0; j + 1 < size; ++j)
+			{
+				std::uint32_t a = std::uint32_t(i*size + j), b = a + 1;
+				std::uint32_t c = std::uint32_t(a + size), d = c + 1;
+				mesh.Indices32.insert(mesh.Indices32.end(), { a, b, c, c, b, d });
+			}
+		}
+
+		FabricMesh cloth(mesh, MeshDt, 1000.0f, 1000.0f, 2.5f, 2.0f, 0.9f);
+		cloth.SetSimdLevel(level);
+		for(std::size_t j = 0; j < size; ++j)
+			cloth.SetPinned(cloth.SolverVertex(j), true);
+		cloth.SetTearing(1.15f, 4 * size * size);
+
+		TornSheet sheet;
+		std::uint32_t left = cloth.SolverVertex(0);
+		std::uint32_t right = cloth.SolverVertex(size - 1);
+		for(int s = 0; s < 400; ++s)
+		{
+			if(s < 200)
+			{
+				DirectX::XMFLOAT3 p = cloth.Position(left);
+				cloth.SetPosition(left, DirectX::XMFLOAT3(p.x - 0.01f, p.y, p.z));
+				p = cloth.Position(right);
+				cloth.SetPosition(right, DirectX::XMFLOAT3(p.x + 0.01f, p.y, p.z));
+			}
+			cloth.Update(MeshDt, 3.0f, 0.0f, 0.0f);
+			sheet.TornSprings += cloth.LastTornSprings();
+			if(s % 25 == 24)
+				sheet.Consistent = sheet.Consistent && cloth.CheckTopology();
+		}
+
+		sheet.Indices = cloth.Indices();
+		sheet.NewVertices = cloth.VertexCount() - size * size;
+		for(std::size_t i = 0; i < cloth.VertexCount(); ++i)
+		{
+			DirectX::XMFLOAT3 p = cloth.Position(i);
+			sheet.Positions.push_back(p.x);
+			sheet.Positions.push_back(p.y);
+			sheet.Positions.push_back(p.z);
+		}
+
+		ThreadPool::SetDefault(nullptr);
+		return sheet;
+	}
+
+	void CheckMeshTearing()
+	{
+		const std::size_t size = 40;
+		for(int level = 0; level <= int(DetectSimdLevel()); ++level)
+		{
+			TornSheet serial = TearSheet(size, SimdLevel(level), 1);
+			TornSheet parallel = TearSheet(size, SimdLevel(level), 3);
+
+			char what[128];
+			std::snprintf(what, sizeof(what), "mesh %zu^2 %s: tore %zu springs and split off %zu vertices",
+				size, SimdLevelName(SimdLevel(level)), serial.TornSprings, serial.NewVertices);
+			Report(serial.TornSprings > 0 && serial.NewVertices > 0, what);
+
+			std::snprintf(what, sizeof(what), "mesh %zu^2 %s: indices, spring and triangle rows agree",
+				size, SimdLevelName(SimdLevel(level)));
+			Report(serial.Consistent && parallel.Consistent, what);
+
+			bool same = serial.Indices == parallel.Indices && serial.Positions.size() == parallel.Positions.size() &&
+				std::memcmp(serial.Positions.data(), parallel.Positions.data(), serial.Positions.size() * sizeof(float)) == 0;
+			std::snprintf(what, sizeof(what), "mesh %zu^2 %s: torn 1 vs 3 threads bitwise identical",
+				size, SimdLevelName(SimdLevel(level)));
+			Report(same, what);
+		}
+	}
+
+	// Guard bytes on either side of every upload destination; a multiple of
+	// 64, so the range itself starts on a 64-byte boundary plus its offset.
+	const std::size_t Guard = 64;
+	const unsigned char Untouched = 0xcd;
+
+	typedef std::vector<unsigned char, AlignedAllocator<unsigned char, 64>> ByteBuffer;
+
+	// Whether every byte outside [begin, end) still holds Untouched.
+	bool GuardsIntact(const ByteBuffer& buffer, std::size_t begin, std::size_t end)
+	{
+		for(std::size_t i = 0; i < buffer.size(); ++i)
+		{
+			if((i < begin || i >= end) && buffer[i] != Untouched)
+				return false;
+		}
+		return true;
+	}
+
+	const char* UploadModeName(UploadCopyMode mode)
+	{
+		return mode == UploadCopyMode::NonTemporal ? "non-temporal" : "cached";
+	}
+
+	void CheckUploadAlignment()
+	{
+		const std::size_t sizes[] = { 1, 15, 16, 17, 63, 64, 65, 100, 1000 };
+		const std::size_t maxSize = 1000;
+
+		std::vector<unsigned char> src(maxSize);
+		for(std::size_t i = 0; i < src.size(); ++i)
+			src[i] = static_cast<unsigned char>(i*7 + 3);
+
+		for(UploadCopyMode mode : { UploadCopyMode::Cached, UploadCopyMode::NonTemporal })
+		{
+			bool same = true;
+			bool guarded = true;
+			for(std::size_t misalign = 0; misalign < 16; ++misalign)
+			{
+				for(std::size_t size : sizes)
+				{
+					ByteBuffer buffer(Guard + 16 + maxSize + Guard, Untouched);
+					std::size_t begin = Guard + misalign;
+					UploadCopy::CopyBytes(buffer.data() + begin, src.data(), size, mode);
+
+					same = same && std::memcmp(buffer.data() + begin, src.data(), size) == 0;
+					guarded = guarded && GuardsIntact(buffer, begin, begin + size);
+				}
+			}
+
+			char what[128];
+			std::snprintf(what, sizeof(what), "upload %s: 1 to %zu bytes at misalignments 0 to 15 copied exactly",
+				UploadModeName(mode), maxSize);
+			Report(same, what);
+			std::snprintf(what, sizeof(what), "upload %s: nothing written outside the destination", UploadModeName(mode));
+			Report(guarded, what);
+		}
+	}
+
+	struct UploadParticle
+	{
+		float Position[3];
+	};
+
+	struct UploadVertex
+	{
+		float Position[3];
+		float Normal[3];
+		float TexC[2];
+	};
+
+	struct SourceVertex
+	{
+		float Weight;
+		float TexC[2];
+		std::uint32_t Id;
+	};
+
+	struct TexC
+	{
+		float U;
+		float V;
+	};
+
+	// Copies count particles into a writer of capacity elements elementByteSize
+	// apart, starting at element first and byteOffset bytes into the buffer, on
+	// a pool of 3 threads.  Returns whether the buffer, padding and guards
+	// included, matches one filled element by element with memcpy.
+	bool ParallelCopyMatches(std::size_t capacity, std::size_t elementByteSize, std::size_t byteOffset,
+		std::size_t first, std::size_t count, UploadCopyMode mode)
+	{
+		// One particle more than is copied, so a copy that overruns its source
+		// writes particle data, not bytes that could pass for the guard.
+		std::vector<UploadParticle> src(count + 1);
+		for(std::size_t k = 0; k <= count; ++k)
+			src[k] = UploadParticle{ { float(k), -0.5f*k, 1.0f/(k + 1) } };
+
+		ByteBuffer buffer(Guard + byteOffset + capacity*elementByteSize + Guard, Untouched);
+		ByteBuffer reference(buffer);
+		unsigned char* data = buffer.data() + Guard + byteOffset;
+		for(std::size_t k = 0; k < count; ++k)
+			std::memcpy(reference.data() + Guard + byteOffset + (first + k)*elementByteSize, &src[k], sizeof(UploadParticle));
+
+		ThreadPool pool(3);
+		UploadWriter<UploadParticle> writer(data, capacity, elementByteSize);
+		writer.ParallelCopyRange(first, src.data(), count, pool, mode);
+
+		return buffer == reference;
+	}
+
+	void CheckUploadWriter()
+	{
+		char what[128];
+		for(UploadCopyMode mode : { UploadCopyMode::Cached, UploadCopyMode::NonTemporal })
+		{
+			// About 1.2 MB, so several parallel chunks, 4 bytes off 16.
+			bool same = ParallelCopyMatches(100003, sizeof(UploadParticle), 4, 2, 100000, mode);
+			std::snprintf(what, sizeof(what), "upload %s: packed parallel copy matches, guards untouched", UploadModeName(mode));
+			Report(same, what);
+
+			// Constant-buffer style elements padded to 256 bytes, in 3 chunks.
+			same = ParallelCopyMatches(2600, 256, 0, 7, 2500, mode);
+			std::snprintf(what, sizeof(what), "upload %s: padded parallel copy matches, padding and guards untouched", UploadModeName(mode));
+			Report(same, what);
+		}
+
+		// Normals from a structure of arrays and texture coordinates from
+		// another vertex layout, into elements padded to 48 bytes.
+		const std::size_t capacity = 40, first = 3, count = 37, elementByteSize = 48;
+		std::vector<float> nx(count), ny(count), nz(count);
+		std::vector<SourceVertex> sources(count);
+		for(std::size_t k = 0; k < count; ++k)
+		{
+			nx[k] = float(k);
+			ny[k] = 2.0f*k + 0.25f;
+			nz[k] = -float(k);
+			sources[k] = SourceVertex{ 0.5f, { 0.125f*k, 1.0f - 0.125f*k }, std::uint32_t(k) };
+		}
+
+		ByteBuffer buffer(Guard + capacity*elementByteSize + Guard, Untouched);
+		ByteBuffer reference(buffer);
+		for(std::size_t k = 0; k < count; ++k)
+		{
+			unsigned char* element = reference.data() + Guard + (first + k)*elementByteSize;
+			float normal[3] = { nx[k], ny[k], nz[k] };
+			std::memcpy(element + offsetof(UploadVertex, Normal), normal, sizeof(normal));
+			std::memcpy(element + offsetof(UploadVertex, TexC), sources[k].TexC, sizeof(TexC));
+		}
+
+		UploadWriter<UploadVertex> writer(buffer.data() + Guard, capacity, elementByteSize);
+		writer.CopyFloat3s(first, count, offsetof(UploadVertex, Normal), nx.data(), ny.data(), nz.data());
+		writer.CopyStrided(first, count, offsetof(UploadVertex, TexC),
+			reinterpret_cast<const TexC*>(&sources[0].TexC), sizeof(SourceVertex));
+
+		Report(buffer == reference, "upload: CopyFloat3s and CopyStrided fill only their members");
+	}
+
+	// Vertices left untouched on either side of every span a solver writes.
+	const std::size_t GuardVertices = 5;
+
+	struct SpanVertex
+	{
+		DirectX::XMFLOAT3 Pos;
+		DirectX::XMFLOAT3 Normal;
+		float TexC[2];
+	};
+
+	bool AllBytes(const void* data, std::size_t bytes, unsigned char value)
+	{
+		const unsigned char* p = static_cast<const unsigned char*>(data);
+		for(std::size_t i = 0; i < bytes; ++i)
+		{
+			if(p[i] != value)
+				return false;
+		}
+		return true;
+	}
+
+	// Has write fill a Float3 span and a packed span of count vertices, each
+	// Sub() of a buffer GuardVertices larger on either side, on a pool of 3
+	// threads.  expect(i, position, normal) gives what vertex i should hold.
+	// Float3 vertices must match bit for bit, packed ones must be what
+	// PackVertex makes of them, and nothing else may be written.
+	template<typename Write, typename Expect>
+	void CheckSpans(const char* name, std::size_t count, const Write& write, const Expect& expect)
+	{
+		std::vector<DirectX::XMFLOAT3> positions(count), normals(count);
+		DirectX::XMFLOAT3 lo(1e30f, 1e30f, 1e30f), hi(-1e30f, -1e30f, -1e30f);
+		for(std::size_t i = 0; i < count; ++i)
+		{
+			expect(i, positions[i], normals[i]);
+			lo = DirectX::XMFLOAT3(std::fmin(lo.x, positions[i].x), std::fmin(lo.y, positions[i].y), std::fmin(lo.z, positions[i].z));
+			hi = DirectX::XMFLOAT3(std::fmax(hi.x, positions[i].x), std::fmax(hi.y, positions[i].y), std::fmax(hi.z, positions[i].z));
+		}
+
+		ThreadPool pool(3);
+		ThreadPool::SetDefault(&pool);
+
+		std::vector<SpanVertex> vertices(count + 2*GuardVertices);
+		std::memset(static_cast<void*>(vertices.data()), Untouched, vertices.size()*sizeof(SpanVertex));
+		write(MakeVertexSpan(vertices.data(), vertices.size()).Sub(GuardVertices, count));
+
+		bool same = true;
+		for(std::size_t i = 0; i < vertices.size(); ++i)
+		{
+			const SpanVertex& v = vertices[i];
+			if(i < GuardVertices || i >= GuardVertices + count)
+			{
+				same = same && AllBytes(&v, sizeof(v), Untouched);
+				continue;
+			}
+			std::size_t k = i - GuardVertices;
+			same = same && std::memcmp(&v.Pos, &positions[k], sizeof(v.Pos)) == 0 &&
+				std::memcmp(&v.Normal, &normals[k], sizeof(v.Normal)) == 0 &&
+				AllBytes(v.TexC, sizeof(v.TexC), Untouched);
+		}
+
+		char what[128];
+		std::snprintf(what, sizeof(what), "span %s float3: %zu positions and normals, nothing else written", name, count);
+		Report(same, what);
+
+		PackedVertexBounds bounds = VertexPacking::MakeBounds(lo, hi);
+		std::vector<PackedVertex> packed(count + 2*GuardVertices);
+		std::memset(static_cast<void*>(packed.data()), Untouched, packed.size()*sizeof(PackedVertex));
+		write(MakePackedVertexSpan(packed.data(), packed.size(), bounds).Sub(GuardVertices, count));
+
+		same = true;
+		for(std::size_t i = 0; i < packed.size(); ++i)
+		{
+			if(i < GuardVertices || i >= GuardVertices + count)
+			{
+				same = same && AllBytes(&packed[i], sizeof(PackedVertex), Untouched);
+				continue;
+			}
+			std::size_t k = i - GuardVertices;
+			PackedVertex p = VertexPacking::PackVertex(positions[k], normals[k], bounds);
+			same = same && std::memcmp(&packed[i], &p, sizeof(p)) == 0;
+		}
+
+		std::snprintf(what, sizeof(what), "span %s packed: %zu positions and normals, nothing else written", name, count);
+		Report(same, what);
+
+		ThreadPool::SetDefault(nullptr);
+	}
+
+	// Sizes are picked so the rows each task writes do not fill the last
+	// VertexSpanWriter batch.
+	void CheckVertexSpans()
+	{
+		// 37 columns, 8 rows a task: 296 vertices, 40 past the last batch.
+		// 50 ms of 20 ms steps leaves the cloth halfway between two steps.
+		Fabric fabric(37, 37, 0.5f, FabricDt, 1000.0f, 1500.0f, 2.5f, 2.0f, 0.9f);
+		fabric.Update(0.05f, 1.2f, 0.3f, -0.4f);
+		CheckSpans("fabric", fabric.VertexCount(),
+			[&fabric](const VertexSpan& out) { fabric.WriteVertices(out); },
+			[&fabric](std::size_t i, DirectX::XMFLOAT3& p, DirectX::XMFLOAT3& n)
+			{
+				p = fabric.InterpolatedPosition(i);
+				n = fabric.Normal(i);
+			});
+
+		// 19 columns, 16 rows a task: 304 vertices, 48 past the last batch.
+		for(WaveHeightFormat format : { WaveHeightFormat::Float32, WaveHeightFormat::Float16 })
+		{
+			Waves waves(21, 19, 0.5f, 0.03f, 3.25f, 0.4f, format);
+			waves.Disturb(10, 9, 0.5f);
+			waves.Step(6);
+			CheckSpans(format == WaveHeightFormat::Float16 ? "waves half" : "waves", waves.VertexCount(),
+				[&waves](const VertexSpan& out) { waves.WriteVertices(out); },
+				[&waves](std::size_t i, DirectX::XMFLOAT3& p, DirectX::XMFLOAT3& n)
+				{
+					p = waves.Position(i);
+					n = waves.Normal(i);
+				});
+		}
+
+		// Two levels of 21^2, each written to its own Sub() of the span.
+		WaveClipmap clipmap(2, 21, 0.5f, 0.03f, 3.25f, 0.4f);
+		clipmap.Disturb(0.5f, -1.0f, 0.5f, 1.0f);
+		clipmap.Update(0.2f);
+		CheckSpans("clipmap", clipmap.VertexCount(),
+			[&clipmap](const VertexSpan& out) { clipmap.WriteVertices(out); },
+			[&clipmap](std::size_t i, DirectX::XMFLOAT3& p, DirectX::XMFLOAT3& n)
+			{
+				const Waves& level = clipmap.Level(int(i / clipmap.Level(0).VertexCount()));
+				std::size_t k = i % clipmap.Level(0).VertexCount();
+				p = level.Position(k);
+				n = level.Normal(k);
+			});
+
+		// 13 x 11 points, every other grid point of the patch from column 5, row 2 on.
+		SpectralOcean ocean(64, 0.5f, 10.0f, 0.3f);
+		ocean.SetTime(2.0);
+		const float spacing = 1.0f, x0 = 2.5f, z0 = -1.0f;
+		const int rows = 13, cols = 11;
+		CheckSpans("ocean tiled", std::size_t(rows*cols),
+			[&](const VertexSpan& out) { ocean.WriteTiledVertices(x0, z0, spacing, rows, cols, out); },
+			[&](std::size_t i, DirectX::XMFLOAT3& p, DirectX::XMFLOAT3& n)
+			{
+				float x = x0 + float(i % cols)*spacing;
+				float z = z0 - float(i / cols)*spacing;
+				p = ocean.TiledPosition(x, z);
+				n = ocean.TiledNormal(x, z);
+			});
+	}
+}
+
+int main()
+{
+	CheckThreadCountDeterminism();
+	CheckMeshTearing();
+	CheckUploadAlignment();
+	CheckUploadWriter();
+	CheckVertexSpans();
+
+	std::printf("%d check(s) failed\n", gFailures);
+	return gFailures == 0 ? 0 : 1;
+}
@@ -0,0 +1,660 @@
+//***************************************************************************************
+// SolverBench.cpp by llyr-who (C) 2011 All Rights Reserved.
+//
+// Headless benchmark for the cloth (Fabric) and wave (Waves, SpectralOcean) solvers.  Sweeps grid
+// sizes and thread counts, times Update in isolation and writes the results as JSON
+// so they can be compared from commit to commit.  The "world" solver splits the same
+// vertex count into 16x16 cloths stepped together by a FabricWorld.  The "ocean"
+// solver only runs at power-of-two sizes.  --write-vertices has every Update also
+// write its vertices into host memory, as it would into a mapped vertex buffer, in
+// the format --vertex-format picks.  The "upload" entry is not a solver: it times
+// UploadWriter copying a vertex buffer of the same size and format from host memory
+// to host memory.  --self-collision turns on the cloths' self-collision; --colliders
+// gives every cloth that many spheres to swing into.  The "mesh" solver runs the same
+// grid as a FabricMesh built from a triangle list whose vertices are in scrambled
+// order; --mesh-order authored keeps that order instead of renumbering it.  --sleep
+// lets the "fabric" and "world" cloths fall asleep below that kinetic energy.
+//
+// Usage: SolverBench [--solver fabric|world|mesh|waves|ocean|upload|all] [--min 64] [--max 2048]
+//                    [--threads 1,2,4] [--steps N] [--reps 3] [--label text]
+//                    [--out file.json] [--check-determinism]
+//                    [--integrator explicit|implicit|xpbd] [--wave-steps-per-pass 1]
+//                    [--wave-format f32|f16] [--write-vertices]
+//                    [--upload-copy cached|nt] [--vertex-format float3|packed]
+//                    [--self-collision] [--colliders 0] [--mesh-order rcm|authored]
+//                    [--sleep 0]
+//***************************************************************************************
+
+#include "../Fabric/Fabric.h"
+#include "../Fabric/FabricMesh.h"
+#include "../Fabric/FabricWorld.h"
+#include "../Fabric/Waves.h"
+#include "../Fabric/SpectralOcean.h"
+#include "../../Common/ThreadPool.h"
+#include "../../Common/UploadWriter.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+	// Bytes each solver moves per vertex per step if every pass streams its arrays
+	// from memory exactly once.  Dividing by the step time gives the effective
+	// bandwidth; values near the machine's peak mean the solver is memory bound.
+	//
+	// Fabric: wind, which also starts the force sum (normal, velocity 24 R,
+	// force 12 W), springs (position, velocity 24 R, force 24 RW), integrate
+	// (position, force 24 R, velocity 24 RW, new position 12 W), normal frame
+	// (12 R, 36 W).
+	const double FabricBytesPerVertex = 36 + 48 + 60 + 48;
+	// FabricMesh, with about six springs and two triangles per vertex: springs
+	// (ends and rest 12 R, force 12 W per spring, position and velocity 24 R),
+	// integrate (row bounds 8 R, 12 entries of index and force 16 R, normal,
+	// position, velocity 36 R, new position and velocity 24 W), face normals
+	// (indices 12 R, normal 12 W per triangle, position 12 R), vertex normals
+	// (row bound 4 R, 6 entries of index and normal 16 R, normal 12 W).
+	const double MeshBytesPerVertex = (6 * 24 + 24) + (8 + 12 * 16 + 36 + 24) + (2 * 24 + 12) + (4 + 6 * 16 + 12);
+	// Waves: one tile pass per stepsPerPass steps, reading the previous and
+	// current heights and writing the new current height, plus the new
+	// previous one when a pass runs more than one step.  Normals are only
+	// worked out on output, so they are not counted.
+	double WavesBytesPerVertex(int stepsPerPass, WaveHeightFormat format)
+	{
+		double bytes = (format == WaveHeightFormat::Float16) ? 2.0 : 4.0;
+		return bytes * (3 + (stepsPerPass > 1 ? 1 : 0)) / double(stepsPerPass);
+	}
+	// SpectralOcean: building the spectra (amplitudes 16 R, frequency and wave
+	// vector 12 R, three fields 24 W), then per field a row pass and a column
+	// pass that each read and write it once (3 x 32 RW).
+	const double OceanBytesPerVertex = 28 + 24 + 96;
+	// Upload: one vertex read and written, 24 bytes as float3s, 12 packed.
+	double UploadBytesPerVertex(VertexFormat format)
+	{
+		return (format == VertexFormat::Packed) ? 12 + 12 : 24 + 24;
+	}
+
+	struct Options
+	{
+		bool RunFabric = true;
+		bool RunWorld = true;
+		bool RunMesh = true;
+		bool RunWaves = true;
+		bool RunOcean = true;
+		bool RunUpload = true;
+		std::size_t MinSize = 64;
+		std::size_t MaxSize = 2048;
+		std::vector<std::size_t> Threads;
+		std::size_t Steps = 0; // 0: pick from the grid size
+		int Reps = 3;
+		std::string Label;
+		std::string OutPath;
+		bool CheckDeterminism = false;
+		FabricIntegrator Integrator = FabricIntegrator::Explicit;
+		int WaveStepsPerPass = 1;
+		WaveHeightFormat WaveFormat = WaveHeightFormat::Float32;
+		bool WriteVertices = false;
+		UploadCopyMode UploadCopy = UploadCopyMode::NonTemporal;
+		VertexFormat Format = VertexFormat::Float3;
+		bool SelfCollision = false;
+		std::size_t Colliders = 0;
+		bool MeshReorder = true;
+		float SleepEnergy = 0.0f;
+	};
+
+	// The layout FabricApp renders from.
+	struct HostVertex
+	{
+		DirectX::XMFLOAT3 Pos;
+		DirectX::XMFLOAT3 Normal;
+	};
+
+	// Packed vertices of the benchmarks are quantized within this box.
+	const float PackedExtent = 1024.0f;
+
+	// Host memory for --write-vertices: count vertices in the chosen format,
+	// in whichever of the two vectors the format uses.
+	VertexSpan MakeHostSpan(const Options& opt, std::size_t count,
+		std::vector<HostVertex>& vertices, std::vector<PackedVertex>& packed)
+	{
+		if(!opt.WriteVertices)
+			return VertexSpan();
+		if(opt.Format == VertexFormat::Packed)
+		{
+			packed.resize(count);
+			return MakePackedVertexSpan(packed.data(), count, VertexPacking::MakeBounds(
+				DirectX::XMFLOAT3(-PackedExtent, -PackedExtent, -PackedExtent),
+				DirectX::XMFLOAT3(PackedExtent, PackedExtent, PackedExtent)));
+		}
+		vertices.resize(count);
+		return MakeVertexSpan(vertices.data(), count);
+	}
+
+	struct Sample
+	{
+		std::string Solver;
+		std::size_t Size;
+		std::size_t Threads;
+		std::size_t Steps;
+		double Seconds;
+	};
+
+	std::vector<std::size_t> ParseList(const char* s)
+	{
+		std::vector<std::size_t> v;
+		for(;;)
+		{
+			char* end = nullptr;
+			std::size_t value = std::strtoul(s, &end, 10);
+			if(end == s)
+				break;
+			v.push_back(value);
+			s = (*end == ',') ? end + 1 : end;
+		}
+		return v;
+	}
+
+	bool ParseOptions(int argc, char** argv, Options& opt)
+	{
+		for(int i = 1; i < argc; ++i)
+		{
+			std::string arg = argv[i];
+			const char* value = (i + 1 < argc) ? argv[i + 1] : nullptr;
+
+			if(arg == "--check-determinism")
+			{
+				opt.CheckDeterminism = true;
+				continue;
+			}
+			if(arg == "--write-vertices")
+			{
+				opt.WriteVertices = true;
+				continue;
+			}
+			if(arg == "--self-collision")
+			{
+				opt.SelfCollision = true;
+				continue;
+			}
+			if(value == nullptr)
+			{
+				std::fprintf(stderr, "missing value for %s\n", arg.c_str());
+				return false;
+			}
+			++i;
+
+			if(arg == "--solver")
+			{
+				std::string s = value;
+				opt.RunFabric = (s == "fabric" || s == "all");
+				opt.RunWorld = (s == "world" || s == "all");
+				opt.RunMesh = (s == "mesh" || s == "all");
+				opt.RunWaves = (s == "waves" || s == "all");
+				opt.RunOcean = (s == "ocean" || s == "all");
+				opt.RunUpload = (s == "upload" || s == "all");
+			}
+			else if(arg == "--min")
+				opt.MinSize = std::strtoul(value, nullptr, 10);
+			else if(arg == "--max")
+				opt.MaxSize = std::strtoul(value, nullptr, 10);
+			else if(arg == "--threads")
+				opt.Threads = ParseList(value);
+			else if(arg == "--steps")
+				opt.Steps = std::strtoul(value, nullptr, 10);
+			else if(arg == "--reps")
+				opt.Reps = std::max(1, std::atoi(value));
+			else if(arg == "--label")
+				opt.Label = value;
+			else if(arg == "--out")
+				opt.OutPath = value;
+			else if(arg == "--colliders")
+				opt.Colliders = std::strtoul(value, nullptr, 10);
+			else if(arg == "--sleep")
+				opt.SleepEnergy = float(std::atof(value));
+			else if(arg == "--mesh-order")
+				opt.MeshReorder = (std::string(value) != "authored");
+			else if(arg == "--wave-steps-per-pass")
+				opt.WaveStepsPerPass = std::max(1, std::atoi(value));
+			else if(arg == "--wave-format")
+				opt.WaveFormat = (std::string(value) == "f16") ? WaveHeightFormat::Float16 : WaveHeightFormat::Float32;
+			else if(arg == "--upload-copy")
+				opt.UploadCopy = (std::string(value) == "cached") ? UploadCopyMode::Cached : UploadCopyMode::NonTemporal;
+			else if(arg == "--vertex-format")
+				opt.Format = (std::string(value) == "packed") ? VertexFormat::Packed : VertexFormat::Float3;
+			else if(arg == "--integrator")
+			{
+				std::string s = value;
+				if(s == "implicit")
+					opt.Integrator = FabricIntegrator::Implicit;
+				else if(s == "xpbd")
+					opt.Integrator = FabricIntegrator::XPBD;
+				else
+					opt.Integrator = FabricIntegrator::Explicit;
+			}
+			else
+			{
+				std::fprintf(stderr, "unknown option %s\n", arg.c_str());
+				return false;
+			}
+		}
+
+		if(opt.Threads.empty())
+		{
+			std::size_t hw = std::max<std::size_t>(1, std::thread::hardware_concurrency());
+			for(std::size_t t = 1; t < hw; t *= 2)
+				opt.Threads.push_back(t);
+			opt.Threads.push_back(hw);
+		}
+		return true;
+	}
+
+	// Enough steps for roughly 2^26 vertex updates, but never fewer than 4.
+	std::size_t StepsFor(const Options& opt, std::size_t size)
+	{
+		if(opt.Steps != 0)
+			return opt.Steps;
+		return std::max<std::size_t>(4, (std::size_t(1) << 26) / (size * size));
+	}
+
+	// The solvers only advance once the accumulated time reaches their step,
+	// so every call below is fed exactly one step of time.
+	const float FabricDt = 0.02f;
+	// FabricMesh applies each step's whole acceleration, where Fabric's step
+	// applies half of it to the velocity, so the same springs need half the
+	// step to stay stable.
+	const float MeshDt = 0.01f;
+	const float WavesDt = 0.03f;
+
+	// Calm steps before a block of a cloth with --sleep falls asleep.
+	const int SleepSteps = 30;
+
+	// opt.Colliders spheres along the cloth's diagonal, below the rest pose, so
+	// the cloth swings into some of them and passes others by.
+	void AddColliders(const Options& opt, Fabric& cloth)
+	{
+		float width = cloth.Width();
+		for(std::size_t k = 0; k < opt.Colliders; ++k)
+		{
+			float t = (k + 0.5f) / opt.Colliders - 0.5f;
+			cloth.AddSphere(DirectX::XMFLOAT3(t*width, -0.25f*width, t*width), 0.05f*width, 0.2f);
+		}
+	}
+
+	std::unique_ptr<Fabric> MakeFabric(const Options& opt, std::size_t size)
+	{
+		auto fabric = std::make_unique<Fabric>(size, size, 0.5f, FabricDt, 1000.0f, 1500.0f, 2.5f, 2.0f, 0.9f);
+		fabric->SetIntegrator(opt.Integrator);
+		fabric->SetSelfCollision(opt.SelfCollision);
+		fabric->SetSleeping(opt.SleepEnergy, SleepSteps);
+		AddColliders(opt, *fabric);
+		return fabric;
+	}
+
+	// A size x size grid of the same spacing as MakeFabric's, as a triangle
+	// list whose vertices are shuffled the same way on every platform, with
+	// the first column pinned like Fabric's.
+	std::unique_ptr<FabricMesh> MakeMesh(const Options& opt, std::size_t size)
+	{
+		std::vector<std::uint32_t> slot(size * size);
+		for(std::size_t i = 0; i < slot.size(); ++i)
+			slot[i] = std::uint32_t(i);
+		std::uint32_t seed = 12345;
+		for(std::size_t i = slot.size(); i > 1; --i)
+		{
+			seed = seed * 1664525u + 1013904223u;
+			std::swap(slot[i - 1], slot[(seed >> 8) % i]);
+		}
+
+		GeometryGenerator::MeshData mesh;
+		mesh.Vertices.resize(size * size);
+		for(std::size_t i = 0; i < size; ++i)
+		{
+			for(std::size_t j = 0; j < size; ++j)
+			{
+				float x = (j - 0.5f*(size - 1))*0.5f;
+				float z = (0.5f*(size - 1) - i)*0.5f;
+				mesh.Vertices[slot[i*size + j]].Position = DirectX::XMFLOAT3(x, 0.1f*std::sin(x*z), z);
+			}
+		}
+		for(std::size_t i = 0; i + 1 < size; ++i)
+		{
+			for(std::size_t j = 0; j + 1 < size; ++j)
+			{
+				std::uint32_t a = slot[i*size + j], b = slot[i*size + j + 1];
+				std::uint32_t c = slot[(i + 1)*size + j], d = slot[(i + 1)*size + j + 1];
+				mesh.Indices32.insert(mesh.Indices32.end(), { a, b, c, c, b, d });
+			}
+		}
+
+		auto cloth = std::make_unique<FabricMesh>(mesh, MeshDt, 1000.0f, 1500.0f, 2.5f, 2.0f, 0.9f, opt.MeshReorder);
+		for(std::size_t i = 0; i < size; ++i)
+			cloth->SetPinned(cloth->SolverVertex(slot[i*size]), true);
+		return cloth;
+	}
+
+	std::unique_ptr<Waves> MakeWaves(const Options& opt, std::size_t size)
+	{
+		auto waves = std::make_unique<Waves>(int(size), int(size), 1.0f, WavesDt, 4.0f, 0.2f, opt.WaveFormat);
+		waves->SetStepsPerPass(opt.WaveStepsPerPass);
+
+		// Seed some ripples so the solver works on non-trivial data.
+		for(int k = 0; k < 16; ++k)
+		{
+			int i = 3 + (k * 7919) % (int(size) - 6);
+			int j = 3 + (k * 104729) % (int(size) - 6);
+			waves->Disturb(i, j, 0.5f);
+		}
+		return waves;
+	}
+
+	double TimeFabric(const Options& opt, std::size_t size, std::size_t steps)
+	{
+		auto fabric = MakeFabric(opt, size);
+		fabric->Update(FabricDt, 1.2f, 0.0f, 0.0f); // warm up caches and the pool
+
+		std::vector<HostVertex> vertices;
+		std::vector<PackedVertex> packed;
+		VertexSpan out = MakeHostSpan(opt, fabric->VertexCount(), vertices, packed);
+
+		auto start = std::chrono::steady_clock::now();
+		for(std::size_t s = 0; s < steps; ++s)
+		{
+			if(opt.WriteVertices)
+				fabric->Update(FabricDt, 1.2f, 0.0f, 0.0f, out);
+			else
+				fabric->Update(FabricDt, 1.2f, 0.0f, 0.0f);
+		}
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	// size^2 vertices as (size / WorldClothSize)^2 small cloths.
+	const std::size_t WorldClothSize = 16;
+
+	double TimeWorld(const Options& opt, std::size_t size, std::size_t steps)
+	{
+		FabricWorld world(FabricDt);
+		std::size_t count = std::max<std::size_t>(1, (size / WorldClothSize) * (size / WorldClothSize));
+		for(std::size_t c = 0; c < count; ++c)
+		{
+			Fabric& cloth = world.Add(WorldClothSize, WorldClothSize, 0.5f, 1000.0f, 1500.0f, 2.5f, 2.0f, 0.9f);
+			cloth.SetIntegrator(opt.Integrator);
+			cloth.SetSelfCollision(opt.SelfCollision);
+			cloth.SetSleeping(opt.SleepEnergy, SleepSteps);
+			AddColliders(opt, cloth);
+		}
+		world.Update(FabricDt, 1.2f, 0.0f, 0.0f);
+
+		auto start = std::chrono::steady_clock::now();
+		for(std::size_t s = 0; s < steps; ++s)
+			world.Update(FabricDt, 1.2f, 0.0f, 0.0f);
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		// Report per vertex of the full grid, which the cloths may not fill.
+		return seconds * double(size * size) / double(count * WorldClothSize * WorldClothSize);
+	}
+
+	double TimeMesh(const Options& opt, std::size_t size, std::size_t steps)
+	{
+		auto cloth = MakeMesh(opt, size);
+		cloth->Update(MeshDt, 1.2f, 0.0f, 0.0f);
+
+		std::vector<HostVertex> vertices;
+		std::vector<PackedVertex> packed;
+		VertexSpan out = MakeHostSpan(opt, cloth->VertexCount(), vertices, packed);
+
+		auto start = std::chrono::steady_clock::now();
+		for(std::size_t s = 0; s < steps; ++s)
+		{
+			if(opt.WriteVertices)
+				cloth->Update(MeshDt, 1.2f, 0.0f, 0.0f, out);
+			else
+				cloth->Update(MeshDt, 1.2f, 0.0f, 0.0f);
+		}
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	double TimeWaves(const Options& opt, std::size_t size, std::size_t steps)
+	{
+		auto waves = MakeWaves(opt, size);
+		waves->SetMaxSubsteps(opt.WaveStepsPerPass);
+		waves->Update(WavesDt);
+
+		// Temporal blocking only groups the steps of a single Update, so feed
+		// a whole pass at a time.  The extra half step keeps rounding from
+		// ever leaving the accumulator one step short; the cap drops the rest.
+		std::size_t passes = (steps + opt.WaveStepsPerPass - 1) / opt.WaveStepsPerPass;
+		float passTime = WavesDt * (opt.WaveStepsPerPass + 0.5f);
+
+		std::vector<HostVertex> vertices;
+		std::vector<PackedVertex> packed;
+		VertexSpan out = MakeHostSpan(opt, waves->VertexCount(), vertices, packed);
+
+		auto start = std::chrono::steady_clock::now();
+		for(std::size_t s = 0; s < passes; ++s)
+		{
+			if(opt.WriteVertices)
+				waves->Update(passTime, out);
+			else
+				waves->Update(passTime);
+		}
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		return seconds * double(steps) / double(passes * opt.WaveStepsPerPass);
+	}
+
+	double TimeOcean(const Options& opt, std::size_t size, std::size_t steps)
+	{
+		SpectralOcean ocean(int(size), 1.0f, 10.0f, 0.5f);
+
+		std::vector<HostVertex> vertices;
+		std::vector<PackedVertex> packed;
+		VertexSpan out = MakeHostSpan(opt, ocean.VertexCount(), vertices, packed);
+
+		auto start = std::chrono::steady_clock::now();
+		for(std::size_t s = 0; s < steps; ++s)
+		{
+			ocean.Update(WavesDt);
+			if(opt.WriteVertices)
+				ocean.WriteVertices(out);
+		}
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	template<typename V>
+	double TimeUpload(const Options& opt, const std::vector<V>& source, std::size_t steps)
+	{
+		std::vector<V> target(source.size());
+		UploadWriter<V> writer(target.data(), target.size());
+		ThreadPool& pool = ThreadPool::Default();
+		writer.ParallelCopyRange(0, source.data(), source.size(), pool, opt.UploadCopy);
+
+		auto start = std::chrono::steady_clock::now();
+		for(std::size_t s = 0; s < steps; ++s)
+			writer.ParallelCopyRange(0, source.data(), source.size(), pool, opt.UploadCopy);
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	double TimeUpload(const Options& opt, std::size_t size, std::size_t steps)
+	{
+		std::vector<HostVertex> source(size * size);
+		for(std::size_t i = 0; i < source.size(); ++i)
+			source[i].Pos = source[i].Normal = DirectX::XMFLOAT3(float(i), 1.0f, 0.0f);
+		if(opt.Format != VertexFormat::Packed)
+			return TimeUpload(opt, source, steps);
+
+		std::vector<PackedVertex> packed(source.size());
+		for(std::size_t i = 0; i < source.size(); ++i)
+			packed[i] = VertexPacking::PackVertex(source[i].Pos, source[i].Normal, PackedVertexBounds());
+		return TimeUpload(opt, packed, steps);
+	}
+
+	// Runs the same cloth on one thread and on threadCount threads and checks
+	// that the positions match bit for bit.
+	template<typename Make>
+	bool CheckDeterminism(const Make& make, std::size_t threadCount)
+	{
+		auto run = [&make](std::size_t threads)
+		{
+			ThreadPool pool(threads);
+			ThreadPool::SetDefault(&pool);
+
+			auto cloth = make();
+			for(int s = 0; s < 64; ++s)
+				cloth->Update(FabricDt, 1.2f, 0.0f, 0.0f);
+
+			std::vector<float> out;
+			out.reserve(cloth->VertexCount() * 3);
+			for(std::size_t i = 0; i < cloth->VertexCount(); ++i)
+			{
+				DirectX::XMFLOAT3 p = cloth->Position(i);
+				out.push_back(p.x);
+				out.push_back(p.y);
+				out.push_back(p.z);
+			}
+
+			ThreadPool::SetDefault(nullptr);
+			return out;
+		};
+
+		std::vector<float> serial = run(1);
+		std::vector<float> parallel = run(threadCount);
+		return std::memcmp(serial.data(), parallel.data(), serial.size() * sizeof(float)) == 0;
+	}
+
+	void WriteJson(std::FILE* f, const Options& opt, const std::vector<Sample>& samples, int determinism)
+	{
+		std::fprintf(f, "{\n");
+		std::fprintf(f, "  \"label\": \"%s\",\n", opt.Label.c_str());
+		std::fprintf(f, "  \"timestamp\": %lld,\n", (long long)std::time(nullptr));
+		std::fprintf(f, "  \"hardware_threads\": %u,\n", std::thread::hardware_concurrency());
+		std::fprintf(f, "  \"fabric_simd\": \"%s\",\n", SimdLevelName(DetectSimdLevel()));
+		const char* integrators[] = { "explicit", "implicit", "xpbd" };
+		std::fprintf(f, "  \"fabric_integrator\": \"%s\",\n", integrators[int(opt.Integrator)]);
+		std::fprintf(f, "  \"wave_steps_per_pass\": %d,\n", opt.WaveStepsPerPass);
+		std::fprintf(f, "  \"wave_format\": \"%s\",\n", opt.WaveFormat == WaveHeightFormat::Float16 ? "f16" : "f32");
+		std::fprintf(f, "  \"write_vertices\": %s,\n", opt.WriteVertices ? "true" : "false");
+		std::fprintf(f, "  \"upload_copy\": \"%s\",\n", opt.UploadCopy == UploadCopyMode::Cached ? "cached" : "nt");
+		std::fprintf(f, "  \"vertex_format\": \"%s\",\n", opt.Format == VertexFormat::Packed ? "packed" : "float3");
+		std::fprintf(f, "  \"self_collision\": %s,\n", opt.SelfCollision ? "true" : "false");
+		std::fprintf(f, "  \"colliders\": %zu,\n", opt.Colliders);
+		std::fprintf(f, "  \"mesh_order\": \"%s\",\n", opt.MeshReorder ? "rcm" : "authored");
+		std::fprintf(f, "  \"sleep_energy\": %g,\n", opt.SleepEnergy);
+		if(determinism >= 0)
+			std::fprintf(f, "  \"fabric_deterministic\": %s,\n", determinism ? "true" : "false");
+		std::fprintf(f, "  \"results\": [\n");
+
+		for(std::size_t k = 0; k < samples.size(); ++k)
+		{
+			const Sample& s = samples[k];
+
+			// Scaling efficiency is relative to the single-thread run of the
+			// same solver and size, if one was measured.
+			double baseline = 0.0;
+			for(const Sample& b : samples)
+			{
+				if(b.Solver == s.Solver && b.Size == s.Size && b.Threads == 1)
+					baseline = b.Seconds;
+			}
+
+			double vertexSteps = double(s.Size) * double(s.Size) * double(s.Steps);
+			double bytesPerVertex = (s.Solver == "waves") ? WavesBytesPerVertex(opt.WaveStepsPerPass, opt.WaveFormat) :
+				(s.Solver == "ocean") ? OceanBytesPerVertex :
+				(s.Solver == "upload") ? UploadBytesPerVertex(opt.Format) :
+				(s.Solver == "mesh") ? MeshBytesPerVertex : FabricBytesPerVertex;
+
+			std::fprintf(f, "    { \"solver\": \"%s\", \"size\": %zu, \"vertices\": %zu, \"threads\": %zu, "
+				"\"steps\": %zu, \"seconds\": %.6f, \"ns_per_vertex_step\": %.4f, \"gb_per_s\": %.3f",
+				s.Solver.c_str(), s.Size, s.Size * s.Size, s.Threads, s.Steps, s.Seconds,
+				1e9 * s.Seconds / vertexSteps, bytesPerVertex * vertexSteps / s.Seconds * 1e-9);
+			if(baseline > 0.0)
+				std::fprintf(f, ", \"scaling_efficiency\": %.4f", baseline / (s.Seconds * double(s.Threads)));
+			std::fprintf(f, " }%s\n", (k + 1 < samples.size()) ? "," : "");
+		}
+
+		std::fprintf(f, "  ]\n}\n");
+	}
+}
+
+int main(int argc, char** argv)
+{
+	Options opt;
+	if(!ParseOptions(argc, argv, opt))
+		return 1;
+
+	int determinism = -1;
+	if(opt.CheckDeterminism)
+	{
+		std::size_t threads = *std::max_element(opt.Threads.begin(), opt.Threads.end());
+		threads = std::max<std::size_t>(threads, 2);
+		determinism = CheckDeterminism([&opt] { return MakeFabric(opt, opt.MinSize); }, threads) ? 1 : 0;
+		std::fprintf(stderr, "fabric 1 vs N threads: %s\n", determinism ? "bitwise identical" : "MISMATCH");
+		if(opt.RunMesh)
+		{
+			bool same = CheckDeterminism([&opt] { return MakeMesh(opt, opt.MinSize); }, threads);
+			std::fprintf(stderr, "mesh 1 vs N threads: %s\n", same ? "bitwise identical" : "MISMATCH");
+			determinism = determinism && same;
+		}
+	}
+
+	std::vector<Sample> samples;
+	for(std::size_t size = opt.MinSize; size <= opt.MaxSize; size *= 2)
+	{
+		std::size_t steps = StepsFor(opt, size);
+		for(std::size_t threads : opt.Threads)
+		{
+			ThreadPool pool(threads);
+			ThreadPool::SetDefault(&pool);
+
+			const char* names[] = { "fabric", "world", "mesh", "waves", "ocean", "upload" };
+			const bool isPowerOfTwo = (size & (size - 1)) == 0;
+			const bool enabled[] = { opt.RunFabric, opt.RunWorld, opt.RunMesh, opt.RunWaves, opt.RunOcean && isPowerOfTwo, opt.RunUpload };
+			for(int solver = 0; solver < 6; ++solver)
+			{
+				if(!enabled[solver])
+					continue;
+
+				// Keep the best of the repetitions; it is the least disturbed by noise.
+				double best = 0.0;
+				for(int r = 0; r < opt.Reps; ++r)
+				{
+					double seconds = (solver == 0) ? TimeFabric(opt, size, steps) :
+						(solver == 1) ? TimeWorld(opt, size, steps) :
+						(solver == 2) ? TimeMesh(opt, size, steps) :
+						(solver == 3) ? TimeWaves(opt, size, steps) :
+						(solver == 4) ? TimeOcean(opt, size, steps) : TimeUpload(opt, size, steps);
+					best = (r == 0) ? seconds : std::min(best, seconds);
+				}
+
+				Sample s = { names[solver], size, threads, steps, best };
+				samples.push_back(s);
+				std::fprintf(stderr, "%-6s %5zu^2 %3zu threads: %8.3f ns/vertex/step\n", s.Solver.c_str(),
+					size, threads, 1e9 * best / (double(size) * double(size) * double(steps)));
+			}
+
+			ThreadPool::SetDefault(nullptr);
+		}
+	}
+
+	std::FILE* out = stdout;
+	if(!opt.OutPath.empty())
+	{
+		out = std::fopen(opt.OutPath.c_str(), "w");
+		if(out == nullptr)
+		{
+			std::fprintf(stderr, "cannot open %s\n", opt.OutPath.c_str());
+			return 1;
+		}
+	}
+	WriteJson(out, opt, samples, determinism);
+	if(out != stdout)
+		std::fclose(out);
+
+	return determinism == 0 ? 2 : 0;
+}